@@ -15,6 +15,7 @@
 #include "timing.h"
 #include "json11.hpp"
 #include "util.h"
+#include "temporal_history.h"
 #include <dlfcn.h>
 #include "CL/cl.h"
 
@@ -44,6 +45,10 @@ typedef	cl_command_queue (*clCreateCommandQueueWithProperties_t)(	cl_context ,
 typedef	cl_int (*clEnqueueWriteBuffer_t)(	cl_command_queue , 	cl_mem , 	cl_bool , 	size_t , 	size_t , 	const void * , 	cl_uint , 	const 	cl_event * , 	cl_event * );
 typedef	cl_int (*clEnqueueReadBuffer_t)(	cl_command_queue , 	cl_mem , 	cl_bool , 	size_t , 	size_t , 	void * , 	cl_uint , 	const 	cl_event * , 	cl_event * );
 typedef cl_int (*clReleaseMemObject_t)(cl_mem);
+typedef cl_int (*clGetDeviceInfo_t)(cl_device_id, cl_device_info, size_t, void *, size_t *);
+typedef cl_int (*clReleaseProgram_t)(cl_program);
+typedef cl_int (*clGetProgramInfo_t)(cl_program, cl_program_info, size_t, void *, size_t *);
+typedef cl_int (*clEnqueueFillBuffer_t)(cl_command_queue, cl_mem, const void *, size_t, size_t, size_t, cl_uint, const cl_event *, cl_event *);
 
 // Load the OpenCL library
 void* opencl_library = dlopen("libOpenCL.so", RTLD_LAZY | RTLD_LOCAL);
@@ -65,6 +70,10 @@ auto p_clCreateCommandQueueWithProperties = reinterpret_cast<clCreateCommandQueu
 auto p_clEnqueueWriteBuffer = reinterpret_cast<clEnqueueWriteBuffer_t>(dlsym(opencl_library,"clEnqueueWriteBuffer"));
 auto p_clEnqueueReadBuffer = reinterpret_cast<clEnqueueReadBuffer_t>(dlsym(opencl_library,"clEnqueueReadBuffer"));
 auto p_clReleaseMemObject = reinterpret_cast<clReleaseMemObject_t>(dlsym(opencl_library,"clReleaseMemObject"));
+auto p_clGetDeviceInfo = reinterpret_cast<clGetDeviceInfo_t>(dlsym(opencl_library,"clGetDeviceInfo"));
+auto p_clReleaseProgram = reinterpret_cast<clReleaseProgram_t>(dlsym(opencl_library,"clReleaseProgram"));
+auto p_clGetProgramInfo = reinterpret_cast<clGetProgramInfo_t>(dlsym(opencl_library,"clGetProgramInfo"));
+auto p_clEnqueueFillBuffer = reinterpret_cast<clEnqueueFillBuffer_t>(dlsym(opencl_library,"clEnqueueFillBuffer"));
 
 // Define more function pointer types
 typedef cl_kernel (*clCreateKernel_t)(cl_program, const char *, cl_int *);
@@ -191,6 +200,12 @@ std::string readFileIntoString(const char *filepath) {
 }
 
 void Thneed::load(const char *filename) {
+    open_program_cache(filename);
+    if (ThneedFile::is_binary(filename)) {
+        load_binary(filename);
+        return;
+    }
+
     __android_log_print(ANDROID_LOG_INFO, "JNILOG","Thneed::load: loading from %s\n", filename);
 
     string buf = readFileIntoString(filename);
@@ -255,7 +270,7 @@ void Thneed::load(const char *filename) {
     map<string, cl_program> g_programs;
     for (const auto &[name, source] : jdat["programs"].object_items()) {
         if (debug >= 1) __android_log_print(ANDROID_LOG_INFO, "JNILOG","building %s with size %zu\n", name.c_str(), source.string_value().size());
-        g_programs[name] = cl_program_from_source(context, device_id, source.string_value());
+        g_programs[name] = program_from_source(source.string_value());
     }
 
     for (auto &obj : jdat["inputs"].array_items()) {
@@ -322,6 +337,162 @@ void Thneed::load(const char *filename) {
     (*p_clFinish)(command_queue);
 }
 
+void Thneed::load_binary(const char *filename) {
+    __android_log_print(ANDROID_LOG_INFO, "JNILOG","Thneed::load: mapping binary model %s\n", filename);
+
+    bool opened = file.open(filename);
+    assert(opened);
+    const ThneedHeader &hdr = file.header();
+
+    // with memory shared between host and GPU the weights are used from the mapping
+    cl_bool unified_memory = CL_FALSE;
+    (*p_clGetDeviceInfo)(device_id, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(unified_memory), &unified_memory, NULL);
+    cl_mem_flags load_flags = CL_MEM_READ_WRITE | (unified_memory ? CL_MEM_USE_HOST_PTR : CL_MEM_COPY_HOST_PTR);
+
+    vector<cl_mem> mem(hdr.num_objects, NULL);
+    for (uint32_t i = 0; i < hdr.num_objects; i++) {
+        const ThneedObject &obj = file.objects()[i];
+        cl_mem clbuf = NULL;
+
+        if (obj.buffer != THNEED_NONE) {
+            clbuf = mem[obj.buffer];
+        } else if (obj.data != 0) {
+            clbuf = (*p_clCreateBuffer)(context, load_flags, obj.size, file.data(obj.data), NULL);
+            if (debug >= 1) __android_log_print(ANDROID_LOG_INFO, "JNILOG","loading %p %lu @ 0x%lX\n", clbuf, obj.size, obj.data);
+        } else {
+            clbuf = (*p_clCreateBuffer)(context, CL_MEM_READ_WRITE, obj.size, NULL, NULL);
+            cl_uchar zero = 0;
+            CL_CHECK((*p_clEnqueueFillBuffer)(command_queue, clbuf, &zero, sizeof(zero), 0, obj.size, 0, NULL, NULL));
+        }
+        assert(clbuf != NULL);
+
+        if (obj.type != THNEED_BUFFER) {
+            cl_image_desc desc = {0};
+            desc.image_type = (obj.type == THNEED_IMAGE2D) ? CL_MEM_OBJECT_IMAGE2D : CL_MEM_OBJECT_IMAGE1D_BUFFER;
+            desc.image_width = obj.width;
+            desc.image_height = obj.height;
+            desc.image_row_pitch = obj.row_pitch;
+            assert(obj.size == desc.image_height*desc.image_row_pitch);
+            desc.buffer = clbuf;
+            cl_image_format format = {0};
+            format.image_channel_order = CL_RGBA;
+            format.image_channel_data_type = obj.float32 ? CL_FLOAT : CL_HALF_FLOAT;
+
+            cl_int errcode;
+            clbuf = (*p_clCreateImage)(context, CL_MEM_READ_WRITE, &format, &desc, NULL, &errcode);
+            if (clbuf == NULL) {
+                __android_log_print(ANDROID_LOG_INFO, "JNILOG","clError: %d create image %zux%zu rp %zu with buffer %p\n", errcode,
+                       desc.image_width, desc.image_height, desc.image_row_pitch, desc.buffer);
+            }
+            assert(clbuf != NULL);
+        }
+        mem[i] = clbuf;
+    }
+
+    vector<cl_program> programs;
+    for (uint32_t i = 0; i < hdr.num_programs; i++) {
+        const ThneedProgram &prg = file.programs()[i];
+        if (debug >= 1) __android_log_print(ANDROID_LOG_INFO, "JNILOG","building %s with size %lu\n", file.str(prg.name), prg.size);
+        if (prg.type == THNEED_PROGRAM_BINARY) {
+            programs.push_back(cl_program_from_binary(context, device_id, (const uint8_t*)file.data(prg.data), prg.size));
+        } else {
+            programs.push_back(program_from_source(string((const char*)file.data(prg.data), prg.size)));
+        }
+    }
+
+    for (uint32_t i = 0; i < hdr.num_inputs; i++) {
+        const ThneedIO &in = file.inputs()[i];
+        cl_mem aa = mem[in.object];
+        input_clmem.push_back(aa);
+        input_sizes.push_back(in.size);
+        __android_log_print(ANDROID_LOG_INFO, "JNILOG","Thneed::load: adding input %s with size %lu\n", file.str(in.name), in.size);
+
+        cl_int cl_err;
+        void *ret = (*p_clEnqueueMapBuffer)(command_queue, aa, CL_TRUE, CL_MAP_WRITE, 0, in.size, 0, NULL, NULL, &cl_err);
+        assert(cl_err == CL_SUCCESS);
+        inputs.push_back(ret);
+    }
+
+    // TODO: support multiple outputs
+    for (uint32_t i = 0; i < hdr.num_outputs; i++) {
+        output = mem[file.outputs()[i].object];
+    }
+
+    for (uint32_t i = 0; i < hdr.num_kernels; i++) {
+        const ThneedKernel &k = file.kernels()[i];
+        auto kk = shared_ptr<CLQueuedKernel>(new CLQueuedKernel(this));
+
+        kk->name = file.str(k.name);
+        kk->program = programs[k.program];
+        kk->work_dim = k.work_dim;
+        for (int j = 0; j < kk->work_dim; j++) {
+            kk->global_work_size[j] = k.global_work_size[j];
+            kk->local_work_size[j] = k.local_work_size[j];
+        }
+        kk->num_args = k.num_args;
+        for (uint32_t j = 0; j < k.num_args; j++) {
+            const ThneedArg &arg = file.args()[k.first_arg + j];
+            kk->args_size.push_back(arg.size);
+            if (arg.object != THNEED_NONE) {
+                cl_mem val = mem[arg.object];
+                kk->args.push_back(string((char*)&val, sizeof(val)));
+            } else if (arg.value != 0) {
+                kk->args.push_back(string((const char*)file.data(arg.value), arg.size));
+            } else {
+                kk->args.push_back(string());
+            }
+        }
+        kq.push_back(kk);
+    }
+
+    (*p_clFinish)(command_queue);
+    if (!unified_memory) file.close();
+}
+
+void Thneed::open_program_cache(const char *filename) {
+    // next to the model unless THNEED_PROGRAM_CACHE says where, set it empty to turn the cache off
+    const char *env = getenv("THNEED_PROGRAM_CACHE");
+    string path = filename;
+    string root = (env != NULL) ? env : path.substr(0, path.find_last_of('/') + 1) + "program_cache";
+    if (root.empty()) return;
+
+    program_cache = make_unique<ProgramCache>(root, get_info(p_clGetDeviceInfo, device_id, CL_DEVICE_NAME),
+                                              get_info(p_clGetDeviceInfo, device_id, CL_DRIVER_VERSION));
+    if (program_cache->failed()) {
+        __android_log_print(ANDROID_LOG_INFO, "JNILOG","Thneed: can't use program cache in %s\n", root.c_str());
+        program_cache.reset();
+    }
+}
+
+cl_program Thneed::program_from_source(const string &source) {
+    if (!program_cache) return cl_program_from_source(context, device_id, source);
+
+    string binary;
+    if (program_cache->get(source, "", binary)) {
+        const uint8_t *bin = (const uint8_t *)binary.data();
+        size_t length = binary.size();
+        cl_int status = CL_INVALID_BINARY, err = CL_INVALID_VALUE;
+        cl_program prg = (*p_clCreateProgramWithBinary)(context, 1, &device_id, &length, &bin, &status, &err);
+        if (prg != NULL && err == CL_SUCCESS && status == CL_SUCCESS && (*p_clBuildProgram)(prg, 1, &device_id, NULL, NULL, NULL) == CL_SUCCESS) {
+            return prg;
+        }
+        if (prg != NULL) (*p_clReleaseProgram)(prg);
+        __android_log_print(ANDROID_LOG_INFO, "JNILOG","Thneed: cached program binary rejected, building from source\n");
+        program_cache->remove(source, "");
+    }
+
+    cl_program prg = cl_program_from_source(context, device_id, source);
+    size_t size = 0;
+    if ((*p_clGetProgramInfo)(prg, CL_PROGRAM_BINARY_SIZES, sizeof(size), &size, NULL) == CL_SUCCESS && size > 0) {
+        binary.resize(size);
+        unsigned char *ptr = (unsigned char *)&binary[0];
+        if ((*p_clGetProgramInfo)(prg, CL_PROGRAM_BINARIES, sizeof(ptr), &ptr, NULL) == CL_SUCCESS) {
+            program_cache->put(source, "", binary);
+        }
+    }
+    return prg;
+}
+
 // *********** Thneed ***********
 
 #ifndef QCOM2
@@ -832,10 +1003,9 @@ jfloat* outputs;
 jint output_len;
 ThneedModel *thneed;
 float *zero_buf;
-float *features_buf;
-float *prev_curvs_buf;
+TemporalHistory<float, HISTORY_BUFFER_LEN, FEATURE_LEN> *features_buf;
+TemporalHistory<float, PREV_DESIRED_CURVS_LEN, DESIRED_CURV_WIDTH> *prev_curvs_buf;
 int zero_len = 1024 / 4;
-int features_len = HISTORY_BUFFER_LEN * FEATURE_LEN;
 
 extern "C" {
 
@@ -853,14 +1023,10 @@ extern "C" {
         outputs = new jfloat[size];
         output_len = size;
         zero_buf = new float[zero_len];
-        features_buf = new float[features_len];
-        prev_curvs_buf = new float[PREV_DESIRED_CURVS_LEN];
+        features_buf = new TemporalHistory<float, HISTORY_BUFFER_LEN, FEATURE_LEN>();
+        prev_curvs_buf = new TemporalHistory<float, PREV_DESIRED_CURVS_LEN, DESIRED_CURV_WIDTH>();
         for (int i=0; i<zero_len; i++)
             zero_buf[i] = 0;
-        for (int i=0; i<features_len; i++)
-            features_buf[i] = 0;
-        for (int i=0; i<PREV_DESIRED_CURVS_LEN; i++)
-            prev_curvs_buf[i] = 0;
     }
 
     void JNICALL Java_ai_flow_android_vision_THNEEDModelRunner_initThneed(JNIEnv *env, jobject obj) {
@@ -886,10 +1052,10 @@ extern "C" {
         thneed->setInputBuffer("desire", desire_buf, desire_len);
         thneed->setInputBuffer("traffic_convention", zero_buf, 8/4);
         thneed->setInputBuffer("lateral_control_params", lat_params, LATERAL_CONTROL_PARAMS_LEN);
-        thneed->setInputBuffer("prev_desired_curvs", prev_curvs_buf, PREV_DESIRED_CURVS_LEN);
+        thneed->setInputBuffer("prev_desired_curvs", prev_curvs_buf->data(), prev_curvs_buf->size());
         thneed->setInputBuffer("nav_features", zero_buf, 1024/4);
         thneed->setInputBuffer("nav_instructions", zero_buf, 600/4);
-        thneed->setInputBuffer("features_buffer", features_buf, features_len);
+        thneed->setInputBuffer("features_buffer", features_buf->data(), features_buf->size());
 
         // ok execute model
         thneed->execute();
@@ -898,12 +1064,10 @@ extern "C" {
         env->ReleaseFloatArrayElements(input, input_buf, 0);
 
         // handle features
-        std::memmove(&features_buf[0], &features_buf[FEATURE_LEN], sizeof(float) * FEATURE_LEN*(HISTORY_BUFFER_LEN-1));
-        std::memcpy(&features_buf[FEATURE_LEN*(HISTORY_BUFFER_LEN-1)], &outputs[OUTPUT_SIZE], sizeof(float) * FEATURE_LEN);
+        features_buf->push(&outputs[OUTPUT_SIZE]);
 
         // handle previous curves
-        std::memmove(&prev_curvs_buf[0], &prev_curvs_buf[1], PREV_DESIRED_CURVS_LEN - 1);
-        prev_curvs_buf[PREV_DESIRED_CURVS_LEN - 1] = outputs[5990];
+        prev_curvs_buf->push(&outputs[5990]);
 
         // get the outputs
         jfloatArray result = env->NewFloatArray(output_len);
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+// The last LEN rows of WIDTH values, oldest first, for the temporal inputs of the model.
+// Every row is stored twice, LEN rows apart, so the window is always contiguous and a push
+// writes two rows instead of shifting all of them.
+template <typename T, size_t LEN, size_t WIDTH>
+class TemporalHistory {
+public:
+  static constexpr size_t size() { return LEN * WIDTH; }
+
+  TemporalHistory() : buf(2 * LEN * WIDTH, T()) {}
+
+  // appends a row, the oldest one drops out
+  void push(const T *row) {
+    std::copy(row, row + WIDTH, &buf[head * WIDTH]);
+    std::copy(row, row + WIDTH, &buf[(head + LEN) * WIDTH]);
+    head = (head + 1 == LEN) ? 0 : head + 1;
+  }
+
+  // all rows, oldest first, valid until the next push
+  T *data() { return &buf[head * WIDTH]; }
+  const T *data() const { return &buf[head * WIDTH]; }
+
+private:
+  std::vector<T> buf;
+  size_t head = 0;
+};
@@ -13,6 +13,8 @@
 #include "CL/cl.h"
 
 #include "msm_kgsl.h"
+#include "program_cache.h"
+#include "thneed_format.h"
 
 //#define QCOM2
 //#define USE_PRECOMPILED
@@ -132,5 +134,12 @@ class Thneed {
     void load(const char *filename);
   private:
     void clinit();
+    void load_binary(const char *filename);
+    void open_program_cache(const char *filename);
+    cl_program program_from_source(const string &source);
+
+    // a binary model stays mapped, its weights can back the CL buffers
+    ThneedFile file;
+    unique_ptr<ProgramCache> program_cache;
 };
 
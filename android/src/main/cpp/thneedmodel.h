@@ -11,6 +11,7 @@ public:
   void *getCLBuffer(const std::string name);
   void execute();
 private:
+  friend class ThneedPipeline;
   Thneed *thneed = NULL;
   bool recorded;
   float *output;
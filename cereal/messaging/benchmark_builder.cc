@@ -0,0 +1,66 @@
+// Allocations and time per message of MessageBuilder against ReusableMessageBuilder,
+// building a can event and serializing it like a publisher does.
+// usage: benchmark_builder [iterations]
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+#include "messaging.h"
+
+// Every heap allocation ends up in one of these, counting them is enough to see the difference
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t n, size_t size);
+static size_t allocations = 0;
+
+extern "C" void *malloc(size_t size) {
+  allocations++;
+  return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t n, size_t size) {
+  allocations++;
+  return __libc_calloc(n, size);
+}
+
+static void fill_can(cereal::Event::Builder event, int num_frames) {
+  auto can = event.initCan(num_frames);
+  uint8_t dat[8] = {};
+  for (int i = 0; i < num_frames; i++) {
+    can[i].setAddress(0x100 + i);
+    can[i].setSrc(i % 3);
+    can[i].setDat(kj::arrayPtr(dat, sizeof(dat)));
+  }
+}
+
+template <typename F>
+static void run(const char *name, int num_frames, int iterations, F build) {
+  size_t bytes = 0;
+  build(num_frames);  // warm up, the reusable builder grows here
+  size_t start_allocations = allocations;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    bytes += build(num_frames);
+  }
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  printf("%-24s %6d %10zu %12.2f %10.1f\n", name, num_frames, bytes / iterations,
+         (double)(allocations - start_allocations) / iterations, ns / iterations);
+}
+
+int main(int argc, char *argv[]) {
+  const int iterations = argc > 1 ? std::stoi(argv[1]) : 100000;
+  ReusableMessageBuilder reusable;
+
+  printf("%-24s %6s %10s %12s %10s\n", "builder", "frames", "bytes", "allocs/msg", "ns/msg");
+  for (int num_frames : {0, 16, 64, 256, 1024}) {
+    run("MessageBuilder", num_frames, iterations, [](int n) {
+      MessageBuilder msg;
+      fill_can(msg.initEvent(), n);
+      return msg.toBytes().size();
+    });
+    run("ReusableMessageBuilder", num_frames, iterations, [&](int n) {
+      fill_can(reusable.initEvent(), n);
+      return reusable.toBytes().size();
+    });
+  }
+  return 0;
+}
@@ -76,14 +76,15 @@ int main(int argc, char** argv) {
 
   while (!do_exit) {
     for (auto sub_sock : poller->poll(100)) {
-      Message * msg = sub_sock->receive();
-      if (msg == NULL) continue;
-      int ret;
-      do {
-        ret = sub2pub[sub_sock]->sendMessage(msg);
-      } while (ret == -1 && errno == EINTR && !do_exit);
-      assert(ret >= 0 || do_exit);
-      delete msg;
+      PubSocket *pub_sock = sub2pub[sub_sock];
+      sub_sock->receiveMany(100, [&](Message *msg) {
+        int ret;
+        do {
+          ret = pub_sock->sendMessage(msg);
+        } while (ret == -1 && errno == EINTR && !do_exit);
+        assert(ret >= 0 || do_exit);
+        return !do_exit;
+      });
 
       if (do_exit) break;
     }
@@ -5,6 +5,8 @@
 #include <csignal>
 #include <cerrno>
 
+#include <kj/io.h>
+
 #include "services.h"
 #include "impl_msgq.h"
 
@@ -16,13 +18,22 @@ void sig_handler(int signal) {
   msgq_do_exit = 1;
 }
 
-static bool service_exists(std::string path){
+static const service *get_service(std::string path){
   for (const auto& it : services) {
     if (it.name == path) {
-      return true;
+      return &it;
     }
   }
-  return false;
+  return NULL;
+}
+
+// Publisher and subscribers look up the same service, so they always agree on the size and layout
+static int service_new_queue(msgq_queue_t *q, std::string endpoint, const service *serv){
+  size_t size = (serv != NULL && serv->segment_size > 0) ? serv->segment_size : DEFAULT_SEGMENT_SIZE;
+  if (serv != NULL && serv->spsc_slots > 0){
+    return msgq_new_spsc_queue(q, endpoint.c_str(), size, serv->spsc_slots);
+  }
+  return msgq_new_queue(q, endpoint.c_str(), size);
 }
 
 
@@ -46,13 +57,21 @@ void MSGQMessage::init(char * d, size_t sz) {
 void MSGQMessage::takeOwnership(char * d, size_t sz) {
   size = sz;
   data = d;
+  borrowed = false;
+}
+
+void MSGQMessage::borrow(char * d, size_t sz) {
+  size = sz;
+  data = d;
+  borrowed = true;
 }
 
 void MSGQMessage::close() {
-  if (size > 0){
+  if (size > 0 && !borrowed){
     delete[] data;
   }
   size = 0;
+  borrowed = false;
 }
 
 MSGQMessage::~MSGQMessage() {
@@ -63,17 +82,25 @@ int MSGQSubSocket::connect(Context *context, std::string endpoint, std::string a
   assert(context);
   assert(address == "127.0.0.1");
 
-  if (check_endpoint && !service_exists(std::string(endpoint))){
+  const service *serv = get_service(endpoint);
+  if (check_endpoint && serv == NULL){
     std::cout << "Warning, " << std::string(endpoint) << " is not in service list." << std::endl;
   }
 
   q = new msgq_queue_t;
-  int r = msgq_new_queue(q, endpoint.c_str(), DEFAULT_SEGMENT_SIZE);
+  int r = service_new_queue(q, endpoint, serv);
   if (r != 0){
     return r;
   }
 
-  msgq_init_subscriber(q);
+  if (serv != NULL && serv->huge_pages){
+    msgq_advise_hugepages(q);
+  }
+
+  r = msgq_init_subscriber(q);
+  if (r != 0){
+    return r;
+  }
 
   if (conflate){
     q->read_conflate = true;
@@ -85,7 +112,7 @@ int MSGQSubSocket::connect(Context *context, std::string endpoint, std::string a
 }
 
 
-Message * MSGQSubSocket::receive(bool non_blocking){
+int MSGQSubSocket::receive_msg(msgq_msg_t *msg, bool non_blocking, int (*recv)(msgq_msg_t *, msgq_queue_t *)){
   msgq_do_exit = 0;
 
   void (*prev_handler_sigint)(int);
@@ -95,11 +122,7 @@ Message * MSGQSubSocket::receive(bool non_blocking){
     prev_handler_sigterm = std::signal(SIGTERM, sig_handler);
   }
 
-  msgq_msg_t msg;
-
-  MSGQMessage *r = NULL;
-
-  int rc = msgq_msg_recv(&msg, q);
+  int rc = recv(msg, q);
 
   // Hack to implement blocking read with a poller. Don't use this
   while (!non_blocking && rc == 0 && msgq_do_exit == 0){
@@ -109,7 +132,7 @@ Message * MSGQSubSocket::receive(bool non_blocking){
     int t = (timeout != -1) ? timeout : 100;
 
     int n = msgq_poll(items, 1, t);
-    rc = msgq_msg_recv(&msg, q);
+    rc = recv(msg, q);
 
     // The poll indicated a message was ready, but the receive failed. Try again
     if (n == 1 && rc == 0){
@@ -128,6 +151,15 @@ Message * MSGQSubSocket::receive(bool non_blocking){
   }
 
   errno = msgq_do_exit ? EINTR : 0;
+  return rc;
+}
+
+Message * MSGQSubSocket::receive(bool non_blocking){
+  msgq_msg_t msg;
+
+  MSGQMessage *r = NULL;
+
+  int rc = receive_msg(&msg, non_blocking, msgq_msg_recv);
 
   if (rc > 0){
     if (msgq_do_exit){
@@ -141,6 +173,86 @@ Message * MSGQSubSocket::receive(bool non_blocking){
   return (Message*)r;
 }
 
+Message * MSGQSubSocket::receiveBorrowed(bool non_blocking){
+  msgq_msg_t msg;
+
+  MSGQMessage *r = NULL;
+
+  int rc = receive_msg(&msg, non_blocking, msgq_msg_borrow);
+
+  if (rc > 0){
+    if (msgq_do_exit){
+      msgq_msg_release(&msg, q); // Hand back unused message on exit
+    } else {
+      borrowed_msg.borrow(msg.data, msg.size);
+      r = &borrowed_msg;
+    }
+  }
+
+  return (Message*)r;
+}
+
+bool MSGQSubSocket::releaseBorrowed(Message *message){
+  assert(message == &borrowed_msg);
+
+  msgq_msg_t msg;
+  msg.data = borrowed_msg.getData();
+  msg.size = borrowed_msg.getSize();
+  borrowed_msg.close();
+
+  return msgq_msg_release(&msg, q);
+}
+
+int MSGQSubSocket::receiveMany(size_t max_msgs, std::function<bool(Message *)> callback){
+  if (batch_msgs.size() < max_msgs){
+    batch_msgs.resize(max_msgs);
+    batch_sizes.resize(max_msgs);
+  }
+
+  int n = msgq_msg_borrow_many(batch_msgs.data(), max_msgs, q);
+  if (n <= 0){
+    return 0;
+  }
+
+  // Copy the batch out before validating it, the consumer can't undo what it did with
+  // overwritten data. Messages are kept word aligned so they can be parsed in place.
+  size_t total_size = 0;
+  for (int i = 0; i < n; i++){
+    batch_sizes[i] = batch_msgs[i].size;
+    total_size += ALIGN(batch_msgs[i].size);
+  }
+  if (batch_buf.size() * sizeof(uint64_t) < total_size){
+    batch_buf.resize(total_size / sizeof(uint64_t));
+  }
+
+  char *p = (char *)batch_buf.data();
+  for (int i = 0; i < n; i++){
+    memcpy(p, batch_msgs[i].data, batch_sizes[i]);
+    p += ALIGN(batch_sizes[i]);
+  }
+
+  // Writer caught up while copying, the reader was reset and the batch is dropped
+  if (!msgq_msg_release_many(batch_msgs.data(), n, q)){
+    return 0;
+  }
+
+  // The rest of the batch is dropped if the callback stops early, it was already taken off the queue
+  MSGQMessage msg;
+  p = (char *)batch_buf.data();
+  int i = 0;
+  while (i < n){
+    msg.borrow(p, batch_sizes[i]);
+    p += ALIGN(batch_sizes[i]);
+    i++;
+    if (!callback(&msg)){
+      break;
+    }
+  }
+  msg.close();
+
+  return i;
+}
+
 void MSGQSubSocket::setTimeout(int t){
   timeout = t;
 }
@@ -155,16 +267,21 @@ MSGQSubSocket::~MSGQSubSocket(){
 int MSGQPubSocket::connect(Context *context, std::string endpoint, bool check_endpoint){
   assert(context);
 
-  if (check_endpoint && !service_exists(std::string(endpoint))){
+  const service *serv = get_service(endpoint);
+  if (check_endpoint && serv == NULL){
     std::cout << "Warning, " << std::string(endpoint) << " is not in service list." << std::endl;
   }
 
   q = new msgq_queue_t;
-  int r = msgq_new_queue(q, endpoint.c_str(), DEFAULT_SEGMENT_SIZE);
+  int r = service_new_queue(q, endpoint, serv);
   if (r != 0){
     return r;
   }
 
+  if (serv != NULL && serv->huge_pages){
+    msgq_advise_hugepages(q);
+  }
+
   msgq_init_publisher(q);
 
   return 0;
@@ -186,6 +303,20 @@ int MSGQPubSocket::send(char *data, size_t size){
   return msgq_msg_send(&msg, q);
 }
 
+int MSGQPubSocket::sendInPlace(capnp::MessageBuilder &message){
+  // Same layout as capnp::messageToFlatArray, written straight into the queue
+  size_t size = capnp::computeSerializedSizeInWords(message) * sizeof(capnp::word);
+  char *p = msgq_reserve(q, size);
+  if (p == NULL){
+    return -1;
+  }
+
+  kj::ArrayOutputStream stream(kj::arrayPtr((capnp::byte *)p, size));
+  capnp::writeMessage(stream, message);
+
+  return msgq_commit(q, size);
+}
+
 bool MSGQPubSocket::all_readers_updated() {
   return msgq_all_readers_updated(q);
 }
@@ -3,6 +3,7 @@
 #include "msgq.h"
 #include <zmq.h>
 #include <string>
+#include <vector>
 
 #define MAX_POLLERS 128
 
@@ -18,11 +19,13 @@ public:
 class MSGQMessage : public Message {
 private:
   char * data;
-  size_t size;
+  size_t size = 0;
+  bool borrowed = false;
 public:
   void init(size_t size);
   void init(char *data, size_t size);
   void takeOwnership(char *data, size_t size);
+  void borrow(char *data, size_t size);
   size_t getSize(){return size;}
   char * getData(){return data;}
   void close();
@@ -33,11 +36,19 @@ class MSGQSubSocket : public SubSocket {
 private:
   msgq_queue_t * q = NULL;
   int timeout;
+  MSGQMessage borrowed_msg;
+  std::vector<msgq_msg_t> batch_msgs;
+  std::vector<size_t> batch_sizes;
+  std::vector<uint64_t> batch_buf;
+  int receive_msg(msgq_msg_t *msg, bool non_blocking, int (*recv)(msgq_msg_t *, msgq_queue_t *));
 public:
   int connect(Context *context, std::string endpoint, std::string address, bool conflate=false, bool check_endpoint=true);
   void setTimeout(int timeout);
   void * getRawSocket() {return (void*)q;}
   Message *receive(bool non_blocking=false);
+  Message *receiveBorrowed(bool non_blocking=false);
+  bool releaseBorrowed(Message *message);
+  int receiveMany(size_t max_msgs, std::function<bool(Message *)> callback);
   ~MSGQSubSocket();
 };
 
@@ -48,6 +59,7 @@ public:
   int connect(Context *context, std::string endpoint, bool check_endpoint=true);
   int sendMessage(Message *message);
   int send(char *data, size_t size);
+  int sendInPlace(capnp::MessageBuilder &msg);
   bool all_readers_updated();
   ~MSGQPubSocket();
 };
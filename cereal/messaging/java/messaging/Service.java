@@ -6,5 +6,8 @@ public class Service{
     public boolean keepLast;
     public boolean log;
     public float decimation;
+    public int segmentSize;
+    public boolean hugePages;
+    public int spscSlots;
 }
 
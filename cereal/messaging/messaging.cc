@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <iostream>
 
 #include "messaging.h"
@@ -76,6 +78,90 @@ PubSocket * PubSocket::create(Context * context, std::string endpoint, bool chec
   }
 }
 
+int SubSocket::receiveMany(size_t max_msgs, std::function<bool(Message *)> callback){
+  size_t n = 0;
+  while (n < max_msgs){
+    Message *msg = receive(true);
+    if (msg == NULL){
+      break;
+    }
+    n++;
+    bool more = callback(msg);
+    delete msg;
+    if (!more){
+      break;
+    }
+  }
+  return n;
+}
+
+int PubSocket::sendInPlace(capnp::MessageBuilder &msg){
+  auto words = capnp::messageToFlatArray(msg);
+  auto bytes = words.asBytes();
+  return send((char *)bytes.begin(), bytes.size());
+}
+
+ReusableMessageBuilder::ReusableMessageBuilder(size_t first_segment_words)
+    : first_segment_(kj::heapArray<capnp::word>(first_segment_words)) {
+  memset(first_segment_.begin(), 0, first_segment_.asBytes().size());
+  builder_.emplace(*this);
+}
+
+kj::ArrayPtr<capnp::word> ReusableMessageBuilder::Builder::allocateSegment(uint minimumSize) {
+  ReusableMessageBuilder &o = owner_;
+  if (o.allocated_words_ == 0 && minimumSize <= o.first_segment_.size()) {
+    o.first_segment_used_ = true;
+    o.allocated_words_ = o.first_segment_.size();
+    return o.first_segment_;
+  }
+  // grow like MallocMessageBuilder, each new segment is as big as all before it
+  auto segment = kj::heapArray<capnp::word>(std::max<size_t>(minimumSize, o.allocated_words_));
+  memset(segment.begin(), 0, segment.asBytes().size());
+  o.allocated_words_ += segment.size();
+  o.more_segments_.push_back(kj::mv(segment));
+  return o.more_segments_.back();
+}
+
+void ReusableMessageBuilder::reset() {
+  // capnp expects zeroed segments, only the part the last message used needs clearing
+  size_t used_words = 0;
+  auto segments = builder_->getSegmentsForOutput();
+  for (auto segment : segments) {
+    used_words += segment.size();
+  }
+  if (first_segment_used_ && segments.size() > 0) {
+    memset(first_segment_.begin(), 0, segments[0].size() * sizeof(capnp::word));
+  }
+  builder_.reset();
+
+  if (!more_segments_.empty()) {
+    more_segments_.clear();
+    if (used_words > first_segment_.size()) {
+      first_segment_ = kj::heapArray<capnp::word>(used_words);
+      memset(first_segment_.begin(), 0, first_segment_.asBytes().size());
+    }
+  }
+  first_segment_used_ = false;
+  allocated_words_ = 0;
+  builder_.emplace(*this);
+}
+
+cereal::Event::Builder ReusableMessageBuilder::initEvent(bool valid) {
+  reset();
+  return init_event_root(*builder_, valid);
+}
+
+kj::ArrayPtr<capnp::byte> ReusableMessageBuilder::toBytes() {
+  size_t size = capnp::computeSerializedSizeInWords(*builder_);
+  if (output_.size() < size) {
+    output_ = kj::heapArray<capnp::word>(size);
+  }
+  auto bytes = output_.asBytes().slice(0, size * sizeof(capnp::word));
+  kj::ArrayOutputStream stream(bytes);
+  capnp::writeMessage(stream, *builder_);
+  return bytes;
+}
+
 Poller * Poller::create(){
   Poller * p;
   if (messaging_use_zmq()){
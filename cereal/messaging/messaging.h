@@ -1,7 +1,9 @@
 #pragma once
 #include <cstddef>
 #include <ctime>
+#include <functional>
 #include <map>
+#include <optional>
 #include <string>
 #include <vector>
 #include <time.h>
@@ -16,6 +18,8 @@
 
 bool messaging_use_zmq();
 
+class MessageBuilder;
+
 class Context {
 public:
   virtual void * getRawContext() = 0;
@@ -39,6 +43,14 @@ public:
   virtual int connect(Context *context, std::string endpoint, std::string address, bool conflate=false, bool check_endpoint=true) = 0;
   virtual void setTimeout(int timeout) = 0;
   virtual Message *receive(bool non_blocking=false) = 0;
+  // Zero copy receive, the message may point into the transport's buffer. It has to be
+  // handed back with releaseBorrowed, which returns false if the data was overwritten in the meantime.
+  virtual Message *receiveBorrowed(bool non_blocking=false) { return receive(non_blocking); }
+  virtual bool releaseBorrowed(Message *message) { delete message; return true; }
+  // Drain up to max_msgs pending messages without blocking. The messages passed to the
+  // callback are only valid during the call, returning false from it stops the drain early.
+  // Returns the number of messages passed to the callback.
+  virtual int receiveMany(size_t max_msgs, std::function<bool(Message *)> callback);
   virtual void * getRawSocket() = 0;
   static SubSocket * create();
   static SubSocket * create(Context * context, std::string endpoint, std::string address="127.0.0.1", bool conflate=false, bool check_endpoint=true);
@@ -50,6 +62,8 @@ public:
   virtual int connect(Context *context, std::string endpoint, bool check_endpoint=true) = 0;
   virtual int sendMessage(Message *message) = 0;
   virtual int send(char *data, size_t size) = 0;
+  // Serialize the message directly into the transport's buffer when it supports it
+  virtual int sendInPlace(capnp::MessageBuilder &msg);
   virtual bool all_readers_updated() = 0;
   static PubSocket * create();
   static PubSocket * create(Context * context, std::string endpoint, bool check_endpoint=true);
@@ -66,10 +80,15 @@ public:
   virtual ~Poller(){};
 };
 
+// Services in borrow are received without copying. The reader returned by operator[] points into the
+// transport's buffer until the next update() hands the message back, or copies it out if no new one
+// arrived. overwritten() tells if the writer overwrote the message before it was handed back, reading
+// it can also throw then. Borrowed services have to be polled.
 class SubMaster {
 public:
   SubMaster(const std::vector<const char *> &service_list, const std::vector<const char *> &poll = {},
-            const char *address = nullptr, const std::vector<const char *> &ignore_alive = {});
+            const char *address = nullptr, const std::vector<const char *> &ignore_alive = {},
+            const std::vector<const char *> &borrow = {});
   void update(int timeout = 1000);
   void update_msgs(uint64_t current_time, const std::vector<std::pair<std::string, cereal::Event::Reader>> &messages);
   inline bool allAlive(const std::vector<const char *> &service_list = {}) { return all_(service_list, false, true); }
@@ -84,6 +103,7 @@ public:
   bool valid(const char *name) const;
   uint64_t rcv_frame(const char *name) const;
   uint64_t rcv_time(const char *name) const;
+  bool overwritten(const char *name) const;
   cereal::Event::Reader &operator[](const char *name) const;
 
 private:
@@ -94,18 +114,22 @@ private:
   std::map<std::string, SubMessage *> services_;
 };
 
+inline cereal::Event::Builder init_event_root(capnp::MessageBuilder &msg, bool valid) {
+  cereal::Event::Builder event = msg.initRoot<cereal::Event>();
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  uint64_t current_time = t.tv_sec * 1000000000ULL + t.tv_nsec;
+  event.setLogMonoTime(current_time);
+  event.setValid(valid);
+  return event;
+}
+
 class MessageBuilder : public capnp::MallocMessageBuilder {
 public:
   MessageBuilder() = default;
 
   cereal::Event::Builder initEvent(bool valid = true) {
-    cereal::Event::Builder event = initRoot<cereal::Event>();
-    struct timespec t;
-    clock_gettime(CLOCK_MONOTONIC, &t);
-    uint64_t current_time = t.tv_sec * 1000000000ULL + t.tv_nsec;
-    event.setLogMonoTime(current_time);
-    event.setValid(valid);
-    return event;
+    return init_event_root(*this, valid);
   }
 
   kj::ArrayPtr<capnp::byte> toBytes() {
@@ -117,11 +141,47 @@ private:
   kj::Array<capnp::word> heapArray_;
 };
 
+// For publishers that build the same kind of message in a loop. The segment memory and the
+// buffer toBytes() serializes into are kept, and initEvent() starts the next message in them.
+// When a message needs more than the first segment, it grows to that size for the next one,
+// so after a few messages nothing is allocated anymore.
+// Everything returned for a message is invalid after the next initEvent().
+class ReusableMessageBuilder {
+public:
+  ReusableMessageBuilder(size_t first_segment_words = capnp::SUGGESTED_FIRST_SEGMENT_WORDS);
+  ReusableMessageBuilder(const ReusableMessageBuilder &) = delete;
+  ReusableMessageBuilder &operator=(const ReusableMessageBuilder &) = delete;
+
+  cereal::Event::Builder initEvent(bool valid = true);
+  kj::ArrayPtr<capnp::byte> toBytes();
+  capnp::MessageBuilder &builder() { return *builder_; }
+  size_t capacity() const { return first_segment_.size(); }
+
+private:
+  class Builder : public capnp::MessageBuilder {
+  public:
+    Builder(ReusableMessageBuilder &owner) : owner_(owner) {}
+    kj::ArrayPtr<capnp::word> allocateSegment(uint minimumSize) override;
+  private:
+    ReusableMessageBuilder &owner_;
+  };
+
+  void reset();
+
+  kj::Array<capnp::word> first_segment_;
+  bool first_segment_used_ = false;
+  std::vector<kj::Array<capnp::word>> more_segments_;  // only until the next reset()
+  size_t allocated_words_ = 0;
+  std::optional<Builder> builder_;
+  kj::Array<capnp::word> output_;
+};
+
 class PubMaster {
 public:
   PubMaster(const std::vector<const char *> &service_list);
   inline int send(const char *name, capnp::byte *data, size_t size) { return sockets_.at(name)->send((char *)data, size); }
-  int send(const char *name, MessageBuilder &msg);
+  int send(const char *name, capnp::MessageBuilder &msg);
+  inline int send(const char *name, ReusableMessageBuilder &msg) { return send(name, msg.builder()); }
   ~PubMaster();
 
 private:
@@ -141,6 +201,16 @@ public:
   inline kj::ArrayPtr<const capnp::word> align(Message *m) {
     return align(m->getData(), m->getSize());
   }
+  // Use the data in place when it is already word aligned, only copy otherwise
+  kj::ArrayPtr<const capnp::word> view(const char *data, const size_t size) {
+    if (((uintptr_t)data % sizeof(capnp::word)) != 0 || (size % sizeof(capnp::word)) != 0) {
+      return align(data, size);
+    }
+    return kj::arrayPtr((const capnp::word *)data, size / sizeof(capnp::word));
+  }
+  inline kj::ArrayPtr<const capnp::word> view(Message *m) {
+    return view(m->getData(), m->getSize());
+  }
 private:
   kj::Array<capnp::word> aligned_buf;
   size_t words_size;
@@ -0,0 +1,88 @@
+#include <cstring>
+#include <string>
+
+#include "catch2/catch.hpp"
+#include "messaging.h"
+
+static void fill_can(cereal::Event::Builder event, int num_frames, uint8_t seed) {
+  event.setLogMonoTime(0);
+  auto can = event.initCan(num_frames);
+  for (int i = 0; i < num_frames; i++) {
+    uint8_t dat[8];
+    memset(dat, seed + i, sizeof(dat));
+    can[i].setAddress(0x100 + i);
+    can[i].setSrc(i % 3);
+    can[i].setDat(kj::arrayPtr(dat, sizeof(dat)));
+  }
+}
+
+static std::string to_string(kj::ArrayPtr<capnp::byte> bytes) {
+  return std::string((const char *)bytes.begin(), bytes.size());
+}
+
+TEST_CASE("ReusableMessageBuilder matches MessageBuilder"){
+  // same first segment size, so the segments are laid out the same way
+  ReusableMessageBuilder reusable;
+  for (int num_frames : {1, 10, 200, 3, 200, 0}) {
+    MessageBuilder msg;
+    fill_can(msg.initEvent(), num_frames, num_frames);
+    fill_can(reusable.initEvent(), num_frames, num_frames);
+
+    INFO("num_frames " << num_frames);
+    REQUIRE(to_string(reusable.toBytes()) == to_string(msg.toBytes()));
+  }
+}
+
+TEST_CASE("ReusableMessageBuilder clears the previous message"){
+  ReusableMessageBuilder reusable;
+  fill_can(reusable.initEvent(), 100, 0xff);
+  reusable.toBytes();
+
+  auto event = reusable.initEvent(false);
+  event.setLogMonoTime(0);
+  event.initSendcan(100);
+
+  MessageBuilder msg;
+  auto expected = msg.initEvent(false);
+  expected.setLogMonoTime(0);
+  expected.initSendcan(100);
+  REQUIRE(to_string(reusable.toBytes()) == to_string(msg.toBytes()));
+}
+
+TEST_CASE("ReusableMessageBuilder grows to the largest message"){
+  ReusableMessageBuilder reusable(16);
+  REQUIRE(reusable.capacity() == 16);
+
+  fill_can(reusable.initEvent(), 200, 0);
+  REQUIRE(reusable.builder().getSegmentsForOutput().size() > 1);
+  reusable.initEvent();
+  size_t capacity = reusable.capacity();
+  REQUIRE(capacity > 16);
+
+  // fits in one segment from now on
+  size_t size = 0;
+  for (int i = 0; i < 10; i++) {
+    fill_can(reusable.initEvent(), 200, i);
+    REQUIRE(reusable.builder().getSegmentsForOutput().size() == 1);
+    if (i == 0) size = reusable.toBytes().size();
+    REQUIRE(reusable.toBytes().size() == size);
+  }
+  REQUIRE(reusable.capacity() == capacity);
+}
+
+TEST_CASE("ReusableMessageBuilder round trip"){
+  // grows a few times on the way
+  ReusableMessageBuilder reusable(16);
+  AlignedBuffer aligned_buf;
+  for (int i : {0, 5, 50, 2, 100, 10}) {
+    fill_can(reusable.initEvent(), i, i);
+    auto bytes = reusable.toBytes();
+    capnp::FlatArrayMessageReader reader(aligned_buf.align((const char *)bytes.begin(), bytes.size()));
+    auto can = reader.getRoot<cereal::Event>().getCan();
+    REQUIRE(can.size() == (unsigned)i);
+    for (int j = 0; j < i; j++) {
+      REQUIRE(can[j].getAddress() == 0x100 + j);
+      REQUIRE(can[j].getDat()[0] == (uint8_t)(i + j));
+    }
+  }
+}
@@ -19,6 +19,11 @@
 #include <sys/syscall.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <climits>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#endif
 
 #include <stdio.h>
 
@@ -28,6 +33,38 @@ void sigusr2_handler(int signal) {
   assert(signal == SIGUSR2);
 }
 
+#ifdef __linux__
+#ifndef SYS_futex_waitv
+#define SYS_futex_waitv 449
+#endif
+#define MSGQ_FUTEX_32 2
+#define MSGQ_FUTEX_WAITV_MAX 128
+
+// Same layout as struct futex_waitv in linux/futex.h, which older headers don't have
+struct msgq_futex_waitv {
+  uint64_t val;
+  uint64_t uaddr;
+  uint32_t flags;
+  uint32_t reserved;
+};
+
+// Cleared the first time the kernel reports futex_waitv is missing (< 5.16)
+static std::atomic<bool> futex_waitv_supported(true);
+
+static int futex_wait(std::atomic<uint32_t> *addr, uint32_t expected, const struct timespec *ts) {
+  // Not FUTEX_PRIVATE_FLAG, the word lives in shared memory mapped by other processes
+  return syscall(SYS_futex, (uint32_t*)addr, FUTEX_WAIT, expected, ts, NULL, 0);
+}
+
+static int futex_wait_multiple(struct msgq_futex_waitv *waiters, size_t n, const struct timespec *deadline) {
+  return syscall(SYS_futex_waitv, waiters, n, 0, deadline, CLOCK_MONOTONIC);
+}
+
+static void futex_wake_all(std::atomic<uint32_t> *addr) {
+  syscall(SYS_futex, (uint32_t*)addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+#endif
+
 uint64_t msgq_get_uid(void){
   std::random_device rd("/dev/urandom");
   std::uniform_int_distribution<uint64_t> distribution(0,std::numeric_limits<uint32_t>::max());
@@ -71,7 +108,11 @@ int msgq_msg_close(msgq_msg_t * msg){
 void msgq_reset_reader(msgq_queue_t * q){
   int id = q->reader_id;
   q->read_valids[id]->store(true);
-  q->read_pointers[id]->store(*q->write_pointer);
+  if (q->spsc){
+    q->spsc_tail->store(*q->spsc_head);
+  } else {
+    q->read_pointers[id]->store(*q->write_pointer);
+  }
 }
 
 void msgq_wait_for_subscriber(msgq_queue_t *q){
@@ -107,7 +148,7 @@ int msgq_new_queue(msgq_queue_t * q, const char * path, size_t size){
   char * mem = (char*)mmap(NULL, size + sizeof(msgq_header_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
   close(fd);
 
-  if (mem == NULL){
+  if (mem == MAP_FAILED){
     return -1;
   }
   q->mmap_p = mem;
@@ -118,11 +159,13 @@ int msgq_new_queue(msgq_queue_t * q, const char * path, size_t size){
   q->num_readers = reinterpret_cast<std::atomic<uint64_t>*>(&header->num_readers);
   q->write_pointer = reinterpret_cast<std::atomic<uint64_t>*>(&header->write_pointer);
   q->write_uid = reinterpret_cast<std::atomic<uint64_t>*>(&header->write_uid);
+  q->write_seq = reinterpret_cast<std::atomic<uint32_t>*>(&header->write_seq);
 
   for (size_t i = 0; i < NUM_READERS; i++){
     q->read_pointers[i] = reinterpret_cast<std::atomic<uint64_t>*>(&header->read_pointers[i]);
     q->read_valids[i] = reinterpret_cast<std::atomic<uint64_t>*>(&header->read_valids[i]);
     q->read_uids[i] = reinterpret_cast<std::atomic<uint64_t>*>(&header->read_uids[i]);
+    q->read_waiting[i] = reinterpret_cast<std::atomic<uint64_t>*>(&header->read_waiting[i]);
   }
 
   q->data = mem + sizeof(msgq_header_t);
@@ -131,12 +174,68 @@ int msgq_new_queue(msgq_queue_t * q, const char * path, size_t size){
 
   q->endpoint = path;
   q->read_conflate = false;
+  q->borrowed = false;
+  q->write_reserved = 0;
+  q->spsc = false;
+
+  #ifdef __linux__
+    q->use_futex = std::getenv("MSGQ_NO_FUTEX") == NULL;
+  #else
+    q->use_futex = false;
+  #endif
 
   return 0;
 }
 
+int msgq_new_spsc_queue(msgq_queue_t * q, const char * path, size_t size, size_t num_slots){
+  assert(num_slots > 0);
+
+  // Every slot starts on its own cache line
+  size_t slot_size = (size / num_slots) & ~(size_t)(MSGQ_CACHELINE - 1);
+  assert(slot_size > sizeof(int64_t));
+
+  size_t total_size = MSGQ_CACHELINE + sizeof(msgq_spsc_header_t) + num_slots * slot_size;
+  if (msgq_new_queue(q, path, total_size) != 0){
+    return -1;
+  }
+
+  // The data segment follows the reader table, which is not cache line aligned
+  uintptr_t base = ((uintptr_t)q->data + MSGQ_CACHELINE - 1) & ~(uintptr_t)(MSGQ_CACHELINE - 1);
+  msgq_spsc_header_t *header = (msgq_spsc_header_t *)base;
+
+  q->spsc_head = reinterpret_cast<std::atomic<uint64_t>*>(&header->head);
+  q->spsc_tail = reinterpret_cast<std::atomic<uint64_t>*>(&header->tail);
+  q->spsc_slots = (char *)(header + 1);
+  q->spsc_num_slots = num_slots;
+  q->spsc_slot_size = slot_size;
+  q->spsc = true;
+
+  return 0;
+}
+
+// Back the queue with transparent huge pages to reduce TLB misses on large or busy queues.
+// /dev/shm is tmpfs, so this only has an effect when shmem THP is set to advise (or always)
+int msgq_advise_hugepages(msgq_queue_t * q){
+  #ifdef MADV_HUGEPAGE
+    return madvise(q->mmap_p, q->size + sizeof(msgq_header_t), MADV_HUGEPAGE);
+  #else
+    errno = ENOTSUP;
+    return -1;
+  #endif
+}
+
 void msgq_close_queue(msgq_queue_t *q){
   if (q->mmap_p != NULL){
+    // Hand back our reader slot
+    int id = q->reader_id;
+    if (id >= 0 && *q->read_uids[id] == q->read_uid_local){
+      *q->read_valids[id] = false;
+      *q->read_waiting[id] = MSGQ_WAIT_NONE;
+
+      uint64_t uid = q->read_uid_local;
+      std::atomic_compare_exchange_strong(q->read_uids[id], &uid, (uint64_t)0);
+    }
+
     munmap(q->mmap_p, q->size + sizeof(msgq_header_t));
   }
 }
@@ -152,6 +251,7 @@ void msgq_init_publisher(msgq_queue_t * q) {
   for (size_t i = 0; i < NUM_READERS; i++){
     *q->read_valids[i] = false;
     *q->read_uids[i] = 0;
+    *q->read_waiting[i] = MSGQ_WAIT_NONE;
   }
 
   q->write_uid_local = uid;
@@ -166,65 +266,147 @@ static void thread_signal(uint32_t tid) {
   #endif
 }
 
-void msgq_init_subscriber(msgq_queue_t * q) {
+static bool msgq_reader_alive(uint64_t uid){
+  // Signal 0 only checks if the thread that owns the slot still exists
+  uint32_t tid = uid & 0xFFFFFFFF;
+  return (kill(tid, 0) == 0) || (errno == EPERM);
+}
+
+static bool msgq_claim_reader(msgq_queue_t * q, uint64_t id, uint64_t old_uid, uint64_t uid){
+  // Use atomic compare and swap to handle race condition
+  // where two subscribers start at the same time
+  if (!std::atomic_compare_exchange_strong(q->read_uids[id], &old_uid, uid)){
+    return false;
+  }
+
+  q->reader_id = id;
+  q->read_uid_local = uid;
+
+  // We start with read_valid = false,
+  // on the first read the read pointer will be synchronized with the write pointer
+  *q->read_valids[id] = false;
+  *q->read_pointers[id] = 0;
+  *q->read_waiting[id] = MSGQ_WAIT_NONE;
+
+  // The publisher only looks at slots below num_readers
+  uint64_t cur_num_readers = *q->num_readers;
+  while (cur_num_readers < id + 1 &&
+         !std::atomic_compare_exchange_strong(q->num_readers, &cur_num_readers, id + 1)){
+    ;
+  }
+
+  return true;
+}
+
+int msgq_init_subscriber(msgq_queue_t * q) {
   assert(q != NULL);
   assert(q->num_readers != NULL);
 
   uint64_t uid = msgq_get_uid();
 
-  // Get reader id
-  while (true){
-    uint64_t cur_num_readers = *q->num_readers;
-    uint64_t new_num_readers = cur_num_readers + 1;
+  // A single producer, single consumer queue only has the first slot
+  uint64_t num_slots = q->spsc ? 1 : NUM_READERS;
 
-    // No more slots available. Reset all subscribers to kick out inactive ones
-    if (new_num_readers > NUM_READERS){
-      //std::cout << "Warning, evicting all subscribers!" << std::endl;
-      *q->num_readers = 0;
+  // Get reader id, take the first free slot
+  for (uint64_t i = 0; i < num_slots; i++){
+    if (*q->read_uids[i] == 0 && msgq_claim_reader(q, i, 0, uid)){
+      goto found;
+    }
+  }
 
-      for (size_t i = 0; i < NUM_READERS; i++){
-        *q->read_valids[i] = false;
+  // No more slots available. Take over the slot of a reader that no longer exists,
+  // live readers are never evicted
+  for (uint64_t i = 0; i < num_slots; i++){
+    uint64_t old_uid = *q->read_uids[i];
+    if (old_uid != 0 && !msgq_reader_alive(old_uid) && msgq_claim_reader(q, i, old_uid, uid)){
+      goto found;
+    }
+  }
 
-        uint64_t old_uid = *q->read_uids[i];
-        *q->read_uids[i] = 0;
+  std::cout << "Warning, no free reader slots: " << q->endpoint << std::endl;
+  errno = ENOSPC;
+  return -1;
 
-        // Wake up reader in case they are in a poll
-        thread_signal(old_uid & 0xFFFFFFFF);
-      }
+ found:
+  //std::cout << "New subscriber id: " << q->reader_id << " uid: " << q->read_uid_local << " " << q->endpoint << std::endl;
+  msgq_reset_reader(q);
+  return 0;
+}
 
-      continue;
+static void msgq_notify_readers(msgq_queue_t * q, uint64_t num_readers){
+  // Only readers that are parked in msgq_poll need a syscall,
+  // all futex waiters share the sequence word so a single wake covers them
+  q->write_seq->fetch_add(1);
+
+  bool wake_futex = false;
+  for (uint64_t i = 0; i < num_readers; i++){
+    uint64_t waiting = *q->read_waiting[i];
+    if (waiting == MSGQ_WAIT_FUTEX){
+      wake_futex = true;
+    } else if (waiting == MSGQ_WAIT_SIGNAL){
+      uint64_t reader_uid = *q->read_uids[i];
+      thread_signal(reader_uid & 0xFFFFFFFF);
     }
+  }
 
-    // Use atomic compare and swap to handle race condition
-    // where two subscribers start at the same time
-    if (std::atomic_compare_exchange_strong(q->num_readers,
-                                            &cur_num_readers,
-                                            new_num_readers)){
-      q->reader_id = cur_num_readers;
-      q->read_uid_local = uid;
-
-      // We start with read_valid = false,
-      // on the first read the read pointer will be synchronized with the write pointer
-      *q->read_valids[cur_num_readers] = false;
-      *q->read_pointers[cur_num_readers] = 0;
-      *q->read_uids[cur_num_readers] = uid;
-      break;
+  #ifdef __linux__
+    if (wake_futex){
+      futex_wake_all(q->write_seq);
     }
+  #endif
+}
+
+static inline char * msgq_spsc_slot(msgq_queue_t * q, uint64_t idx){
+  return q->spsc_slots + (idx % q->spsc_num_slots) * q->spsc_slot_size;
+}
+
+static char * msgq_spsc_reserve(msgq_queue_t * q, size_t size){
+  if (size + sizeof(int64_t) > q->spsc_slot_size){
+    std::cout << "Warning, message does not fit in a slot: " << q->endpoint << std::endl;
+    errno = EMSGSIZE;
+    return NULL;
   }
 
-  //std::cout << "New subscriber id: " << q->reader_id << " uid: " << q->read_uid_local << " " << q->endpoint << std::endl;
-  msgq_reset_reader(q);
+  uint64_t head = *q->spsc_head;
+  uint64_t tail = *q->spsc_tail;
+
+  // All slots are full, drop the oldest messages so the slot we write is no longer readable.
+  // The subscriber only keeps what it copied if it can still move the tail past it afterwards
+  while (head - tail >= q->spsc_num_slots &&
+         !std::atomic_compare_exchange_strong(q->spsc_tail, &tail, head - q->spsc_num_slots + 1)){
+    ;
+  }
+
+  q->write_reserved = size;
+  return msgq_spsc_slot(q, head) + sizeof(int64_t);
 }
 
-int msgq_msg_send(msgq_msg_t * msg, msgq_queue_t *q){
+static int msgq_spsc_commit(msgq_queue_t * q, size_t size){
+  uint64_t head = *q->spsc_head;
+
+  std::atomic<int64_t> *size_p = reinterpret_cast<std::atomic<int64_t>*>(msgq_spsc_slot(q, head));
+  *size_p = size;
+
+  // Publish the slot
+  q->spsc_head->store(head + 1);
+
+  msgq_notify_readers(q, 1);
+  return size;
+}
+
+char * msgq_reserve(msgq_queue_t * q, size_t size){
   // Die if we are no longer the active publisher
   if (q->write_uid_local != *q->write_uid){
     std::cout << "Killing old publisher: " << q->endpoint << std::endl;
     errno = EADDRINUSE;
-    return -1;
+    return NULL;
+  }
+
+  if (q->spsc){
+    return msgq_spsc_reserve(q, size);
   }
 
-  uint64_t total_msg_size = ALIGN(msg->size + sizeof(int64_t));
+  uint64_t total_msg_size = ALIGN(size + sizeof(int64_t));
 
   // We need to fit at least three messages in the queue,
   // then we can always safely access the last message
@@ -267,7 +449,7 @@ int msgq_msg_send(msgq_msg_t * msg, msgq_queue_t *q){
 
   // Invalidate readers that are in the area that will be written
   uint64_t start = write_pointer;
-  uint64_t end = ALIGN(start + sizeof(int64_t) + msg->size);
+  uint64_t end = ALIGN(start + sizeof(int64_t) + size);
 
   for (uint64_t i = 0; i < num_readers; i++){
     uint32_t read_cycles, read_pointer;
@@ -278,26 +460,49 @@ int msgq_msg_send(msgq_msg_t * msg, msgq_queue_t *q){
     }
   }
 
+  q->write_reserved = size;
+  return p + sizeof(int64_t);
+}
+
+int msgq_commit(msgq_queue_t * q, size_t size){
+  // Can't publish more than what was reserved, the readers in that area weren't invalidated
+  assert(size <= q->write_reserved);
+  q->write_reserved = 0;
+
+  if (q->spsc){
+    return msgq_spsc_commit(q, size);
+  }
+
+  uint64_t num_readers = *q->num_readers;
+
+  uint32_t write_cycles, write_pointer;
+  UNPACK64(write_cycles, write_pointer, *q->write_pointer);
+
+  char *p = q->data + write_pointer; // add base offset
 
   // Write size tag
   std::atomic<int64_t> *size_p = reinterpret_cast<std::atomic<int64_t>*>(p);
-  *size_p = msg->size;
-
-  // Copy data
-  memcpy(p + sizeof(int64_t), msg->data, msg->size);
+  *size_p = size;
   __sync_synchronize();
 
   // Update write pointer
-  uint32_t new_ptr = ALIGN(write_pointer + msg->size + sizeof(int64_t));
+  uint32_t new_ptr = ALIGN(write_pointer + size + sizeof(int64_t));
   PACK64(*q->write_pointer, write_cycles, new_ptr);
 
-  // Notify readers
-  for (uint64_t i = 0; i < num_readers; i++){
-    uint64_t reader_uid = *q->read_uids[i];
-    thread_signal(reader_uid & 0xFFFFFFFF);
+  msgq_notify_readers(q, num_readers);
+  return size;
+}
+
+int msgq_msg_send(msgq_msg_t * msg, msgq_queue_t *q){
+  char *p = msgq_reserve(q, msg->size);
+  if (p == NULL){
+    return -1;
   }
 
-  return msg->size;
+  // Copy data
+  memcpy(p, msg->data, msg->size);
+
+  return msgq_commit(q, msg->size);
 }
 
 
@@ -306,9 +511,23 @@ int msgq_msg_ready(msgq_queue_t * q){
   int id = q->reader_id;
   assert(id >= 0); // Make sure subscriber is initialized
 
+  // While a message is borrowed the reader is left alone, the release still has to see if it was
+  // overwritten. Only messages after the borrowed one are new, an overwrite is reported as ready.
+  if (q->borrowed){
+    if (q->read_uid_local != *q->read_uids[id] || !*q->read_valids[id]){
+      return 1;
+    }
+    if (q->spsc){
+      return (*q->spsc_tail != q->borrow_read_pointer || *q->spsc_head != q->borrow_read_pointer + 1);
+    }
+    return ((q->borrow_read_pointer & 0xFFFFFFFF) != (*q->write_pointer & 0xFFFFFFFF));
+  }
+
   if (q->read_uid_local != *q->read_uids[id]){
     //std::cout << q->endpoint << ": Reader was evicted, reconnecting" << std::endl;
-    msgq_init_subscriber(q);
+    if (msgq_init_subscriber(q) != 0){
+      return 0;
+    }
     goto start;
   }
 
@@ -318,24 +537,110 @@ int msgq_msg_ready(msgq_queue_t * q){
     goto start;
   }
 
-  uint32_t read_cycles, read_pointer;
-  UNPACK64(read_cycles, read_pointer, *q->read_pointers[id]);
+  if (q->spsc){
+    return (*q->spsc_tail != *q->spsc_head);
+  }
 
-  uint32_t write_cycles, write_pointer;
-  UNPACK64(write_cycles, write_pointer, *q->write_pointer);
+  // Only the pointers are compared, the cycles are not needed here
+  uint32_t read_pointer = *q->read_pointers[id] & 0xFFFFFFFF;
+  uint32_t write_pointer = *q->write_pointer & 0xFFFFFFFF;
 
   // Check if new message is available
   return (read_pointer != write_pointer);
 }
 
-int msgq_msg_recv(msgq_msg_t * msg, msgq_queue_t * q){
+// Find the oldest unread slot of a single producer, single consumer queue, or the newest one when conflating.
+// The tail is left at the slot, the caller moves it past the slot once done with the data.
+// Returns the size of the message and its location, 0 if no message is available,
+// or -1 if the reader was evicted and could not get a new slot.
+static int64_t msgq_spsc_next(msgq_queue_t * q, char ** data, uint64_t * tail_p){
+ start:
+  int id = q->reader_id;
+  assert(id >= 0); // Make sure subscriber is initialized
+
+  if (q->read_uid_local != *q->read_uids[id]){
+    if (msgq_init_subscriber(q) != 0){
+      return -1;
+    }
+    goto start;
+  }
+
+  if (!*q->read_valids[id]){
+    msgq_reset_reader(q);
+    goto start;
+  }
+
+  uint64_t tail = *q->spsc_tail;
+  uint64_t head = *q->spsc_head;
+  if (tail == head){
+    return 0;
+  }
+
+  if (q->read_conflate && head - tail > 1){
+    if (!std::atomic_compare_exchange_strong(q->spsc_tail, &tail, head - 1)){
+      goto start;
+    }
+    tail = head - 1;
+  }
+
+  char *p = msgq_spsc_slot(q, tail);
+  std::atomic<int64_t> *size_p = reinterpret_cast<std::atomic<int64_t>*>(p);
+  std::int64_t size = *size_p;
+
+  if (size <= 0 || (uint64_t)size + sizeof(int64_t) > q->spsc_slot_size){
+    // The publisher dropped this slot and is writing a new message into it
+    if (*q->spsc_tail != tail){
+      goto start;
+    }
+    // crashing is better than passing garbage data to the consumer
+    assert(false);
+  }
+
+  *data = p + sizeof(int64_t);
+  *tail_p = tail;
+  return size;
+}
+
+static int msgq_spsc_recv(msgq_msg_t * msg, msgq_queue_t * q){
+  char * p;
+  uint64_t tail;
+
+ start:
+  std::int64_t size = msgq_spsc_next(q, &p, &tail);
+  if (size <= 0){
+    msg->size = 0;
+    return size;
+  }
+
+  if (msgq_msg_init_size(msg, size) < 0)
+    return -1;
+
+  memcpy(msg->data, p, size);
+
+  // The publisher moves the tail past a slot before it overwrites it,
+  // if we can't move it ourselves the data that was copied is not valid
+  if (!std::atomic_compare_exchange_strong(q->spsc_tail, &tail, tail + 1)){
+    msgq_msg_close(msg);
+    goto start;
+  }
+
+  return msg->size;
+}
+
+// Find the next message for this reader, following wraparound tags and skipping
+// to the latest message when conflating. The read pointer is left at the start of the message.
+// Returns the size of the message and its location, 0 if no message is available,
+// or -1 if the reader was evicted and could not get a new slot.
+static int64_t msgq_msg_next(msgq_queue_t * q, char ** data, uint32_t * cycles, uint32_t * next_read_pointer){
  start:
   int id = q->reader_id;
   assert(id >= 0); // Make sure subscriber is initialized
 
   if (q->read_uid_local != *q->read_uids[id]){
     //std::cout << q->endpoint << ": Reader was evicted, reconnecting" << std::endl;
-    msgq_init_subscriber(q);
+    if (msgq_init_subscriber(q) != 0){
+      return -1;
+    }
     goto start;
   }
 
@@ -348,14 +653,12 @@ int msgq_msg_recv(msgq_msg_t * msg, msgq_queue_t * q){
   uint32_t read_cycles, read_pointer;
   UNPACK64(read_cycles, read_pointer, *q->read_pointers[id]);
 
-  uint32_t write_cycles, write_pointer;
-  UNPACK64(write_cycles, write_pointer, *q->write_pointer);
+  uint32_t write_pointer = *q->write_pointer & 0xFFFFFFFF;
 
   char * p = q->data + read_pointer;
 
   // Check if new message is available
   if (read_pointer == write_pointer) {
-    msg->size = 0;
     return 0;
   }
 
@@ -392,12 +695,36 @@ int msgq_msg_recv(msgq_msg_t * msg, msgq_queue_t * q){
     }
   }
 
+  *data = p + sizeof(int64_t);
+  *cycles = read_cycles;
+  *next_read_pointer = new_read_pointer;
+  return size;
+}
+
+int msgq_msg_recv(msgq_msg_t * msg, msgq_queue_t * q){
+  assert(!q->borrowed); // Release the borrowed message first
+  if (q->spsc){
+    return msgq_spsc_recv(msg, q);
+  }
+
+  int id;
+  char * p;
+  uint32_t read_cycles, new_read_pointer;
+
+ start:
+  std::int64_t size = msgq_msg_next(q, &p, &read_cycles, &new_read_pointer);
+  if (size <= 0){
+    msg->size = 0;
+    return size;
+  }
+  id = q->reader_id;
+
   // Copy message
   if (msgq_msg_init_size(msg, size) < 0)
     return -1;
 
   __sync_synchronize();
-  memcpy(msg->data, p + sizeof(int64_t), size);
+  memcpy(msg->data, p, size);
   __sync_synchronize();
 
   // Update read pointer
@@ -414,35 +741,189 @@ int msgq_msg_recv(msgq_msg_t * msg, msgq_queue_t * q){
   return msg->size;
 }
 
+int msgq_msg_borrow(msgq_msg_t * msg, msgq_queue_t * q){
+  assert(!q->borrowed); // Only one message can be borrowed at a time
 
+  if (q->spsc){
+    char * p;
+    uint64_t tail;
+    std::int64_t size = msgq_spsc_next(q, &p, &tail);
+    if (size <= 0){
+      msg->size = 0;
+      return size;
+    }
 
-int msgq_poll(msgq_pollitem_t * items, size_t nitems, int timeout){
-  int num = 0;
+    // The tail stays at the slot until it is released
+    msg->data = p;
+    msg->size = size;
+    q->borrow_read_pointer = tail;
+    q->borrowed = true;
+    return msg->size;
+  }
 
-  // Check if messages ready
+  char * p;
+  uint32_t read_cycles, new_read_pointer;
+  std::int64_t size = msgq_msg_next(q, &p, &read_cycles, &new_read_pointer);
+  if (size <= 0){
+    msg->size = 0;
+    return size;
+  }
+
+  // The read pointer stays at the start of the message until it is released,
+  // so the writer will clear our validity flag as soon as it starts overwriting it
+  __sync_synchronize();
+  msg->data = p;
+  msg->size = size;
+  PACK64(q->borrow_read_pointer, read_cycles, new_read_pointer);
+  q->borrowed = true;
+
+  return msg->size;
+}
+
+int msgq_msg_borrow_many(msgq_msg_t * msgs, size_t max_msgs, msgq_queue_t * q){
+  if (max_msgs == 0){
+    return 0;
+  }
+
+  int64_t size = msgq_msg_borrow(&msgs[0], q);
+  if (size <= 0 || q->read_conflate){
+    return size <= 0 ? size : 1;
+  }
+
+  if (q->spsc){
+    // Slots after the first one are only checked for a sane size,
+    // if the publisher dropped any of them the release fails
+    uint64_t head = *q->spsc_head;
+    uint64_t idx = q->borrow_read_pointer + 1;
+
+    size_t n = 1;
+    while (n < max_msgs && idx != head){
+      char *p = msgq_spsc_slot(q, idx);
+      size = *reinterpret_cast<std::atomic<int64_t>*>(p);
+      if (size <= 0 || (uint64_t)size + sizeof(int64_t) > q->spsc_slot_size){
+        break;
+      }
+
+      msgs[n].data = p + sizeof(int64_t);
+      msgs[n].size = size;
+      n++;
+      idx++;
+    }
+    return n;
+  }
+
+  int id = q->reader_id;
+  uint32_t read_cycles, read_pointer;
+  UNPACK64(read_cycles, read_pointer, q->borrow_read_pointer);
+
+  // Only look at messages that were committed when we started
+  uint32_t write_pointer = *q->write_pointer & 0xFFFFFFFF;
+
+  size_t n = 1;
+  while (n < max_msgs && read_pointer != write_pointer){
+    std::atomic<int64_t> *size_p = reinterpret_cast<std::atomic<int64_t>*>(q->data + read_pointer);
+    size = *size_p;
+
+    // The writer caught up, stop here. Releasing the batch will report it
+    if (!*q->read_valids[id]){
+      break;
+    }
+
+    if (size == -1){
+      read_cycles++;
+      read_pointer = 0;
+      continue;
+    }
+
+    assert((uint64_t)size < q->size);
+    assert(size > 0);
+
+    msgs[n].data = q->data + read_pointer + sizeof(int64_t);
+    msgs[n].size = size;
+    n++;
+
+    read_pointer = ALIGN(read_pointer + sizeof(std::int64_t) + size);
+  }
+
+  // The read pointer stays at the first message, which the writer always reaches
+  // before any of the later ones. Releasing moves it past the whole batch at once
+  __sync_synchronize();
+  PACK64(q->borrow_read_pointer, read_cycles, read_pointer);
+  return n;
+}
+
+bool msgq_msg_release_many(msgq_msg_t * msgs, size_t nmsgs, msgq_queue_t * q){
+  assert(q->borrowed);
+  int id = q->reader_id;
+
+  // Check if the data was still valid when the consumer was done with it
+  __sync_synchronize();
+  bool valid = *q->read_valids[id] && (q->read_uid_local == *q->read_uids[id]);
+  if (valid && q->spsc){
+    uint64_t tail = q->borrow_read_pointer;
+    valid = std::atomic_compare_exchange_strong(q->spsc_tail, &tail, tail + nmsgs);
+  } else if (valid){
+    *q->read_pointers[id] = q->borrow_read_pointer;
+  }
+
+  for (size_t i = 0; i < nmsgs; i++){
+    msgs[i].size = 0;
+    msgs[i].data = NULL;
+  }
+  q->borrowed = false;
+
+  return valid;
+}
+
+bool msgq_msg_release(msgq_msg_t * msg, msgq_queue_t * q){
+  return msgq_msg_release_many(msg, 1, q);
+}
+
+
+
+static void msgq_set_waiting(msgq_pollitem_t * items, size_t nitems, uint64_t state){
   for (size_t i = 0; i < nitems; i++) {
-    items[i].revents = msgq_msg_ready(items[i].q);
+    msgq_queue_t *q = items[i].q;
+    int id = q->reader_id;
+
+    // Don't touch the slot if it was handed to another reader after an eviction
+    if (id >= 0 && *q->read_uids[id] == q->read_uid_local){
+      *q->read_waiting[id] = state;
+    }
+  }
+}
+
+static int msgq_poll_ready(msgq_pollitem_t * items, size_t nitems){
+  int num = 0;
+  for (size_t i = 0; i < nitems; i++) {
+    if (items[i].revents == 0 && msgq_msg_ready(items[i].q)){
+      items[i].revents = 1;
+    }
     if (items[i].revents) num++;
   }
+  return num;
+}
+
+static int msgq_poll_signal(msgq_pollitem_t * items, size_t nitems, int timeout){
+  int num = 0;
 
   int ms = (timeout == -1) ? 100 : timeout;
   struct timespec ts;
   ts.tv_sec = ms / 1000;
   ts.tv_nsec = (ms % 1000) * 1000 * 1000;
 
+  // Writer sends SIGUSR2 to interrupt the sleep
+  msgq_set_waiting(items, nitems, MSGQ_WAIT_SIGNAL);
 
   while (num == 0) {
-    int ret;
+    num = msgq_poll_ready(items, nitems);
+    if (num > 0){
+      break;
+    }
 
-    ret = nanosleep(&ts, &ts);
+    int ret = nanosleep(&ts, &ts);
 
-    // Check if messages ready
-    for (size_t i = 0; i < nitems; i++) {
-      if (items[i].revents == 0 && msgq_msg_ready(items[i].q)){
-        num += 1;
-        items[i].revents = 1;
-      }
-    }
+    num = msgq_poll_ready(items, nitems);
 
     // exit if we had a timeout and the sleep finished
     if (timeout != -1 && ret == 0){
@@ -450,13 +931,104 @@ int msgq_poll(msgq_pollitem_t * items, size_t nitems, int timeout){
     }
   }
 
+  msgq_set_waiting(items, nitems, MSGQ_WAIT_NONE);
   return num;
 }
 
+#ifdef __linux__
+static inline uint64_t msgq_nanos_since_boot(){
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static int msgq_poll_futex(msgq_pollitem_t * items, size_t nitems, int timeout){
+  int num = 0;
+  uint64_t deadline = msgq_nanos_since_boot() + (uint64_t)timeout * 1000000ULL;
+
+  struct msgq_futex_waitv waiters[MSGQ_FUTEX_WAITV_MAX];
+
+  while (num == 0) {
+    // Announce the wait before taking the sequence snapshot and checking for messages.
+    // A writer that publishes after the check is then guaranteed to see us and wake the futex,
+    // and a writer that publishes in between changes the sequence so the wait returns immediately.
+    msgq_set_waiting(items, nitems, MSGQ_WAIT_FUTEX);
+    for (size_t i = 0; i < nitems; i++) {
+      waiters[i].val = *items[i].q->write_seq;
+      waiters[i].uaddr = (uint64_t)items[i].q->write_seq;
+      waiters[i].flags = MSGQ_FUTEX_32;
+      waiters[i].reserved = 0;
+    }
+
+    num = msgq_poll_ready(items, nitems);
+    if (num > 0){
+      break;
+    }
+
+    // Wait in chunks of 100 ms when blocking forever, same as the signal based poll
+    uint64_t now = msgq_nanos_since_boot();
+    uint64_t wait_ns = 100 * 1000000ULL;
+    if (timeout != -1){
+      if (now >= deadline){
+        break;
+      }
+      wait_ns = deadline - now;
+    }
+
+    // Woken up, timed out or interrupted by a signal, the loop checks again. The remaining
+    // time comes from the deadline, so an interrupted wait doesn't end the poll early
+    if (nitems == 1){
+      struct timespec ts = {(time_t)(wait_ns / 1000000000ULL), (long)(wait_ns % 1000000000ULL)};
+      futex_wait(items[0].q->write_seq, waiters[0].val, &ts);
+    } else {
+      uint64_t end = now + wait_ns;
+      struct timespec ts = {(time_t)(end / 1000000000ULL), (long)(end % 1000000000ULL)};
+      int ret = futex_wait_multiple(waiters, nitems, &ts);
+      if (ret < 0 && errno == ENOSYS){
+        futex_waitv_supported = false;
+        msgq_set_waiting(items, nitems, MSGQ_WAIT_NONE);
+        return msgq_poll_signal(items, nitems, timeout);
+      }
+    }
+  }
+
+  msgq_set_waiting(items, nitems, MSGQ_WAIT_NONE);
+  return num;
+}
+#endif
+
+int msgq_poll(msgq_pollitem_t * items, size_t nitems, int timeout){
+  // Check if messages ready
+  for (size_t i = 0; i < nitems; i++) {
+    items[i].revents = 0;
+  }
+  int num = msgq_poll_ready(items, nitems);
+  if (num > 0 || timeout == 0){
+    return num;
+  }
+
+  #ifdef __linux__
+    bool use_futex = (nitems <= MSGQ_FUTEX_WAITV_MAX) && (nitems == 1 || futex_waitv_supported);
+    for (size_t i = 0; i < nitems; i++) {
+      use_futex = use_futex && items[i].q->use_futex;
+    }
+
+    if (use_futex){
+      return msgq_poll_futex(items, nitems, timeout);
+    }
+  #endif
+
+  return msgq_poll_signal(items, nitems, timeout);
+}
+
 bool msgq_all_readers_updated(msgq_queue_t *q) {
   uint64_t num_readers = *q->num_readers;
+  if (q->spsc){
+    return num_readers > 0 && *q->read_uids[0] != 0 && *q->spsc_tail == *q->spsc_head;
+  }
+
   for (uint64_t i = 0; i < num_readers; i++) {
-    if (*q->read_valids[i] && *q->write_pointer != *q->read_pointers[i]) {
+    if (*q->read_uids[i] != 0 && *q->read_valids[i] && *q->write_pointer != *q->read_pointers[i]) {
       return false;
     }
   }
@@ -5,37 +5,70 @@
 #include <atomic>
 
 #define DEFAULT_SEGMENT_SIZE (10 * 1024 * 1024)
-#define NUM_READERS 10
+// Size of the reader table in the queue header. All processes sharing /dev/shm must agree on it
+#ifndef NUM_READERS
+#define NUM_READERS 128
+#endif
 #define ALIGN(n) ((n + (8 - 1)) & -8)
+#define MSGQ_CACHELINE 64
 
 #define UNPACK64(higher, lower, input) do {uint64_t tmp = input; higher = tmp >> 32; lower = tmp & 0xFFFFFFFF;} while (0)
 #define PACK64(output, higher, lower) output = ((uint64_t)higher << 32 ) | ((uint64_t)lower & 0xFFFFFFFF)
 
+// Wait state of a reader, published in read_waiting so the writer only wakes parked readers
+#define MSGQ_WAIT_NONE 0
+#define MSGQ_WAIT_FUTEX 1
+#define MSGQ_WAIT_SIGNAL 2
+
 struct  msgq_header_t {
   uint64_t num_readers;
   uint64_t write_pointer;
   uint64_t write_uid;
+  uint32_t write_seq; // futex word, incremented after every message
+  uint32_t reserved;
   uint64_t read_pointers[NUM_READERS];
   uint64_t read_valids[NUM_READERS];
   uint64_t read_uids[NUM_READERS];
+  uint64_t read_waiting[NUM_READERS];
+};
+
+// Index of the next slot to write and of the oldest unread slot of a single producer, single consumer queue.
+// Kept on separate cache lines so the publisher and the subscriber don't keep stealing each others line
+struct msgq_spsc_header_t {
+  alignas(MSGQ_CACHELINE) uint64_t head;
+  alignas(MSGQ_CACHELINE) uint64_t tail;
 };
 
 struct msgq_queue_t {
   std::atomic<uint64_t> *num_readers;
   std::atomic<uint64_t> *write_pointer;
   std::atomic<uint64_t> *write_uid;
+  std::atomic<uint32_t> *write_seq;
   std::atomic<uint64_t> *read_pointers[NUM_READERS];
   std::atomic<uint64_t> *read_valids[NUM_READERS];
   std::atomic<uint64_t> *read_uids[NUM_READERS];
+  std::atomic<uint64_t> *read_waiting[NUM_READERS];
   char * mmap_p;
   char * data;
   size_t size;
   int reader_id;
   uint64_t read_uid_local;
   uint64_t write_uid_local;
+  size_t write_reserved;
 
   bool read_conflate;
+  bool use_futex;
+  bool borrowed;
+  uint64_t borrow_read_pointer;
   std::string endpoint;
+
+  // Single producer, single consumer mode, messages go into fixed size slots instead of the byte ring
+  bool spsc;
+  std::atomic<uint64_t> *spsc_head;
+  std::atomic<uint64_t> *spsc_tail;
+  char * spsc_slots;
+  size_t spsc_num_slots;
+  size_t spsc_slot_size;
 };
 
 struct msgq_msg_t {
@@ -56,12 +89,34 @@ int msgq_msg_init_data(msgq_msg_t *msg, char * data, size_t size);
 int msgq_msg_close(msgq_msg_t *msg);
 
 int msgq_new_queue(msgq_queue_t * q, const char * path, size_t size);
+// Queue with a single subscriber, split into num_slots slots of equal size.
+// There is no reader table to walk on send, a second subscriber is refused while the first one is alive.
+// When all slots are full the oldest message is dropped
+int msgq_new_spsc_queue(msgq_queue_t * q, const char * path, size_t size, size_t num_slots);
+int msgq_advise_hugepages(msgq_queue_t * q);
 void msgq_close_queue(msgq_queue_t *q);
 void msgq_init_publisher(msgq_queue_t * q);
-void msgq_init_subscriber(msgq_queue_t * q);
+int msgq_init_subscriber(msgq_queue_t * q);
 
 int msgq_msg_send(msgq_msg_t *msg, msgq_queue_t *q);
+
+// Zero copy send. Reserve returns where the data of a message of up to size bytes
+// should be written, or NULL if this is no longer the active publisher.
+// The message becomes visible to readers once it is committed with its actual size.
+char * msgq_reserve(msgq_queue_t *q, size_t size);
+int msgq_commit(msgq_queue_t *q, size_t size);
 int msgq_msg_recv(msgq_msg_t *msg, msgq_queue_t *q);
+
+// Zero copy receive. The message points directly into the queue and must be handed back
+// with msgq_msg_release instead of msgq_msg_close. Release returns false if the writer
+// overwrote the message while it was borrowed, anything derived from it must be discarded.
+int msgq_msg_borrow(msgq_msg_t *msg, msgq_queue_t *q);
+bool msgq_msg_release(msgq_msg_t *msg, msgq_queue_t *q);
+
+// Borrow up to max_msgs consecutive messages in one pass, and release them all at once.
+// Returns the number of messages borrowed, a conflating reader only gets the latest message.
+int msgq_msg_borrow_many(msgq_msg_t *msgs, size_t max_msgs, msgq_queue_t *q);
+bool msgq_msg_release_many(msgq_msg_t *msgs, size_t nmsgs, msgq_queue_t *q);
 int msgq_msg_ready(msgq_queue_t * q);
 int msgq_poll(msgq_pollitem_t * items, size_t nitems, int timeout);
 
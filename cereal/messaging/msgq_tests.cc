@@ -1,6 +1,23 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
 #include "catch2/catch.hpp"
 #include "msgq.h"
 
+static uint64_t nanos_now(){
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 TEST_CASE("ALIGN"){
   REQUIRE(ALIGN(0) == 0);
   REQUIRE(ALIGN(1) == 8);
@@ -220,6 +237,63 @@ TEST_CASE("msgq_init_subscriber init 2 subscribers"){
 }
 
 
+TEST_CASE("msgq_init_subscriber reclaims dead reader slots"){
+  remove("/dev/shm/test_queue");
+  msgq_queue_t q;
+  msgq_new_queue(&q, "test_queue", 1024);
+
+  // Above pid_max, so kill() reports these threads don't exist
+  const uint64_t dead_uid = ((uint64_t)1 << 32) | 0x7FFFFFF0;
+  const uint64_t live_uid = ((uint64_t)1 << 32) | syscall(SYS_gettid);
+
+  for (size_t i = 0; i < NUM_READERS; i++){
+    *q.read_uids[i] = live_uid;
+  }
+  *q.num_readers = NUM_READERS;
+
+  SECTION("Table full of live readers"){
+    REQUIRE(msgq_init_subscriber(&q) == -1);
+    REQUIRE(errno == ENOSPC);
+  }
+  SECTION("One dead reader"){
+    *q.read_uids[5] = dead_uid;
+    REQUIRE(msgq_init_subscriber(&q) == 0);
+    REQUIRE(q.reader_id == 5);
+    REQUIRE(*q.read_uids[5] == q.read_uid_local);
+    REQUIRE(*q.read_valids[5] == true);
+  }
+
+  // Live readers are never evicted
+  REQUIRE(*q.num_readers == NUM_READERS);
+  for (size_t i = 0; i < NUM_READERS; i++){
+    if (i != 5){
+      REQUIRE(*q.read_uids[i] == live_uid);
+    }
+  }
+}
+
+TEST_CASE("msgq_close_queue releases reader slot"){
+  remove("/dev/shm/test_queue");
+  msgq_queue_t q1, q2, q3;
+  msgq_new_queue(&q1, "test_queue", 1024);
+  msgq_new_queue(&q2, "test_queue", 1024);
+  msgq_new_queue(&q3, "test_queue", 1024);
+
+  msgq_init_subscriber(&q1);
+  msgq_init_subscriber(&q2);
+  REQUIRE(q1.reader_id == 0);
+  REQUIRE(q2.reader_id == 1);
+
+  msgq_close_queue(&q1);
+  REQUIRE(*q3.read_uids[0] == 0);
+  REQUIRE(*q3.read_valids[0] == false);
+
+  msgq_init_subscriber(&q3);
+  REQUIRE(q3.reader_id == 0);
+  REQUIRE(*q3.num_readers == 2);
+}
+
+
 TEST_CASE("Write 1 msg, read 1 msg", "[integration]"){
   remove("/dev/shm/test_queue");
   const size_t msg_size = 128;
@@ -393,3 +467,747 @@ TEST_CASE("1 publisher, 2 subscribers", "[integration]"){
     msgq_msg_close(&msg2);
   }
 }
+
+TEST_CASE("msgq_poll wakes up on new message"){
+  remove("/dev/shm/test_queue");
+  msgq_queue_t writer, reader;
+
+  msgq_new_queue(&writer, "test_queue", 1024);
+  msgq_new_queue(&reader, "test_queue", 1024);
+
+  msgq_init_publisher(&writer);
+  msgq_init_subscriber(&reader);
+
+  SECTION("futex"){
+    reader.use_futex = true;
+  }
+  SECTION("signal"){
+    reader.use_futex = false;
+  }
+
+  std::thread t([&writer](){
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    msgq_msg_t msg;
+    msgq_msg_init_size(&msg, 8);
+    msgq_msg_send(&msg, &writer);
+    msgq_msg_close(&msg);
+  });
+
+  msgq_pollitem_t items[1];
+  items[0].q = &reader;
+
+  uint64_t start = nanos_now();
+  REQUIRE(msgq_poll(items, 1, 1000) == 1);
+  REQUIRE(items[0].revents == 1);
+  REQUIRE((nanos_now() - start) < 500 * 1000000ULL);
+  t.join();
+
+  // Reader is no longer parked after the poll returns
+  REQUIRE(*reader.read_waiting[reader.reader_id] == MSGQ_WAIT_NONE);
+}
+
+static void ignore_signal(int){}
+
+TEST_CASE("msgq_poll keeps waiting when interrupted by a signal"){
+  remove("/dev/shm/test_queue");
+  msgq_queue_t writer, reader;
+
+  msgq_new_queue(&writer, "test_queue", 1024);
+  msgq_new_queue(&reader, "test_queue", 1024);
+
+  msgq_init_publisher(&writer);
+  msgq_init_subscriber(&reader);
+
+  SECTION("futex"){
+    reader.use_futex = true;
+  }
+  SECTION("signal"){
+    reader.use_futex = false;
+  }
+
+  // No SA_RESTART, so the wait returns EINTR
+  struct sigaction sa = {}, old_sa;
+  sa.sa_handler = ignore_signal;
+  sigaction(SIGUSR1, &sa, &old_sa);
+
+  pthread_t poll_thread = pthread_self();
+  std::thread t([poll_thread](){
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    pthread_kill(poll_thread, SIGUSR1);
+  });
+
+  msgq_pollitem_t items[1];
+  items[0].q = &reader;
+
+  uint64_t start = nanos_now();
+  int num = msgq_poll(items, 1, 100);
+  uint64_t elapsed = nanos_now() - start;
+  t.join();
+  sigaction(SIGUSR1, &old_sa, nullptr);
+
+  REQUIRE(num == 0);
+  REQUIRE(elapsed >= 100 * 1000000ULL);
+}
+
+TEST_CASE("msgq_poll multiple queues"){
+  remove("/dev/shm/test_queue");
+  remove("/dev/shm/test_queue2");
+  msgq_queue_t writer1, writer2, reader1, reader2;
+
+  msgq_new_queue(&writer1, "test_queue", 1024);
+  msgq_new_queue(&writer2, "test_queue2", 1024);
+  msgq_new_queue(&reader1, "test_queue", 1024);
+  msgq_new_queue(&reader2, "test_queue2", 1024);
+
+  msgq_init_publisher(&writer1);
+  msgq_init_publisher(&writer2);
+  msgq_init_subscriber(&reader1);
+  msgq_init_subscriber(&reader2);
+
+  msgq_pollitem_t items[2];
+  items[0].q = &reader1;
+  items[1].q = &reader2;
+
+  SECTION("timeout"){
+    uint64_t start = nanos_now();
+    REQUIRE(msgq_poll(items, 2, 20) == 0);
+    REQUIRE((nanos_now() - start) >= 20 * 1000000ULL);
+  }
+  SECTION("message on second queue"){
+    std::thread t([&writer2](){
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      msgq_msg_t msg;
+      msgq_msg_init_size(&msg, 8);
+      msgq_msg_send(&msg, &writer2);
+      msgq_msg_close(&msg);
+    });
+
+    REQUIRE(msgq_poll(items, 2, 1000) == 1);
+    REQUIRE(items[0].revents == 0);
+    REQUIRE(items[1].revents == 1);
+    t.join();
+  }
+}
+
+static void benchmark_poll_latency(bool use_futex, int n){
+  remove("/dev/shm/test_queue");
+  msgq_queue_t writer, reader;
+
+  msgq_new_queue(&writer, "test_queue", 1024 * 1024);
+  msgq_new_queue(&reader, "test_queue", 1024 * 1024);
+
+  msgq_init_publisher(&writer);
+  msgq_init_subscriber(&reader);
+  reader.use_futex = use_futex;
+
+  std::vector<uint64_t> latencies;
+  latencies.reserve(n);
+
+  std::thread t([&writer, n](){
+    for (int i = 0; i < n; i++){
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+      uint64_t ts = nanos_now();
+      msgq_msg_t msg;
+      msgq_msg_init_data(&msg, (char*)&ts, sizeof(ts));
+      msgq_msg_send(&msg, &writer);
+      msgq_msg_close(&msg);
+    }
+  });
+
+  uint64_t start = nanos_now();
+  msgq_pollitem_t items[1];
+  items[0].q = &reader;
+  while ((int)latencies.size() < n){
+    if (msgq_poll(items, 1, 1000) == 0) break;
+
+    msgq_msg_t msg;
+    while (msgq_msg_recv(&msg, &reader) > 0){
+      latencies.push_back(nanos_now() - *(uint64_t*)msg.data);
+      msgq_msg_close(&msg);
+    }
+  }
+  double elapsed = (nanos_now() - start) * 1e-9;
+  t.join();
+
+  REQUIRE(latencies.size() == (size_t)n);
+  std::sort(latencies.begin(), latencies.end());
+  std::cout << (use_futex ? "futex " : "signal") << " wakeup latency"
+            << " p50: " << latencies[n / 2] / 1000.0 << " us"
+            << " p99: " << latencies[n * 99 / 100] / 1000.0 << " us"
+            << " throughput: " << n / elapsed << " msg/s" << std::endl;
+}
+
+TEST_CASE("Benchmark msgq_poll wakeup latency", "[.][benchmark]"){
+  benchmark_poll_latency(false, 5000);
+  benchmark_poll_latency(true, 5000);
+}
+
+TEST_CASE("msgq_msg_borrow", "[integration]"){
+  remove("/dev/shm/test_queue");
+  const size_t msg_size = 128;
+  msgq_queue_t writer, reader;
+
+  msgq_new_queue(&writer, "test_queue", 1024);
+  msgq_new_queue(&reader, "test_queue", 1024);
+
+  msgq_init_publisher(&writer);
+  msgq_init_subscriber(&reader);
+
+  msgq_msg_t outgoing_msg;
+  msgq_msg_init_size(&outgoing_msg, msg_size);
+  for (size_t i = 0; i < msg_size; i++){
+    outgoing_msg.data[i] = i;
+  }
+  REQUIRE(msgq_msg_send(&outgoing_msg, &writer) == msg_size);
+
+  msgq_msg_t incoming_msg;
+  REQUIRE(msgq_msg_borrow(&incoming_msg, &reader) == msg_size);
+
+  // Message points into the ring, and is word aligned
+  REQUIRE(incoming_msg.data >= reader.data);
+  REQUIRE(incoming_msg.data < reader.data + reader.size);
+  REQUIRE((uintptr_t)incoming_msg.data % 8 == 0);
+  REQUIRE(memcmp(incoming_msg.data, outgoing_msg.data, msg_size) == 0);
+
+  SECTION("release"){
+    REQUIRE(msgq_msg_release(&incoming_msg, &reader));
+
+    // Verify that there are no more messages
+    msgq_msg_t incoming_msg2;
+    REQUIRE(msgq_msg_borrow(&incoming_msg2, &reader) == 0);
+  }
+  SECTION("overwritten while borrowed"){
+    for (int i = 0; i < 8; i++){
+      msgq_msg_send(&outgoing_msg, &writer);
+    }
+    REQUIRE(msgq_msg_release(&incoming_msg, &reader) == false);
+
+    // Reader is reset to the write pointer
+    msgq_msg_t incoming_msg2;
+    REQUIRE(msgq_msg_recv(&incoming_msg2, &reader) == 0);
+  }
+
+  msgq_msg_close(&outgoing_msg);
+}
+
+TEST_CASE("msgq_msg_borrow - conflate = true", "[integration]"){
+  remove("/dev/shm/test_queue");
+  msgq_queue_t writer, reader;
+
+  msgq_new_queue(&writer, "test_queue", 1024);
+  msgq_new_queue(&reader, "test_queue", 1024);
+
+  msgq_init_publisher(&writer);
+  msgq_init_subscriber(&reader);
+  reader.read_conflate = true;
+
+  for (uint64_t i = 0; i < 3; i++){
+    msgq_msg_t outgoing_msg;
+    msgq_msg_init_data(&outgoing_msg, (char*)&i, sizeof(uint64_t));
+    msgq_msg_send(&outgoing_msg, &writer);
+    msgq_msg_close(&outgoing_msg);
+  }
+
+  msgq_msg_t incoming_msg;
+  REQUIRE(msgq_msg_borrow(&incoming_msg, &reader) == sizeof(uint64_t));
+  REQUIRE(*(uint64_t*)incoming_msg.data == 2);
+  REQUIRE(msgq_msg_release(&incoming_msg, &reader));
+  REQUIRE(msgq_msg_borrow(&incoming_msg, &reader) == 0);
+}
+
+TEST_CASE("msgq_poll while a message is borrowed", "[integration]"){
+  remove("/dev/shm/test_queue");
+  msgq_queue_t writer, reader;
+
+  msgq_new_queue(&writer, "test_queue", 1024);
+  msgq_new_queue(&reader, "test_queue", 1024);
+
+  msgq_init_publisher(&writer);
+  msgq_init_subscriber(&reader);
+
+  msgq_msg_t outgoing_msg;
+  msgq_msg_init_size(&outgoing_msg, 128);
+  memset(outgoing_msg.data, 1, 128);
+  msgq_msg_send(&outgoing_msg, &writer);
+
+  msgq_msg_t incoming_msg;
+  REQUIRE(msgq_msg_borrow(&incoming_msg, &reader) == 128);
+
+  // The borrowed message itself is not new
+  msgq_pollitem_t items[1];
+  items[0].q = &reader;
+  REQUIRE(msgq_poll(items, 1, 0) == 0);
+
+  SECTION("new message"){
+    msgq_msg_send(&outgoing_msg, &writer);
+    REQUIRE(msgq_poll(items, 1, 0) == 1);
+    REQUIRE(msgq_msg_release(&incoming_msg, &reader));
+    REQUIRE(msgq_msg_borrow(&incoming_msg, &reader) == 128);
+    REQUIRE(msgq_msg_release(&incoming_msg, &reader));
+  }
+  SECTION("overwritten while borrowed"){
+    for (int i = 0; i < 8; i++){
+      msgq_msg_send(&outgoing_msg, &writer);
+    }
+    REQUIRE(msgq_poll(items, 1, 0) == 1);
+
+    // Polling didn't reset the reader and hide the overwrite
+    REQUIRE(msgq_msg_release(&incoming_msg, &reader) == false);
+  }
+
+  msgq_msg_close(&outgoing_msg);
+}
+
+TEST_CASE("Benchmark msgq_msg_recv vs msgq_msg_borrow", "[.][benchmark]"){
+  remove("/dev/shm/test_queue");
+  const size_t msg_size = 1536 * 1024;
+  const int n = 1000;
+  msgq_queue_t writer, reader;
+
+  msgq_new_queue(&writer, "test_queue", DEFAULT_SEGMENT_SIZE);
+  msgq_new_queue(&reader, "test_queue", DEFAULT_SEGMENT_SIZE);
+
+  msgq_init_publisher(&writer);
+  msgq_init_subscriber(&reader);
+
+  msgq_msg_t outgoing_msg;
+  msgq_msg_init_size(&outgoing_msg, msg_size);
+  memset(outgoing_msg.data, 1, msg_size);
+
+  uint64_t copy_ns = 0, borrow_ns = 0, sum = 0;
+  for (int i = 0; i < n; i++){
+    msgq_msg_send(&outgoing_msg, &writer);
+    uint64_t start = nanos_now();
+    msgq_msg_t msg;
+    REQUIRE(msgq_msg_recv(&msg, &reader) == msg_size);
+    sum += msg.data[msg_size - 1];
+    msgq_msg_close(&msg);
+    copy_ns += nanos_now() - start;
+
+    msgq_msg_send(&outgoing_msg, &writer);
+    start = nanos_now();
+    REQUIRE(msgq_msg_borrow(&msg, &reader) == msg_size);
+    sum += msg.data[msg_size - 1];
+    REQUIRE(msgq_msg_release(&msg, &reader));
+    borrow_ns += nanos_now() - start;
+  }
+  REQUIRE(sum == 2 * n);
+
+  std::cout << "receive " << msg_size << " bytes"
+            << " copy: " << copy_ns / n / 1000.0 << " us"
+            << " borrow: " << borrow_ns / n / 1000.0 << " us" << std::endl;
+
+  msgq_msg_close(&outgoing_msg);
+}
+
+TEST_CASE("msgq_reserve and msgq_commit", "[integration]"){
+  remove("/dev/shm/test_queue");
+  msgq_queue_t writer, reader;
+
+  msgq_new_queue(&writer, "test_queue", 1024);
+  msgq_new_queue(&reader, "test_queue", 1024);
+
+  msgq_init_publisher(&writer);
+  msgq_init_subscriber(&reader);
+
+  for (uint64_t i = 0; i < 32; i++){
+    // Reserve more than what is finally written
+    char *p = msgq_reserve(&writer, 128);
+    REQUIRE(p != NULL);
+    REQUIRE((uintptr_t)p % 8 == 0);
+    memcpy(p, &i, sizeof(uint64_t));
+    REQUIRE(msgq_commit(&writer, sizeof(uint64_t)) == sizeof(uint64_t));
+
+    msgq_msg_t msg;
+    REQUIRE(msgq_msg_recv(&msg, &reader) == sizeof(uint64_t));
+    REQUIRE(*(uint64_t*)msg.data == i);
+    msgq_msg_close(&msg);
+  }
+
+  // Message is not visible before it is committed
+  REQUIRE(msgq_reserve(&writer, 8) != NULL);
+  REQUIRE(msgq_msg_ready(&reader) == 0);
+  msgq_commit(&writer, 8);
+  REQUIRE(msgq_msg_ready(&reader) == 1);
+}
+
+TEST_CASE("msgq_reserve after publisher was replaced"){
+  remove("/dev/shm/test_queue");
+  msgq_queue_t writer1, writer2;
+
+  msgq_new_queue(&writer1, "test_queue", 1024);
+  msgq_new_queue(&writer2, "test_queue", 1024);
+
+  msgq_init_publisher(&writer1);
+  msgq_init_publisher(&writer2);
+
+  REQUIRE(msgq_reserve(&writer1, 8) == NULL);
+  REQUIRE(errno == EADDRINUSE);
+  REQUIRE(msgq_reserve(&writer2, 8) != NULL);
+}
+
+TEST_CASE("1 publisher, 64 concurrent subscribers", "[integration]"){
+  remove("/dev/shm/test_queue");
+  const int num_subscribers = 64;
+  const uint64_t num_msgs = 1000;
+  msgq_queue_t writer;
+
+  msgq_new_queue(&writer, "test_queue", 1024 * 1024);
+  msgq_init_publisher(&writer);
+
+  std::atomic<int> subscribed(0);
+  std::vector<int> reader_ids(num_subscribers, -1);
+  std::vector<uint64_t> received(num_subscribers, 0);
+  std::vector<char> in_order(num_subscribers, true);  // not vector<bool>: threads write neighbouring elements
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_subscribers; t++){
+    threads.emplace_back([&, t](){
+      msgq_queue_t reader;
+      msgq_new_queue(&reader, "test_queue", 1024 * 1024);
+      if (msgq_init_subscriber(&reader) != 0){
+        subscribed++;
+        return;
+      }
+      reader_ids[t] = reader.reader_id;
+      subscribed++;
+
+      msgq_pollitem_t items[1];
+      items[0].q = &reader;
+      uint64_t expected = 0;
+      while (expected < num_msgs && msgq_poll(items, 1, 1000) > 0){
+        msgq_msg_t msg;
+        while (msgq_msg_recv(&msg, &reader) > 0){
+          in_order[t] = in_order[t] && (*(uint64_t*)msg.data == expected);
+          expected++;
+          msgq_msg_close(&msg);
+        }
+      }
+      received[t] = expected;
+      msgq_close_queue(&reader);
+    });
+  }
+
+  while (subscribed < num_subscribers){
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  REQUIRE(*writer.num_readers == num_subscribers);
+
+  for (uint64_t i = 0; i < num_msgs; i++){
+    msgq_msg_t msg;
+    msgq_msg_init_data(&msg, (char*)&i, sizeof(uint64_t));
+    msgq_msg_send(&msg, &writer);
+    msgq_msg_close(&msg);
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+
+  for (auto &t : threads){
+    t.join();
+  }
+
+  // Every subscriber got its own slot, and nobody was evicted
+  std::vector<int> ids = reader_ids;
+  std::sort(ids.begin(), ids.end());
+  REQUIRE(ids.front() == 0);
+  REQUIRE(std::unique(ids.begin(), ids.end()) == ids.end());
+  for (int t = 0; t < num_subscribers; t++){
+    REQUIRE(received[t] == num_msgs);
+    REQUIRE(in_order[t]);
+  }
+}
+
+TEST_CASE("msgq_msg_borrow_many", "[integration]"){
+  remove("/dev/shm/test_queue");
+  msgq_queue_t writer, reader;
+
+  msgq_new_queue(&writer, "test_queue", 1024);
+  msgq_new_queue(&reader, "test_queue", 1024);
+
+  msgq_init_publisher(&writer);
+  msgq_init_subscriber(&reader);
+
+  // Move close to the end of the buffer, so the batch wraps around
+  for (int i = 0; i < 50; i++){
+    msgq_msg_t outgoing_msg;
+    msgq_msg_init_size(&outgoing_msg, 8);
+    msgq_msg_send(&outgoing_msg, &writer);
+    msgq_msg_close(&outgoing_msg);
+  }
+  msgq_msg_t msg;
+  while (msgq_msg_recv(&msg, &reader) > 0){
+    msgq_msg_close(&msg);
+  }
+
+  for (uint64_t i = 0; i < 20; i++){
+    msgq_msg_t outgoing_msg;
+    msgq_msg_init_data(&outgoing_msg, (char*)&i, sizeof(uint64_t));
+    msgq_msg_send(&outgoing_msg, &writer);
+    msgq_msg_close(&outgoing_msg);
+  }
+  uint64_t write_cycles = *writer.write_pointer >> 32;
+  REQUIRE(write_cycles == 1);
+
+  msgq_msg_t msgs[32];
+  SECTION("all messages"){
+    REQUIRE(msgq_msg_borrow_many(msgs, 32, &reader) == 20);
+    for (uint64_t i = 0; i < 20; i++){
+      REQUIRE(msgs[i].size == sizeof(uint64_t));
+      REQUIRE(*(uint64_t*)msgs[i].data == i);
+    }
+    REQUIRE(msgq_msg_release_many(msgs, 20, &reader));
+    REQUIRE(*reader.read_pointers[0] == *writer.write_pointer);
+    REQUIRE((*reader.read_pointers[0] >> 32) == write_cycles);
+    REQUIRE(msgq_msg_borrow_many(msgs, 32, &reader) == 0);
+  }
+  SECTION("limited batch"){
+    REQUIRE(msgq_msg_borrow_many(msgs, 5, &reader) == 5);
+    REQUIRE(msgq_msg_release_many(msgs, 5, &reader));
+    REQUIRE(msgq_msg_borrow_many(msgs, 32, &reader) == 15);
+    REQUIRE(*(uint64_t*)msgs[0].data == 5);
+    REQUIRE(msgq_msg_release_many(msgs, 15, &reader));
+  }
+  SECTION("overwritten while borrowed"){
+    REQUIRE(msgq_msg_borrow_many(msgs, 32, &reader) == 20);
+    for (int i = 0; i < 60; i++){
+      msgq_msg_t outgoing_msg;
+      msgq_msg_init_size(&outgoing_msg, 8);
+      msgq_msg_send(&outgoing_msg, &writer);
+      msgq_msg_close(&outgoing_msg);
+    }
+    REQUIRE(msgq_msg_release_many(msgs, 20, &reader) == false);
+  }
+}
+
+TEST_CASE("Benchmark msgq_msg_recv vs msgq_msg_borrow_many", "[.][benchmark]"){
+  remove("/dev/shm/test_queue");
+  const size_t msg_size = 1024;
+  const int batch = 100;
+  const int rounds = 10000;
+  msgq_queue_t writer, reader;
+
+  msgq_new_queue(&writer, "test_queue", DEFAULT_SEGMENT_SIZE);
+  msgq_new_queue(&reader, "test_queue", DEFAULT_SEGMENT_SIZE);
+
+  msgq_init_publisher(&writer);
+  msgq_init_subscriber(&reader);
+
+  msgq_msg_t outgoing_msg;
+  msgq_msg_init_size(&outgoing_msg, msg_size);
+  memset(outgoing_msg.data, 1, msg_size);
+
+  uint64_t single_ns = 0, batch_ns = 0, sum = 0;
+  std::vector<msgq_msg_t> msgs(batch);
+  for (int r = 0; r < rounds; r++){
+    for (int i = 0; i < batch; i++){
+      msgq_msg_send(&outgoing_msg, &writer);
+    }
+    uint64_t start = nanos_now();
+    msgq_msg_t msg;
+    while (msgq_msg_recv(&msg, &reader) > 0){
+      sum += msg.data[0];
+      msgq_msg_close(&msg);
+    }
+    single_ns += nanos_now() - start;
+
+    for (int i = 0; i < batch; i++){
+      msgq_msg_send(&outgoing_msg, &writer);
+    }
+    start = nanos_now();
+    int n = msgq_msg_borrow_many(msgs.data(), batch, &reader);
+    for (int i = 0; i < n; i++){
+      sum += msgs[i].data[0];
+    }
+    REQUIRE(msgq_msg_release_many(msgs.data(), n, &reader));
+    batch_ns += nanos_now() - start;
+  }
+  REQUIRE(sum == 2ULL * batch * rounds);
+
+  double total_msgs = (double)batch * rounds;
+  std::cout << "drain " << batch << " x " << msg_size << " bytes"
+            << " recv: " << total_msgs / (single_ns * 1e-9) << " msg/s"
+            << " borrow_many: " << total_msgs / (batch_ns * 1e-9) << " msg/s" << std::endl;
+
+  msgq_msg_close(&outgoing_msg);
+}
+
+TEST_CASE("msgq spsc queue", "[integration]"){
+  remove("/dev/shm/test_queue");
+  const size_t num_slots = 4;
+  msgq_queue_t writer, reader;
+
+  msgq_new_spsc_queue(&writer, "test_queue", 4096, num_slots);
+  msgq_new_spsc_queue(&reader, "test_queue", 4096, num_slots);
+  REQUIRE(writer.spsc_slot_size == 1024);
+
+  msgq_init_publisher(&writer);
+  REQUIRE(msgq_init_subscriber(&reader) == 0);
+
+  auto send = [&writer](uint64_t val){
+    msgq_msg_t msg;
+    msgq_msg_init_data(&msg, (char*)&val, sizeof(val));
+    REQUIRE(msgq_msg_send(&msg, &writer) == sizeof(val));
+    msgq_msg_close(&msg);
+  };
+
+  SECTION("messages arrive in order"){
+    REQUIRE(msgq_msg_ready(&reader) == 0);
+    for (uint64_t i = 0; i < 3; i++) send(i);
+    REQUIRE(msgq_msg_ready(&reader) == 1);
+
+    for (uint64_t i = 0; i < 3; i++){
+      msgq_msg_t msg;
+      REQUIRE(msgq_msg_recv(&msg, &reader) == sizeof(uint64_t));
+      REQUIRE(*(uint64_t*)msg.data == i);
+      msgq_msg_close(&msg);
+    }
+    REQUIRE(msgq_msg_ready(&reader) == 0);
+    REQUIRE(msgq_all_readers_updated(&writer));
+  }
+  SECTION("full queue drops the oldest message"){
+    for (uint64_t i = 0; i < 10; i++) send(i);
+
+    std::vector<uint64_t> received;
+    msgq_msg_t msg;
+    while (msgq_msg_recv(&msg, &reader) > 0){
+      received.push_back(*(uint64_t*)msg.data);
+      msgq_msg_close(&msg);
+    }
+    REQUIRE(received == std::vector<uint64_t>{6, 7, 8, 9});
+  }
+  SECTION("conflate"){
+    reader.read_conflate = true;
+    for (uint64_t i = 0; i < 3; i++) send(i);
+
+    msgq_msg_t msg;
+    REQUIRE(msgq_msg_recv(&msg, &reader) == sizeof(uint64_t));
+    REQUIRE(*(uint64_t*)msg.data == 2);
+    msgq_msg_close(&msg);
+    REQUIRE(msgq_msg_ready(&reader) == 0);
+  }
+  SECTION("message larger than a slot"){
+    msgq_msg_t msg;
+    msgq_msg_init_size(&msg, 2048);
+    REQUIRE(msgq_msg_send(&msg, &writer) == -1);
+    REQUIRE(errno == EMSGSIZE);
+    msgq_msg_close(&msg);
+  }
+  SECTION("second subscriber is refused"){
+    msgq_queue_t reader2;
+    msgq_new_spsc_queue(&reader2, "test_queue", 4096, num_slots);
+    REQUIRE(msgq_init_subscriber(&reader2) == -1);
+    REQUIRE(errno == ENOSPC);
+
+    // Until the first one goes away
+    msgq_close_queue(&reader);
+    REQUIRE(msgq_init_subscriber(&reader2) == 0);
+    msgq_close_queue(&reader2);
+    return;
+  }
+  SECTION("borrow"){
+    for (uint64_t i = 0; i < 3; i++) send(i);
+
+    msgq_msg_t msgs[4];
+    REQUIRE(msgq_msg_borrow_many(msgs, 4, &reader) == 3);
+    REQUIRE(*(uint64_t*)msgs[2].data == 2);
+    REQUIRE(msgq_msg_release_many(msgs, 3, &reader));
+    REQUIRE(msgq_msg_ready(&reader) == 0);
+
+    // Publisher drops the borrowed message to make room
+    send(3);
+    REQUIRE(msgq_msg_borrow(&msgs[0], &reader) == sizeof(uint64_t));
+    for (uint64_t i = 4; i < 8; i++) send(i);
+    REQUIRE_FALSE(msgq_msg_release(&msgs[0], &reader));
+
+    msgq_msg_t msg;
+    REQUIRE(msgq_msg_recv(&msg, &reader) == sizeof(uint64_t));
+    REQUIRE(*(uint64_t*)msg.data == 4);
+    msgq_msg_close(&msg);
+  }
+  SECTION("poll"){
+    std::thread t([&](){
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      send(42);
+    });
+
+    msgq_pollitem_t items[1];
+    items[0].q = &reader;
+    REQUIRE(msgq_poll(items, 1, 1000) == 1);
+    t.join();
+  }
+
+  msgq_close_queue(&reader);
+  msgq_close_queue(&writer);
+}
+
+// Round trip through a publisher thread at a fixed rate, like controlsd sending to boardd
+static void benchmark_transport_latency(bool spsc, size_t msg_size, int n){
+  remove("/dev/shm/test_queue");
+  msgq_queue_t writer, reader;
+
+  // Same amount of buffering for both
+  size_t size = 32 * ALIGN(msg_size + MSGQ_CACHELINE);
+  if (spsc){
+    msgq_new_spsc_queue(&writer, "test_queue", size, 32);
+    msgq_new_spsc_queue(&reader, "test_queue", size, 32);
+  } else {
+    msgq_new_queue(&writer, "test_queue", size);
+    msgq_new_queue(&reader, "test_queue", size);
+  }
+
+  msgq_init_publisher(&writer);
+  msgq_init_subscriber(&reader);
+
+  // A publisher always has other subscribers on the same queue, they just add work on every send
+  std::vector<msgq_queue_t> others(spsc ? 0 : 8);
+  for (auto &q : others){
+    msgq_new_queue(&q, "test_queue", size);
+    msgq_init_subscriber(&q);
+  }
+
+  std::vector<uint64_t> latencies;
+  latencies.reserve(n);
+
+  std::thread t([&writer, msg_size, n](){
+    for (int i = 0; i < n; i++){
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+      char *p = msgq_reserve(&writer, msg_size);
+      *(uint64_t*)p = nanos_now();
+      msgq_commit(&writer, msg_size);
+    }
+  });
+
+  msgq_pollitem_t items[1];
+  items[0].q = &reader;
+  while ((int)latencies.size() < n){
+    if (msgq_poll(items, 1, 100) == 0) break;
+
+    msgq_msg_t msg;
+    while (msgq_msg_recv(&msg, &reader) > 0){
+      latencies.push_back(nanos_now() - *(uint64_t*)msg.data);
+      msgq_msg_close(&msg);
+    }
+  }
+  t.join();
+
+  // Messages the reader lost to invalidation show up as drops
+  size_t received = latencies.size();
+  REQUIRE(received > 0);
+  std::sort(latencies.begin(), latencies.end());
+  std::cout << (spsc ? "spsc" : "msgq") << " " << msg_size << " bytes"
+            << " p50: " << latencies[received / 2] / 1000.0 << " us"
+            << " p99: " << latencies[received * 99 / 100] / 1000.0 << " us"
+            << " dropped: " << n - received << std::endl;
+
+  for (auto &q : others){
+    msgq_close_queue(&q);
+  }
+  msgq_close_queue(&reader);
+  msgq_close_queue(&writer);
+}
+
+TEST_CASE("Benchmark spsc vs msgq latency", "[.][benchmark]"){
+  for (size_t msg_size : {256, 64 * 1024, 1024 * 1024}){
+    benchmark_transport_latency(false, msg_size, 5000);
+    benchmark_transport_latency(true, msg_size, 5000);
+  }
+}
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <time.h>
 #include <assert.h>
 #include <stdlib.h>
@@ -52,13 +53,46 @@ struct SubMaster::SubMessage {
   uint64_t rcv_time = 0, rcv_frame = 0;
   void *allocated_msg_reader = nullptr;
   bool is_polled = false;
+  bool borrow = false, overwritten = false;
+  Message *borrowed_msg = nullptr;
   capnp::FlatArrayMessageReader *msg_reader = nullptr;
   AlignedBuffer aligned_buf;
   cereal::Event::Reader event;
+
+  void set_reader(kj::ArrayPtr<const capnp::word> words) {
+    msg_reader->~FlatArrayMessageReader();
+    capnp::ReaderOptions options;
+    options.traversalLimitInWords = kj::maxValue; // Don't limit
+    msg_reader = new (allocated_msg_reader) capnp::FlatArrayMessageReader(words, options);
+  }
+
+  void clear() {
+    set_reader({});
+    event = cereal::Event::Reader();
+    valid = false;
+  }
+
+  // Hand the borrowed message back to the socket. With keep, the event stays readable from a copy
+  void release_borrowed(bool keep) {
+    if (borrowed_msg == nullptr) return;
+
+    kj::ArrayPtr<const capnp::word> words;
+    if (keep) words = aligned_buf.align(borrowed_msg);
+    overwritten = !socket->releaseBorrowed(borrowed_msg);
+    borrowed_msg = nullptr;
+
+    if (keep && overwritten) {
+      clear();
+    } else if (keep) {
+      set_reader(words);
+      event = msg_reader->getRoot<cereal::Event>();
+    }
+  }
 };
 
 SubMaster::SubMaster(const std::vector<const char *> &service_list, const std::vector<const char *> &poll,
-                     const char *address, const std::vector<const char *> &ignore_alive) {
+                     const char *address, const std::vector<const char *> &ignore_alive,
+                     const std::vector<const char *> &borrow) {
   poller_ = Poller::create();
   for (auto name : service_list) {
     const service *serv = get_service(name);
@@ -67,13 +101,16 @@ SubMaster::SubMaster(const std::vector<const char *> &service_list, const std::v
     assert(socket != 0);
     bool is_polled = inList(poll, name) || poll.empty();
     if (is_polled) poller_->registerSocket(socket);
+    // a borrowed message is only handed back once the poller reports a new one
+    assert(is_polled || !inList(borrow, name));
     SubMessage *m = new SubMessage{
       .name = name,
       .socket = socket,
       .freq = serv->frequency,
       .ignore_alive = inList(ignore_alive, name),
       .allocated_msg_reader = malloc(sizeof(capnp::FlatArrayMessageReader)),
-      .is_polled = is_polled};
+      .is_polled = is_polled,
+      .borrow = inList(borrow, name)};
     m->msg_reader = new (m->allocated_msg_reader) capnp::FlatArrayMessageReader({});
     messages_[socket] = m;
     services_[name] = m;
@@ -81,10 +118,20 @@ SubMaster::SubMaster(const std::vector<const char *> &service_list, const std::v
 }
 
 void SubMaster::update(int timeout) {
-  for (auto &kv : messages_) kv.second->updated = false;
+  for (auto &kv : messages_) {
+    kv.second->updated = false;
+    kv.second->overwritten = false;
+  }
 
   auto sockets = poller_->poll(timeout);
 
+  // borrowed messages that won't be replaced are copied before they are handed back
+  for (auto &kv : messages_) {
+    if (kv.second->borrowed_msg && std::find(sockets.begin(), sockets.end(), kv.first) == sockets.end()) {
+      kv.second->release_borrowed(true);
+    }
+  }
+
   // add non-polled sockets for non-blocking receive
   for (auto &kv : messages_) {
     SubMessage *m = kv.second;
@@ -97,16 +144,26 @@ void SubMaster::update(int timeout) {
   std::vector<std::pair<std::string, cereal::Event::Reader>> messages;
 
   for (auto s : sockets) {
-    Message *msg = s->receive(true);
-    if (msg == nullptr) continue;
-
     SubMessage *m = messages_.at(s);
-
-    m->msg_reader->~FlatArrayMessageReader();
-    capnp::ReaderOptions options;
-    options.traversalLimitInWords = kj::maxValue; // Don't limit
-    m->msg_reader = new (m->allocated_msg_reader) capnp::FlatArrayMessageReader(m->aligned_buf.align(msg), options);
-    delete msg;
+    if (m->borrow) {
+      // only one message can be borrowed at a time
+      bool released = m->borrowed_msg != nullptr;
+      m->release_borrowed(false);
+      Message *msg = s->receiveBorrowed(true);
+      if (msg == nullptr) {
+        // the previous message is gone as well
+        if (released) m->clear();
+        continue;
+      }
+      m->set_reader(m->aligned_buf.view(msg));
+      m->borrowed_msg = msg;
+    } else {
+      Message *msg = s->receive(true);
+      if (msg == nullptr) continue;
+
+      m->set_reader(m->aligned_buf.align(msg));
+      delete msg;
+    }
     messages.push_back({m->name, m->msg_reader->getRoot<cereal::Event>()});
   }
 
@@ -150,6 +207,8 @@ bool SubMaster::all_(const std::vector<const char *> &service_list, bool valid,
 }
 
 void SubMaster::drain() {
+  for (auto &kv : messages_) kv.second->release_borrowed(true);
+
   while (true) {
     auto polls = poller_->poll(0);
     if (polls.size() == 0)
@@ -182,6 +241,10 @@ uint64_t SubMaster::rcv_time(const char *name) const {
   return services_.at(name)->rcv_time;
 }
 
+bool SubMaster::overwritten(const char *name) const {
+  return services_.at(name)->overwritten;
+}
+
 cereal::Event::Reader &SubMaster::operator[](const char *name) const {
   return services_.at(name)->event;
 };
@@ -190,6 +253,7 @@ SubMaster::~SubMaster() {
   delete poller_;
   for (auto &kv : messages_) {
     SubMessage *m = kv.second;
+    m->release_borrowed(false);
     m->msg_reader->~FlatArrayMessageReader();
     free(m->allocated_msg_reader);
     delete m->socket;
@@ -206,9 +270,8 @@ PubMaster::PubMaster(const std::vector<const char *> &service_list) {
   }
 }
 
-int PubMaster::send(const char *name, MessageBuilder &msg) {
-  auto bytes = msg.toBytes();
-  return send(name, bytes.begin(), bytes.size());
+int PubMaster::send(const char *name, capnp::MessageBuilder &msg) {
+  return sockets_.at(name)->sendInPlace(msg);
 }
 
 PubMaster::~PubMaster() {
@@ -16,6 +16,14 @@ class TestServices(unittest.TestCase):
     self.assertTrue(service.port != RESERVED_PORT)
     self.assertTrue(service.port >= STARTING_PORT)
     self.assertTrue(service.frequency <= 100)
+    if service.segment_size is not None:
+      self.assertTrue(service.segment_size % 8 == 0)
+      # segment_size is an int in the generated header
+      self.assertTrue(0 < service.segment_size < 2**31)
+    if service.spsc_slots:
+      # loggerd would be a second subscriber
+      self.assertFalse(service.should_log)
+      self.assertTrue(service.segment_size is not None and service.segment_size // service.spsc_slots >= 64)
 
   def test_no_duplicate_port(self):
     ports = {}
@@ -19,6 +19,9 @@ class Service:
     self.frequency = vals.get("expectedFreq", 0.0)
     self.decimation = vals.get("decimation", None)
     self.keep_last = vals.get("keepLast", True)
+    self.segment_size = vals.get("segmentSize", None)
+    self.huge_pages = vals.get("hugePages", False)
+    self.spsc_slots = vals.get("spscSlots", 0)
     
 with open(os.path.join(CEREAL_PATH, "resources/services.yaml"), 'r') as stream:
     services = yaml.safe_load(stream)["services"]
@@ -32,14 +35,16 @@ def build_header():
   h += "/* THIS IS AN AUTOGENERATED FILE, PLEASE EDIT services.yaml */\n"
   h += "#ifndef __SERVICES_H\n"
   h += "#define __SERVICES_H\n"
-  h += "struct service { char name[0x100]; int port; bool should_log; int frequency; int decimation; bool keep_last;};\n"
+  h += "struct service { char name[0x100]; int port; bool should_log; int frequency; int decimation; bool keep_last; int segment_size; bool huge_pages; int spsc_slots;};\n"
   h += "static struct service services[] = {\n"
   for k, v in service_list.items():
     should_log = "true" if v.should_log else "false"
     keep_last = "true" if v.keep_last else "false"
     decimation = -1 if v.decimation is None else v.decimation
-    h += '  { "%s", %d, %s, %d, %d, %s},\n' % \
-         (k, v.port, should_log, v.frequency, decimation, keep_last)
+    segment_size = 0 if v.segment_size is None else v.segment_size
+    huge_pages = "true" if v.huge_pages else "false"
+    h += '  { "%s", %d, %s, %d, %d, %s, %d, %s, %d},\n' % \
+         (k, v.port, should_log, v.frequency, decimation, keep_last, segment_size, huge_pages, v.spsc_slots)
   h += "};\n"
   h += "#endif\n"
   return h
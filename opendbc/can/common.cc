@@ -1,13 +1,14 @@
 #include "common.h"
+#include "crc.h"
 
 
-unsigned int honda_checksum(uint32_t address, const Signal &sig, const std::vector<uint8_t> &d) {
+unsigned int honda_checksum(uint32_t address, const Signal &sig, const uint8_t *d, size_t len) {
   int s = 0;
   bool extended = address > 0x7FF;
   while (address) { s += (address & 0xF); address >>= 4; }
-  for (int i = 0; i < d.size(); i++) {
+  for (int i = 0; i < len; i++) {
     uint8_t x = d[i];
-    if (i == d.size()-1) x >>= 4; // remove checksum
+    if (i == len-1) x >>= 4; // remove checksum
     s += (x & 0xF) + (x >> 4);
   }
   s = 8-s;
@@ -16,99 +17,32 @@ unsigned int honda_checksum(uint32_t address, const Signal &sig, const std::vect
   return s & 0xF;
 }
 
-unsigned int toyota_checksum(uint32_t address, const Signal &sig, const std::vector<uint8_t> &d) {
-  unsigned int s = d.size();
+unsigned int toyota_checksum(uint32_t address, const Signal &sig, const uint8_t *d, size_t len) {
+  unsigned int s = len;
   while (address) { s += address & 0xFF; address >>= 8; }
-  for (int i = 0; i < d.size() - 1; i++) { s += d[i]; }
+  for (int i = 0; i < len - 1; i++) { s += d[i]; }
 
   return s & 0xFF;
 }
 
-unsigned int subaru_checksum(uint32_t address, const Signal &sig, const std::vector<uint8_t> &d) {
+unsigned int subaru_checksum(uint32_t address, const Signal &sig, const uint8_t *d, size_t len) {
   unsigned int s = 0;
   while (address) { s += address & 0xFF; address >>= 8; }
 
   // skip checksum in first byte
-  for (int i = 1; i < d.size(); i++) { s += d[i]; };
+  for (int i = 1; i < len; i++) { s += d[i]; };
 
   return s & 0xFF;
 }
 
-unsigned int chrysler_checksum(uint32_t address, const Signal &sig, const std::vector<uint8_t> &d) {
+unsigned int chrysler_checksum(uint32_t address, const Signal &sig, const uint8_t *d, size_t len) {
   // jeep chrysler canbus checksum from http://illmatics.com/Remote%20Car%20Hacking.pdf
-  uint8_t checksum = 0xFF;
-  for (int j = 0; j < (d.size() - 1); j++) {
-    uint8_t shift = 0x80;
-    uint8_t curr = d[j];
-    for (int i = 0; i < 8; i++) {
-      uint8_t bit_sum = curr & shift;
-      uint8_t temp_chk = checksum & 0x80U;
-      if (bit_sum != 0U) {
-        bit_sum = 0x1C;
-        if (temp_chk != 0U) {
-          bit_sum = 1;
-        }
-        checksum = checksum << 1;
-        temp_chk = checksum | 1U;
-        bit_sum ^= temp_chk;
-      } else {
-        if (temp_chk != 0U) {
-          bit_sum = 0x1D;
-        }
-        checksum = checksum << 1;
-        bit_sum ^= checksum;
-      }
-      checksum = bit_sum;
-      shift = shift >> 1;
-    }
-  }
+  // this is CRC-8 SAE J1850 over the payload without the checksum byte
+  uint8_t checksum = crc8_j1850.update(0xFF, d, len > 0 ? len - 1 : 0);
   return ~checksum & 0xFF;
 }
 
-// Static lookup table for fast computation of CRCs
-uint8_t crc8_lut_8h2f[256]; // CRC8 poly 0x2F, aka 8H2F/AUTOSAR
-uint16_t crc16_lut_xmodem[256]; // CRC16 poly 0x1021, aka XMODEM
-
-void gen_crc_lookup_table_8(uint8_t poly, uint8_t crc_lut[]) {
-  uint8_t crc;
-  int i, j;
-
-   for (i = 0; i < 256; i++) {
-    crc = i;
-    for (j = 0; j < 8; j++) {
-      if ((crc & 0x80) != 0)
-        crc = (uint8_t)((crc << 1) ^ poly);
-      else
-        crc <<= 1;
-    }
-    crc_lut[i] = crc;
-  }
-}
-
-void gen_crc_lookup_table_16(uint16_t poly, uint16_t crc_lut[]) {
-  uint16_t crc;
-  int i, j;
-
-   for (i = 0; i < 256; i++) {
-    crc = i << 8;
-    for (j = 0; j < 8; j++) {
-      if ((crc & 0x8000) != 0) {
-        crc = (uint16_t)((crc << 1) ^ poly);
-      } else {
-        crc <<= 1;
-      }
-    }
-    crc_lut[i] = crc;
-  }
-}
-
-void init_crc_lookup_tables() {
-  // At init time, set up static lookup tables for fast CRC computation.
-  gen_crc_lookup_table_8(0x2F, crc8_lut_8h2f);    // CRC-8 8H2F/AUTOSAR for Volkswagen
-  gen_crc_lookup_table_16(0x1021, crc16_lut_xmodem);    // CRC-16 XMODEM for HKG CAN FD
-}
-
-unsigned int volkswagen_mqb_checksum(uint32_t address, const Signal &sig, const std::vector<uint8_t> &d) {
+unsigned int volkswagen_mqb_checksum(uint32_t address, const Signal &sig, const uint8_t *d, size_t len) {
   // Volkswagen uses standard CRC8 8H2F/AUTOSAR, but they compute it with
   // a magic variable padding byte tacked onto the end of the payload.
   // https://www.autosar.org/fileadmin/user_upload/standards/classic/4-3/AUTOSAR_SWS_CRCLibrary.pdf
@@ -116,10 +50,7 @@ unsigned int volkswagen_mqb_checksum(uint32_t address, const Signal &sig, const
   uint8_t crc = 0xFF; // Standard init value for CRC8 8H2F/AUTOSAR
 
   // CRC the payload first, skipping over the first byte where the CRC lives.
-  for (int i = 1; i < d.size(); i++) {
-    crc ^= d[i];
-    crc = crc8_lut_8h2f[crc];
-  }
+  crc = crc8_8h2f.update(crc, d + 1, len > 1 ? len - 1 : 0);
 
   // Look up and apply the magic final CRC padding byte, which permutes by CAN
   // address, and additionally (for SOME addresses) by the message counter.
@@ -184,17 +115,17 @@ unsigned int volkswagen_mqb_checksum(uint32_t address, const Signal &sig, const
       crc ^= (uint8_t[]){0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}[counter];
       break;
   }
-  crc = crc8_lut_8h2f[crc];
+  crc = crc8_8h2f.step(crc, 0);
 
   return crc ^ 0xFF; // Return after standard final XOR for CRC8 8H2F/AUTOSAR
 }
 
-unsigned int xor_checksum(uint32_t address, const Signal &sig, const std::vector<uint8_t> &d) {
+unsigned int xor_checksum(uint32_t address, const Signal &sig, const uint8_t *d, size_t len) {
   uint8_t checksum = 0;
   int checksum_byte = sig.start_bit / 8;
 
   // Simple XOR over the payload, except for the byte where the checksum lives.
-  for (int i = 0; i < d.size(); i++) {
+  for (int i = 0; i < len; i++) {
     if (i != checksum_byte) {
       checksum ^= d[i];
     }
@@ -203,42 +134,30 @@ unsigned int xor_checksum(uint32_t address, const Signal &sig, const std::vector
   return checksum;
 }
 
-unsigned int pedal_checksum(uint32_t address, const Signal &sig, const std::vector<uint8_t> &d) {
+unsigned int pedal_checksum(uint32_t address, const Signal &sig, const uint8_t *d, size_t len) {
   uint8_t crc = 0xFF;
-  uint8_t poly = 0xD5; // standard crc8
 
   // skip checksum byte
-  for (int i = d.size()-2; i >= 0; i--) {
-    crc ^= d[i];
-    for (int j = 0; j < 8; j++) {
-      if ((crc & 0x80) != 0) {
-        crc = (uint8_t)((crc << 1) ^ poly);
-      } else {
-        crc <<= 1;
-      }
-    }
+  for (int i = len-2; i >= 0; i--) {
+    crc = crc8_d5.step(crc, d[i]);
   }
   return crc;
 }
 
-unsigned int hkg_can_fd_checksum(uint32_t address, const Signal &sig, const std::vector<uint8_t> &d) {
-  uint16_t crc = 0;
-
-  for (int i = 2; i < d.size(); i++) {
-    crc = (crc << 8) ^ crc16_lut_xmodem[(crc >> 8) ^ d[i]];
-  }
+unsigned int hkg_can_fd_checksum(uint32_t address, const Signal &sig, const uint8_t *d, size_t len) {
+  uint16_t crc = crc16_xmodem.update(0, d + 2, len > 2 ? len - 2 : 0);
 
   // Add address to crc
-  crc = (crc << 8) ^ crc16_lut_xmodem[(crc >> 8) ^ ((address >> 0) & 0xFF)];
-  crc = (crc << 8) ^ crc16_lut_xmodem[(crc >> 8) ^ ((address >> 8) & 0xFF)];
+  crc = crc16_xmodem.step(crc, (address >> 0) & 0xFF);
+  crc = crc16_xmodem.step(crc, (address >> 8) & 0xFF);
 
-  if (d.size() == 8) {
+  if (len == 8) {
     crc ^= 0x5f29;
-  } else if (d.size() == 16) {
+  } else if (len == 16) {
     crc ^= 0x041d;
-  } else if (d.size() == 24) {
+  } else if (len == 24) {
     crc ^= 0x819d;
-  } else if (d.size() == 32) {
+  } else if (len == 32) {
     crc ^= 0x9f5b;
   }
 
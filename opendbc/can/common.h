@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <map>
 #include <string>
 #include <utility>
@@ -14,6 +15,7 @@
 #endif
 
 #include "common_dbc.h"
+#include "unpacker.h"
 
 #define INFO printf
 #define WARN printf
@@ -23,38 +25,69 @@
 #define MAX_BAD_COUNTER 5
 #define CAN_INVALID_CNT 5
 
-void init_crc_lookup_tables();
+// Values kept per signal between query_latest calls before all_values has to grow
+#define ALL_VALUES_RESERVE 16
 
 // Car specific functions
-unsigned int honda_checksum(uint32_t address, const Signal &sig, const std::vector<uint8_t> &d);
-unsigned int toyota_checksum(uint32_t address, const Signal &sig, const std::vector<uint8_t> &d);
-unsigned int subaru_checksum(uint32_t address, const Signal &sig, const std::vector<uint8_t> &d);
-unsigned int chrysler_checksum(uint32_t address, const Signal &sig, const std::vector<uint8_t> &d);
-unsigned int volkswagen_mqb_checksum(uint32_t address, const Signal &sig, const std::vector<uint8_t> &d);
-unsigned int xor_checksum(uint32_t address, const Signal &sig, const std::vector<uint8_t> &d);
-unsigned int hkg_can_fd_checksum(uint32_t address, const Signal &sig, const std::vector<uint8_t> &d);
-unsigned int pedal_checksum(uint32_t address, const Signal &sig, const std::vector<uint8_t> &d);
+unsigned int honda_checksum(uint32_t address, const Signal &sig, const uint8_t *d, size_t len);
+unsigned int toyota_checksum(uint32_t address, const Signal &sig, const uint8_t *d, size_t len);
+unsigned int subaru_checksum(uint32_t address, const Signal &sig, const uint8_t *d, size_t len);
+unsigned int chrysler_checksum(uint32_t address, const Signal &sig, const uint8_t *d, size_t len);
+unsigned int volkswagen_mqb_checksum(uint32_t address, const Signal &sig, const uint8_t *d, size_t len);
+unsigned int xor_checksum(uint32_t address, const Signal &sig, const uint8_t *d, size_t len);
+unsigned int hkg_can_fd_checksum(uint32_t address, const Signal &sig, const uint8_t *d, size_t len);
+unsigned int pedal_checksum(uint32_t address, const Signal &sig, const uint8_t *d, size_t len);
+
+// Everything needed to decode a signal, kept small so the signals of a message share cache lines
+struct SignalDecode {
+  double factor, offset;
+  int16_t msb, lsb;
+  int16_t unpack_idx;  // position in the output of the generated unpacker
+  uint8_t size;
+  bool is_signed;
+  bool is_little_endian;
+  SignalType type;
+};
+
+// All signals tracked by a parser, stored per field. A message owns the range [sig_begin, sig_end).
+// The index of a signal is its id, fixed once the parser is constructed
+struct SignalStore {
+  std::vector<const Signal *> sigs;  // points into the DBC, which is never freed
+  std::vector<uint32_t> address;
+  std::vector<SignalDecode> decode;
+  std::vector<double> vals;
+  std::vector<std::vector<double>> all_vals;
+  std::vector<uint64_t> ts_nanos;
+  std::vector<uint8_t> updated;  // set when parsed, cleared by CANParser::update
+
+  void add(const Signal &sig, uint32_t msg_address);
+};
 
 class MessageState {
 public:
-  std::string name;
+  const char *name;
   uint32_t address;
   unsigned int size;
 
-  std::vector<Signal> parse_sigs;
-  std::vector<double> vals;
-  std::vector<std::vector<double>> all_vals;
+  uint32_t sig_begin = 0;
+  uint32_t sig_end = 0;
 
-  uint64_t last_seen_nanos;
-  uint64_t check_threshold;
+  uint64_t last_seen_nanos = 0;
+  uint64_t last_event_nanos = 0;  // logMonoTime of the event it was last seen in
+  uint64_t check_threshold = 0;
 
-  uint8_t counter;
-  uint8_t counter_fail;
+  uint8_t counter = 0;
+  uint8_t counter_fail = 0;
 
   bool ignore_checksum = false;
   bool ignore_counter = false;
 
-  bool parse(uint64_t sec, const std::vector<uint8_t> &dat);
+  // Generated unpacker for this message, if there is one that matches the DBC
+  const MessageUnpacker *unpacker = nullptr;
+  std::vector<int64_t> raw;
+
+  void setup_unpacker(const std::string &dbc_name, SignalStore &store);
+  bool parse(uint64_t sec, const uint8_t *dat, size_t len, SignalStore &store);
   bool update_counter_generic(int64_t v, int cnt_size);
 };
 
@@ -64,7 +97,34 @@ private:
   kj::Array<capnp::word> aligned_buf;
 
   const DBC *dbc = NULL;
-  std::unordered_map<uint32_t, MessageState> message_states;
+  std::vector<MessageState> message_states;
+  SignalStore signals;
+
+  // Index into message_states by address. Standard 11 bit addresses are looked up directly,
+  // extended addresses in a sorted list
+  std::vector<int16_t> std_index;
+  std::vector<std::pair<uint32_t, int16_t>> ext_index;
+
+  friend class CANParserGroup;
+
+  MessageState &add_state(const Msg &msg);
+  inline MessageState *find_state(uint32_t address) {
+    int idx = -1;
+    if (address < std_index.size()) {
+      idx = std_index[address];
+    } else {
+      auto it = std::lower_bound(ext_index.begin(), ext_index.end(), std::make_pair(address, (int16_t)-1));
+      if (it != ext_index.end() && it->first == address) {
+        idx = it->second;
+      }
+    }
+    return idx >= 0 ? &message_states[idx] : nullptr;
+  }
+
+  // Steps of update_string, also driven by CANParserGroup
+  void UpdateFrame(uint64_t sec, uint16_t rx_age_us, uint32_t address, const uint8_t *dat, size_t len);
+  void UpdateBusTimeout(uint64_t sec, bool bus_empty);
+  void ClearUpdated();
 
 public:
   bool can_valid = false;
@@ -83,10 +143,51 @@ public:
   void update_string(const std::string &data, bool sendcan);
   void update_strings(const std::vector<std::string> &data, std::vector<SignalValue> &vals, bool sendcan);
   void UpdateCans(uint64_t sec, const capnp::List<CanData>::Reader& cans);
+
+  // Columnar output, without building SignalValues. Clears the updated flags and
+  // all values, then parses the strings. Results are read per signal id below
+  void update(const std::vector<std::string> &data, bool sendcan);
   #endif
   void UpdateCans(uint64_t sec, const capnp::DynamicStruct::Reader& cans);
   void UpdateValid(uint64_t sec);
   void query_latest(std::vector<SignalValue> &vals, uint64_t last_ts = 0);
+  void use_unpackers(bool enable);
+
+  size_t num_signals() const { return signals.sigs.size(); }
+  uint32_t signal_address(size_t id) const { return signals.address[id]; }
+  const std::string &signal_name(size_t id) const { return signals.sigs[id]->name; }
+  const double *values() const { return signals.vals.data(); }
+  const uint64_t *ts_nanos() const { return signals.ts_nanos.data(); }
+  const uint8_t *updated() const { return signals.updated.data(); }
+  const std::vector<double> &all_values(size_t id) const { return signals.all_vals[id]; }
+};
+
+// Parses every event once for a set of parsers, handing each frame to the parsers on its bus.
+// Results are the same as calling update_string/update on every parser on its own
+class CANParserGroup {
+private:
+  kj::Array<capnp::word> aligned_buf;
+  std::vector<CANParser *> parsers;
+  std::vector<CANParser *> bus_parsers[256];  // indexed by CanData.src
+
+public:
+  CANParserGroup();
+  void add(CANParser *parser);
+  #ifndef DYNAMIC_CAPNP
+  void update_string(const std::string &data, bool sendcan);
+  void update(const std::vector<std::string> &data, bool sendcan);
+  #endif
+};
+
+// A message and an ordered list of its signals, resolved once by CANPacker::make_plan
+struct PackPlan {
+  uint32_t address;
+  uint32_t size;
+  std::vector<const Signal *> sigs;  // nullptr for signals the message doesn't have
+  int counter_idx = -1;              // position of COUNTER in sigs, if given
+  const Signal *counter = nullptr;
+  const Signal *checksum = nullptr;
+  uint32_t *counter_value = nullptr;
 };
 
 class CANPacker {
@@ -95,9 +196,15 @@ private:
   std::map<std::pair<uint32_t, std::string>, Signal> signal_lookup;
   std::map<uint32_t, Msg> message_lookup;
   std::map<uint32_t, uint32_t> counters;
+  std::vector<PackPlan> plans;
 
 public:
   CANPacker(const std::string& dbc_name);
   std::vector<uint8_t> pack(uint32_t address, const std::vector<SignalPackValue> &values);
+  // Returns a plan id, or -1 if the address isn't in the DBC
+  int make_plan(uint32_t address, const std::vector<std::string> &signal_names);
+  // values holds one value per signal of the plan, out has room for plan_size bytes
+  void pack(int plan_id, const double *values, uint8_t *out);
+  uint32_t plan_size(int plan_id) const;
   Msg* lookup_message(uint32_t address);
 };
@@ -9,7 +9,7 @@ from libcpp.vector cimport vector
 from libcpp.unordered_set cimport unordered_set
 
 
-ctypedef unsigned int (*calc_checksum_type)(uint32_t, const Signal&, const vector[uint8_t] &)
+ctypedef unsigned int (*calc_checksum_type)(uint32_t, const Signal&, const uint8_t *, size_t)
 
 cdef extern from "common_dbc.h":
   ctypedef enum SignalType:
@@ -79,7 +79,23 @@ cdef extern from "common.h":
     bool bus_timeout
     CANParser(int, string, vector[MessageParseOptions], vector[SignalParseOptions])
     void update_strings(vector[string]&, vector[SignalValue]&, bool)
+    void update(vector[string]&, bool)
+    size_t num_signals()
+    uint32_t signal_address(size_t)
+    string signal_name(size_t)
+    const double *values()
+    const uint64_t *ts_nanos()
+    const uint8_t *updated()
+    vector[double] all_values(size_t)
+
+  cdef cppclass CANParserGroup:
+    CANParserGroup()
+    void add(CANParser *)
+    void update(vector[string]&, bool)
 
   cdef cppclass CANPacker:
    CANPacker(string)
    vector[uint8_t] pack(uint32_t, vector[SignalPackValue]&)
+   int make_plan(uint32_t, vector[string]&)
+   void pack(int, const double *, uint8_t *)
+   uint32_t plan_size(int)
@@ -50,7 +50,7 @@ struct Signal {
   double factor, offset;
   bool is_little_endian;
   SignalType type;
-  unsigned int (*calc_checksum)(uint32_t address, const Signal &sig, const std::vector<uint8_t> &d);
+  unsigned int (*calc_checksum)(uint32_t address, const Signal &sig, const uint8_t *d, size_t len);
 };
 
 struct Msg {
@@ -80,10 +80,14 @@ typedef struct ChecksumState {
   int counter_start_bit;
   bool little_endian;
   SignalType checksum_type;
-  unsigned int (*calc_checksum)(uint32_t address, const Signal &sig, const std::vector<uint8_t> &d);
+  unsigned int (*calc_checksum)(uint32_t address, const Signal &sig, const uint8_t *d, size_t len);
 } ChecksumState;
 
 DBC* dbc_parse(const std::string& dbc_path);
 DBC* dbc_parse_from_stream(const std::string &dbc_name, std::istream &stream, ChecksumState *checksum = nullptr, bool allow_duplicate_msg_name=false);
 const DBC* dbc_lookup(const std::string& dbc_name);
+const std::string get_dbc_root_path();
+std::string dbc_cache_path(const std::string &dbc_name);
+DBC* dbc_cache_load(const std::string &cache_path, const std::string &dbc_path);
+bool dbc_cache_write(const std::string &cache_path, const std::string &dbc_path, const DBC &dbc);
 std::vector<std::string> get_dbc_names();
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// MSB first CRCs with lookup tables built at compile time.
+// Table k holds the CRC of a byte followed by k zero bytes, which lets update() fold
+// SLICES bytes per step with independent lookups (slice-by-N) instead of one dependent lookup per byte.
+// Only the tables and plain integer math are used, so the same scheme runs on the panda's Cortex-M.
+
+template <typename T, T POLY, int SLICES>
+struct CRCTables {
+  static_assert(sizeof(T) == 1 || sizeof(T) == 2, "only CRC-8 and CRC-16 are implemented");
+  static_assert(SLICES >= (int)sizeof(T), "a slice has to cover the CRC register");
+  static constexpr int BITS = 8 * sizeof(T);
+
+  T t[SLICES][256] = {};
+
+  constexpr CRCTables() {
+    for (int i = 0; i < 256; i++) {
+      T crc = (T)(i << (BITS - 8));
+      for (int j = 0; j < 8; j++) {
+        crc = (crc & (T)(1U << (BITS - 1))) ? (T)((crc << 1) ^ POLY) : (T)(crc << 1);
+      }
+      t[0][i] = crc;
+    }
+    for (int k = 1; k < SLICES; k++) {
+      for (int i = 0; i < 256; i++) {
+        t[k][i] = step(t[k - 1][i], 0);
+      }
+    }
+  }
+
+  // One byte through the first table
+  constexpr T step(T crc, uint8_t b) const {
+    if constexpr (BITS == 8) {
+      return t[0][crc ^ b];
+    } else {
+      return (T)((crc << 8) ^ t[0][(crc >> 8) ^ b]);
+    }
+  }
+
+  // N bytes at once through tables N-1 to 0, the register is xored into the first bytes
+  template <int N>
+  T fold(T crc, const uint8_t *d) const {
+    T ret = 0;
+    for (int i = 0; i < N; i++) {
+      uint8_t b = d[i];
+      if (i < BITS / 8) {
+        b ^= (uint8_t)(crc >> (BITS - 8 * (i + 1)));
+      }
+      ret ^= t[N - 1 - i][b];
+    }
+    return ret;
+  }
+
+  T update(T crc, const uint8_t *d, size_t len) const {
+    for (; len >= SLICES; d += SLICES, len -= SLICES) {
+      crc = fold<SLICES>(crc, d);
+    }
+    if constexpr (SLICES > 4) {
+      if (len >= 4) {
+        crc = fold<4>(crc, d);
+        d += 4;
+        len -= 4;
+      }
+    }
+    for (size_t i = 0; i < len; i++) {
+      crc = step(crc, d[i]);
+    }
+    return crc;
+  }
+};
+
+inline constexpr CRCTables<uint8_t, 0x2F, 8> crc8_8h2f;       // CRC-8 8H2F/AUTOSAR for Volkswagen
+inline constexpr CRCTables<uint8_t, 0x1D, 8> crc8_j1850;      // CRC-8 SAE J1850 for Chrysler
+inline constexpr CRCTables<uint8_t, 0xD5, 1> crc8_d5;         // CRC-8 0xD5 for the comma pedal, walked backwards
+inline constexpr CRCTables<uint16_t, 0x1021, 8> crc16_xmodem; // CRC-16 XMODEM for HKG CAN FD
@@ -1,24 +1,24 @@
 #include <algorithm>
+#include <cctype>
 #include <filesystem>
 #include <fstream>
 #include <map>
-#include <regex>
 #include <set>
 #include <sstream>
+#include <string_view>
 #include <vector>
 #include <mutex>
 #include <cstring>
 #include <iterator>
 
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
 #include "common.h"
 #include "common_dbc.h"
 
-std::regex bo_regexp(R"(^BO_ (\w+) (\w+) *: (\w+) (\w+))");
-std::regex sg_regexp(R"(^SG_ (\w+) : (\d+)\|(\d+)@(\d+)([\+|\-]) \(([0-9.+\-eE]+),([0-9.+\-eE]+)\) \[([0-9.+\-eE]+)\|([0-9.+\-eE]+)\] \"(.*)\" (.*))");
-std::regex sgm_regexp(R"(^SG_ (\w+) (\w+) *: (\d+)\|(\d+)@(\d+)([\+|\-]) \(([0-9.+\-eE]+),([0-9.+\-eE]+)\) \[([0-9.+\-eE]+)\|([0-9.+\-eE]+)\] \"(.*)\" (.*))");
-std::regex val_regexp(R"(VAL_ (\w+) (\w+) (\s*[-+]?[0-9]+\s+\".+?\"[^;]*))");
-std::regex val_split_regexp{R"([\"]+)"};  // split on "
-
 #define DBC_ASSERT(condition, message)                             \
   do {                                                             \
     if (!(condition)) {                                            \
@@ -98,6 +98,150 @@ void set_signal_type(Signal& s, ChecksumState* chk, const std::string& dbc_name,
   }
 }
 
+// Cursor over a single DBC line. Replaces std::regex, which made SG_ lines the slowest part of startup.
+// Every read either consumes what it matched and returns true, or leaves the position alone
+class LineReader {
+public:
+  LineReader(const std::string &line) : s(line) {}
+
+  bool eof() const { return pos == s.size(); }
+  char peek() const { return eof() ? '\0' : s[pos]; }
+  std::string_view rest() const { return s.substr(pos); }
+
+  bool literal(char c) {
+    if (eof() || s[pos] != c) return false;
+    pos++;
+    return true;
+  }
+
+  bool literal(std::string_view lit) {
+    if (s.compare(pos, lit.size(), lit) != 0) return false;
+    pos += lit.size();
+    return true;
+  }
+
+  void skip(char c) {
+    while (!eof() && s[pos] == c) pos++;
+  }
+
+  // \s*
+  void skip_whitespace() {
+    while (!eof() && std::isspace((unsigned char)s[pos])) pos++;
+  }
+
+  // \w+
+  bool word(std::string_view &out) {
+    return span([](char c) { return std::isalnum((unsigned char)c) || c == '_'; }, out);
+  }
+
+  // \d+
+  bool digits(std::string_view &out) {
+    return span([](char c) { return c >= '0' && c <= '9'; }, out);
+  }
+
+  // [0-9.+\-eE]+, converted with std::stod
+  bool number(std::string_view &out) {
+    return span([](char c) { return (c >= '0' && c <= '9') || c == '.' || c == '+' || c == '-' || c == 'e' || c == 'E'; }, out);
+  }
+
+private:
+  template <typename F>
+  bool span(F match, std::string_view &out) {
+    size_t end = pos;
+    while (end < s.size() && match(s[end])) end++;
+    if (end == pos) return false;
+    out = s.substr(pos, end - pos);
+    pos = end;
+    return true;
+  }
+
+  std::string_view s;
+  size_t pos = 0;
+};
+
+// BO_ <address> <name> *: <size> <transmitter>
+static bool parse_bo(const std::string &line, Msg &msg) {
+  LineReader r(line);
+  std::string_view address, name, size, transmitter;
+  if (!(r.literal("BO_ ") && r.word(address) && r.literal(' ') && r.word(name))) return false;
+  r.skip(' ');
+  if (!(r.literal(": ") && r.word(size) && r.literal(' ') && r.word(transmitter) && r.eof())) return false;
+
+  msg.address = std::stoul(std::string(address));  // could be hex
+  msg.name = name;
+  msg.size = std::stoul(std::string(size));
+  return true;
+}
+
+// SG_ <name> [<multiplexer>] : <start>|<size>@<endianness><sign> (<factor>,<offset>) [<min>|<max>] "<unit>" <receivers>
+static bool parse_sg(const std::string &line, Signal &sig) {
+  LineReader r(line);
+  std::string_view name, mux, start_bit, size, endianness, factor, offset, min, max;
+  if (!(r.literal("SG_ ") && r.word(name) && r.literal(' '))) return false;
+  if (r.peek() != ':') {
+    if (!r.word(mux)) return false;
+    r.skip(' ');
+  }
+  if (!(r.literal(": ") && r.digits(start_bit) && r.literal('|') && r.digits(size) && r.literal('@') && r.digits(endianness))) return false;
+
+  const char sign = r.peek();
+  if (!(r.literal('+') || r.literal('-') || r.literal('|'))) return false;
+  if (!(r.literal(" (") && r.number(factor) && r.literal(',') && r.number(offset) && r.literal(") [") &&
+        r.number(min) && r.literal('|') && r.number(max) && r.literal("] \""))) return false;
+
+  // unit and receivers are not used, only check that the unit is closed
+  if (r.rest().find("\" ") == std::string_view::npos) return false;
+
+  sig.name = name;
+  sig.start_bit = std::stoi(std::string(start_bit));
+  sig.size = std::stoi(std::string(size));
+  sig.is_little_endian = std::stoi(std::string(endianness)) == 1;
+  sig.is_signed = sign == '-';
+  sig.factor = std::stod(std::string(factor));
+  sig.offset = std::stod(std::string(offset));
+  return true;
+}
+
+// VAL_ <address> <signal> <value> "<description>" ... ;
+static bool parse_val(const std::string &line, Val &val) {
+  LineReader r(line);
+  std::string_view address, name, value;
+  if (!(r.literal("VAL_ ") && r.word(address) && r.literal(' ') && r.word(name) && r.literal(' '))) return false;
+
+  std::string_view defvals = r.rest();
+  r.skip_whitespace();
+  if (!r.literal('+')) r.literal('-');
+  if (!r.digits(value) || r.eof() || !std::isspace((unsigned char)r.peek())) return false;
+  r.skip_whitespace();
+
+  // first description needs at least one character, the definitions run until the first ; after it
+  std::string_view rest = r.rest();
+  size_t close = rest.size() < 2 || rest[0] != '"' ? std::string_view::npos : rest.find('"', 2);
+  if (close == std::string_view::npos) return false;
+  size_t end = rest.find(';', close + 1);
+  defvals = defvals.substr(0, defvals.size() - rest.size() + (end == std::string_view::npos ? rest.size() : end));
+
+  val.address = std::stoul(std::string(address));  // could be hex
+  val.name = name;
+
+  // split on quotes and convert the descriptions to UPPER_CASE_WITH_UNDERSCORES
+  std::string def_val;
+  size_t i = 0;
+  while (i < defvals.size()) {
+    size_t next = std::min(defvals.find('"', i), defvals.size());
+    std::string w(defvals.substr(i, next - i));
+    w = trim(w);
+    std::transform(w.begin(), w.end(), w.begin(), ::toupper);
+    std::replace(w.begin(), w.end(), ' ', '_');
+    def_val += w + " ";
+
+    i = next;
+    while (i < defvals.size() && defvals[i] == '"') i++;
+  }
+  val.def_val = trim(def_val);
+  return true;
+}
+
 DBC* dbc_parse_from_stream(const std::string &dbc_name, std::istream &stream, ChecksumState *checksum, bool allow_duplicate_msg_name) {
   uint32_t address = 0;
   std::set<uint32_t> address_set;
@@ -107,30 +251,16 @@ DBC* dbc_parse_from_stream(const std::string &dbc_name, std::istream &stream, Ch
   DBC* dbc = new DBC;
   dbc->name = dbc_name;
 
-  // used to find big endian LSB from MSB and size
-  std::vector<int> be_bits;
-  for (int i = 0; i < 64; i++) {
-    for (int j = 7; j >= 0; j--) {
-      be_bits.push_back(j + i * 8);
-    }
-  }
-
   std::string line;
   int line_num = 0;
-  std::smatch match;
-  // TODO: see if we can speed up the regex statements in this loop, SG_ is specifically the slowest
   while (std::getline(stream, line)) {
     line = trim(line);
     line_num += 1;
     if (startswith(line, "BO_ ")) {
       // new group
-      bool ret = std::regex_match(line, match, bo_regexp);
-      DBC_ASSERT(ret, "bad BO: " << line);
-
       Msg& msg = dbc->msgs.emplace_back();
-      address = msg.address = std::stoul(match[1].str());  // could be hex
-      msg.name = match[2].str();
-      msg.size = std::stoul(match[3].str());
+      DBC_ASSERT(parse_bo(line, msg), "bad BO: " << line);
+      address = msg.address;
 
       // check for duplicates
       DBC_ASSERT(address_set.find(address) == address_set.end(), "Duplicate message address: " << address << " (" << msg.name << ")");
@@ -142,27 +272,16 @@ DBC* dbc_parse_from_stream(const std::string &dbc_name, std::istream &stream, Ch
       }
     } else if (startswith(line, "SG_ ")) {
       // new signal
-      int offset = 0;
-      if (!std::regex_search(line, match, sg_regexp)) {
-        bool ret = std::regex_search(line, match, sgm_regexp);
-        DBC_ASSERT(ret, "bad SG: " << line);
-        offset = 1;
-      }
       Signal& sig = signals[address].emplace_back();
-      sig.name = match[1].str();
-      sig.start_bit = std::stoi(match[offset + 2].str());
-      sig.size = std::stoi(match[offset + 3].str());
-      sig.is_little_endian = std::stoi(match[offset + 4].str()) == 1;
-      sig.is_signed = match[offset + 5].str() == "-";
-      sig.factor = std::stod(match[offset + 6].str());
-      sig.offset = std::stod(match[offset + 7].str());
+      DBC_ASSERT(parse_sg(line, sig), "bad SG: " << line);
       set_signal_type(sig, checksum, dbc_name, line_num);
       if (sig.is_little_endian) {
         sig.lsb = sig.start_bit;
         sig.msb = sig.start_bit + sig.size - 1;
       } else {
-        auto it = find(be_bits.begin(), be_bits.end(), sig.start_bit);
-        sig.lsb = be_bits[(it - be_bits.begin()) + sig.size - 1];
+        // walk big endian bit order (7..0, 15..8, ...) from the MSB to find the LSB
+        int idx = (sig.start_bit / 8) * 8 + (7 - sig.start_bit % 8) + sig.size - 1;
+        sig.lsb = (idx / 8) * 8 + (7 - idx % 8);
         sig.msb = sig.start_bit;
       }
       DBC_ASSERT(sig.lsb < (64 * 8) && sig.msb < (64 * 8), "Signal out of bounds: " << line);
@@ -172,27 +291,8 @@ DBC* dbc_parse_from_stream(const std::string &dbc_name, std::istream &stream, Ch
       signal_name_sets[address].insert(sig.name);
     } else if (startswith(line, "VAL_ ")) {
       // new signal value/definition
-      bool ret = std::regex_search(line, match, val_regexp);
-      DBC_ASSERT(ret, "bad VAL: " << line);
-
       auto& val = dbc->vals.emplace_back();
-      val.address = std::stoul(match[1].str());  // could be hex
-      val.name = match[2].str();
-
-      auto defvals = match[3].str();
-      std::sregex_token_iterator it{defvals.begin(), defvals.end(), val_split_regexp, -1};
-      // convert strings to UPPER_CASE_WITH_UNDERSCORES
-      std::vector<std::string> words{it, {}};
-      for (auto& w : words) {
-        w = trim(w);
-        std::transform(w.begin(), w.end(), w.begin(), ::toupper);
-        std::replace(w.begin(), w.end(), ' ', '_');
-      }
-      // join string
-      std::stringstream s;
-      std::copy(words.begin(), words.end(), std::ostream_iterator<std::string>(s, " "));
-      val.def_val = s.str();
-      val.def_val = trim(val.def_val);
+      DBC_ASSERT(parse_val(line, val), "bad VAL: " << line);
     }
   }
 
@@ -224,6 +324,238 @@ const std::string get_dbc_root_path() {
   }
 }
 
+// Binary cache of parsed DBCs. The file is mmapped and the structs are read in place:
+//   header | msgs | signals, grouped by message | vals | string data
+// A cache is only used if it was written by the same format version from a DBC file with the same size and mtime.
+// Bump DBC_CACHE_VERSION whenever the layout below or the result of parsing a DBC changes.
+#define DBC_CACHE_VERSION 2
+
+namespace {
+
+struct CacheString {
+  uint32_t offset, size;
+};
+
+struct CacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t num_msgs, num_sigs, num_vals;
+  uint64_t file_size;
+  uint64_t source_size;
+  int64_t source_mtime;
+  CacheString name;
+  uint32_t strings_size;
+  uint32_t pad;
+};
+
+struct CacheMsg {
+  CacheString name;
+  uint32_t address;
+  uint32_t size;
+  uint32_t num_sigs;
+  uint32_t pad;
+};
+
+struct CacheSignal {
+  CacheString name;
+  int32_t start_bit, msb, lsb, size;
+  double factor, offset;
+  uint8_t is_signed, is_little_endian;
+};
+
+struct CacheVal {
+  CacheString name, def_val;
+  uint32_t address;
+  uint32_t pad;
+};
+
+const char CACHE_MAGIC[8] = {'D', 'B', 'C', 'C', 'A', 'C', 'H', 'E'};
+static_assert(sizeof(CacheHeader) % 8 == 0 && sizeof(CacheMsg) % 8 == 0 && sizeof(CacheSignal) % 8 == 0 && sizeof(CacheVal) % 8 == 0);
+
+bool source_stamp(const std::string &dbc_path, uint64_t &size, int64_t &mtime) {
+  std::error_code ec;
+  size = std::filesystem::file_size(dbc_path, ec);
+  if (ec) return false;
+  mtime = std::filesystem::last_write_time(dbc_path, ec).time_since_epoch().count();
+  return !ec;
+}
+
+}  // namespace
+
+std::string dbc_cache_path(const std::string &dbc_name) {
+  std::string dir;
+  if (const char *env = std::getenv("DBC_CACHE_DIR")) {
+    // an empty DBC_CACHE_DIR disables the cache
+    if (*env == '\0') return "";
+    dir = env;
+  } else if (const char *xdg = std::getenv("XDG_CACHE_HOME"); xdg != nullptr && *xdg != '\0') {
+    dir = std::string(xdg) + "/opendbc";
+  } else if (const char *home = std::getenv("HOME"); home != nullptr && *home != '\0') {
+    dir = std::string(home) + "/.cache/opendbc";
+  } else {
+    dir = "/tmp/opendbc_cache";
+  }
+  return dir + "/" + dbc_name + ".bin";
+}
+
+DBC* dbc_cache_load(const std::string &cache_path, const std::string &dbc_path) {
+  uint64_t source_size;
+  int64_t source_mtime;
+  if (!source_stamp(dbc_path, source_size, source_mtime)) return nullptr;
+
+  int fd = open(cache_path.c_str(), O_RDONLY);
+  if (fd < 0) return nullptr;
+
+  struct stat st;
+  void *mem = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(CacheHeader)) {
+    mem = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (mem == MAP_FAILED) return nullptr;
+
+  const char *base = (const char *)mem;
+  const CacheHeader *h = (const CacheHeader *)base;
+  const size_t strings_offset = sizeof(CacheHeader) + h->num_msgs * sizeof(CacheMsg) +
+                                h->num_sigs * sizeof(CacheSignal) + h->num_vals * sizeof(CacheVal);
+
+  DBC *dbc = nullptr;
+  if (memcmp(h->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0 && h->version == DBC_CACHE_VERSION &&
+      h->file_size == (uint64_t)st.st_size && strings_offset + h->strings_size == h->file_size &&
+      h->source_size == source_size && h->source_mtime == source_mtime) {
+    const CacheMsg *msgs = (const CacheMsg *)(base + sizeof(CacheHeader));
+    const CacheSignal *sigs = (const CacheSignal *)(msgs + h->num_msgs);
+    const CacheVal *vals = (const CacheVal *)(sigs + h->num_sigs);
+    const char *strings = base + strings_offset;
+    bool ok = true;
+    auto str = [&](const CacheString &cs) {
+      ok = ok && (uint64_t)cs.offset + cs.size <= h->strings_size;
+      return ok ? std::string(strings + cs.offset, cs.size) : std::string();
+    };
+
+    dbc = new DBC;
+    dbc->name = str(h->name);
+    std::unique_ptr<ChecksumState> checksum(get_checksum(dbc->name));
+
+    uint32_t sig_idx = 0;
+    std::map<uint32_t, const Msg *> msg_by_address;
+    dbc->msgs.resize(h->num_msgs);
+    for (uint32_t i = 0; i < h->num_msgs && ok; i++) {
+      Msg &msg = dbc->msgs[i];
+      msg.name = str(msgs[i].name);
+      msg.address = msgs[i].address;
+      msg.size = msgs[i].size;
+      ok = ok && sig_idx + msgs[i].num_sigs <= h->num_sigs;
+      msg.sigs.resize(ok ? msgs[i].num_sigs : 0);
+      for (Signal &sig : msg.sigs) {
+        const CacheSignal &cs = sigs[sig_idx++];
+        sig.name = str(cs.name);
+        sig.start_bit = cs.start_bit;
+        sig.msb = cs.msb;
+        sig.lsb = cs.lsb;
+        sig.size = cs.size;
+        sig.is_signed = cs.is_signed;
+        sig.factor = cs.factor;
+        sig.offset = cs.offset;
+        sig.is_little_endian = cs.is_little_endian;
+        // the type and checksum function come from this build's checksum table, not from the cache
+        set_signal_type(sig, checksum.get(), dbc->name, 0);
+      }
+      msg_by_address[msg.address] = &msg;
+    }
+
+    dbc->vals.resize(h->num_vals);
+    for (uint32_t i = 0; i < h->num_vals && ok; i++) {
+      Val &val = dbc->vals[i];
+      val.name = str(vals[i].name);
+      val.def_val = str(vals[i].def_val);
+      val.address = vals[i].address;
+      auto it = msg_by_address.find(val.address);
+      if (it != msg_by_address.end()) {
+        val.sigs = it->second->sigs;
+      }
+    }
+
+    if (!ok || sig_idx != h->num_sigs) {
+      delete dbc;
+      dbc = nullptr;
+    }
+  }
+
+  munmap(mem, st.st_size);
+  return dbc;
+}
+
+bool dbc_cache_write(const std::string &cache_path, const std::string &dbc_path, const DBC &dbc) {
+  CacheHeader h = {};
+  memcpy(h.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+  h.version = DBC_CACHE_VERSION;
+  if (!source_stamp(dbc_path, h.source_size, h.source_mtime)) return false;
+
+  std::string strings;
+  auto add_string = [&](const std::string &str) {
+    CacheString cs = {(uint32_t)strings.size(), (uint32_t)str.size()};
+    strings += str;
+    return cs;
+  };
+  h.name = add_string(dbc.name);
+
+  std::vector<CacheMsg> msgs;
+  std::vector<CacheSignal> sigs;
+  for (const Msg &msg : dbc.msgs) {
+    msgs.push_back({add_string(msg.name), msg.address, msg.size, (uint32_t)msg.sigs.size(), 0});
+    for (const Signal &sig : msg.sigs) {
+      CacheSignal &cs = sigs.emplace_back();
+      cs = {};
+      cs.name = add_string(sig.name);
+      cs.start_bit = sig.start_bit;
+      cs.msb = sig.msb;
+      cs.lsb = sig.lsb;
+      cs.size = sig.size;
+      cs.factor = sig.factor;
+      cs.offset = sig.offset;
+      cs.is_signed = sig.is_signed;
+      cs.is_little_endian = sig.is_little_endian;
+    }
+  }
+
+  std::vector<CacheVal> vals;
+  for (const Val &val : dbc.vals) {
+    vals.push_back({add_string(val.name), add_string(val.def_val), val.address, 0});
+  }
+
+  h.num_msgs = msgs.size();
+  h.num_sigs = sigs.size();
+  h.num_vals = vals.size();
+  h.strings_size = strings.size();
+  h.file_size = sizeof(h) + msgs.size() * sizeof(CacheMsg) + sigs.size() * sizeof(CacheSignal) +
+                vals.size() * sizeof(CacheVal) + strings.size();
+
+  // write to a temporary file and rename, so readers in other processes never see a partial cache
+  std::error_code ec;
+  std::filesystem::create_directories(std::filesystem::path(cache_path).parent_path(), ec);
+  const std::string tmp_path = cache_path + ".tmp" + std::to_string(getpid());
+  {
+    std::ofstream f(tmp_path, std::ios::binary);
+    f.write((const char *)&h, sizeof(h));
+    f.write((const char *)msgs.data(), msgs.size() * sizeof(CacheMsg));
+    f.write((const char *)sigs.data(), sigs.size() * sizeof(CacheSignal));
+    f.write((const char *)vals.data(), vals.size() * sizeof(CacheVal));
+    f.write(strings.data(), strings.size());
+    if (!f.good()) {
+      f.close();
+      std::filesystem::remove(tmp_path, ec);
+      return false;
+    }
+  }
+  std::filesystem::rename(tmp_path, cache_path, ec);
+  if (ec) {
+    std::filesystem::remove(tmp_path, ec);
+    return false;
+  }
+  return true;
+}
+
 const DBC* dbc_lookup(const std::string& dbc_name) {
   static std::mutex lock;
   static std::map<std::string, DBC*> dbcs;
@@ -236,7 +568,17 @@ const DBC* dbc_lookup(const std::string& dbc_name) {
   std::unique_lock lk(lock);
   auto it = dbcs.find(dbc_name);
   if (it == dbcs.end()) {
-    it = dbcs.insert(it, {dbc_name, dbc_parse(dbc_file_path)});
+    // only DBCs looked up by name are cached, the name is the cache key
+    const std::string cache_path = dbc_file_path != dbc_name ? dbc_cache_path(dbc_name) : "";
+
+    DBC *dbc = cache_path.empty() ? nullptr : dbc_cache_load(cache_path, dbc_file_path);
+    if (dbc == nullptr) {
+      dbc = dbc_parse(dbc_file_path);
+      if (dbc != nullptr && !cache_path.empty()) {
+        dbc_cache_write(cache_path, dbc_file_path, *dbc);
+      }
+    }
+    it = dbcs.insert(it, {dbc_name, dbc});
   }
   return it->second;
 }
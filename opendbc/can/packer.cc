@@ -1,4 +1,5 @@
 #include <cassert>
+#include <cstring>
 #include <utility>
 #include <algorithm>
 #include <map>
@@ -7,14 +8,14 @@
 #include "common.h"
 
 
-void set_value(std::vector<uint8_t> &msg, const Signal &sig, int64_t ival) {
+void set_value(uint8_t *msg, size_t len, const Signal &sig, int64_t ival) {
   int i = sig.lsb / 8;
   int bits = sig.size;
   if (sig.size < 64) {
     ival &= ((1ULL << sig.size) - 1);
   }
 
-  while (i >= 0 && i < msg.size() && bits > 0) {
+  while (i >= 0 && i < len && bits > 0) {
     int shift = (int)(sig.lsb / 8) == i ? sig.lsb % 8 : 0;
     int size = std::min(bits, 8 - shift);
 
@@ -27,6 +28,14 @@ void set_value(std::vector<uint8_t> &msg, const Signal &sig, int64_t ival) {
   }
 }
 
+int64_t encode_value(const Signal &sig, double value) {
+  int64_t ival = (int64_t)(round((value - sig.offset) / sig.factor));
+  if (ival < 0) {
+    ival = (1ULL << sig.size) + ival;
+  }
+  return ival;
+}
+
 CANPacker::CANPacker(const std::string& dbc_name) {
   dbc = dbc_lookup(dbc_name);
   assert(dbc);
@@ -37,7 +46,6 @@ CANPacker::CANPacker(const std::string& dbc_name) {
       signal_lookup[std::make_pair(msg.address, std::string(sig.name))] = sig;
     }
   }
-  init_crc_lookup_tables();
 }
 
 std::vector<uint8_t> CANPacker::pack(uint32_t address, const std::vector<SignalPackValue> &signals) {
@@ -53,16 +61,11 @@ std::vector<uint8_t> CANPacker::pack(uint32_t address, const std::vector<SignalP
       continue;
     }
     const auto &sig = sig_it->second;
+    set_value(ret.data(), ret.size(), sig, encode_value(sig, sigval.value));
 
-    int64_t ival = (int64_t)(round((sigval.value - sig.offset) / sig.factor));
-    if (ival < 0) {
-      ival = (1ULL << sig.size) + ival;
-    }
-    set_value(ret, sig, ival);
-
-    counter_set = counter_set || (sigval.name == "COUNTER");
-    if (counter_set) {
+    if (sigval.name == "COUNTER") {
       counters[address] = sigval.value;
+      counter_set = true;
     }
   }
 
@@ -74,7 +77,7 @@ std::vector<uint8_t> CANPacker::pack(uint32_t address, const std::vector<SignalP
     if (counters.find(address) == counters.end()) {
       counters[address] = 0;
     }
-    set_value(ret, sig, counters[address]);
+    set_value(ret.data(), ret.size(), sig, counters[address]);
     counters[address] = (counters[address] + 1) % (1 << sig.size);
   }
 
@@ -83,14 +86,83 @@ std::vector<uint8_t> CANPacker::pack(uint32_t address, const std::vector<SignalP
   if (sig_it_checksum != signal_lookup.end()) {
     const auto &sig = sig_it_checksum->second;
     if (sig.calc_checksum != nullptr) {
-      unsigned int checksum = sig.calc_checksum(address, sig, ret);
-      set_value(ret, sig, checksum);
+      unsigned int checksum = sig.calc_checksum(address, sig, ret.data(), ret.size());
+      set_value(ret.data(), ret.size(), sig, checksum);
     }
   }
 
   return ret;
 }
 
+int CANPacker::make_plan(uint32_t address, const std::vector<std::string> &signal_names) {
+  auto msg_it = message_lookup.find(address);
+  if (msg_it == message_lookup.end()) {
+    WARN("undefined address %d\n", address);
+    return -1;
+  }
+  const Msg &msg = msg_it->second;
+
+  auto find_signal = [&msg](const std::string &name) -> const Signal * {
+    for (const auto &sig : msg.sigs) {
+      if (name == sig.name) return &sig;
+    }
+    return nullptr;
+  };
+
+  PackPlan plan;
+  plan.address = address;
+  plan.size = msg.size;
+  for (int i = 0; i < signal_names.size(); i++) {
+    const Signal *sig = find_signal(signal_names[i]);
+    if (sig == nullptr) {
+      WARN("undefined signal %s - %d\n", signal_names[i].c_str(), address);
+    } else if (signal_names[i] == "COUNTER") {
+      plan.counter_idx = i;
+    }
+    plan.sigs.push_back(sig);
+  }
+
+  plan.counter = find_signal("COUNTER");
+  if (plan.counter != nullptr) {
+    plan.counter_value = &counters[address];
+  }
+  const Signal *checksum = find_signal("CHECKSUM");
+  if (checksum != nullptr && checksum->calc_checksum != nullptr) {
+    plan.checksum = checksum;
+  }
+
+  plans.push_back(std::move(plan));
+  return plans.size() - 1;
+}
+
+void CANPacker::pack(int plan_id, const double *values, uint8_t *out) {
+  const PackPlan &plan = plans[plan_id];
+  memset(out, 0, plan.size);
+
+  for (int i = 0; i < plan.sigs.size(); i++) {
+    if (plan.sigs[i] != nullptr) {
+      set_value(out, plan.size, *plan.sigs[i], encode_value(*plan.sigs[i], values[i]));
+    }
+  }
+
+  // same counter handling as the map based pack, sharing its counters
+  if (plan.counter_idx >= 0) {
+    *plan.counter_value = values[plan.counter_idx];
+  } else if (plan.counter != nullptr) {
+    set_value(out, plan.size, *plan.counter, *plan.counter_value);
+    *plan.counter_value = (*plan.counter_value + 1) % (1 << plan.counter->size);
+  }
+
+  if (plan.checksum != nullptr) {
+    unsigned int checksum = plan.checksum->calc_checksum(plan.address, *plan.checksum, out, plan.size);
+    set_value(out, plan.size, *plan.checksum, checksum);
+  }
+}
+
+uint32_t CANPacker::plan_size(int plan_id) const {
+  return plans[plan_id].size;
+}
+
 // This function has a definition in common.h and is used in PlotJuggler
 Msg* CANPacker::lookup_message(uint32_t address) {
   return &message_lookup[address];
@@ -12,6 +12,17 @@ from .common cimport CANPacker as cpp_CANPacker
 from .common cimport dbc_lookup, SignalPackValue, DBC
 
 
+cdef class PackPlan:
+  cdef:
+    readonly uint32_t address
+    readonly uint32_t size
+    readonly tuple signals
+    int plan_id
+    object packer
+    vector[double] values
+    vector[uint8_t] dat
+
+
 cdef class CANPacker:
   cdef:
     cpp_CANPacker *packer
@@ -52,3 +63,53 @@ cdef class CANPacker:
 
     cdef vector[uint8_t] val = self.pack(addr, values)
     return [addr, 0, (<char *>&val[0])[:size], bus]
+
+  def make_plan(self, name_or_addr, signals):
+    """Resolves a message and an ordered list of its signals once, for make_can_msg_plan and pack_into"""
+    cdef int addr
+    if type(name_or_addr) == int:
+      addr = name_or_addr
+    else:
+      addr = self.name_to_address_and_size[name_or_addr.encode('utf8')][0]
+
+    cdef vector[string] names
+    for name in signals:
+      names.push_back(name.encode('utf8'))
+
+    cdef int plan_id = self.packer.make_plan(addr, names)
+    if plan_id < 0:
+      raise RuntimeError(f"Can't make plan for address {addr}")
+
+    cdef PackPlan plan = PackPlan.__new__(PackPlan)
+    plan.address = addr
+    plan.size = self.packer.plan_size(plan_id)
+    plan.signals = tuple(signals)
+    plan.plan_id = plan_id
+    plan.packer = self
+    plan.values.resize(names.size())
+    plan.dat.resize(plan.size)
+    return plan
+
+  cdef check_plan(self, PackPlan plan, size_t n_values):
+    if plan.packer is not self:
+      raise ValueError("plan was made by another CANPacker")
+    if n_values != plan.values.size():
+      raise ValueError(f"expected {plan.values.size()} values, got {n_values}")
+
+  cpdef make_can_msg_plan(self, PackPlan plan, bus, values):
+    """Same as make_can_msg, with values given in the order of plan.signals"""
+    self.check_plan(plan, len(values))
+    for i, v in enumerate(values):
+      plan.values[i] = v
+
+    self.packer.pack(plan.plan_id, plan.values.data(), plan.dat.data())
+    return [plan.address, 0, (<char *>plan.dat.data())[:plan.size], bus]
+
+  def pack_into(self, PackPlan plan, const double[::1] values, uint8_t[::1] out):
+    """Packs a contiguous array of values into a caller owned buffer of at least plan.size bytes"""
+    self.check_plan(plan, values.shape[0])
+    if out.shape[0] < plan.size:
+      raise ValueError(f"output buffer needs {plan.size} bytes, got {out.shape[0]}")
+
+    cdef const double *vals = &values[0] if values.shape[0] > 0 else NULL
+    self.packer.pack(plan.plan_id, vals, &out[0])
@@ -12,17 +12,19 @@
 #include "msg.capnp.h"
 
 
-int64_t get_raw_value(const std::vector<uint8_t> &msg, const Signal &sig) {
+int64_t get_raw_value(const uint8_t *msg, size_t len, const SignalDecode &sig) {
   int64_t ret = 0;
 
-  int i = sig.msb / 8;
+  size_t i = sig.msb / 8;
   int bits = sig.size;
-  while (i >= 0 && i < msg.size() && bits > 0) {
-    int lsb = (int)(sig.lsb / 8) == i ? sig.lsb : i*8;
-    int msb = (int)(sig.msb / 8) == i ? sig.msb : (i+1)*8 - 1;
+  // for little endian signals i wraps around below byte 0, which also ends the loop
+  while (i < len && bits > 0) {
+    const int byte = i;
+    int lsb = sig.lsb / 8 == byte ? sig.lsb : byte*8;
+    int msb = sig.msb / 8 == byte ? sig.msb : (byte+1)*8 - 1;
     int size = msb - lsb + 1;
 
-    uint64_t d = (msg[i] >> (lsb - (i*8))) & ((1ULL << size) - 1);
+    uint64_t d = (msg[i] >> (lsb - byte*8)) & ((1ULL << size) - 1);
     ret |= d << (bits - size);
 
     bits -= size;
@@ -32,39 +34,122 @@ int64_t get_raw_value(const std::vector<uint8_t> &msg, const Signal &sig) {
 }
 
 
-bool MessageState::parse(uint64_t sec, const std::vector<uint8_t> &dat) {
-  for (int i = 0; i < parse_sigs.size(); i++) {
-    const auto &sig = parse_sigs[i];
+const MessageUnpacker *unpacker_lookup(const std::string &dbc_name, uint32_t address) {
+  for (const auto &d : get_dbc_unpackers()) {
+    if (dbc_name != d.name) continue;
 
-    int64_t tmp = get_raw_value(dat, sig);
-    if (sig.is_signed) {
-      tmp -= ((tmp >> (sig.size-1)) & 0x1) ? (1ULL << sig.size) : 0;
+    for (size_t i = 0; i < d.num_msgs; i++) {
+      if (d.msgs[i].address == address) {
+        return &d.msgs[i];
+      }
     }
+  }
+  return nullptr;
+}
+
+
+void SignalStore::add(const Signal &sig, uint32_t msg_address) {
+  sigs.push_back(&sig);
+  address.push_back(msg_address);
+  decode.push_back({
+    .factor = sig.factor,
+    .offset = sig.offset,
+    .msb = (int16_t)sig.msb,
+    .lsb = (int16_t)sig.lsb,
+    .unpack_idx = -1,
+    .size = (uint8_t)sig.size,
+    .is_signed = sig.is_signed,
+    .is_little_endian = sig.is_little_endian,
+    .type = sig.type,
+  });
+  vals.push_back(0);
+  ts_nanos.push_back(0);
+  updated.push_back(0);
+  // query_latest clears these without giving back the memory, so parsing doesn't allocate once warmed up
+  all_vals.emplace_back().reserve(ALL_VALUES_RESERVE);
+}
+
 
-    //DEBUG("parse 0x%X %s -> %ld\n", address, sig.name, tmp);
+void MessageState::setup_unpacker(const std::string &dbc_name, SignalStore &store) {
+  unpacker = unpacker_lookup(dbc_name, address);
+  if (unpacker == nullptr) return;
 
-    bool checksum_failed = false;
-    if (!ignore_checksum) {
-      if (sig.calc_checksum != nullptr && sig.calc_checksum(address, sig, dat) != tmp) {
-        checksum_failed = true;
+  // Only use the unpacker if it was generated from the same signal layout
+  for (uint32_t i = sig_begin; i < sig_end; i++) {
+    const Signal &sig = *store.sigs[i];
+    int idx = -1;
+    for (size_t j = 0; j < unpacker->num_sigs; j++) {
+      const SignalLayout &l = unpacker->sigs[j];
+      if (sig.name == l.name && sig.start_bit == l.start_bit && sig.size == l.size &&
+          sig.is_little_endian == l.is_little_endian && sig.is_signed == l.is_signed) {
+        idx = j;
+        break;
       }
     }
 
-    bool counter_failed = false;
-    if (!ignore_counter) {
-      if (sig.type == SignalType::COUNTER) {
-        counter_failed = !update_counter_generic(tmp, sig.size);
-      }
+    if (idx < 0) {
+      DEBUG("0x%X %s does not match the generated unpacker\n", address, sig.name.c_str());
+      unpacker = nullptr;
+      return;
     }
+    store.decode[i].unpack_idx = idx;
+  }
+  raw.resize(unpacker->num_sigs);
+}
 
-    if (checksum_failed || counter_failed) {
-      WARN("0x%X message checks failed, checksum failed %d, counter failed %d", address, checksum_failed, counter_failed);
-      return false;
+
+bool MessageState::parse(uint64_t sec, const uint8_t *dat, size_t len, SignalStore &store) {
+  const bool unpacked = unpacker != nullptr && len >= unpacker->min_size;
+  if (unpacked) {
+    unpacker->unpack(dat, raw.data());
+  }
+
+  auto raw_value = [&](const SignalDecode &sig) {
+    if (unpacked) {
+      return raw[sig.unpack_idx];
     }
+    int64_t tmp = get_raw_value(dat, len, sig);
+    if (sig.is_signed) {
+      tmp -= ((tmp >> (sig.size-1)) & 0x1) ? (1ULL << sig.size) : 0;
+    }
+    return tmp;
+  };
+
+  // Check the whole frame first, a frame that fails the checks doesn't touch any stored value
+  if (!ignore_checksum || !ignore_counter) {
+    for (uint32_t i = sig_begin; i < sig_end; i++) {
+      const SignalDecode &sig = store.decode[i];
+
+      bool checksum_failed = false;
+      if (!ignore_checksum) {
+        const Signal &dbc_sig = *store.sigs[i];
+        if (dbc_sig.calc_checksum != nullptr && dbc_sig.calc_checksum(address, dbc_sig, dat, len) != raw_value(sig)) {
+          checksum_failed = true;
+        }
+      }
 
-    // TODO: these may get updated if the invalid or checksum gets checked later
-    vals[i] = tmp * sig.factor + sig.offset;
-    all_vals[i].push_back(vals[i]);
+      bool counter_failed = false;
+      if (!ignore_counter) {
+        if (sig.type == SignalType::COUNTER) {
+          counter_failed = !update_counter_generic(raw_value(sig), sig.size);
+        }
+      }
+
+      if (checksum_failed || counter_failed) {
+        WARN("0x%X message checks failed, checksum failed %d, counter failed %d", address, checksum_failed, counter_failed);
+        return false;
+      }
+    }
+  }
+
+  for (uint32_t i = sig_begin; i < sig_end; i++) {
+    const SignalDecode &sig = store.decode[i];
+    //DEBUG("parse 0x%X %s -> %ld\n", address, sig.name, raw_value(sig));
+
+    store.vals[i] = raw_value(sig) * sig.factor + sig.offset;
+    store.all_vals[i].push_back(store.vals[i]);
+    store.ts_nanos[i] = sec;
+    store.updated[i] = 1;
   }
   last_seen_nanos = sec;
 
@@ -90,29 +175,38 @@ bool MessageState::update_counter_generic(int64_t v, int cnt_size) {
 }
 
 
+MessageState &CANParser::add_state(const Msg &msg) {
+  MessageState *existing = find_state(msg.address);
+  if (existing != nullptr) {
+    return *existing;
+  }
+
+  int16_t idx = message_states.size();
+  MessageState &state = message_states.emplace_back();
+  state.name = msg.name.c_str();
+  state.address = msg.address;
+  state.size = msg.size;
+  assert(state.size <= 64);  // max signal size is 64 bytes
+
+  if (msg.address < std_index.size()) {
+    std_index[msg.address] = idx;
+  } else {
+    auto entry = std::make_pair(msg.address, idx);
+    ext_index.insert(std::lower_bound(ext_index.begin(), ext_index.end(), entry), entry);
+  }
+  return state;
+}
+
 CANParser::CANParser(int abus, const std::string& dbc_name,
           const std::vector<MessageParseOptions> &options,
           const std::vector<SignalParseOptions> &sigoptions)
-  : bus(abus), aligned_buf(kj::heapArray<capnp::word>(1024)) {
+  : bus(abus), aligned_buf(kj::heapArray<capnp::word>(1024)), std_index(0x800, -1) {
   dbc = dbc_lookup(dbc_name);
   assert(dbc);
-  init_crc_lookup_tables();
 
   bus_timeout_threshold = std::numeric_limits<uint64_t>::max();
 
   for (const auto& op : options) {
-    MessageState &state = message_states[op.address];
-    state.address = op.address;
-    // state.check_frequency = op.check_frequency,
-
-    // msg is not valid if a message isn't received for 10 consecutive steps
-    if (op.check_frequency > 0) {
-      state.check_threshold = (1000000000ULL / op.check_frequency) * 10;
-
-      // bus timeout threshold should be 10x the fastest msg
-      bus_timeout_threshold = std::min(bus_timeout_threshold, state.check_threshold);
-    }
-
     const Msg* msg = NULL;
     for (const auto& m : dbc->msgs) {
       if (m.address == op.address) {
@@ -125,16 +219,24 @@ CANParser::CANParser(int abus, const std::string& dbc_name,
       assert(false);
     }
 
-    state.name = msg->name;
-    state.size = msg->size;
-    assert(state.size <= 64);  // max signal size is 64 bytes
+    MessageState &state = add_state(*msg);
+    // state.check_frequency = op.check_frequency,
+
+    // msg is not valid if a message isn't received for 10 consecutive steps
+    if (op.check_frequency > 0) {
+      state.check_threshold = (1000000000ULL / op.check_frequency) * 10;
+
+      // bus timeout threshold should be 10x the fastest msg
+      bus_timeout_threshold = std::min(bus_timeout_threshold, state.check_threshold);
+    }
+
+    // The signals of a message are stored together
+    state.sig_begin = signals.sigs.size();
 
     // track checksums and counters for this message
     for (const auto& sig : msg->sigs) {
       if (sig.type != SignalType::DEFAULT) {
-        state.parse_sigs.push_back(sig);
-        state.vals.push_back(0);
-        state.all_vals.push_back({});
+        signals.add(sig, msg->address);
       }
     }
 
@@ -144,41 +246,38 @@ CANParser::CANParser(int abus, const std::string& dbc_name,
 
       for (const auto& sig : msg->sigs) {
         if (sig.name == sigop.name && sig.type == SignalType::DEFAULT) {
-          state.parse_sigs.push_back(sig);
-          state.vals.push_back(0);
-          state.all_vals.push_back({});
+          signals.add(sig, msg->address);
           break;
         }
       }
     }
+
+    state.sig_end = signals.sigs.size();
   }
+
+  use_unpackers(true);
 }
 
 CANParser::CANParser(int abus, const std::string& dbc_name, bool ignore_checksum, bool ignore_counter)
-  : bus(abus) {
+  : bus(abus), std_index(0x800, -1) {
   // Add all messages and signals
 
   dbc = dbc_lookup(dbc_name);
   assert(dbc);
-  init_crc_lookup_tables();
 
   for (const auto& msg : dbc->msgs) {
-    MessageState state = {
-      .name = msg.name,
-      .address = msg.address,
-      .size = msg.size,
-      .ignore_checksum = ignore_checksum,
-      .ignore_counter = ignore_counter,
-    };
+    MessageState &state = add_state(msg);
+    state.ignore_checksum = ignore_checksum;
+    state.ignore_counter = ignore_counter;
 
+    state.sig_begin = signals.sigs.size();
     for (const auto& sig : msg.sigs) {
-      state.parse_sigs.push_back(sig);
-      state.vals.push_back(0);
-      state.all_vals.push_back({});
+      signals.add(sig, msg.address);
     }
-
-    message_states[state.address] = state;
+    state.sig_end = signals.sigs.size();
   }
+
+  use_unpackers(true);
 }
 
 #ifndef DYNAMIC_CAPNP
@@ -216,6 +315,13 @@ void CANParser::update_strings(const std::vector<std::string> &data, std::vector
   query_latest(vals, current_sec);
 }
 
+void CANParser::update(const std::vector<std::string> &data, bool sendcan) {
+  ClearUpdated();
+  for (const auto &d : data) {
+    update_string(d, sendcan);
+  }
+}
+
 void CANParser::UpdateCans(uint64_t sec, const capnp::List<CanData>::Reader& cans) {
   //DEBUG("got %d messages\n", cans.size());
 
@@ -229,35 +335,11 @@ void CANParser::UpdateCans(uint64_t sec, const capnp::List<CanData>::Reader& can
     }
     bus_empty = false;
 
-    auto state_it = message_states.find(cmsg.getAddress());
-    if (state_it == message_states.end()) {
-      // DEBUG("skip %d: not specified\n", cmsg.getAddress());
-      continue;
-    }
-
     auto dat = cmsg.getDat();
-
-    if (dat.size() > 64) {
-      DEBUG("got message longer than 64 bytes: 0x%X %zu\n", cmsg.getAddress(), dat.size());
-      continue;
-    }
-
-    // TODO: this actually triggers for some cars. fix and enable this
-    //if (dat.size() != state_it->second.size) {
-    //  DEBUG("got message with unexpected length: expected %d, got %zu for %d", state_it->second.size, dat.size(), cmsg.getAddress());
-    //  continue;
-    //}
-
-    std::vector<uint8_t> data(dat.size(), 0);
-    memcpy(data.data(), dat.begin(), dat.size());
-    state_it->second.parse(sec, data);
+    UpdateFrame(sec, cmsg.getRxAgeUs(), cmsg.getAddress(), dat.begin(), dat.size());
   }
 
-  // update bus timeout
-  if (!bus_empty) {
-    last_nonempty_sec = sec;
-  }
-  bus_timeout = (sec - last_nonempty_sec) > bus_timeout_threshold;
+  UpdateBusTimeout(sec, bus_empty);
 }
 #endif
 
@@ -270,17 +352,51 @@ void CANParser::UpdateCans(uint64_t sec, const capnp::DynamicStruct::Reader& cms
     return;
   }
 
-  auto state_it = message_states.find(cmsg.get("address").as<uint32_t>());
-  if (state_it == message_states.end()) {
-    DEBUG("skip %d: not specified\n", cmsg.get("address").as<uint32_t>());
-    return;
+  // schemas from before rxAgeUs don't have it
+  uint16_t rx_age_us = 0;
+  KJ_IF_MAYBE(field, cmsg.getSchema().findFieldByName("rxAgeUs")) {
+    rx_age_us = cmsg.get(*field).as<uint16_t>();
   }
 
   auto dat = cmsg.get("dat").as<capnp::Data>();
-  if (dat.size() > 64) return; // shouldn't ever happen
-  std::vector<uint8_t> data(dat.size(), 0);
-  memcpy(data.data(), dat.begin(), dat.size());
-  state_it->second.parse(sec, data);
+  UpdateFrame(sec, rx_age_us, cmsg.get("address").as<uint32_t>(), dat.begin(), dat.size());
+}
+
+void CANParser::UpdateFrame(uint64_t sec, uint16_t rx_age_us, uint32_t address, const uint8_t *dat, size_t len) {
+  MessageState *state = find_state(address);
+  if (state == nullptr) {
+    // DEBUG("skip %d: not specified\n", address);
+    return;
+  }
+
+  if (len > 64) {
+    DEBUG("got message longer than 64 bytes: 0x%X %zu\n", address, len);
+    return;
+  }
+
+  // TODO: this actually triggers for some cars. fix and enable this
+  //if (len != state->size) {
+  //  DEBUG("got message with unexpected length: expected %d, got %zu for %d", state->size, len, address);
+  //  return;
+  //}
+
+  // timestamped frames count from when the panda received them, rxAgeUs us before the event
+  state->last_event_nanos = sec;
+  state->parse(sec - std::min<uint64_t>(rx_age_us * 1000ULL, sec), dat, len, signals);
+}
+
+void CANParser::UpdateBusTimeout(uint64_t sec, bool bus_empty) {
+  if (!bus_empty) {
+    last_nonempty_sec = sec;
+  }
+  bus_timeout = (sec - last_nonempty_sec) > bus_timeout_threshold;
+}
+
+void CANParser::ClearUpdated() {
+  std::fill(signals.updated.begin(), signals.updated.end(), 0);
+  for (auto &v : signals.all_vals) {
+    v.clear();
+  }
 }
 
 void CANParser::UpdateValid(uint64_t sec) {
@@ -288,9 +404,7 @@ void CANParser::UpdateValid(uint64_t sec) {
 
   bool _valid = true;
   bool _counters_valid = true;
-  for (const auto& kv : message_states) {
-    const auto& state = kv.second;
-
+  for (const auto& state : message_states) {
     if (state.counter_fail >= MAX_BAD_COUNTER) {
       _counters_valid = false;
     }
@@ -301,9 +415,9 @@ void CANParser::UpdateValid(uint64_t sec) {
       if (bus_timeout) {
         WARN("Bus timeout!");
       } else if (missing) {
-        WARN("0x%X '%s' NOT SEEN", state.address, state.name.c_str());
+        WARN("0x%X '%s' NOT SEEN", state.address, state.name);
       } else if (timed_out) {
-        WARN("0x%X '%s' TIMED OUT", state.address, state.name.c_str());
+        WARN("0x%X '%s' TIMED OUT", state.address, state.name);
       }
       _valid = false;
     }
@@ -312,25 +426,97 @@ void CANParser::UpdateValid(uint64_t sec) {
   can_valid = (can_invalid_cnt < CAN_INVALID_CNT) && _counters_valid;
 }
 
+void CANParser::use_unpackers(bool enable) {
+  // DBCs are looked up by file name
+  std::string dbc_name = dbc->name;
+  if (dbc_name.size() > 4 && dbc_name.compare(dbc_name.size() - 4, 4, ".dbc") == 0) {
+    dbc_name.resize(dbc_name.size() - 4);
+  }
+
+  for (auto &state : message_states) {
+    if (enable) {
+      state.setup_unpacker(dbc_name, signals);
+    } else {
+      state.unpacker = nullptr;
+    }
+  }
+}
+
 void CANParser::query_latest(std::vector<SignalValue> &vals, uint64_t last_ts) {
   if (last_ts == 0) {
     last_ts = last_sec;
   }
-  for (auto& kv : message_states) {
-    auto& state = kv.second;
-    if (last_ts != 0 && state.last_seen_nanos < last_ts) {
+  for (const auto& state : message_states) {
+    if (last_ts != 0 && state.last_event_nanos < last_ts) {
       continue;
     }
 
-    for (int i = 0; i < state.parse_sigs.size(); i++) {
-      const Signal &sig = state.parse_sigs[i];
+    for (uint32_t i = state.sig_begin; i < state.sig_end; i++) {
       SignalValue &v = vals.emplace_back();
       v.address = state.address;
       v.ts_nanos = state.last_seen_nanos;
-      v.name = sig.name;
-      v.value = state.vals[i];
-      v.all_values = state.all_vals[i];
-      state.all_vals[i].clear();
+      v.name = signals.sigs[i]->name;
+      v.value = signals.vals[i];
+      v.all_values = signals.all_vals[i];
+      signals.all_vals[i].clear();
     }
   }
 }
+
+CANParserGroup::CANParserGroup() : aligned_buf(kj::heapArray<capnp::word>(1024)) {}
+
+void CANParserGroup::add(CANParser *parser) {
+  assert(parser->bus >= 0 && parser->bus < 256);
+  parsers.push_back(parser);
+  bus_parsers[parser->bus].push_back(parser);
+}
+
+#ifndef DYNAMIC_CAPNP
+void CANParserGroup::update_string(const std::string &data, bool sendcan) {
+  // one aligned copy and reader for all parsers
+  const size_t buf_size = (data.length() / sizeof(capnp::word)) + 1;
+  if (aligned_buf.size() < buf_size) {
+    aligned_buf = kj::heapArray<capnp::word>(buf_size);
+  }
+  memcpy(aligned_buf.begin(), data.data(), data.length());
+
+  capnp::FlatArrayMessageReader cmsg(aligned_buf.slice(0, buf_size));
+  Event::Reader event = cmsg.getRoot<Event>();
+  const uint64_t sec = event.getLogMonoTime();
+
+  for (CANParser *p : parsers) {
+    if (p->first_sec == 0) {
+      p->first_sec = sec;
+    }
+    p->last_sec = sec;
+  }
+
+  bool bus_seen[256] = {};
+  for (const auto frame : (sendcan ? event.getSendcan() : event.getCan())) {
+    const uint8_t src = frame.getSrc();
+    bus_seen[src] = true;
+
+    const auto &bus = bus_parsers[src];
+    if (bus.empty()) continue;
+
+    auto dat = frame.getDat();
+    for (CANParser *p : bus) {
+      p->UpdateFrame(sec, frame.getRxAgeUs(), frame.getAddress(), dat.begin(), dat.size());
+    }
+  }
+
+  for (CANParser *p : parsers) {
+    p->UpdateBusTimeout(sec, !bus_seen[p->bus]);
+    p->UpdateValid(sec);
+  }
+}
+
+void CANParserGroup::update(const std::vector<std::string> &data, bool sendcan) {
+  for (CANParser *p : parsers) {
+    p->ClearUpdated();
+  }
+  for (const auto &d : data) {
+    update_string(d, sendcan);
+  }
+}
+#endif
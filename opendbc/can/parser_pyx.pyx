@@ -1,34 +1,58 @@
 # distutils: language = c++
 # cython: c_string_encoding=ascii, language_level=3
 
-from cython.operator cimport dereference as deref, preincrement as preinc
 from libcpp.string cimport string
 from libcpp.vector cimport vector
 from libcpp.unordered_set cimport unordered_set
-from libc.stdint cimport uint32_t, uint64_t, uint16_t
+from libc.stdint cimport uint8_t, uint32_t, uint64_t, uint16_t
 from libcpp cimport bool
 from libcpp.map cimport map
 
 from .common cimport CANParser as cpp_CANParser
-from .common cimport SignalParseOptions, MessageParseOptions, dbc_lookup, SignalValue, DBC
+from .common cimport CANParserGroup as cpp_CANParserGroup
+from .common cimport SignalParseOptions, MessageParseOptions, dbc_lookup, DBC
 
 import os
 import numbers
 from collections import defaultdict
+from collections.abc import Mapping
+
+import numpy as np
+
+# what a SignalDict reads for each signal
+cdef enum:
+  SIGNAL_VALUE
+  SIGNAL_ALL_VALUES
+  SIGNAL_TS_NANOS
 
 
 cdef class CANParser:
+  """
+    Every tracked signal gets an id when the parser is constructed, signal_ids[msg][sig] with msg
+    as name or address. update_strings writes straight into arrays indexed by that id:
+      values      latest value of each signal
+      timestamps  logMonoTime of the frame it was last parsed from
+      updated     whether it was parsed by the last update_strings call
+    These are read only numpy views of the parser's own storage, they don't change identity between calls.
+
+    vl, vl_all and ts_nanos are the older dict interface, built on first use as views of the same arrays.
+  """
   cdef:
     cpp_CANParser *can
     const DBC *dbc
     map[uint32_t, string] address_to_msg_name
-    vector[SignalValue] can_values
+    dict msg_name_to_address
+    size_t num_signals
+    dict _vl
+    dict _vl_all
+    dict _ts_nanos
 
   cdef readonly:
-    dict vl
-    dict vl_all
-    dict ts_nanos
     string dbc_name
+    dict signal_ids
+    object values
+    object timestamps
+    object updated
 
   def __init__(self, dbc_name, signals, checks=None, bus=0, enforce_checks=True):
     if checks is None:
@@ -39,10 +63,9 @@ cdef class CANParser:
     if not self.dbc:
       raise RuntimeError(f"Can't find DBC: {dbc_name}")
 
-    self.vl = {}
-    self.vl_all = {}
-    self.ts_nanos = {}
-    msg_name_to_address = {}
+    self.msg_name_to_address = {}
+    self.signal_ids = {}
+    msg_name_to_address = self.msg_name_to_address
 
     for i in range(self.dbc[0].msgs.size()):
       msg = self.dbc[0].msgs[i]
@@ -50,12 +73,8 @@ cdef class CANParser:
 
       msg_name_to_address[name] = msg.address
       self.address_to_msg_name[msg.address] = name
-      self.vl[msg.address] = {}
-      self.vl[name] = self.vl[msg.address]
-      self.vl_all[msg.address] = {}
-      self.vl_all[name] = self.vl_all[msg.address]
-      self.ts_nanos[msg.address] = {}
-      self.ts_nanos[name] = self.ts_nanos[msg.address]
+      self.signal_ids[msg.address] = {}
+      self.signal_ids[name] = self.signal_ids[msg.address]
 
     # Convert message names into addresses
     for i in range(len(signals)):
@@ -102,30 +121,66 @@ cdef class CANParser:
       message_options_v.push_back(mpo)
 
     self.can = new cpp_CANParser(bus, dbc_name, message_options_v, signal_options_v)
-    self.update_strings([])
+
+    self.num_signals = self.can.num_signals()
+    for i in range(self.num_signals):
+      self.signal_ids[self.can.signal_address(i)][<unicode>self.can.signal_name(i)] = i
+
+    if self.num_signals > 0:
+      self.values = np.asarray(<double[:self.num_signals]> <double *> self.can.values())
+      self.timestamps = np.asarray(<uint64_t[:self.num_signals]> <uint64_t *> self.can.ts_nanos())
+      self.updated = np.asarray(<uint8_t[:self.num_signals]> <uint8_t *> self.can.updated()).view(np.bool_)
+    else:
+      self.values = np.zeros(0, dtype=np.float64)
+      self.timestamps = np.zeros(0, dtype=np.uint64)
+      self.updated = np.zeros(0, dtype=np.bool_)
+    for a in (self.values, self.timestamps, self.updated):
+      a.flags.writeable = False
 
   def update_strings(self, strings, sendcan=False):
-    for v in self.vl_all.values():
-      for l in v.values():
-        l.clear()
+    self.can.update(strings, sendcan)
+    return self.updated_addresses()
 
-    cdef vector[SignalValue] new_vals
+  cdef updated_addresses(self):
     cdef unordered_set[uint32_t] updated_addrs
+    cdef const uint8_t *updated = self.can.updated()
+    cdef size_t i
+    for i in range(self.num_signals):
+      if updated[i]:
+        updated_addrs.insert(self.can.signal_address(i))
+    return updated_addrs
 
-    self.can.update_strings(strings, new_vals, sendcan)
-    cdef vector[SignalValue].iterator it = new_vals.begin()
-    cdef SignalValue* cv
-    while it != new_vals.end():
-      cv = &deref(it)
-      # Cast char * directly to unicode
-      cv_name = <unicode>cv.name
-      self.vl[cv.address][cv_name] = cv.value
-      self.vl_all[cv.address][cv_name] = cv.all_values
-      self.ts_nanos[cv.address][cv_name] = cv.ts_nanos
-      updated_addrs.insert(cv.address)
-      preinc(it)
+  cdef object signal_value(self, size_t i, int kind):
+    if kind == SIGNAL_VALUE:
+      return self.can.values()[i]
+    elif kind == SIGNAL_ALL_VALUES:
+      return self.can.all_values(i)
+    return self.can.ts_nanos()[i]
 
-    return updated_addrs
+  cdef dict signal_dicts(self, int kind):
+    # names and addresses share the same dict, like signal_ids
+    cdef dict dicts = {}
+    for name, address in self.msg_name_to_address.items():
+      dicts[address] = dicts[name] = SignalDict(self, self.signal_ids[address], kind)
+    return dicts
+
+  @property
+  def vl(self):
+    if self._vl is None:
+      self._vl = self.signal_dicts(SIGNAL_VALUE)
+    return self._vl
+
+  @property
+  def vl_all(self):
+    if self._vl_all is None:
+      self._vl_all = self.signal_dicts(SIGNAL_ALL_VALUES)
+    return self._vl_all
+
+  @property
+  def ts_nanos(self):
+    if self._ts_nanos is None:
+      self._ts_nanos = self.signal_dicts(SIGNAL_TS_NANOS)
+    return self._ts_nanos
 
   @property
   def can_valid(self):
@@ -136,6 +191,83 @@ cdef class CANParser:
     return self.can.bus_timeout
 
 
+cdef class CANParserGroup:
+  """
+    Updates several CANParsers from the same strings, parsing each event once and handing
+    every frame only to the parsers on its bus. Parsers in a group shouldn't be updated on their own.
+  """
+  cdef:
+    cpp_CANParserGroup *group
+    list parsers
+
+  def __init__(self, parsers):
+    self.group = new cpp_CANParserGroup()
+    self.parsers = list(parsers)
+    for p in self.parsers:
+      if p is not None:
+        self.group.add((<CANParser?>p).can)
+
+  def update_strings(self, strings, sendcan=False):
+    """Returns the updated addresses of each parser, like CANParser.update_strings. None entries stay None"""
+    self.group.update(strings, sendcan)
+    return [None if p is None else (<CANParser>p).updated_addresses() for p in self.parsers]
+
+
+cdef class SignalDict:
+  """Read only dict of the signals of one message, reading the current values from its CANParser"""
+  cdef:
+    CANParser parser
+    dict ids
+    int kind
+
+  def __init__(self, CANParser parser, dict ids, int kind):
+    self.parser = parser
+    self.ids = ids
+    self.kind = kind
+
+  def __getitem__(self, name):
+    return self.parser.signal_value(self.ids[name], self.kind)
+
+  def __contains__(self, name):
+    return name in self.ids
+
+  def __len__(self):
+    return len(self.ids)
+
+  def __iter__(self):
+    return iter(self.ids)
+
+  def get(self, name, default=None):
+    return self[name] if name in self.ids else default
+
+  def keys(self):
+    return self.ids.keys()
+
+  def values(self):
+    return [self[name] for name in self.ids]
+
+  def items(self):
+    return [(name, self[name]) for name in self.ids]
+
+  def iteritems(self):
+    return iter(self.items())
+
+  def copy(self):
+    return dict(self.items())
+
+  def __copy__(self):
+    return self.copy()
+
+  def __eq__(self, other):
+    return self.copy() == (other.copy() if isinstance(other, SignalDict) else other)
+
+  def __repr__(self):
+    return repr(self.copy())
+
+
+Mapping.register(SignalDict)
+
+
 cdef class CANDefine():
   cdef:
     const DBC *dbc
@@ -0,0 +1,61 @@
+// Time per message of every table based checksum, against the previous implementations.
+// usage: benchmark_crc [iterations]
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "checksums_reference.h"
+
+typedef unsigned int (*checksum_fn)(uint32_t address, const Signal &sig, const uint8_t *d, size_t len);
+
+struct Checksum {
+  const char *name;
+  checksum_fn fn, ref;
+  uint32_t address;
+  size_t len;
+};
+
+// payloads are rotated so the checksum of one can't be hoisted out of the loop
+static double time_ns(checksum_fn fn, uint32_t address, const std::vector<std::vector<uint8_t>> &payloads, int iterations) {
+  const Signal sig = {};
+  unsigned int sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    const auto &d = payloads[i % payloads.size()];
+    sink += fn(address, sig, d.data(), d.size());
+  }
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  volatile unsigned int keep = sink;
+  (void)keep;
+  return ns / iterations;
+}
+
+int main(int argc, char *argv[]) {
+  const int iterations = argc > 1 ? std::stoi(argv[1]) : 10000000;
+  ref_init_crc_lookup_tables();
+
+  const Checksum checksums[] = {
+    {"chrysler_checksum", chrysler_checksum, ref_chrysler_checksum, 0x292, 8},
+    {"volkswagen_mqb_checksum", volkswagen_mqb_checksum, ref_volkswagen_mqb_checksum, 0x126, 8},
+    {"pedal_checksum", pedal_checksum, ref_pedal_checksum, 0x200, 6},
+    {"hkg_can_fd_checksum", hkg_can_fd_checksum, ref_hkg_can_fd_checksum, 0x50, 8},
+    {"hkg_can_fd_checksum", hkg_can_fd_checksum, ref_hkg_can_fd_checksum, 0x50, 32},
+    {"hkg_can_fd_checksum", hkg_can_fd_checksum, ref_hkg_can_fd_checksum, 0x50, 64},
+  };
+
+  std::mt19937 rng(0);
+  printf("%-24s %4s %10s %10s\n", "checksum", "len", "old ns", "new ns");
+  for (const auto &c : checksums) {
+    std::vector<std::vector<uint8_t>> payloads(64, std::vector<uint8_t>(c.len));
+    for (auto &d : payloads) {
+      for (auto &b : d) b = rng();
+    }
+    double ref_ns = time_ns(c.ref, c.address, payloads, iterations);
+    double new_ns = time_ns(c.fn, c.address, payloads, iterations);
+    printf("%-24s %4zu %10.2f %10.2f\n", c.name, c.len, ref_ns, new_ns);
+  }
+  return 0;
+}
@@ -0,0 +1,78 @@
+// Startup cost of every DBC: parsing the text file against loading the binary cache.
+// usage: benchmark_dbc_parse [dbc names]
+// Also checks that the cached DBCs are identical to the parsed ones.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "common_dbc.h"
+
+static bool same_signals(const std::vector<Signal> &a, const std::vector<Signal> &b) {
+  return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](const Signal &x, const Signal &y) {
+    return x.name == y.name && x.start_bit == y.start_bit && x.msb == y.msb && x.lsb == y.lsb && x.size == y.size &&
+           x.is_signed == y.is_signed && x.factor == y.factor && x.offset == y.offset &&
+           x.is_little_endian == y.is_little_endian && x.type == y.type && x.calc_checksum == y.calc_checksum;
+  });
+}
+
+static bool same_dbc(const DBC &a, const DBC &b) {
+  if (a.name != b.name || a.msgs.size() != b.msgs.size() || a.vals.size() != b.vals.size()) return false;
+  for (size_t i = 0; i < a.msgs.size(); i++) {
+    const Msg &x = a.msgs[i], &y = b.msgs[i];
+    if (x.name != y.name || x.address != y.address || x.size != y.size || !same_signals(x.sigs, y.sigs)) return false;
+  }
+  for (size_t i = 0; i < a.vals.size(); i++) {
+    const Val &x = a.vals[i], &y = b.vals[i];
+    if (x.name != y.name || x.address != y.address || x.def_val != y.def_val || !same_signals(x.sigs, y.sigs)) return false;
+  }
+  return true;
+}
+
+template <typename F>
+static double time_us(F f) {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[]) {
+  std::vector<std::string> names = argc > 1 ? std::vector<std::string>(argv + 1, argv + argc) : get_dbc_names();
+  std::sort(names.begin(), names.end());
+
+  char tmpl[] = "/tmp/dbc_cache_XXXXXX";
+  const std::string cache_dir = mkdtemp(tmpl);
+
+  double parse_total = 0, load_total = 0;
+  int failed = 0;
+  printf("%-55s %10s %10s\n", "dbc", "parse us", "cache us");
+  for (const auto &name : names) {
+    const std::string dbc_path = get_dbc_root_path() + "/" + name + ".dbc";
+    const std::string cache_path = cache_dir + "/" + name + ".bin";
+
+    DBC *parsed = nullptr, *cached = nullptr;
+    double parse_us = time_us([&] { parsed = dbc_parse(dbc_path); });
+    if (parsed == nullptr || !dbc_cache_write(cache_path, dbc_path, *parsed)) {
+      printf("%-55s failed to parse or write cache\n", name.c_str());
+      failed++;
+      continue;
+    }
+    double load_us = time_us([&] { cached = dbc_cache_load(cache_path, dbc_path); });
+
+    bool same = cached != nullptr && same_dbc(*parsed, *cached);
+    printf("%-55s %10.1f %10.1f%s\n", name.c_str(), parse_us, load_us, same ? "" : "  MISMATCH");
+    failed += !same;
+    parse_total += parse_us;
+    load_total += load_us;
+
+    delete parsed;
+    delete cached;
+  }
+  printf("%-55s %10.1f %10.1f\n", "total", parse_total, load_total);
+
+  std::filesystem::remove_all(cache_dir);
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,65 @@
+#!/usr/bin/env python3
+# Packs every message of a few DBCs with make_can_msg, make_can_msg_plan and pack_into.
+# usage: benchmark_packer.py [dbc names]
+# Also checks that all three produce the same bytes.
+import random
+import sys
+import time
+
+import numpy as np
+
+from opendbc import DBC_PATH
+from opendbc.can.packer import CANPacker
+from opendbc.generator.unpacker import parse_dbc
+
+DBCS = ["toyota_nodsu_pt_generated", "honda_civic_touring_2016_can_generated", "hyundai_canfd"]
+PASSES = 200
+
+
+def signal_values(dbc_name):
+  # every signal except the ones the packer fills in
+  rng = random.Random(0)
+  msgs = {}
+  for msg in parse_dbc(f"{DBC_PATH}/{dbc_name}.dbc"):
+    sigs = [s["name"] for s in msg["sigs"] if s["name"] not in ("COUNTER", "CHECKSUM")]
+    msgs[msg["name"]] = {s: float(rng.randint(0, 3)) for s in sigs}
+  return msgs
+
+
+def benchmark(dbc_name):
+  msgs = signal_values(dbc_name)
+  packers = [CANPacker(dbc_name) for _ in range(3)]
+  plans = {name: (packers[1].make_plan(name, list(v)), packers[2].make_plan(name, list(v))) for name, v in msgs.items()}
+  lists = {name: list(v.values()) for name, v in msgs.items()}
+  arrays = {name: np.array(v, dtype=np.float64) for name, v in lists.items()}
+  bufs = {name: bytearray(plans[name][0].size) for name in msgs}
+
+  times = [0, 0, 0]
+  mismatches = 0
+  for _ in range(PASSES):
+    t0 = time.perf_counter_ns()
+    dict_dats = [packers[0].make_can_msg(name, 0, v)[2] for name, v in msgs.items()]
+    t1 = time.perf_counter_ns()
+    plan_dats = [packers[1].make_can_msg_plan(plans[name][0], 0, lists[name])[2] for name in msgs]
+    t2 = time.perf_counter_ns()
+    for name in msgs:
+      packers[2].pack_into(plans[name][1], arrays[name], bufs[name])
+    t3 = time.perf_counter_ns()
+
+    times[0] += t1 - t0
+    times[1] += t2 - t1
+    times[2] += t3 - t2
+    mismatches += sum(a != b or a != bytes(bufs[name]) for a, b, name in zip(dict_dats, plan_dats, msgs))
+
+  n = PASSES * len(msgs)
+  print(f"{dbc_name}: {len(msgs)} messages")
+  for label, t in zip(("make_can_msg", "make_can_msg_plan", "pack_into"), times):
+    print(f"  {label:<18} {t / n:8.0f} ns per message")
+  print(f"  {mismatches} mismatches")
+  return mismatches == 0
+
+
+if __name__ == "__main__":
+  dbcs = sys.argv[1:] or DBCS
+  ok = all([benchmark(d) for d in dbcs])
+  sys.exit(0 if ok else 1)
@@ -0,0 +1,116 @@
+// Three parsers updated one by one against the same parsers in a CANParserGroup.
+// usage: benchmark_parser_group [seconds of driving]
+// Simulates a Toyota: powertrain on bus 0, camera on bus 2 with the same DBC, radar on bus 1.
+// Every message is sent at 100, 50, 20 or 10 Hz, packed into one can event per 10 ms.
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <capnp/message.h>
+#include <capnp/serialize.h>
+
+#include "common.h"
+#include "msg.capnp.h"
+
+struct Bus {
+  int bus;
+  const char *dbc;
+};
+
+static const Bus buses[] = {
+  {0, "toyota_nodsu_pt_generated"},
+  {1, "toyota_adas"},
+  {2, "toyota_nodsu_pt_generated"},
+};
+
+static std::vector<std::string> build_events(int seconds) {
+  const int rates[] = {100, 50, 20, 10};
+  std::mt19937 rng(0);
+
+  std::vector<std::string> events;
+  size_t frames = 0;
+  for (int tick = 0; tick < seconds * 100; tick++) {
+    std::vector<std::pair<int, const Msg *>> due;
+    for (const auto &b : buses) {
+      const DBC *dbc = dbc_lookup(b.dbc);
+      for (size_t i = 0; i < dbc->msgs.size(); i++) {
+        if (tick % (100 / rates[i % 4]) == 0) {
+          due.push_back({b.bus, &dbc->msgs[i]});
+        }
+      }
+    }
+
+    capnp::MallocMessageBuilder msg;
+    Event::Builder event = msg.initRoot<Event>();
+    event.setLogMonoTime((tick + 1) * 10000000ULL);
+    auto cans = event.initCan(due.size());
+    for (size_t i = 0; i < due.size(); i++) {
+      std::vector<uint8_t> dat(due[i].second->size);
+      for (auto &d : dat) d = rng();
+      cans[i].setAddress(due[i].second->address);
+      cans[i].setSrc(due[i].first);
+      cans[i].setDat(kj::arrayPtr(dat.data(), dat.size()));
+    }
+    frames += due.size();
+
+    auto words = capnp::messageToFlatArray(msg);
+    events.emplace_back((const char *)words.begin(), words.size() * sizeof(capnp::word));
+  }
+  printf("%zu events, %.0f frames per second\n", events.size(), (double)frames / seconds);
+  return events;
+}
+
+static std::vector<std::unique_ptr<CANParser>> make_parsers() {
+  std::vector<std::unique_ptr<CANParser>> parsers;
+  for (const auto &b : buses) {
+    // Checksums and counters would fail on random data
+    parsers.emplace_back(new CANParser(b.bus, b.dbc, true, true));
+  }
+  return parsers;
+}
+
+int main(int argc, char *argv[]) {
+  const int seconds = argc > 1 ? std::stoi(argv[1]) : 60;
+  const std::vector<std::string> events = build_events(seconds);
+
+  auto separate = make_parsers();
+  auto grouped = make_parsers();
+  CANParserGroup group;
+  for (auto &p : grouped) {
+    group.add(p.get());
+  }
+
+  double separate_ms = 0, group_ms = 0;
+  size_t mismatches = 0, compared = 0;
+  for (size_t i = 0; i < events.size(); i++) {
+    const std::vector<std::string> batch = {events[i]};
+
+    auto start = std::chrono::steady_clock::now();
+    for (auto &p : separate) {
+      p->update(batch, false);
+    }
+    auto mid = std::chrono::steady_clock::now();
+    group.update(batch, false);
+    auto end = std::chrono::steady_clock::now();
+
+    separate_ms += std::chrono::duration<double, std::milli>(mid - start).count();
+    group_ms += std::chrono::duration<double, std::milli>(end - mid).count();
+
+    for (size_t j = 0; j < separate.size(); j++) {
+      const CANParser &a = *separate[j], &b = *grouped[j];
+      mismatches += a.can_valid != b.can_valid || a.bus_timeout != b.bus_timeout;
+      for (size_t id = 0; id < a.num_signals(); id++, compared++) {
+        mismatches += a.values()[id] != b.values()[id] || a.ts_nanos()[id] != b.ts_nanos()[id] ||
+                      a.updated()[id] != b.updated()[id] || a.all_values(id) != b.all_values(id);
+      }
+    }
+  }
+
+  printf("separate %8.2f ms, %6.2f us per event\n", separate_ms, separate_ms * 1e3 / events.size());
+  printf("group    %8.2f ms, %6.2f us per event\n", group_ms, group_ms * 1e3 / events.size());
+  printf("%zu signal values compared, %zu mismatches\n", compared, mismatches);
+  return mismatches == 0 ? 0 : 1;
+}
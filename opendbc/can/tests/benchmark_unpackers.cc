@@ -0,0 +1,116 @@
+// Replays a can stream through CANParser with and without the generated unpackers.
+// usage: benchmark_unpackers <dbc name> [can events] [bus]
+// The events file holds only can events from a route, for example written with
+//   f.write(b"".join(m.as_builder().to_bytes() for m in LogReader(rlog) if m.which() == "can"))
+// Without one, random frames for every message in the DBC are used.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <capnp/message.h>
+#include <capnp/serialize.h>
+
+#include "common.h"
+#include "msg.capnp.h"
+
+static std::vector<std::string> read_can_events(const std::string &path) {
+  std::ifstream f(path, std::ios::binary);
+  std::string raw((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+
+  kj::Array<capnp::word> buf = kj::heapArray<capnp::word>(raw.size() / sizeof(capnp::word) + 1);
+  memcpy(buf.begin(), raw.data(), raw.size());
+
+  std::vector<std::string> events;
+  kj::ArrayPtr<const capnp::word> words(buf.begin(), raw.size() / sizeof(capnp::word));
+  while (words.size() > 0) {
+    capnp::FlatArrayMessageReader reader(words);
+    const capnp::word *end = reader.getEnd();
+    events.emplace_back((const char *)words.begin(), (end - words.begin()) * sizeof(capnp::word));
+    words = kj::arrayPtr(end, words.end());
+  }
+  return events;
+}
+
+static std::vector<std::string> random_can_events(const DBC *dbc, int bus, int n) {
+  std::mt19937 rng(0);
+  std::vector<std::string> events;
+  for (int i = 0; i < n; i++) {
+    capnp::MallocMessageBuilder msg;
+    Event::Builder event = msg.initRoot<Event>();
+    event.setLogMonoTime((i + 1) * 10000000ULL);
+
+    auto cans = event.initCan(dbc->msgs.size());
+    for (size_t j = 0; j < dbc->msgs.size(); j++) {
+      std::vector<uint8_t> dat(dbc->msgs[j].size);
+      for (auto &b : dat) b = rng();
+      cans[j].setAddress(dbc->msgs[j].address);
+      cans[j].setSrc(bus);
+      cans[j].setDat(kj::arrayPtr(dat.data(), dat.size()));
+    }
+
+    auto words = capnp::messageToFlatArray(msg);
+    events.emplace_back((const char *)words.begin(), words.size() * sizeof(capnp::word));
+  }
+  return events;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    printf("usage: %s <dbc name> [can events] [bus]\n", argv[0]);
+    return 1;
+  }
+  const std::string dbc_name = argv[1];
+  const int bus = argc > 3 ? std::stoi(argv[3]) : 0;
+
+  const DBC *dbc = dbc_lookup(dbc_name);
+  if (dbc == nullptr) {
+    printf("can't find DBC: %s\n", dbc_name.c_str());
+    return 1;
+  }
+
+  std::vector<std::string> events = argc > 2 ? read_can_events(argv[2]) : random_can_events(dbc, bus, 1000);
+  size_t frames = 0;
+  for (const auto &e : events) {
+    capnp::FlatArrayMessageReader reader(kj::ArrayPtr<const capnp::word>((const capnp::word *)e.data(), e.size() / sizeof(capnp::word)));
+    frames += reader.getRoot<Event>().getCan().size();
+  }
+  printf("%zu events, %zu frames\n", events.size(), frames);
+
+  const int passes = 20;
+  std::vector<SignalValue> results[2];
+  for (int unpack = 0; unpack < 2; unpack++) {
+    // Checksums and counters would fail on random data
+    CANParser parser(bus, dbc_name, true, true);
+    parser.use_unpackers(unpack);
+
+    double total_ms = 0;
+    for (int p = 0; p < passes; p++) {
+      auto start = std::chrono::steady_clock::now();
+      for (const auto &e : events) {
+        parser.update_string(e, false);
+      }
+      total_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+      results[unpack].clear();
+      parser.query_latest(results[unpack], 1);
+    }
+
+    printf("%-8s %8.2f ms per pass, %6.1f ns per frame\n", unpack ? "unpacker" : "generic",
+           total_ms / passes, total_ms / passes * 1e6 / std::max<size_t>(frames, 1));
+  }
+
+  size_t mismatches = 0;
+  for (size_t i = 0; i < std::min(results[0].size(), results[1].size()); i++) {
+    const auto &a = results[0][i], &b = results[1][i];
+    if (a.address != b.address || a.name != b.name || a.value != b.value || a.all_values != b.all_values) {
+      mismatches++;
+    }
+  }
+  printf("%zu signals compared, %zu mismatches\n", results[0].size(), mismatches);
+  return (mismatches == 0 && results[0].size() == results[1].size()) ? 0 : 1;
+}
@@ -0,0 +1,71 @@
+// Checks the checksums built on crc.h against the previous implementations in checksums_reference.h.
+// usage: test_crc
+// Every length gets every byte value at every position, which covers each CRC completely since
+// they are linear, plus random payloads.
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "checksums_reference.h"
+
+typedef unsigned int (*checksum_fn)(uint32_t address, const Signal &sig, const uint8_t *d, size_t len);
+
+struct Checksum {
+  const char *name;
+  checksum_fn fn, ref;
+  size_t min_len, max_len;
+  std::vector<uint32_t> addresses;
+};
+
+static size_t check(const Checksum &c, std::mt19937 &rng) {
+  const Signal sig = {};
+  size_t mismatches = 0, checked = 0;
+  auto compare = [&](uint32_t address, const std::vector<uint8_t> &d) {
+    checked++;
+    if (c.fn(address, sig, d.data(), d.size()) != c.ref(address, sig, d.data(), d.size())) {
+      if (mismatches++ < 5) {
+        printf("  mismatch at address 0x%X, len %zu\n", address, d.size());
+      }
+    }
+  };
+
+  for (size_t len = c.min_len; len <= c.max_len; len++) {
+    std::vector<uint8_t> d(len);
+    for (uint32_t address : c.addresses) {
+      for (size_t pos = 0; pos < len; pos++) {
+        for (int b = 0; b < 256; b++) {
+          std::fill(d.begin(), d.end(), 0);
+          d[pos] = b;
+          compare(address, d);
+        }
+      }
+      for (int i = 0; i < 1000; i++) {
+        for (auto &b : d) b = rng();
+        compare(address, d);
+      }
+    }
+  }
+  printf("%-24s %9zu payloads, %zu mismatches\n", c.name, checked, mismatches);
+  return mismatches;
+}
+
+int main() {
+  ref_init_crc_lookup_tables();
+
+  const Checksum checksums[] = {
+    {"chrysler_checksum", chrysler_checksum, ref_chrysler_checksum, 1, 8, {0x292}},
+    {"volkswagen_mqb_checksum", volkswagen_mqb_checksum, ref_volkswagen_mqb_checksum, 2, 8,
+     {0x86, 0x9F, 0xAD, 0xFD, 0x106, 0x117, 0x120, 0x121, 0x122, 0x126, 0x12B, 0x12E, 0x187, 0x30C, 0x30F, 0x324, 0x3C0, 0x65D}},
+    {"pedal_checksum", pedal_checksum, ref_pedal_checksum, 0, 8, {0x200}},
+    {"hkg_can_fd_checksum", hkg_can_fd_checksum, ref_hkg_can_fd_checksum, 0, 64, {0x0, 0x50, 0x12A, 0x1CF, 0x7FF, 0x1FFFFFFF}},
+  };
+
+  std::mt19937 rng(0);
+  size_t mismatches = 0;
+  for (const auto &c : checksums) {
+    mismatches += check(c, rng);
+  }
+  return mismatches == 0 ? 0 : 1;
+}
@@ -1,18 +1,22 @@
 #!/usr/bin/env python3
+import array
+import copy
 import os
 import unittest
 import random
 
 from cereal import log
-from opendbc.can.parser import CANParser
+from opendbc.can.parser import CANParser, CANParserGroup
 from opendbc.can.packer import CANPacker
+from opendbc.generator.unpacker import parse_dbc
+from opendbc import DBC_PATH
 
 
 TEST_DBC = os.path.abspath(os.path.join(os.path.dirname(__file__), "test.dbc"))
 
 
 # Python implementation so we don't have to depend on boardd
-def can_list_to_can_capnp(can_msgs, msgtype='can'):
+def can_list_to_can_capnp(can_msgs, msgtype='can', logMonoTime=None):
   dat = log.Event.new_message()
   dat.init(msgtype, len(can_msgs))
 
@@ -29,6 +33,8 @@ def can_list_to_can_capnp(can_msgs, msgtype='can'):
     cc.busTime = can_msg[1]
     cc.dat = bytes(can_msg[2])
     cc.src = can_msg[3]
+    if len(can_msg) > 4:
+      cc.rxAgeUs = can_msg[4]
 
   return dat.to_bytes()
 
@@ -207,6 +213,37 @@ class TestCanParserPacker(unittest.TestCase):
         self.assertAlmostEqual(parser.vl["ES_LKAS"]["COUNTER"], idx % 16)
         idx += 1
 
+  def test_unpacker_dbcs(self):
+    # These DBCs are parsed with generated unpackers, check them against the packer
+    def signal_bits(sig):
+      if sig["is_little_endian"]:
+        return set(range(sig["start_bit"], sig["start_bit"] + sig["size"]))
+      be_bits = [j + i * 8 for i in range(64) for j in range(7, -1, -1)]
+      idx = be_bits.index(sig["start_bit"])
+      return set(be_bits[idx:idx + sig["size"]])
+
+    for dbc_file in ["toyota_nodsu_pt_generated", "hyundai_canfd", "honda_civic_touring_2016_can_generated"]:
+      packer = CANPacker(dbc_file)
+      for msg in parse_dbc(os.path.join(DBC_PATH, f"{dbc_file}.dbc")):
+        sigs = [s for s in msg["sigs"] if s["name"] not in ("CHECKSUM", "COUNTER")]
+        used_bits = [b for s in msg["sigs"] for b in signal_bits(s)]
+        if not sigs or len(used_bits) != len(set(used_bits)):
+          continue  # multiplexed
+
+        with self.subTest(dbc=dbc_file, msg=msg["name"]):
+          parser = CANParser(dbc_file, [(s["name"], msg["name"]) for s in sigs], [], 0, enforce_checks=False)
+          for _ in range(10):
+            values = {}
+            for s in sigs:
+              size = min(s["size"], 32)
+              raw = random.randint(-2**(size - 1), 2**(size - 1) - 1) if s["is_signed"] else random.randint(0, 2**size - 1)
+              values[s["name"]] = raw * s["factor"] + s["offset"]
+
+            dat = can_list_to_can_capnp([packer.make_can_msg(msg["name"], 0, values)])
+            parser.update_strings([dat])
+            for name, value in values.items():
+              self.assertAlmostEqual(parser.vl[msg["name"]][name], value, places=5)
+
   def test_bus_timeout(self):
     """Test CAN bus timeout detection"""
     dbc_file = "honda_civic_touring_2016_can_generated"
@@ -317,6 +354,155 @@ class TestCanParserPacker(unittest.TestCase):
       ts_nanos = parser.ts_nanos["POWERTRAIN_DATA"].values()
       self.assertEqual(set(ts_nanos), {0})
 
+  def test_timestamp_rx_age(self):
+    """Frames timestamped by the panda are dated rxAgeUs us before logMonoTime, busTime is ignored"""
+    dbc_file = "honda_civic_touring_2016_can_generated"
+    parser = CANParser(dbc_file, [("USER_BRAKE", "VSA_STATUS")], [("VSA_STATUS", 50)], 0)
+    packer = CANPacker(dbc_file)
+
+    for i in range(1, 10):
+      log_mono_time = int(i * 1e9)
+      addr, _, dat, bus = packer.make_can_msg("VSA_STATUS", 0, {})
+      updated = parser.update_strings([can_list_to_can_capnp([[addr, 1000, dat, bus, 2000 * i]], logMonoTime=log_mono_time)])
+
+      self.assertIn(addr, updated)
+      self.assertEqual(set(parser.ts_nanos["VSA_STATUS"].values()), {log_mono_time - 2000000 * i})
+
+    # old routes have busTime set and no rxAgeUs
+    log_mono_time = int(20 * 1e9)
+    parser.update_strings([can_list_to_can_capnp([[addr, 1000, dat, bus]], logMonoTime=log_mono_time)])
+    self.assertEqual(set(parser.ts_nanos["VSA_STATUS"].values()), {log_mono_time})
+
+  def test_columnar(self):
+    """Test the arrays indexed by signal id"""
+    dbc_file = "honda_civic_touring_2016_can_generated"
+
+    signals = [
+      ("USER_BRAKE", "VSA_STATUS"),
+      ("PEDAL_GAS", "POWERTRAIN_DATA"),
+    ]
+    checks = [
+      ("VSA_STATUS", 50),
+      ("POWERTRAIN_DATA", 100),
+    ]
+
+    parser = CANParser(dbc_file, signals, checks, 0)
+    packer = CANPacker(dbc_file)
+
+    self.assertIs(parser.signal_ids["VSA_STATUS"], parser.signal_ids[420])
+    brake = parser.signal_ids["VSA_STATUS"]["USER_BRAKE"]
+    gas = parser.signal_ids["POWERTRAIN_DATA"]["PEDAL_GAS"]
+    self.assertNotEqual(brake, gas)
+
+    values, timestamps, updated = parser.values, parser.timestamps, parser.updated
+    self.assertEqual(len(values), len(timestamps))
+    self.assertEqual(len(values), len(updated))
+    self.assertFalse(values.flags.writeable)
+
+    for i in range(10):
+      log_mono_time = int(0.01 * (i + 1) * 1e+9)
+      can_msg = packer.make_can_msg("VSA_STATUS", 0, {"USER_BRAKE": i})
+      updated_addrs = parser.update_strings([can_list_to_can_capnp([can_msg], logMonoTime=log_mono_time)])
+      self.assertEqual(updated_addrs, {420})
+
+      # arrays are updated in place
+      self.assertIs(parser.values, values)
+      self.assertAlmostEqual(values[brake], i)
+      self.assertEqual(values[brake], parser.vl["VSA_STATUS"]["USER_BRAKE"])
+      self.assertEqual(timestamps[brake], log_mono_time)
+      self.assertEqual(timestamps[gas], 0)
+      self.assertTrue(updated[brake])
+      self.assertFalse(updated[gas])
+
+    # copies of the dict interface don't follow later updates
+    vsa_status = copy.copy(parser.vl["VSA_STATUS"])
+    parser.update_strings([can_list_to_can_capnp([packer.make_can_msg("VSA_STATUS", 0, {"USER_BRAKE": 20})])])
+    self.assertAlmostEqual(vsa_status["USER_BRAKE"], 9)
+    self.assertAlmostEqual(parser.vl["VSA_STATUS"]["USER_BRAKE"], 20)
+
+    parser.update_strings([])
+    self.assertFalse(updated.any())
+
+  def test_parser_group(self):
+    """Test parsers in a group see the same as parsers updated on their own"""
+    dbc_file = "honda_civic_touring_2016_can_generated"
+
+    signals = [
+      ("USER_BRAKE", "VSA_STATUS"),
+      ("PEDAL_GAS", "POWERTRAIN_DATA"),
+    ]
+    checks = [
+      ("VSA_STATUS", 50),
+      ("POWERTRAIN_DATA", 100),
+    ]
+
+    buses = (0, 1, 2)
+    separate = [CANParser(dbc_file, signals, checks, bus) for bus in buses]
+    grouped = [CANParser(dbc_file, signals, checks, bus) for bus in buses]
+    group = CANParserGroup(grouped + [None])
+    packers = {bus: CANPacker(dbc_file) for bus in buses}
+
+    for i in range(100):
+      # bus 2 goes quiet half way through
+      can_msgs = []
+      for bus in buses:
+        if bus != 2 or i < 50:
+          can_msgs.append(packers[bus].make_can_msg("VSA_STATUS", bus, {"USER_BRAKE": random.randrange(100)}))
+        if bus == 0:
+          can_msgs.append(packers[bus].make_can_msg("POWERTRAIN_DATA", bus, {"PEDAL_GAS": i}))
+      can_strings = [can_list_to_can_capnp(can_msgs, logMonoTime=int(0.01 * (i + 1) * 1e9))]
+
+      expected = [p.update_strings(can_strings) for p in separate]
+      self.assertEqual(group.update_strings(can_strings), expected + [None])
+
+      for a, b in zip(separate, grouped):
+        self.assertEqual(a.can_valid, b.can_valid)
+        self.assertEqual(a.bus_timeout, b.bus_timeout)
+        self.assertEqual(list(a.values), list(b.values))
+        self.assertEqual(list(a.timestamps), list(b.timestamps))
+        self.assertEqual(list(a.updated), list(b.updated))
+        for msg in ("VSA_STATUS", "POWERTRAIN_DATA"):
+          self.assertEqual(a.vl_all[msg].copy(), b.vl_all[msg].copy())
+
+    self.assertTrue(grouped[0].can_valid)
+    self.assertFalse(grouped[0].bus_timeout)
+    self.assertTrue(grouped[2].bus_timeout)
+
+  def test_pack_plan(self):
+    """Test packing with a plan matches make_can_msg, including counters and checksums"""
+    dbc_file = "honda_civic_touring_2016_can_generated"
+    signals = ["STEER_TORQUE", "STEER_TORQUE_REQUEST"]
+
+    packer = CANPacker(dbc_file)
+    plan_packer = CANPacker(dbc_file)
+    plan = plan_packer.make_plan("STEERING_CONTROL", signals)
+    counter_plan = plan_packer.make_plan(0xe4, signals + ["COUNTER"])
+    self.assertEqual(plan.address, 0xe4)
+    self.assertEqual(plan.signals, tuple(signals))
+
+    out = bytearray(plan.size)
+    for i in range(100):
+      values = {"STEER_TORQUE": random.randint(-3840, 3840), "STEER_TORQUE_REQUEST": i % 2}
+      if i % 10 == 9:
+        # an explicit counter moves both packers to the same value
+        values["COUNTER"] = random.randint(0, 3)
+        expected = packer.make_can_msg("STEERING_CONTROL", 0, values)
+        self.assertEqual(plan_packer.make_can_msg_plan(counter_plan, 0, list(values.values())), expected)
+      elif i % 2:
+        expected = packer.make_can_msg("STEERING_CONTROL", 0, values)
+        plan_packer.pack_into(plan, array.array('d', values.values()), out)
+        self.assertEqual(bytes(out), expected[2])
+      else:
+        expected = packer.make_can_msg("STEERING_CONTROL", 0, values)
+        self.assertEqual(plan_packer.make_can_msg_plan(plan, 0, list(values.values())), expected)
+
+    with self.assertRaises(ValueError):
+      plan_packer.make_can_msg_plan(plan, 0, [1])
+    with self.assertRaises(ValueError):
+      plan_packer.pack_into(plan, array.array('d', [1, 2]), bytearray(plan.size - 1))
+    with self.assertRaises(ValueError):
+      packer.make_can_msg_plan(plan, 0, [1, 2])
+
 
 if __name__ == "__main__":
   unittest.main()
@@ -0,0 +1,116 @@
+// Checks that CANParser::UpdateCans doesn't touch the heap once the parser has seen every message.
+// usage: test_parser_allocations [dbc names]
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <capnp/message.h>
+#include <capnp/serialize.h>
+
+#include "common.h"
+#include "msg.capnp.h"
+
+static std::atomic<bool> counting = false;
+static std::atomic<size_t> allocations = 0;
+
+void *operator new(size_t size) {
+  if (counting) allocations++;
+  void *p = malloc(size == 0 ? 1 : size);
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+static bool check_dbc(const std::string &dbc_name, bool unpackers, bool checks) {
+  const DBC *dbc = dbc_lookup(dbc_name);
+  if (dbc == nullptr) {
+    printf("can't find DBC: %s\n", dbc_name.c_str());
+    return false;
+  }
+
+  // one event per cycle with a frame of random data for every message, twice for the first one.
+  // With checks, the frames are packed so their checksums and counters are valid
+  std::mt19937 rng(0);
+  CANPacker packer(dbc_name);
+  std::map<uint32_t, uint32_t> counters;
+  std::vector<kj::Array<capnp::word>> events;
+  for (int i = 0; i < 100; i++) {
+    capnp::MallocMessageBuilder msg;
+    Event::Builder event = msg.initRoot<Event>();
+    event.setLogMonoTime((i + 1) * 10000000ULL);
+
+    auto cans = event.initCan(dbc->msgs.size() + 1);
+    for (size_t j = 0; j < cans.size(); j++) {
+      const Msg &m = dbc->msgs[j % dbc->msgs.size()];
+      std::vector<uint8_t> dat(m.size);
+      if (checks) {
+        std::vector<SignalPackValue> values;
+        for (const Signal &sig : m.sigs) {
+          if (sig.type == SignalType::DEFAULT) {
+            values.push_back({sig.name, (rng() % (1U << std::min(sig.size, 16))) * sig.factor + sig.offset});
+          } else if (sig.type == SignalType::COUNTER) {
+            // the packer only counts signals named COUNTER
+            values.push_back({sig.name, (double)(counters[m.address]++ % (1U << sig.size))});
+          }
+        }
+        dat = packer.pack(m.address, values);
+      } else {
+        for (auto &b : dat) b = rng();
+      }
+      cans[j].setAddress(m.address);
+      cans[j].setSrc(0);
+      cans[j].setDat(kj::arrayPtr(dat.data(), dat.size()));
+    }
+    events.push_back(capnp::messageToFlatArray(msg));
+  }
+
+  // Checksums and counters would fail on random data
+  CANParser parser(0, dbc_name, !checks, !checks);
+  parser.use_unpackers(unpackers);
+
+  std::vector<SignalValue> vals;
+  size_t steady_allocations = 0;
+  for (size_t i = 0; i < events.size(); i++) {
+    capnp::FlatArrayMessageReader reader(events[i]);
+    Event::Reader event = reader.getRoot<Event>();
+
+    // the first cycles warm up the output vectors
+    counting = i >= 10;
+    allocations = 0;
+    parser.UpdateCans(event.getLogMonoTime(), event.getCan());
+    counting = false;
+    steady_allocations += allocations;
+
+    vals.clear();
+    parser.query_latest(vals, event.getLogMonoTime());
+  }
+
+  printf("%-45s %-8s %-9s %zu allocations\n", dbc_name.c_str(), unpackers ? "unpacker" : "generic",
+         checks ? "checks" : "no checks", steady_allocations);
+  return steady_allocations == 0;
+}
+
+int main(int argc, char *argv[]) {
+  std::vector<std::string> dbcs = {"toyota_nodsu_pt_generated", "honda_civic_touring_2016_can_generated", "hyundai_canfd"};
+  if (argc > 1) {
+    dbcs.assign(argv + 1, argv + argc);
+  }
+
+  bool ok = true;
+  for (const auto &dbc_name : dbcs) {
+    for (bool unpackers : {false, true}) {
+      for (bool checks : {false, true}) {
+        ok = check_dbc(dbc_name, unpackers, checks) && ok;
+      }
+    }
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "common_dbc.h"
+
+// Unpackers are generated at build time by opendbc/generator/unpacker.py for the DBCs listed in SConscript.
+// Each one extracts the raw values of all signals of a message in DBC order, already sign extended.
+
+template <int SIZE>
+inline int64_t sign_extend(uint64_t v) {
+  constexpr uint64_t m = 1ULL << (SIZE - 1);
+  return (int64_t)((v ^ m) - m);
+}
+
+// Layout the unpacker was generated for, checked against the DBC that is loaded at runtime
+struct SignalLayout {
+  const char *name;
+  int start_bit, size;
+  bool is_little_endian;
+  bool is_signed;
+};
+
+struct MessageUnpacker {
+  uint32_t address;
+  unsigned int min_size;  // bytes read by the unpacker, shorter messages take the generic path
+  void (*unpack)(const uint8_t *dat, int64_t *raw);
+  const SignalLayout *sigs;
+  size_t num_sigs;
+};
+
+struct DBCUnpackers {
+  const char *name;
+  const MessageUnpacker *msgs;
+  size_t num_msgs;
+};
+
+const std::vector<DBCUnpackers> &get_dbc_unpackers();
+const MessageUnpacker *unpacker_lookup(const std::string &dbc_name, uint32_t address);
@@ -0,0 +1,151 @@
+#!/usr/bin/env python3
+# Generates a C++ header per DBC with one straight line unpack function per message,
+# used by CANParser instead of walking the signal bits at runtime.
+import os
+import re
+import sys
+
+bo_regexp = re.compile(r"^BO_ (\w+) (\w+) *: (\w+) (\w+)")
+sg_regexp = re.compile(r"^SG_ (\w+)(?: \w+)? *: (\d+)\|(\d+)@(\d+)([\+|\-]) \(([0-9.+\-eE]+),([0-9.+\-eE]+)\)")
+
+
+def parse_dbc(path: str):
+  msgs = []
+  with open(path) as f:
+    for line in f:
+      line = line.strip()
+      if line.startswith("BO_ "):
+        m = bo_regexp.match(line)
+        msgs.append({"name": m.group(2), "address": int(m.group(1)), "size": int(m.group(3)), "sigs": []})
+      elif line.startswith("SG_ "):
+        m = sg_regexp.match(line)
+        msgs[-1]["sigs"].append({
+          "name": m.group(1),
+          "start_bit": int(m.group(2)),
+          "size": int(m.group(3)),
+          "is_little_endian": m.group(4) == "1",
+          "is_signed": m.group(5) == "-",
+          "factor": float(m.group(6)),
+          "offset": float(m.group(7)),
+        })
+  return msgs
+
+
+def signal_bytes(sig):
+  # Same walk as get_raw_value in parser.cc, resolved at generation time.
+  # Returns (byte index, right shift, mask, left shift) for every byte the signal touches
+  if sig["is_little_endian"]:
+    lsb = sig["start_bit"]
+    msb = sig["start_bit"] + sig["size"] - 1
+  else:
+    be_bits = [j + i * 8 for i in range(64) for j in range(7, -1, -1)]
+    lsb = be_bits[be_bits.index(sig["start_bit"]) + sig["size"] - 1]
+    msb = sig["start_bit"]
+
+  pieces = []
+  i = msb // 8
+  bits = sig["size"]
+  while i >= 0 and bits > 0:
+    byte_lsb = lsb if lsb // 8 == i else i * 8
+    byte_msb = msb if msb // 8 == i else (i + 1) * 8 - 1
+    size = byte_msb - byte_lsb + 1
+    pieces.append((i, byte_lsb - i * 8, (1 << size) - 1, bits - size))
+    bits -= size
+    i = i - 1 if sig["is_little_endian"] else i + 1
+  return pieces
+
+
+def signal_expr(sig):
+  terms = []
+  for i, shift, mask, pos in signal_bytes(sig):
+    term = f"dat[{i}]"
+    if shift:
+      term = f"({term} >> {shift})"
+    if mask != 0xFF >> shift:
+      term = f"({term} & 0x{mask:X})"
+    term = f"(uint64_t){term}"
+    if pos:
+      term = f"({term} << {pos})"
+    terms.append(term)
+
+  expr = " | ".join(terms) if terms else "0"
+  if sig["is_signed"]:
+    return f"sign_extend<{sig['size']}>({expr})"
+  return f"(int64_t)({expr})"
+
+
+def cpp_name(dbc_name: str) -> str:
+  return re.sub(r"\W", "_", dbc_name)
+
+
+def build_header(dbc_name: str, msgs) -> str:
+  ns = cpp_name(dbc_name)
+  h = "/* THIS IS AN AUTOGENERATED FILE, PLEASE EDIT opendbc/generator/unpacker.py */\n"
+  h += "#pragma once\n\n"
+  h += '#include "../unpacker.h"\n\n'
+  h += f"namespace unpackers::{ns} {{\n\n"
+
+  entries = []
+  for msg in msgs:
+    if not msg["sigs"]:
+      continue
+    min_size = max(i for sig in msg["sigs"] for i, _, _, _ in signal_bytes(sig)) + 1
+
+    fn = f"unpack_{msg['name']}"
+    h += f"// 0x{msg['address']:X}\n"
+    h += f"inline void {fn}(const uint8_t *dat, int64_t *raw) {{\n"
+    for idx, sig in enumerate(msg["sigs"]):
+      h += f"  raw[{idx}] = {signal_expr(sig)};  // {sig['name']}\n"
+    h += "}\n\n"
+
+    h += f"inline const SignalLayout {fn}_sigs[] = {{\n"
+    for sig in msg["sigs"]:
+      le = "true" if sig["is_little_endian"] else "false"
+      signed = "true" if sig["is_signed"] else "false"
+      h += f'  {{"{sig["name"]}", {sig["start_bit"]}, {sig["size"]}, {le}, {signed}}},\n'
+    h += "};\n\n"
+
+    entries.append(f"  {{{msg['address']}, {min_size}, &{fn}, {fn}_sigs, ARRAYSIZE({fn}_sigs)}},\n")
+
+  h += "inline const MessageUnpacker messages[] = {\n"
+  h += "".join(entries)
+  h += "};\n\n"
+  h += f"}}  // namespace unpackers::{ns}\n"
+  return h
+
+
+def build_registry(dbc_names) -> str:
+  c = "/* THIS IS AN AUTOGENERATED FILE, PLEASE EDIT opendbc/generator/unpacker.py */\n"
+  c += '#include "../unpacker.h"\n\n'
+  for name in dbc_names:
+    c += f'#include "{name}.h"\n'
+  c += "\nconst std::vector<DBCUnpackers> &get_dbc_unpackers() {\n"
+  c += "  static const std::vector<DBCUnpackers> dbc_unpackers = {\n"
+  for name in dbc_names:
+    ns = cpp_name(name)
+    c += f'    {{"{name}", unpackers::{ns}::messages, ARRAYSIZE(unpackers::{ns}::messages)}},\n'
+  c += "  };\n"
+  c += "  return dbc_unpackers;\n"
+  c += "}\n"
+  return c
+
+
+def create_all(output_path: str, dbc_paths):
+  os.makedirs(output_path, exist_ok=True)
+
+  dbc_names = []
+  for path in dbc_paths:
+    name = os.path.basename(path).replace(".dbc", "")
+    with open(os.path.join(output_path, f"{name}.h"), "w") as f:
+      f.write(build_header(name, parse_dbc(path)))
+    dbc_names.append(name)
+
+  with open(os.path.join(output_path, "dbc_unpackers.cc"), "w") as f:
+    f.write(build_registry(dbc_names))
+
+
+if __name__ == "__main__":
+  if len(sys.argv) < 2:
+    print(f"usage: {sys.argv[0]} <output dir> <dbc files>")
+    sys.exit(1)
+  create_all(sys.argv[1], sys.argv[2:])
@@ -10,15 +10,35 @@
     spans multiple transfers/chunks.
   * the overflow buffers are reset by a dedicated control transfer handler,
     which is sent by the host on each start of a connection.
+  * with can_rx_timestamps, comms_can_read sets reserved in the header and
+    appends the RX timestamp to every packet. The checksum covers it too.
+    The reset turns it off again, so hosts that don't know about it are safe.
 */
 
 typedef struct {
   uint32_t ptr;
   uint32_t tail_size;
-  uint8_t data[72];
+  uint8_t data[76];
 } asm_buffer;
 
 asm_buffer can_read_buffer = {.ptr = 0U, .tail_size = 0U};
+bool can_rx_timestamps = false;
+
+// the packet as it goes to the host, returns its length
+uint32_t can_packet_to_host(CANPacket_t *can_packet, uint32_t timestamp, uint8_t *out) {
+  uint32_t pckt_len = CANPACKET_HEAD_SIZE + dlc_to_len[can_packet->data_len_code];
+  if (can_rx_timestamps) {
+    can_packet->reserved = 1U;
+    can_packet->checksum = 0U;
+    (void)memcpy(out, can_packet, pckt_len);
+    WORD_TO_BYTE_ARRAY(&out[pckt_len], timestamp);
+    pckt_len += CANPACKET_TIMESTAMP_SIZE;
+    out[CANPACKET_HEAD_SIZE - 1U] = calculate_checksum(out, pckt_len);
+  } else {
+    (void)memcpy(out, can_packet, pckt_len);
+  }
+  return pckt_len;
+}
 
 int comms_can_read(uint8_t *data, uint32_t max_len) {
   uint32_t pos = 0U;
@@ -35,16 +55,17 @@ int comms_can_read(uint8_t *data, uint32_t max_len) {
   if (can_read_buffer.ptr == 0U) {
     // Fill rest of buffer with new data
     CANPacket_t can_packet;
-    while ((pos < max_len) && can_pop(&can_rx_q, &can_packet)) {
-      uint32_t pckt_len = CANPACKET_HEAD_SIZE + dlc_to_len[can_packet.data_len_code];
+    uint32_t timestamp;
+    uint8_t pckt[sizeof(can_read_buffer.data)];
+    while ((pos < max_len) && can_pop_rx(&can_packet, &timestamp)) {
+      uint32_t pckt_len = can_packet_to_host(&can_packet, timestamp, pckt);
       if ((pos + pckt_len) <= max_len) {
-        (void)memcpy(&data[pos], &can_packet, pckt_len);
+        (void)memcpy(&data[pos], pckt, pckt_len);
         pos += pckt_len;
       } else {
-        (void)memcpy(&data[pos], &can_packet, max_len - pos);
+        (void)memcpy(&data[pos], pckt, max_len - pos);
         can_read_buffer.ptr += pckt_len - (max_len - pos);
-        // cppcheck-suppress objectIndex
-        (void)memcpy(can_read_buffer.data, &((uint8_t*)&can_packet)[(max_len - pos)], can_read_buffer.ptr);
+        (void)memcpy(can_read_buffer.data, &pckt[(max_len - pos)], can_read_buffer.ptr);
         pos = max_len;
       }
     }
@@ -109,6 +130,7 @@ void comms_can_reset(void) {
   can_write_buffer.tail_size = 0U;
   can_read_buffer.ptr = 0U;
   can_read_buffer.tail_size = 0U;
+  can_rx_timestamps = false;
 }
 
 // TODO: make this more general!
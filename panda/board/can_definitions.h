@@ -7,6 +7,8 @@ const uint8_t PANDA_BUS_CNT = 4U;
 #define CAN_PACKET_VERSION 4
 
 #define CANPACKET_HEAD_SIZE 6U
+// with RX timestamps enabled, received packets have reserved set and this many bytes after the data
+#define CANPACKET_TIMESTAMP_SIZE 4U
 
 #if !defined(STM32F4) && !defined(STM32F2)
   #define CANFD
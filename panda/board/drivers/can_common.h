@@ -52,17 +52,22 @@ void process_can(uint8_t can_number);
   CANPacket_t elems_##x[size]; \
   can_ring can_##x = { .w_ptr = 0, .r_ptr = 0, .fifo_size = (size), .elems = (CANPacket_t *)&(elems_##x) };
 
+#define CAN_RX_Q_SIZE 0x1000U
+
 #ifdef STM32H7
-__attribute__((section(".ram_d1"))) can_buffer(rx_q, 0x1000)
+__attribute__((section(".ram_d1"))) can_buffer(rx_q, CAN_RX_Q_SIZE)
 __attribute__((section(".ram_d1"))) can_buffer(tx2_q, 0x1A0)
 __attribute__((section(".ram_d2"))) can_buffer(txgmlan_q, 0x1A0)
 #else
-can_buffer(rx_q, 0x1000)
+can_buffer(rx_q, CAN_RX_Q_SIZE)
 can_buffer(tx2_q, 0x1A0)
 can_buffer(txgmlan_q, 0x1A0)
 #endif
 can_buffer(tx1_q, 0x1A0)
 can_buffer(tx3_q, 0x1A0)
+// when each packet went into can_rx_q, by slot. Kept out of CANPacket_t so the TX queues don't pay for it.
+// On H7 this is in DTCM with the rest of .bss, RAM_D1 is nearly full with can_rx_q
+uint32_t can_rx_q_timestamps[CAN_RX_Q_SIZE];
 // FIXME:
 // cppcheck-suppress misra-c2012-9.3
 can_ring *can_queues[] = {&can_tx1_q, &can_tx2_q, &can_tx3_q, &can_txgmlan_q};
@@ -90,6 +95,20 @@ bool can_pop(can_ring *q, CANPacket_t *elem) {
   return ret;
 }
 
+// can_pop for can_rx_q, also returning when the packet was pushed
+bool can_pop_rx(CANPacket_t *elem, uint32_t *timestamp) {
+  bool ret = false;
+
+  ENTER_CRITICAL();
+  if (can_rx_q.w_ptr != can_rx_q.r_ptr) {
+    *timestamp = can_rx_q_timestamps[can_rx_q.r_ptr];
+    ret = can_pop(&can_rx_q, elem);
+  }
+  EXIT_CRITICAL();
+
+  return ret;
+}
+
 bool can_push(can_ring *q, CANPacket_t *elem) {
   bool ret = false;
   uint32_t next_w_ptr;
@@ -102,6 +121,9 @@ bool can_push(can_ring *q, CANPacket_t *elem) {
   }
   if (next_w_ptr != q->r_ptr) {
     q->elems[q->w_ptr] = *elem;
+    if (q == &can_rx_q) {
+      can_rx_q_timestamps[q->w_ptr] = microsecond_timer_get();
+    }
     q->w_ptr = next_w_ptr;
     ret = true;
   }
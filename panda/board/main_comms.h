@@ -381,6 +381,12 @@ int comms_control_handler(ControlPacket_t *req, uint8_t *resp) {
     case 0xe7:
       set_power_save_state(req->param1);
       break;
+    // **** 0xe8: enable/disable RX timestamps on CAN packets, acks with 1 so hosts can tell old firmware
+    case 0xe8:
+      can_rx_timestamps = (req->param1 > 0U);
+      resp[0] = 1U;
+      resp_len = 1;
+      break;
     // **** 0xf0: k-line/l-line wake-up pulse for KWP2000 fast initialization
     case 0xf0:
       if(current_board->has_lin) {
@@ -116,6 +116,18 @@ void gen_crc_lookup_table_16(uint16_t poly, uint16_t crc_lut[]) {
   }
 }
 
+// Adds the tables for slice-by-4 CRC-16, crc_lut[k][i] is the CRC of byte i followed by k zero bytes.
+// Four bytes then take four independent lookups instead of a chain of four dependent ones.
+void gen_crc_lookup_table_16_slice4(uint16_t poly, uint16_t crc_lut[4][256]) {
+  gen_crc_lookup_table_16(poly, crc_lut[0]);
+  for (int k = 1; k < 4; k++) {
+    for (int i = 0; i < 256; i++) {
+      uint16_t crc = crc_lut[k - 1][i];
+      crc_lut[k][i] = (uint16_t)(crc << 8U) ^ crc_lut[0][crc >> 8U];
+    }
+  }
+}
+
 bool msg_allowed(CANPacket_t *to_send, const CanMsg msg_list[], int len) {
   int addr = GET_ADDR(to_send);
   int bus = GET_BUS(to_send);
@@ -111,7 +111,7 @@ AddrCheckStruct hyundai_canfd_ice_addr_checks[] = {
 addr_checks hyundai_canfd_rx_checks = {hyundai_canfd_addr_checks, HYUNDAI_CANFD_ADDR_CHECK_LEN};
 
 
-uint16_t hyundai_canfd_crc_lut[256];
+uint16_t hyundai_canfd_crc_lut[4][256];
 
 
 const int HYUNDAI_PARAM_CANFD_HDA2 = 16;
@@ -141,13 +141,23 @@ static uint32_t hyundai_canfd_compute_checksum(CANPacket_t *to_push) {
 
   uint16_t crc = 0;
 
-  for (int i = 2; i < len; i++) {
-    crc = (crc << 8U) ^ hyundai_canfd_crc_lut[(crc >> 8U) ^ GET_BYTE(to_push, i)];
+  // four bytes per step while they last, see gen_crc_lookup_table_16_slice4
+  int i = 2;
+  while ((i + 4) <= len) {
+    uint8_t b0 = (uint8_t)((crc >> 8U) ^ GET_BYTE(to_push, i));
+    uint8_t b1 = (uint8_t)((crc & 0xFFU) ^ GET_BYTE(to_push, i + 1));
+    crc = hyundai_canfd_crc_lut[3][b0] ^ hyundai_canfd_crc_lut[2][b1] ^
+          hyundai_canfd_crc_lut[1][GET_BYTE(to_push, i + 2)] ^ hyundai_canfd_crc_lut[0][GET_BYTE(to_push, i + 3)];
+    i += 4;
+  }
+  while (i < len) {
+    crc = (crc << 8U) ^ hyundai_canfd_crc_lut[0][(crc >> 8U) ^ GET_BYTE(to_push, i)];
+    i++;
   }
 
   // Add address to crc
-  crc = (crc << 8U) ^ hyundai_canfd_crc_lut[(crc >> 8U) ^ ((address >> 0U) & 0xFFU)];
-  crc = (crc << 8U) ^ hyundai_canfd_crc_lut[(crc >> 8U) ^ ((address >> 8U) & 0xFFU)];
+  crc = (crc << 8U) ^ hyundai_canfd_crc_lut[0][(crc >> 8U) ^ ((address >> 0U) & 0xFFU)];
+  crc = (crc << 8U) ^ hyundai_canfd_crc_lut[0][(crc >> 8U) ^ ((address >> 8U) & 0xFFU)];
 
   if (len == 8) {
     crc ^= 0x5f29U;
@@ -341,7 +351,7 @@ static int hyundai_canfd_fwd_hook(int bus_num, int addr) {
 static const addr_checks* hyundai_canfd_init(uint16_t param) {
   hyundai_common_init(param);
 
-  gen_crc_lookup_table_16(0x1021, hyundai_canfd_crc_lut);
+  gen_crc_lookup_table_16_slice4(0x1021, hyundai_canfd_crc_lut);
   hyundai_canfd_hda2 = GET_FLAG(param, HYUNDAI_PARAM_CANFD_HDA2);
   hyundai_canfd_alt_buttons = GET_FLAG(param, HYUNDAI_PARAM_CANFD_ALT_BUTTONS);
 
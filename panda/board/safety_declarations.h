@@ -149,6 +149,7 @@ float interpolate(struct lookup_t xy, float x);
 int ROUND(float val);
 void gen_crc_lookup_table_8(uint8_t poly, uint8_t crc_lut[]);
 void gen_crc_lookup_table_16(uint16_t poly, uint16_t crc_lut[]);
+void gen_crc_lookup_table_16_slice4(uint16_t poly, uint16_t crc_lut[4][256]);
 bool msg_allowed(CANPacket_t *to_send, const CanMsg msg_list[], int len);
 int get_addr_check_index(CANPacket_t *to_push, AddrCheckStruct addr_list[], const int len);
 void update_counter(AddrCheckStruct addr_list[], int index, uint8_t counter);
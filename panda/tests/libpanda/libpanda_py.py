@@ -52,6 +52,12 @@ int comms_can_read(uint8_t *data, uint32_t max_len);
 void comms_can_write(uint8_t *data, uint32_t len);
 void comms_can_reset(void);
 uint32_t can_slots_empty(can_ring *q);
+extern bool can_rx_timestamps;
+
+typedef struct {
+  uint32_t CNT;
+} TIM_TypeDef;
+extern TIM_TypeDef timer;
 """)
 
 ffi.cdef("""
@@ -100,6 +106,8 @@ class Panda(PandaSafety, Protocol):
   tx2_q: Any
   tx3_q: Any
   txgmlan_q: Any
+  can_rx_timestamps: bool
+  timer: Any
   def can_set_checksum(self, p: CANPacket) -> None: ...
 
   # safety
@@ -154,6 +154,41 @@ class TestPandaComms(unittest.TestCase):
     self.assertEqual(len(rx_msgs), len(msgs))
     self.assertEqual(rx_msgs, msgs)
 
+  def test_can_receive_timestamps(self):
+    msgs = random_can_messages(100)
+    for i, m in enumerate(msgs):
+      lpp.timer.CNT = 1000 * i
+      lpp.can_push(lpp.rx_q, libpanda_py.make_CANPacket(m[0], m[3], m[2]))
+
+    lpp.can_rx_timestamps = True
+    dat = libpanda_py.ffi.new(f"uint8_t[{CHUNK_SIZE}]")
+    buf = b""
+    while True:
+      rx_len = lpp.comms_can_read(dat, CHUNK_SIZE)
+      buf += bytes(dat[0:rx_len])
+      if rx_len < CHUNK_SIZE:
+        break
+
+    pos = 0
+    for i, m in enumerate(msgs):
+      dat_len = DLC_TO_LEN[buf[pos] >> 4]
+      pckt_len = 6 + dat_len + 4
+      pckt = buf[pos:pos+pckt_len]
+      pos += pckt_len
+
+      self.assertEqual(pckt[0] & 1, 1)
+      self.assertEqual(pckt[6:6+dat_len], m[2])
+      self.assertEqual(int.from_bytes(pckt[6+dat_len:], "little"), 1000 * i)
+      checksum = 0
+      for b in pckt:
+        checksum ^= b
+      self.assertEqual(checksum, 0)
+    self.assertEqual(pos, len(buf))
+
+    # a comms reset turns them off again
+    lpp.comms_can_reset()
+    self.assertFalse(lpp.can_rx_timestamps)
+
 
 if __name__ == "__main__":
   unittest.main()
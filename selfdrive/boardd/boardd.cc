@@ -14,10 +14,13 @@
 #include <cerrno>
 #include <chrono>
 #include <cmath>
+#include <condition_variable>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <future>
+#include <mutex>
+#include <string>
 #include <thread>
 
 #include "cereal/gen/cpp/car.capnp.h"
@@ -28,6 +31,7 @@
 #include "common/util.h"
 #include "system/hardware/hw.h"
 
+#include "selfdrive/boardd/panda_worker.h"
 #include "selfdrive/boardd/pigeon.h"
 
 // -- Multi-panda conventions --
@@ -56,6 +60,8 @@
 #define NIBBLE_TO_HEX(n) ((n) < 10 ? (n) + '0' : ((n) - 10) + 'a')
 using namespace std::chrono_literals;
 
+const auto RECV_WORKER_WAIT = 5ms;
+
 std::atomic<bool> ignition(false);
 std::atomic<bool> pigeon_active(false);
 
@@ -215,6 +221,14 @@ void can_send_thread(std::vector<Panda *> pandas, bool fake_send) {
   assert(subscriber != NULL);
   subscriber->setTimeout(100);
 
+  // with more than one panda every panda writes on its own thread
+  std::vector<std::unique_ptr<PandaSendWorker>> workers;
+  if (pandas.size() > 1) {
+    for (const auto& panda : pandas) {
+      workers.push_back(std::make_unique<PandaSendWorker>(panda));
+    }
+  }
+
   // run as fast as messages come in
   while (!do_exit && check_all_connected(pandas)) {
     std::unique_ptr<Message> msg(subscriber->receive());
@@ -225,11 +239,19 @@ void can_send_thread(std::vector<Panda *> pandas, bool fake_send) {
       continue;
     }
 
-    capnp::FlatArrayMessageReader cmsg(aligned_buf.align(msg.get()));
+    auto words = aligned_buf.align(msg.get());
+    capnp::FlatArrayMessageReader cmsg(words);
     cereal::Event::Reader event = cmsg.getRoot<cereal::Event>();
 
     //Dont send if older than 1 second
     if ((nanos_since_boot() - event.getLogMonoTime() < 1e9) && !fake_send) {
+      if (!workers.empty()) {
+        auto sendcan = std::make_shared<const kj::Array<capnp::word>>(kj::heapArray(words));
+        for (const auto& worker : workers) {
+          worker->send(sendcan);
+        }
+        continue;
+      }
       for (const auto& panda : pandas) {
         LOGT("sending sendcan to panda: %s", (panda->hw_serial()).c_str());
         panda->can_send(event.getSendcan());
@@ -239,35 +261,172 @@ void can_send_thread(std::vector<Panda *> pandas, bool fake_send) {
   }
 }
 
+static void publish_can(PubMaster &pm, ReusableMessageBuilder &msg, const std::vector<Panda *> &pandas, bool comms_healthy) {
+  size_t num_frames = 0;
+  for (const auto& panda : pandas) {
+    num_frames += panda->can_receive_count();
+  }
+
+  auto evt = msg.initEvent();
+  auto canData = evt.initCan(num_frames);
+  size_t idx = 0;
+  for (const auto& panda : pandas) {
+    comms_healthy &= panda->can_receive_unpack(canData, idx, evt.getLogMonoTime());
+  }
+  evt.setValid(comms_healthy);
+  pm.send("can", msg);
+}
+
+// Time from the first USB transfer that went into a can message until it was published.
+// Bucket i counts latencies below 2^i us, the last one everything above.
+struct LatencyHistogram {
+  std::array<uint32_t, 16> buckets = {};
+
+  void add(uint64_t ns) {
+    uint64_t us = ns / 1000;
+    size_t i = 0;
+    while (i < buckets.size() - 1 && us >= (1ULL << i)) i++;
+    buckets[i]++;
+  }
+
+  std::string str() const {
+    std::string s;
+    for (size_t i = 0; i < buckets.size(); i++) {
+      if (buckets[i] == 0) continue;
+      bool last = i == buckets.size() - 1;
+      s += util::string_format("%s%llu:%u ", last ? ">=" : "<", 1ULL << (last ? i - 1 : i), buckets[i]);
+    }
+    return s;
+  }
+};
+
+// Publishes as soon as frames arrive, after waiting up to coalesce for the rest of the burst.
+// Without frames an empty can message still goes out every 10ms, same as the polling loop.
+// Returns false if a panda doesn't support async receive.
+static bool can_recv_async_loop(PubMaster &pm, ReusableMessageBuilder &msg, std::vector<Panda *> pandas, std::chrono::microseconds coalesce) {
+  std::mutex lock;
+  std::condition_variable cv;
+  bool data_ready = false;
+  auto notify = [&]() {
+    {
+      std::lock_guard lk(lock);
+      data_ready = true;
+    }
+    cv.notify_one();
+  };
+
+  for (const auto& panda : pandas) {
+    if (!panda->can_receive_async_start(notify)) {
+      for (const auto& p : pandas) p->can_receive_async_stop();
+      return false;
+    }
+  }
+  LOGW("async can receive, coalescing %lld us", (long long)coalesce.count());
+
+  const auto dt = 10ms;
+  auto deadline = std::chrono::steady_clock::now() + dt;
+  auto next_report = std::chrono::steady_clock::now() + 60s;
+  LatencyHistogram latency;
+
+  while (!do_exit && check_all_connected(pandas)) {
+    bool got_data = false;
+    {
+      std::unique_lock lk(lock);
+      got_data = cv.wait_until(lk, deadline, [&] { return data_ready; });
+      data_ready = false;
+    }
+    if (got_data && coalesce.count() > 0) {
+      std::this_thread::sleep_until(std::min(deadline, std::chrono::steady_clock::now() + coalesce));
+    }
+
+    bool comms_healthy = true;
+    uint64_t first_arrival = 0;
+    for (const auto& panda : pandas) {
+      uint64_t arrival = 0;
+      comms_healthy &= panda->can_receive_queued(arrival);
+      if (arrival != 0 && (first_arrival == 0 || arrival < first_arrival)) {
+        first_arrival = arrival;
+      }
+    }
+    publish_can(pm, msg, pandas, comms_healthy);
+    if (first_arrival != 0) {
+      latency.add(nanos_since_boot() - first_arrival);
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    deadline = now + dt;
+    if (now >= next_report) {
+      LOG("can recv latency us: %s", latency.str().c_str());
+      latency = {};
+      next_report = now + 60s;
+    }
+  }
+
+  for (const auto& panda : pandas) {
+    panda->can_receive_async_stop();
+  }
+  return true;
+}
+
 void can_recv_thread(std::vector<Panda *> pandas) {
   util::set_thread_name("boardd_can_recv");
 
   // can = 8006
   PubMaster pm({"can"});
+  ReusableMessageBuilder msg;
+
+  // BOARDD_CAN_COALESCE_US switches from polling at 100hz to publishing as frames arrive.
+  // It's opt in, controlsd steps once per can message.
+  const char *coalesce_us = getenv("BOARDD_CAN_COALESCE_US");
+  if (coalesce_us != nullptr) {
+    if (can_recv_async_loop(pm, msg, pandas, std::chrono::microseconds(std::atoi(coalesce_us)))) {
+      return;
+    }
+    LOGW("async can receive not supported, polling");
+  }
+
+  // With more than one panda every panda reads on its own thread. The cycle waits up to
+  // RECV_WORKER_WAIT for all reads, a stalled panda's frames go out in a later message.
+  std::mutex lock;
+  std::condition_variable cv;
+  auto on_read = [&]() {
+    { std::lock_guard lk(lock); }
+    cv.notify_one();
+  };
+  std::vector<std::unique_ptr<PandaRecvWorker>> workers;
+  if (pandas.size() > 1) {
+    for (const auto& panda : pandas) {
+      workers.push_back(std::make_unique<PandaRecvWorker>(panda, on_read));
+    }
+  }
+  auto all_idle = [&]() {
+    return std::all_of(workers.begin(), workers.end(), [](const auto &w) { return w->idle(); });
+  };
 
   // run at 100hz
   const uint64_t dt = 10000000ULL;
   uint64_t next_frame_time = nanos_since_boot() + dt;
-  std::vector<can_frame> raw_can_data;
 
   while (!do_exit && check_all_connected(pandas)) {
     bool comms_healthy = true;
-    raw_can_data.clear();
-    for (const auto& panda : pandas) {
-      comms_healthy &= panda->can_receive(raw_can_data);
-    }
-
-    MessageBuilder msg;
-    auto evt = msg.initEvent();
-    evt.setValid(comms_healthy);
-    auto canData = evt.initCan(raw_can_data.size());
-    for (uint i = 0; i<raw_can_data.size(); i++) {
-      canData[i].setAddress(raw_can_data[i].address);
-      canData[i].setBusTime(raw_can_data[i].busTime);
-      canData[i].setDat(kj::arrayPtr((uint8_t*)raw_can_data[i].dat.data(), raw_can_data[i].dat.size()));
-      canData[i].setSrc(raw_can_data[i].src);
+    if (workers.empty()) {
+      for (const auto& panda : pandas) {
+        comms_healthy &= panda->can_receive();
+      }
+    } else {
+      for (const auto& worker : workers) {
+        worker->request();
+      }
+      {
+        std::unique_lock lk(lock);
+        cv.wait_for(lk, RECV_WORKER_WAIT, all_idle);
+      }
+      for (const auto& panda : pandas) {
+        uint64_t arrival = 0;
+        comms_healthy &= panda->can_receive_queued(arrival);
+      }
     }
-    pm.send("can", msg);
+    publish_can(pm, msg, pandas, comms_healthy);
 
     uint64_t cur_time = nanos_since_boot();
     int64_t remaining = next_frame_time - cur_time;
@@ -300,12 +459,11 @@ void send_empty_panda_state(PubMaster *pm) {
   pm->send("pandaStates", msg);
 }
 
-std::optional<bool> send_panda_states(PubMaster *pm, const std::vector<Panda *> &pandas, bool spoofing_started) {
+std::optional<bool> send_panda_states(PubMaster *pm, ReusableMessageBuilder &msg, const std::vector<Panda *> &pandas, bool spoofing_started) {
   bool ignition_local = false;
   const uint32_t pandas_cnt = pandas.size();
 
   // build msg
-  MessageBuilder msg;
   auto evt = msg.initEvent();
   auto pss = evt.initPandaStates(pandas_cnt);
 
@@ -465,6 +623,7 @@ void panda_state_thread(PubMaster *pm, std::vector<Panda *> pandas, bool spoofin
   SubMaster sm({"controlsState"});
 
   Panda *peripheral_panda = pandas[0];
+  ReusableMessageBuilder panda_states_msg;
   bool ignition_last = false;
   std::future<bool> safety_future;
 
@@ -476,7 +635,7 @@ void panda_state_thread(PubMaster *pm, std::vector<Panda *> pandas, bool spoofin
 
     // send out peripheralState
     send_peripheral_state(pm, peripheral_panda);
-    auto ignition_opt = send_panda_states(pm, pandas, spoofing_started);
+    auto ignition_opt = send_panda_states(pm, panda_states_msg, pandas, spoofing_started);
 
     if (!ignition_opt) {
       continue;
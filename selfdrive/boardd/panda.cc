@@ -2,11 +2,13 @@
 
 #include <unistd.h>
 
+#include <algorithm>
 #include <cassert>
 #include <stdexcept>
 
 #include "cereal/messaging/messaging.h"
 #include "common/swaglog.h"
+#include "common/timing.h"
 #include "common/util.h"
 
 Panda::Panda(std::string serial, uint32_t bus_offset) : bus_offset(bus_offset) {
@@ -45,6 +47,11 @@ Panda::Panda(int fd, uint32_t bus_offset) : bus_offset(bus_offset) {
   return;
 }
 
+Panda::~Panda() {
+  // the async callbacks use this panda's buffers
+  can_receive_async_stop();
+}
+
 bool Panda::connected() {
   return handle->connected;
 }
@@ -238,7 +245,7 @@ void Panda::can_send(capnp::List<cereal::CanData>::Reader can_data_list) {
   });
 }
 
-bool Panda::can_receive(std::vector<can_frame>& out_vec) {
+bool Panda::can_receive() {
   // Check if enough space left in buffer to store RECV_SIZE data
   assert(receive_buffer_size + RECV_SIZE <= sizeof(receive_buffer));
 
@@ -249,58 +256,252 @@ bool Panda::can_receive(std::vector<can_frame>& out_vec) {
   if (recv == RECV_SIZE) {
     LOGW("Panda receive buffer full");
   }
-  receive_buffer_size += recv;
+  if (recv > 0) {
+    receive_buffer_size += recv;
+    rx_read_time = nanos_since_boot();
+  }
+  return true;
+}
+
+size_t Panda::can_receive_count() {
+  auto data = received();
+  rx_checksum_ok = count_can_buffer(data.begin(), data.size(), rx_count, rx_used);
+  return rx_count;
+}
+
+bool Panda::can_receive_unpack(capnp::List<cereal::CanData>::Builder &out, size_t &idx, uint64_t log_mono_time) {
+  auto data = received();
+  if (rx_last_timestamped) {
+    sync_timestamps(rx_last_timestamp, rx_read_time);
+  }
+  unpack_can_buffer(data.begin(), rx_count, out, idx, log_mono_time);
+
+  // move the overflowing data to the beginning of the buffer for the next round,
+  // after a checksum error everything is dropped
+  uint32_t left = rx_checksum_ok ? data.size() - rx_used : 0;
+  memmove(receive_buffer, &data[rx_used], left);
+  receive_buffer_size = left;
+  rx_taken.clear();
+
+  bool ret = rx_checksum_ok;
+  rx_count = 0;
+  rx_used = 0;
+  rx_checksum_ok = true;
+  rx_last_timestamped = false;
+  return ret;
+}
+
+bool Panda::can_receive_async_start(std::function<void()> on_data) {
+  return handle->start_async_read(0x81, RECV_SIZE, RECV_TRANSFERS, [=](const uint8_t *data, int length) {
+    if (length > 0) {
+      queue_received(data, length);
+      on_data();
+    }
+  });
+}
 
-  return (recv <= 0) ? true : unpack_can_buffer(receive_buffer, receive_buffer_size, out_vec);
+void Panda::can_receive_async_stop() {
+  if (handle) {
+    handle->stop_async_read();
+  }
+}
+
+bool Panda::can_receive_to_queue() {
+  int recv = handle->bulk_read(0x81, rx_read_buffer, RECV_SIZE);
+  if (!comms_healthy()) {
+    return false;
+  }
+  if (recv == RECV_SIZE) {
+    LOGW("Panda receive buffer full");
+  }
+  if (recv > 0) {
+    queue_received(rx_read_buffer, recv);
+  }
+  return true;
+}
+
+void Panda::queue_received(const uint8_t *data, int length) {
+  // before the push, so a read time is never older than the data taken with it
+  rx_queued_read_time = nanos_since_boot();
+  if (!rx_queue.push(data, length)) {
+    LOGE("Panda receive queue full, dropping %d bytes", length);
+    rx_resync = true;
+    return;
+  }
+  uint64_t no_arrival = 0;
+  rx_arrival.compare_exchange_strong(no_arrival, nanos_since_boot());
+}
+
+bool Panda::can_receive_queued(uint64_t &arrival) {
+  arrival = rx_arrival.exchange(0);
+  if (!comms_healthy()) {
+    rx_queue.pop(rx_taken);
+    rx_taken.clear();
+    return false;
+  }
+
+  // frames can span reads, so this continues after what's left in receive_buffer
+  if (rx_queue.size() > 0) {
+    rx_taken.reserve(sizeof(receive_buffer) + RECV_QUEUE_SIZE);
+    rx_taken.assign(receive_buffer, receive_buffer + receive_buffer_size);
+    receive_buffer_size = 0;
+    rx_read_time = rx_queued_read_time;
+    rx_queue.pop(rx_taken);
+  }
+
+  // Frames span transfers, so the ones around a dropped transfer can't be put back together.
+  // Checked after the pop: if it took anything from after the gap, the flag is already set.
+  // Everything taken so far goes, and parsing starts again at a transfer that came after it.
+  if (rx_resync.exchange(false)) {
+    rx_taken.clear();
+    receive_buffer_size = 0;
+    return false;
+  }
+  return true;
+}
+
+kj::ArrayPtr<uint8_t> Panda::received() {
+  if (rx_taken.empty()) {
+    return kj::arrayPtr(receive_buffer, receive_buffer_size);
+  }
+  return kj::arrayPtr(rx_taken.data(), rx_taken.size());
 }
 
 void Panda::can_reset_communications() {
   handle->control_write(0xc0, 0, 0);
+
+  // The reset turns RX timestamps off. Firmware that has them acks turning them on,
+  // older firmware doesn't answer and keeps sending frames without.
+  uint8_t ack = 0;
+  rx_timestamps = (handle->control_read(0xe8, 1, 0, &ack, 1) == 1) && (ack == 1);
+  ts_sync = ts_sync_next = {};
+  ts_sync_start = 0;
+  LOG("panda %s CAN timestamps %s", hw_serial().c_str(), rx_timestamps ? "on" : "off");
+}
+
+void Panda::sync_timestamps(uint32_t newest_us, uint64_t read_ns) {
+  // The newest frame of a read came in some time before the read returned, the read where that
+  // time was the shortest maps the clocks best. A better one is taken right away, and every
+  // second the best of the last second replaces the mapping to follow the clocks' drift.
+  const can_timestamp_sync sync = {newest_us, read_ns};
+  if (ts_sync_start == 0) {
+    ts_sync = ts_sync_next = sync;
+    ts_sync_start = read_ns;
+    return;
+  }
+  if (read_ns < ts_sync.to_boot_time(newest_us)) {
+    ts_sync = sync;
+  }
+  if (read_ns < ts_sync_next.to_boot_time(newest_us)) {
+    ts_sync_next = sync;
+  }
+  if (read_ns - ts_sync_start > 1e9) {
+    ts_sync = ts_sync_next;
+    ts_sync_next = sync;
+    ts_sync_start = read_ns;
+  }
 }
 
-bool Panda::unpack_can_buffer(uint8_t *data, uint32_t &size, std::vector<can_frame> &out_vec) {
-  int pos = 0;
+uint32_t Panda::can_packet_size(const can_header &header) {
+  // reserved is only meaningful once timestamps are on, older firmware leaves it uninitialized
+  uint32_t size = sizeof(can_header) + dlc_to_len[header.data_len_code];
+  if (rx_timestamps && header.reserved) {
+    size += CANPACKET_TIMESTAMP_SIZE;
+  }
+  return size;
+}
+
+bool Panda::count_can_buffer(const uint8_t *data, uint32_t size, size_t &count, uint32_t &used) {
+  count = 0;
+  used = 0;
 
-  while (pos <= size - sizeof(can_header)) {
+  while (used + sizeof(can_header) <= size) {
     can_header header;
-    memcpy(&header, &data[pos], sizeof(can_header));
+    memcpy(&header, &data[used], sizeof(can_header));
 
-    const uint8_t data_len = dlc_to_len[header.data_len_code];
-    if (pos + sizeof(can_header) + data_len > size) {
+    const uint32_t pckt_len = can_packet_size(header);
+    if (used + pckt_len > size) {
       // we don't have all the data for this message yet
       break;
     }
-
-    can_frame &canData = out_vec.emplace_back();
-    canData.busTime = 0;
-    canData.address = header.addr;
-    canData.src = header.bus + bus_offset;
-    if (header.rejected) {
-      canData.src += CAN_REJECTED_BUS_OFFSET;
+    if (calculate_checksum(&data[used], pckt_len) != 0) {
+      LOGE("Panda CAN checksum failed");
+      return false;
     }
-    if (header.returned) {
-      canData.src += CAN_RETURNED_BUS_OFFSET;
+
+    // the timestamp follows the data
+    rx_last_timestamped = pckt_len > sizeof(can_header) + dlc_to_len[header.data_len_code];
+    if (rx_last_timestamped) {
+      memcpy(&rx_last_timestamp, &data[used + pckt_len - CANPACKET_TIMESTAMP_SIZE], CANPACKET_TIMESTAMP_SIZE);
     }
 
-    if (calculate_checksum(&data[pos], sizeof(can_header) + data_len) != 0) {
-      LOGE("Panda CAN checksum failed");
-      size = 0;
-      return false;
+    count++;
+    used += pckt_len;
+  }
+  return true;
+}
+
+uint8_t Panda::can_src(const can_header &header) {
+  uint8_t src = header.bus + bus_offset;
+  if (header.rejected) {
+    src += CAN_REJECTED_BUS_OFFSET;
+  }
+  if (header.returned) {
+    src += CAN_RETURNED_BUS_OFFSET;
+  }
+  return src;
+}
+
+void Panda::unpack_can_buffer(const uint8_t *data, size_t count, capnp::List<cereal::CanData>::Builder &out, size_t &idx, uint64_t log_mono_time) {
+  for (uint32_t pos = 0; count > 0; count--) {
+    can_header header;
+    memcpy(&header, &data[pos], sizeof(can_header));
+    const uint8_t data_len = dlc_to_len[header.data_len_code];
+    const uint32_t pckt_len = can_packet_size(header);
+
+    auto canData = out[idx++];
+    canData.setAddress(header.addr);
+    canData.setSrc(can_src(header));
+    canData.setDat(kj::arrayPtr(&data[pos + sizeof(can_header)], data_len));
+    if (pckt_len > sizeof(can_header) + data_len) {
+      uint32_t timestamp;
+      memcpy(&timestamp, &data[pos + sizeof(can_header) + data_len], sizeof(timestamp));
+      const uint64_t rx_time = ts_sync.to_boot_time(timestamp);
+      if (rx_time < log_mono_time) {
+        canData.setRxAgeUs(std::min<uint64_t>((log_mono_time - rx_time) / 1000, UINT16_MAX));
+      }
     }
 
+    pos += pckt_len;
+  }
+}
+
+bool Panda::unpack_can_buffer(uint8_t *data, uint32_t &size, std::vector<can_frame> &out_vec) {
+  size_t count = 0;
+  uint32_t used = 0;
+  const bool ret = count_can_buffer(data, size, count, used);
+
+  for (uint32_t pos = 0; count > 0; count--) {
+    can_header header;
+    memcpy(&header, &data[pos], sizeof(can_header));
+    const uint8_t data_len = dlc_to_len[header.data_len_code];
+
+    can_frame &canData = out_vec.emplace_back();
+    canData.busTime = 0;
+    canData.address = header.addr;
+    canData.src = can_src(header);
     canData.dat.assign((char *)&data[pos + sizeof(can_header)], data_len);
 
-    pos += sizeof(can_header) + data_len;
+    pos += can_packet_size(header);
   }
 
   // move the overflowing data to the beginning of the buffer for the next round
-  memmove(data, &data[pos], size - pos);
-  size -= pos;
-
-  return true;
+  size = ret ? size - used : 0;
+  memmove(data, &data[used], size);
+  return ret;
 }
 
-uint8_t Panda::calculate_checksum(uint8_t *data, uint32_t len) {
+uint8_t Panda::calculate_checksum(const uint8_t *data, uint32_t len) {
   uint8_t checksum = 0U;
   for (uint32_t i = 0U; i < len; i++) {
     checksum ^= data[i];
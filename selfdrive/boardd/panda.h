@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 #include <ctime>
 #include <functional>
@@ -13,11 +14,14 @@
 #include "panda/board/health.h"
 #include "panda/board/can_definitions.h"
 #include "selfdrive/boardd/panda_comms.h"
+#include "selfdrive/boardd/spsc_queue.h"
 
 #define USB_TX_SOFT_LIMIT   (0x100U)
 #define USBPACKET_MAX_SIZE  (0x40)
 
 #define RECV_SIZE (0x4000U)
+#define RECV_TRANSFERS 4  // bulk reads in flight in async receive
+#define RECV_QUEUE_SIZE (4 * RECV_SIZE)
 
 #define CAN_REJECTED_BUS_OFFSET   0xC0U
 #define CAN_RETURNED_BUS_OFFSET 0x80U
@@ -33,6 +37,17 @@ struct __attribute__((packed)) can_header {
   uint8_t checksum : 8;
 };
 
+// Maps the panda's microsecond timer to boot time
+struct can_timestamp_sync {
+  uint32_t panda_us = 0;
+  uint64_t boot_ns = 0;
+
+  uint64_t to_boot_time(uint32_t us) const {
+    // the timer wraps, differences are fine as long as they're below half of that
+    return boot_ns + (int64_t)(int32_t)(us - panda_us) * 1000;
+  }
+};
+
 struct can_frame {
   long address;
   std::string dat;
@@ -47,6 +62,7 @@ public:
   std::unique_ptr<PandaCommsHandle> handle;
   Panda(std::string serial="", uint32_t bus_offset=0);
   Panda(int fd, uint32_t bus_offset=0);
+  ~Panda();
 
   cereal::PandaState::PandaType hw_type = cereal::PandaState::PandaType::UNKNOWN;
   bool has_rtc = false;
@@ -80,17 +96,62 @@ public:
   void set_data_speed_kbps(uint16_t bus, uint16_t speed);
   void set_canfd_non_iso(uint16_t bus, bool non_iso);
   void can_send(capnp::List<cereal::CanData>::Reader can_data_list);
-  bool can_receive(std::vector<can_frame>& out_vec);
+  // Received frames go straight into the can message, which takes two passes so the list can be
+  // sized for all pandas: can_receive_count counts the complete frames read so far and
+  // can_receive_unpack writes them into out from idx on. With firmware that timestamps frames,
+  // rxAgeUs is the microseconds a frame came in before log_mono_time.
+  bool can_receive();
+  size_t can_receive_count();
+  bool can_receive_unpack(capnp::List<cereal::CanData>::Builder &out, size_t &idx, uint64_t log_mono_time);
+  // Queued receive, reading on another thread than the one building the can message:
+  // with can_receive_async_start the USB event thread queues every transfer and calls on_data,
+  // can_receive_to_queue does one blocking read into the queue.
+  // can_receive_queued takes everything queued since the last call, instead of can_receive.
+  // arrival is the boot time the oldest of that data came in, 0 if there was none. It returns
+  // false, with nothing to unpack, after a transfer was dropped because the queue was full.
+  bool can_receive_async_start(std::function<void()> on_data);
+  void can_receive_async_stop();
+  bool can_receive_to_queue();
+  bool can_receive_queued(uint64_t &arrival);
   void can_reset_communications();
+  bool can_timestamps() const { return rx_timestamps; }
 
 protected:
   // for unit tests
-  uint8_t receive_buffer[RECV_SIZE + sizeof(can_header) + 64];
+  uint8_t receive_buffer[RECV_SIZE + sizeof(can_header) + 64 + CANPACKET_TIMESTAMP_SIZE];
   uint32_t receive_buffer_size = 0;
 
+  SPSCByteQueue rx_queue{RECV_QUEUE_SIZE};
+  std::atomic<uint64_t> rx_arrival = 0;
+  std::atomic<uint64_t> rx_queued_read_time = 0;
+  std::atomic<bool> rx_resync = false;  // a transfer didn't fit in rx_queue
+  uint8_t rx_read_buffer[RECV_SIZE];  // for can_receive_to_queue
+  std::vector<uint8_t> rx_taken;
+
+  // frames come with the panda's RX timestamp, set up by can_reset_communications
+  bool rx_timestamps = false;
+  // boot time of the last read, its newest frame came in before that
+  uint64_t rx_read_time = 0;
+  can_timestamp_sync ts_sync, ts_sync_next;
+  uint64_t ts_sync_start = 0;
+
+  // result of the last can_receive_count
+  size_t rx_count = 0;
+  uint32_t rx_used = 0;
+  bool rx_checksum_ok = true;
+  bool rx_last_timestamped = false;
+  uint32_t rx_last_timestamp = 0;
+
   Panda(uint32_t bus_offset) : bus_offset(bus_offset) {}
   void pack_can_buffer(const capnp::List<cereal::CanData>::Reader &can_data_list,
                          std::function<void(uint8_t *, size_t)> write_func);
+  void queue_received(const uint8_t *data, int length);
+  kj::ArrayPtr<uint8_t> received();
+  uint8_t can_src(const can_header &header);
+  uint32_t can_packet_size(const can_header &header);
+  void sync_timestamps(uint32_t newest_us, uint64_t read_ns);
+  bool count_can_buffer(const uint8_t *data, uint32_t size, size_t &count, uint32_t &used);
+  void unpack_can_buffer(const uint8_t *data, size_t count, capnp::List<cereal::CanData>::Builder &out, size_t &idx, uint64_t log_mono_time);
   bool unpack_can_buffer(uint8_t *data, uint32_t &size, std::vector<can_frame> &out_vec);
-  uint8_t calculate_checksum(uint8_t *data, uint32_t len);
+  uint8_t calculate_checksum(const uint8_t *data, uint32_t len);
 };
@@ -4,6 +4,7 @@
 #include <stdexcept>
 
 #include "common/swaglog.h"
+#include "common/util.h"
 
 static int init_usb_ctx(libusb_context **context) {
   assert(context != nullptr);
@@ -120,6 +121,7 @@ fail:
 }
 
 PandaUsbHandle::~PandaUsbHandle() {
+  stop_async_read();
   std::lock_guard lk(hw_lock);
   cleanup();
   connected = false;
@@ -273,3 +275,94 @@ int PandaUsbHandle::bulk_read(unsigned char endpoint, unsigned char* data, int l
 
   return transferred;
 }
+
+bool PandaUsbHandle::start_async_read(unsigned char endpoint, int length, int num_transfers, bulk_read_callback callback) {
+  assert(transfers.empty());
+  if (!connected) {
+    return false;
+  }
+
+  read_callback = callback;
+  async_stop = false;
+  transfer_buffers.assign(num_transfers, std::vector<uint8_t>(length));
+  for (int i = 0; i < num_transfers; i++) {
+    libusb_transfer *transfer = libusb_alloc_transfer(0);
+    // no timeout, a transfer completes whenever the panda has data
+    libusb_fill_bulk_transfer(transfer, dev_handle, endpoint, transfer_buffers[i].data(), length, transfer_completed, this, 0);
+    transfers.push_back(transfer);
+  }
+
+  // libusb completes transfers on an endpoint in submission order, so the stream stays in order
+  for (auto transfer : transfers) {
+    int err = libusb_submit_transfer(transfer);
+    if (err != 0) {
+      handle_usb_issue(err, __func__);
+      break;
+    }
+    transfers_active++;
+  }
+
+  event_thread = std::thread(&PandaUsbHandle::handle_events, this);
+  return transfers_active > 0;
+}
+
+void PandaUsbHandle::stop_async_read() {
+  async_stop = true;
+  if (event_thread.joinable()) {
+    event_thread.join();
+  }
+
+  for (auto transfer : transfers) {
+    libusb_free_transfer(transfer);
+  }
+  transfers.clear();
+  transfer_buffers.clear();
+}
+
+void PandaUsbHandle::handle_events() {
+  util::set_thread_name("boardd_usb_events");
+
+  while (transfers_active > 0) {
+    if (async_stop) {
+      // repeated, a transfer resubmitted while stopping isn't missed
+      for (auto transfer : transfers) {
+        libusb_cancel_transfer(transfer);
+      }
+    }
+    struct timeval tv = {0, 100000};
+    libusb_handle_events_timeout_completed(ctx, &tv, NULL);
+  }
+}
+
+void LIBUSB_CALL PandaUsbHandle::transfer_completed(libusb_transfer *transfer) {
+  PandaUsbHandle *h = (PandaUsbHandle *)transfer->user_data;
+
+  switch (transfer->status) {
+    case LIBUSB_TRANSFER_COMPLETED:
+      h->read_callback(transfer->buffer, transfer->actual_length);
+      break;
+    case LIBUSB_TRANSFER_OVERFLOW:
+      h->comms_healthy = false;
+      LOGE_100("overflow got 0x%x", transfer->actual_length);
+      break;
+    case LIBUSB_TRANSFER_CANCELLED:
+      break;
+    case LIBUSB_TRANSFER_NO_DEVICE:
+      h->handle_usb_issue(LIBUSB_ERROR_NO_DEVICE, __func__);
+      break;
+    default:
+      LOGE_100("usb transfer failed with status %d", transfer->status);
+      break;
+  }
+
+  int err = LIBUSB_ERROR_INTERRUPTED;
+  if (!h->async_stop && h->connected) {
+    err = libusb_submit_transfer(transfer);
+    if (err != 0) {
+      h->handle_usb_issue(err, __func__);
+    }
+  }
+  if (err != 0) {
+    h->transfers_active--;
+  }
+}
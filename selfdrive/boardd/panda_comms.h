@@ -3,6 +3,8 @@
 #include <mutex>
 #include <atomic>
 #include <cstdint>
+#include <functional>
+#include <thread>
 #include <vector>
 
 #ifndef __APPLE__
@@ -15,6 +17,9 @@
 #define TIMEOUT 0
 #define SPI_BUF_SIZE 1024
 
+// called from the libusb event thread with the data of every completed bulk IN transfer
+typedef std::function<void(const uint8_t *data, int length)> bulk_read_callback;
+
 
 // comms base class
 class PandaCommsHandle {
@@ -34,6 +39,10 @@ public:
   virtual int control_read(uint8_t request, uint16_t param1, uint16_t param2, unsigned char *data, uint16_t length, unsigned int timeout=TIMEOUT) = 0;
   virtual int bulk_write(unsigned char endpoint, unsigned char* data, int length, unsigned int timeout=TIMEOUT) = 0;
   virtual int bulk_read(unsigned char endpoint, unsigned char* data, int length, unsigned int timeout=TIMEOUT) = 0;
+
+  // Keeps num_transfers bulk IN transfers of length bytes in flight, returns false if unsupported
+  virtual bool start_async_read(unsigned char endpoint, int length, int num_transfers, bulk_read_callback callback) { return false; }
+  virtual void stop_async_read() {}
 };
 
 class PandaUsbHandle : public PandaCommsHandle {
@@ -45,6 +54,8 @@ public:
   int control_read(uint8_t request, uint16_t param1, uint16_t param2, unsigned char *data, uint16_t length, unsigned int timeout=TIMEOUT);
   int bulk_write(unsigned char endpoint, unsigned char* data, int length, unsigned int timeout=TIMEOUT);
   int bulk_read(unsigned char endpoint, unsigned char* data, int length, unsigned int timeout=TIMEOUT);
+  bool start_async_read(unsigned char endpoint, int length, int num_transfers, bulk_read_callback callback);
+  void stop_async_read();
   void cleanup();
 
   static std::vector<std::string> list();
@@ -54,6 +65,16 @@ private:
   libusb_device_handle *dev_handle = NULL;
   std::recursive_mutex hw_lock;
   void handle_usb_issue(int err, const char func[]);
+
+  // async bulk reads, completed and resubmitted by event_thread
+  std::vector<libusb_transfer *> transfers;
+  std::vector<std::vector<uint8_t>> transfer_buffers;
+  bulk_read_callback read_callback;
+  std::atomic<int> transfers_active = 0;
+  std::atomic<bool> async_stop = false;
+  std::thread event_thread;
+  void handle_events();
+  static void LIBUSB_CALL transfer_completed(libusb_transfer *transfer);
 };
 
 #ifndef __APPLE__
@@ -0,0 +1,99 @@
+#include "selfdrive/boardd/panda_worker.h"
+
+#include <capnp/serialize.h>
+
+#include "common/swaglog.h"
+#include "common/util.h"
+
+PandaRecvWorker::PandaRecvWorker(Panda *panda, std::function<void()> on_read) : panda(panda), on_read(on_read) {
+  thread = std::thread(&PandaRecvWorker::run, this);
+}
+
+PandaRecvWorker::~PandaRecvWorker() {
+  {
+    std::lock_guard lk(lock);
+    stop = true;
+  }
+  cv.notify_one();
+  thread.join();
+}
+
+void PandaRecvWorker::request() {
+  {
+    std::lock_guard lk(lock);
+    requested++;
+  }
+  cv.notify_one();
+}
+
+void PandaRecvWorker::run() {
+  util::set_thread_name("boardd_panda_rx");
+
+  while (true) {
+    uint64_t serving = 0;
+    {
+      std::unique_lock lk(lock);
+      cv.wait(lk, [&] { return stop || requested != completed; });
+      if (stop) {
+        return;
+      }
+      serving = requested;
+    }
+
+    panda->can_receive_to_queue();
+    completed = serving;
+    on_read();
+  }
+}
+
+PandaSendWorker::PandaSendWorker(Panda *panda) : panda(panda) {
+  thread = std::thread(&PandaSendWorker::run, this);
+}
+
+PandaSendWorker::~PandaSendWorker() {
+  {
+    std::lock_guard lk(lock);
+    stop = true;
+  }
+  cv.notify_one();
+  thread.join();
+}
+
+bool PandaSendWorker::send(Sendcan sendcan) {
+  if (!queue.push(std::move(sendcan))) {
+    if (dropped++ % 100 == 0) {
+      LOGW("sendcan queue of panda %s full, dropped %llu", panda->hw_serial().c_str(), (unsigned long long)dropped);
+    }
+    return false;
+  }
+  {
+    // taking the lock orders the push before the worker's check, so the wakeup isn't lost
+    std::lock_guard lk(lock);
+    queued++;
+  }
+  cv.notify_one();
+  return true;
+}
+
+void PandaSendWorker::run() {
+  util::set_thread_name("boardd_panda_tx");
+
+  Sendcan sendcan;
+  while (true) {
+    {
+      std::unique_lock lk(lock);
+      cv.wait(lk, [&] { return stop || !queue.empty(); });
+      if (stop) {
+        return;
+      }
+    }
+
+    while (queue.pop(sendcan)) {
+      capnp::FlatArrayMessageReader cmsg(*sendcan);
+      cereal::Event::Reader event = cmsg.getRoot<cereal::Event>();
+      panda->can_send(event.getSendcan());
+      sendcan.reset();
+      sent++;
+    }
+  }
+}
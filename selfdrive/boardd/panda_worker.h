@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "selfdrive/boardd/panda.h"
+#include "selfdrive/boardd/spsc_queue.h"
+
+#define SEND_QUEUE_SIZE 16
+
+// Per panda I/O threads for boardd with more than one panda, so a slow or stalled
+// USB device only delays its own buses.
+
+// Reads from the panda into its receive queue whenever asked. on_read is called after every read.
+class PandaRecvWorker {
+public:
+  PandaRecvWorker(Panda *panda, std::function<void()> on_read);
+  ~PandaRecvWorker();
+
+  // Starts a read and returns right away, a request during a read is served by the next one
+  void request();
+  // All requests are served
+  bool idle() const { return completed == requested; }
+
+private:
+  void run();
+
+  Panda *panda;
+  std::function<void()> on_read;
+  std::atomic<uint64_t> requested = 0;
+  std::atomic<uint64_t> completed = 0;
+  std::mutex lock;
+  std::condition_variable cv;
+  bool stop = false;
+  std::thread thread;
+};
+
+// Writes sendcan events to the panda in the order they were queued.
+class PandaSendWorker {
+public:
+  typedef std::shared_ptr<const kj::Array<capnp::word>> Sendcan;
+
+  PandaSendWorker(Panda *panda);
+  ~PandaSendWorker();
+
+  // Queues an aligned sendcan event, false if the queue is full and it was dropped
+  bool send(Sendcan sendcan);
+  // Everything queued is written
+  bool idle() const { return sent == queued; }
+
+private:
+  void run();
+
+  Panda *panda;
+  SPSCQueue<Sendcan> queue{SEND_QUEUE_SIZE};
+  std::atomic<uint64_t> queued = 0;
+  std::atomic<uint64_t> sent = 0;
+  uint64_t dropped = 0;
+  std::mutex lock;
+  std::condition_variable cv;
+  bool stop = false;
+  std::thread thread;
+};
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+// Lock-free FIFOs between exactly one producer and one consumer thread.
+// head and tail only ever grow, the capacity is a power of two so they're masked into the buffer.
+
+template <typename T>
+class SPSCQueue {
+public:
+  explicit SPSCQueue(size_t capacity) : items(capacity), mask(capacity - 1) {
+    assert(capacity > 0 && (capacity & mask) == 0);
+  }
+
+  // producer, false if the queue is full
+  bool push(T item) {
+    const size_t t = tail.load(std::memory_order_relaxed);
+    if (t - head.load(std::memory_order_acquire) == items.size()) {
+      return false;
+    }
+    items[t & mask] = std::move(item);
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  // consumer, false if the queue is empty
+  bool pop(T &item) {
+    const size_t h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire)) {
+      return false;
+    }
+    item = std::move(items[h & mask]);
+    items[h & mask] = T();
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool empty() const {
+    return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+  }
+
+private:
+  std::vector<T> items;
+  const size_t mask;
+  alignas(64) std::atomic<size_t> head = 0;
+  alignas(64) std::atomic<size_t> tail = 0;
+};
+
+class SPSCByteQueue {
+public:
+  explicit SPSCByteQueue(size_t capacity) : buf(capacity), mask(capacity - 1) {
+    assert(capacity > 0 && (capacity & mask) == 0);
+  }
+
+  // producer, all or nothing so the stream isn't cut in the middle of a chunk
+  bool push(const uint8_t *data, size_t len) {
+    const size_t t = tail.load(std::memory_order_relaxed);
+    if (buf.size() - (t - head.load(std::memory_order_acquire)) < len) {
+      return false;
+    }
+    const size_t pos = t & mask;
+    const size_t n = std::min(len, buf.size() - pos);
+    memcpy(&buf[pos], data, n);
+    memcpy(&buf[0], data + n, len - n);
+    tail.store(t + len, std::memory_order_release);
+    return true;
+  }
+
+  // consumer, appends everything queued to out and returns how much that was
+  size_t pop(std::vector<uint8_t> &out) {
+    const size_t h = head.load(std::memory_order_relaxed);
+    const size_t len = tail.load(std::memory_order_acquire) - h;
+    const size_t pos = h & mask;
+    const size_t n = std::min(len, buf.size() - pos);
+    out.insert(out.end(), buf.begin() + pos, buf.begin() + pos + n);
+    out.insert(out.end(), buf.begin(), buf.begin() + (len - n));
+    head.store(h + len, std::memory_order_release);
+    return len;
+  }
+
+  size_t size() const {
+    return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+  }
+
+private:
+  std::vector<uint8_t> buf;
+  const size_t mask;
+  alignas(64) std::atomic<size_t> head = 0;
+  alignas(64) std::atomic<size_t> tail = 0;
+};
@@ -18,6 +18,8 @@ struct PandaTest : public Panda {
   void test_can_send();
   void test_can_recv(uint32_t chunk_size = 0);
   void test_chunked_can_recv();
+  void test_can_recv_capnp(uint32_t chunk_size = 0);
+  void test_can_recv_timestamps();
 
   std::map<int, std::string> test_data;
   int can_list_size = 0;
@@ -109,6 +111,114 @@ void PandaTest::test_can_recv(uint32_t rx_chunk_size) {
   }
 }
 
+// the can event the way can_recv_thread built it from can_frames
+kj::Array<capnp::word> can_frames_to_capnp(const std::vector<can_frame> &frames) {
+  MessageBuilder msg;
+  auto evt = msg.initEvent();
+  evt.setLogMonoTime(0);
+  auto canData = evt.initCan(frames.size());
+  for (uint i = 0; i < frames.size(); i++) {
+    canData[i].setAddress(frames[i].address);
+    canData[i].setBusTime(frames[i].busTime);
+    canData[i].setDat(kj::arrayPtr((uint8_t*)frames[i].dat.data(), frames[i].dat.size()));
+    canData[i].setSrc(frames[i].src);
+  }
+  return capnp::messageToFlatArray(msg);
+}
+
+void PandaTest::test_can_recv_capnp(uint32_t rx_chunk_size) {
+  std::vector<uint8_t> packed;
+  this->pack_can_buffer(can_data_list, [&](uint8_t *data, uint32_t size) {
+    packed.insert(packed.end(), data, &data[size]);
+  });
+  if (rx_chunk_size == 0) {
+    rx_chunk_size = packed.size();
+  }
+
+  // the reference goes through unpack_can_buffer and can_frames
+  uint8_t ref_buffer[sizeof(this->receive_buffer)];
+  uint32_t ref_buffer_size = 0;
+  this->receive_buffer_size = 0;
+  size_t total_frames = 0;
+
+  for (uint32_t pos = 0; pos < packed.size(); pos += rx_chunk_size) {
+    uint32_t chunk_size = std::min<uint32_t>(rx_chunk_size, packed.size() - pos);
+    memcpy(&this->receive_buffer[this->receive_buffer_size], &packed[pos], chunk_size);
+    this->receive_buffer_size += chunk_size;
+    memcpy(&ref_buffer[ref_buffer_size], &packed[pos], chunk_size);
+    ref_buffer_size += chunk_size;
+
+    std::vector<can_frame> frames;
+    REQUIRE(this->unpack_can_buffer(ref_buffer, ref_buffer_size, frames));
+    auto expected = can_frames_to_capnp(frames);
+
+    size_t num_frames = this->can_receive_count();
+    REQUIRE(num_frames == frames.size());
+    MessageBuilder msg;
+    auto evt = msg.initEvent();
+    evt.setLogMonoTime(0);
+    auto canData = evt.initCan(num_frames);
+    size_t idx = 0;
+    REQUIRE(this->can_receive_unpack(canData, idx, 0));
+    REQUIRE(idx == num_frames);
+    auto result = capnp::messageToFlatArray(msg);
+
+    INFO("test can message is byte identical");
+    REQUIRE(result.asBytes().size() == expected.asBytes().size());
+    REQUIRE(memcmp(result.begin(), expected.begin(), result.asBytes().size()) == 0);
+    REQUIRE(this->receive_buffer_size == ref_buffer_size);
+    total_frames += num_frames;
+  }
+  REQUIRE(total_frames == can_list_size);
+  REQUIRE(this->receive_buffer_size == 0);
+}
+
+void PandaTest::test_can_recv_timestamps() {
+  // what firmware with RX timestamps on sends: reserved set and the timestamp after the data,
+  // frame i came in i ms after the first
+  std::vector<uint8_t> packed;
+  this->pack_can_buffer(can_data_list, [&](uint8_t *data, uint32_t size) {
+    for (uint32_t pos = 0; pos < size;) {
+      can_header header;
+      memcpy(&header, &data[pos], sizeof(can_header));
+      uint32_t pckt_len = sizeof(can_header) + dlc_to_len[header.data_len_code];
+      uint32_t timestamp = 1000000 + header.addr * 1000;
+
+      size_t start = packed.size();
+      packed.insert(packed.end(), &data[pos], &data[pos + pckt_len]);
+      packed.insert(packed.end(), (uint8_t *)&timestamp, (uint8_t *)&timestamp + sizeof(timestamp));
+      packed[start] |= 1;  // reserved
+      packed[start + sizeof(can_header) - 1] = 0;
+      packed[start + sizeof(can_header) - 1] = calculate_checksum(&packed[start], pckt_len + sizeof(timestamp));
+      pos += pckt_len;
+    }
+  });
+
+  this->rx_timestamps = true;
+  memcpy(this->receive_buffer, packed.data(), packed.size());
+  this->receive_buffer_size = packed.size();
+  // the first read maps the newest frame to the read time, the message goes out 1ms after it
+  this->rx_read_time = 5000000000ULL;
+  const uint64_t log_mono_time = this->rx_read_time + 1000000;
+
+  REQUIRE(this->can_receive_count() == can_list_size);
+  MessageBuilder msg;
+  auto canData = msg.initEvent().initCan(can_list_size);
+  size_t idx = 0;
+  REQUIRE(this->can_receive_unpack(canData, idx, log_mono_time));
+  REQUIRE(this->receive_buffer_size == 0);
+
+  auto frames = canData.asReader();
+  for (int i = 0; i < can_list_size; ++i) {
+    INFO("frame " << i);
+    REQUIRE(frames[i].getAddress() == i);
+    const std::string &dat = test_data[frames[i].getDat().size()];
+    REQUIRE(memcmp(dat.data(), frames[i].getDat().begin(), dat.size()) == 0);
+    REQUIRE(frames[i].getBusTime() == 0);
+    REQUIRE(frames[i].getRxAgeUs() == std::min(1000 + (can_list_size - 1 - i) * 1000, (int)UINT16_MAX));
+  }
+}
+
 TEST_CASE("send/recv CAN 2.0 packets") {
   auto bus_offset = GENERATE(0, 4);
   auto can_list_size = GENERATE(1, 3, 5, 10, 30, 60, 100, 200);
@@ -123,6 +233,15 @@ TEST_CASE("send/recv CAN 2.0 packets") {
   SECTION("chunked_can_receive") {
     test.test_can_recv(0x40);
   }
+  SECTION("can_receive_capnp") {
+    test.test_can_recv_capnp();
+  }
+  SECTION("chunked_can_receive_capnp") {
+    test.test_can_recv_capnp(0x40);
+  }
+  SECTION("can_receive_timestamps") {
+    test.test_can_recv_timestamps();
+  }
 }
 
 TEST_CASE("send/recv CAN FD packets") {
@@ -139,4 +258,13 @@ TEST_CASE("send/recv CAN FD packets") {
   SECTION("chunked_can_receive") {
     test.test_can_recv(0x40);
   }
+  SECTION("can_receive_capnp") {
+    test.test_can_recv_capnp();
+  }
+  SECTION("chunked_can_receive_capnp") {
+    test.test_can_recv_capnp(0x40);
+  }
+  SECTION("can_receive_timestamps") {
+    test.test_can_recv_timestamps();
+  }
 }
@@ -0,0 +1,269 @@
+#define CATCH_CONFIG_MAIN
+#include <chrono>
+#include <thread>
+
+#include "catch2/catch.hpp"
+#include "cereal/messaging/messaging.h"
+#include "common/timing.h"
+#include "selfdrive/boardd/panda_worker.h"
+
+using namespace std::chrono_literals;
+
+// stands in for a USB device that takes latency for every bulk transfer
+class MockCommsHandle : public PandaCommsHandle {
+public:
+  MockCommsHandle(std::string serial, std::chrono::milliseconds latency) : PandaCommsHandle(serial), latency(latency) {
+    hw_serial = serial;
+  }
+  void cleanup() override {}
+
+  int control_write(uint8_t request, uint16_t param1, uint16_t param2, unsigned int timeout=TIMEOUT) override { return 0; }
+  int control_read(uint8_t request, uint16_t param1, uint16_t param2, unsigned char *data, uint16_t length, unsigned int timeout=TIMEOUT) override { return 0; }
+
+  int bulk_write(unsigned char endpoint, unsigned char* data, int length, unsigned int timeout=TIMEOUT) override {
+    std::this_thread::sleep_for(latency);
+    std::lock_guard lk(lock);
+    written.insert(written.end(), data, data + length);
+    return length;
+  }
+
+  int bulk_read(unsigned char endpoint, unsigned char* data, int length, unsigned int timeout=TIMEOUT) override {
+    std::this_thread::sleep_for(latency);
+    std::lock_guard lk(lock);
+    int n = std::min<int>(length, rx.size());
+    memcpy(data, rx.data(), n);
+    rx.erase(rx.begin(), rx.begin() + n);
+    return n;
+  }
+
+  size_t written_size() {
+    std::lock_guard lk(lock);
+    return written.size();
+  }
+
+  void add_rx(const std::vector<uint8_t> &data) {
+    std::lock_guard lk(lock);
+    rx.insert(rx.end(), data.begin(), data.end());
+  }
+
+  const std::chrono::milliseconds latency;
+
+private:
+  std::mutex lock;
+  std::vector<uint8_t> written;
+  std::vector<uint8_t> rx;
+};
+
+struct MockPanda : public Panda {
+  MockPanda(uint32_t bus_offset, std::chrono::milliseconds latency) : Panda(bus_offset) {
+    hw_type = cereal::PandaState::PandaType::DOS;
+    comms = new MockCommsHandle("panda" + std::to_string(bus_offset), latency);
+    handle.reset(comms);
+  }
+
+  // the bytes the panda sends for these frames
+  std::vector<uint8_t> pack(capnp::List<cereal::CanData>::Reader can_data_list) {
+    std::vector<uint8_t> packed;
+    pack_can_buffer(can_data_list, [&](uint8_t *data, size_t size) {
+      packed.insert(packed.end(), data, data + size);
+    });
+    return packed;
+  }
+
+  using Panda::queue_received;
+
+  MockCommsHandle *comms;
+};
+
+static kj::Array<capnp::word> build_sendcan(int num_frames, uint32_t bus_offset, int num_buses = 3) {
+  MessageBuilder msg;
+  auto can_list = msg.initEvent().initSendcan(num_frames);
+  uint8_t dat[8] = {};
+  for (int i = 0; i < num_frames; i++) {
+    can_list[i].setAddress(0x100 + i);
+    can_list[i].setSrc(bus_offset + i % num_buses);
+    can_list[i].setDat(kj::arrayPtr(dat, sizeof(dat)));
+  }
+  return capnp::messageToFlatArray(msg);
+}
+
+template <typename F>
+static bool wait_until(F done, std::chrono::milliseconds timeout) {
+  auto end = std::chrono::steady_clock::now() + timeout;
+  while (!done()) {
+    if (std::chrono::steady_clock::now() > end) return false;
+    std::this_thread::sleep_for(1ms);
+  }
+  return true;
+}
+
+TEST_CASE("SPSCQueue keeps order across wraparound") {
+  SPSCQueue<int> queue(4);
+  int item = 0;
+  REQUIRE(!queue.pop(item));
+  for (int i = 0; i < 100; i++) {
+    REQUIRE(queue.push(i * 2));
+    REQUIRE(queue.push(i * 2 + 1));
+    REQUIRE(queue.pop(item));
+    REQUIRE(item == i * 2);
+    REQUIRE(queue.pop(item));
+    REQUIRE(item == i * 2 + 1);
+  }
+  for (int i = 0; i < 4; i++) {
+    REQUIRE(queue.push(i));
+  }
+  REQUIRE(!queue.push(4));
+}
+
+TEST_CASE("SPSCByteQueue") {
+  SPSCByteQueue queue(16);
+  std::vector<uint8_t> data(10);
+  std::vector<uint8_t> out;
+
+  SECTION("all or nothing") {
+    REQUIRE(queue.push(data.data(), 10));
+    REQUIRE(!queue.push(data.data(), 7));
+    REQUIRE(queue.push(data.data(), 6));
+    REQUIRE(queue.size() == 16);
+    REQUIRE(queue.pop(out) == 16);
+    REQUIRE(queue.size() == 0);
+  }
+  SECTION("between two threads") {
+    const size_t total = 100000;
+    std::thread producer([&]() {
+      uint8_t chunk[7];
+      for (size_t pos = 0; pos < total;) {
+        size_t len = std::min(sizeof(chunk), total - pos);
+        for (size_t i = 0; i < len; i++) chunk[i] = (pos + i) & 0xff;
+        if (queue.push(chunk, len)) {
+          pos += len;
+        }
+      }
+    });
+    while (out.size() < total) {
+      queue.pop(out);
+    }
+    producer.join();
+    for (size_t i = 0; i < total; i++) {
+      REQUIRE(out[i] == (i & 0xff));
+    }
+  }
+}
+
+TEST_CASE("sendcan isn't held up by a slow panda") {
+  MockPanda fast(0, 0ms), slow(4, 50ms);
+  PandaSendWorker fast_worker(&fast), slow_worker(&slow);
+
+  // frames for the buses of both pandas
+  auto words = build_sendcan(16, 0, 2 * PANDA_BUS_CNT);
+  auto sendcan = std::make_shared<const kj::Array<capnp::word>>(kj::heapArray(words.asPtr()));
+  for (int i = 0; i < 3; i++) {
+    REQUIRE(fast_worker.send(sendcan));
+    REQUIRE(slow_worker.send(sendcan));
+  }
+
+  capnp::FlatArrayMessageReader cmsg(words);
+  auto sent = cmsg.getRoot<cereal::Event>().getSendcan();
+  REQUIRE(wait_until([&] { return fast_worker.idle(); }, 40ms));
+  REQUIRE(fast.comms->written_size() == fast.pack(sent).size() * 3);
+  REQUIRE(!slow_worker.idle());
+
+  REQUIRE(wait_until([&] { return slow_worker.idle(); }, 1000ms));
+  REQUIRE(slow.comms->written_size() == slow.pack(sent).size() * 3);
+  REQUIRE(slow.pack(sent).size() > 0);
+}
+
+TEST_CASE("sendcan queue drops when full") {
+  MockPanda slow(0, 50ms);
+  PandaSendWorker worker(&slow);
+
+  auto words = build_sendcan(1, 0);
+  auto sendcan = std::make_shared<const kj::Array<capnp::word>>(kj::heapArray(words.asPtr()));
+  int queued = 0;
+  for (int i = 0; i < SEND_QUEUE_SIZE * 2; i++) {
+    queued += worker.send(sendcan);
+  }
+  REQUIRE(queued < SEND_QUEUE_SIZE * 2);
+}
+
+TEST_CASE("can receive isn't held up by a slow panda") {
+  MockPanda fast(0, 0ms), slow(4, 50ms);
+  std::atomic<int> reads = 0;
+  PandaRecvWorker fast_worker(&fast, [&] { reads++; }), slow_worker(&slow, [&] { reads++; });
+
+  for (MockPanda *panda : {&fast, &slow}) {
+    auto words = build_sendcan(20, panda->bus_offset);
+    capnp::FlatArrayMessageReader cmsg(words);
+    panda->comms->add_rx(panda->pack(cmsg.getRoot<cereal::Event>().getSendcan()));
+  }
+
+  fast_worker.request();
+  slow_worker.request();
+  REQUIRE(wait_until([&] { return fast_worker.idle(); }, 40ms));
+  REQUIRE(!slow_worker.idle());
+
+  uint64_t arrival = 0;
+  REQUIRE(fast.can_receive_queued(arrival));
+  REQUIRE(arrival > 0);
+  REQUIRE(arrival <= nanos_since_boot());
+  REQUIRE(fast.can_receive_count() == 20);
+  REQUIRE(slow.can_receive_queued(arrival));
+  REQUIRE(arrival == 0);
+  REQUIRE(slow.can_receive_count() == 0);
+
+  REQUIRE(wait_until([&] { return slow_worker.idle(); }, 1000ms));
+  REQUIRE(reads == 2);
+  REQUIRE(slow.can_receive_queued(arrival));
+  REQUIRE(arrival > 0);
+  REQUIRE(slow.can_receive_count() == 20);
+
+  MessageBuilder msg;
+  auto can = msg.initEvent().initCan(40);
+  size_t idx = 0;
+  REQUIRE(fast.can_receive_unpack(can, idx, 0));
+  REQUIRE(slow.can_receive_unpack(can, idx, 0));
+  REQUIRE(idx == 40);
+  auto frames = can.asReader();
+  for (int i = 0; i < 20; i++) {
+    REQUIRE(frames[i].getAddress() == 0x100 + i);
+    REQUIRE(frames[i].getSrc() == i % 3);
+    REQUIRE(frames[20 + i].getAddress() == 0x100 + i);
+    REQUIRE(frames[20 + i].getSrc() == 4 + i % 3);
+  }
+}
+
+TEST_CASE("can receive starts over after the queue overflows") {
+  MockPanda panda(0, 0ms);
+  auto words = build_sendcan(20, 0);
+  capnp::FlatArrayMessageReader cmsg(words);
+  const std::vector<uint8_t> packed = panda.pack(cmsg.getRoot<cereal::Event>().getSendcan());
+
+  MessageBuilder msg;
+  auto can = msg.initEvent().initCan(20);
+  size_t idx = 0;
+  uint64_t arrival = 0;
+
+  // the start of a frame stays in the receive buffer
+  panda.queue_received(packed.data(), 10);
+  REQUIRE(panda.can_receive_queued(arrival));
+  REQUIRE(panda.can_receive_count() == 0);
+  REQUIRE(panda.can_receive_unpack(can, idx, 0));
+
+  // zeros would unpack as frames if they were put together with what came before
+  const std::vector<uint8_t> zeros(RECV_QUEUE_SIZE);
+  panda.queue_received(zeros.data(), zeros.size());
+  panda.queue_received(packed.data(), packed.size());
+  REQUIRE(!panda.can_receive_queued(arrival));
+  REQUIRE(panda.can_receive_count() == 0);
+  REQUIRE(panda.can_receive_unpack(can, idx, 0));
+  REQUIRE(idx == 0);
+
+  panda.queue_received(packed.data(), packed.size());
+  REQUIRE(panda.can_receive_queued(arrival));
+  REQUIRE(panda.can_receive_count() == 20);
+  REQUIRE(panda.can_receive_unpack(can, idx, 0));
+  auto frames = can.asReader();
+  for (int i = 0; i < 20; i++) {
+    REQUIRE(frames[i].getAddress() == 0x100 + i);
+  }
+}
@@ -5,6 +5,7 @@ from abc import abstractmethod, ABC
 from typing import Any, Dict, Optional, Tuple, List, Callable
 
 from cereal import car
+from opendbc.can.parser import CANParserGroup
 from common.basedir import BASEDIR
 from common.conversions import Conversions as CV
 from common.kalman.simple_kalman import KF1D
@@ -70,6 +71,7 @@ class CarInterfaceBase(ABC):
 
     self.CS = None
     self.can_parsers = []
+    self.can_parser_group = None
     if CarState is not None:
       self.CS = CarState(CP)
 
@@ -79,6 +81,7 @@ class CarInterfaceBase(ABC):
       self.cp_body = self.CS.get_body_can_parser(CP)
       self.cp_loopback = self.CS.get_loopback_can_parser(CP)
       self.can_parsers = [self.cp, self.cp_cam, self.cp_adas, self.cp_body, self.cp_loopback]
+      self.can_parser_group = CANParserGroup(self.can_parsers)
 
     self.CC = None
     if CarController is not None:
@@ -197,10 +200,9 @@ class CarInterfaceBase(ABC):
     pass
 
   def update(self, c: car.CarControl, can_strings: List[bytes]) -> car.CarState:
-    # parse can
-    for cp in self.can_parsers:
-      if cp is not None:
-        cp.update_strings(can_strings)
+    # parse can, once for all buses
+    if self.can_parser_group is not None:
+      self.can_parser_group.update_strings(can_strings)
 
     # get CarState
     ret = self._update(c)
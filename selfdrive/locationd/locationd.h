@@ -41,8 +41,7 @@ public:
   bool are_inputs_ok();
   void observation_timings_invalid_reset();
 
-  kj::ArrayPtr<capnp::byte> get_message_bytes(MessageBuilder& msg_builder,
-    bool inputsOK, bool sensorsOK, bool gpsOK, bool msgValid);
+  kj::ArrayPtr<capnp::byte> get_message_bytes(bool inputsOK, bool sensorsOK, bool gpsOK, bool msgValid);
   void build_live_location(cereal::LiveLocationKalman::Builder& fix);
 
   Eigen::VectorXd get_position_geodetic();
@@ -62,6 +61,8 @@ public:
 
 private:
   std::unique_ptr<LiveKalman> kf;
+  // liveLocationKalman is built in here every time, the bytes are valid until the next one
+  ReusableMessageBuilder msg_builder;
 
   Eigen::VectorXd calib;
   MatrixXdr device_from_calib;
@@ -93,7 +93,7 @@ bool UbloxMsgParser::add_data(const uint8_t *incoming_data, uint32_t incoming_da
 }
 
 
-std::pair<std::string, kj::Array<capnp::word>> UbloxMsgParser::gen_msg() {
+std::pair<std::string, ReusableMessageBuilder *> UbloxMsgParser::gen_msg() {
   std::string dat = data();
   kaitai::kstream stream(dat);
 
@@ -113,13 +113,12 @@ std::pair<std::string, kj::Array<capnp::word>> UbloxMsgParser::gen_msg() {
     return {"ubloxGnss", gen_mon_hw2(static_cast<ubx_t::mon_hw2_t*>(body))};
   default:
     LOGE("Unknown message type %x", ubx_message.msg_type());
-    return {"ubloxGnss", kj::Array<capnp::word>()};
+    return {"ubloxGnss", nullptr};
   }
 }
 
 
-kj::Array<capnp::word> UbloxMsgParser::gen_nav_pvt(ubx_t::nav_pvt_t *msg) {
-  MessageBuilder msg_builder;
+ReusableMessageBuilder *UbloxMsgParser::gen_nav_pvt(ubx_t::nav_pvt_t *msg) {
   auto gpsLoc = msg_builder.initEvent().initGpsLocationExternal();
   gpsLoc.setSource(cereal::GpsLocationData::SensorSource::UBLOX);
   gpsLoc.setFlags(msg->flags());
@@ -144,11 +143,11 @@ kj::Array<capnp::word> UbloxMsgParser::gen_nav_pvt(ubx_t::nav_pvt_t *msg) {
   gpsLoc.setVerticalAccuracy(msg->v_acc() * 1e-03);
   gpsLoc.setSpeedAccuracy(msg->s_acc() * 1e-03);
   gpsLoc.setBearingAccuracyDeg(msg->head_acc() * 1e-05);
-  return capnp::messageToFlatArray(msg_builder);
+  return &msg_builder;
 }
 
 
-kj::Array<capnp::word> UbloxMsgParser::gen_rxm_sfrbx(ubx_t::rxm_sfrbx_t *msg) {
+ReusableMessageBuilder *UbloxMsgParser::gen_rxm_sfrbx(ubx_t::rxm_sfrbx_t *msg) {
   auto body = *msg->body();
 
   if (msg->gnss_id() == ubx_t::gnss_type_t::GNSS_TYPE_GPS) {
@@ -176,7 +175,6 @@ kj::Array<capnp::word> UbloxMsgParser::gen_rxm_sfrbx(ubx_t::rxm_sfrbx_t *msg) {
     }
 
     if (gps_subframes[msg->sv_id()].size() == 5) {
-      MessageBuilder msg_builder;
       auto eph = msg_builder.initEvent().initUbloxGnss().initEphemeris();
       eph.setSvId(msg->sv_id());
 
@@ -250,14 +248,13 @@ kj::Array<capnp::word> UbloxMsgParser::gen_rxm_sfrbx(ubx_t::rxm_sfrbx_t *msg) {
         }
       }
 
-      return capnp::messageToFlatArray(msg_builder);
+      return &msg_builder;
     }
   }
-  return kj::Array<capnp::word>();
+  return nullptr;
 }
 
-kj::Array<capnp::word> UbloxMsgParser::gen_rxm_rawx(ubx_t::rxm_rawx_t *msg) {
-  MessageBuilder msg_builder;
+ReusableMessageBuilder *UbloxMsgParser::gen_rxm_rawx(ubx_t::rxm_rawx_t *msg) {
   auto mr = msg_builder.initEvent().initUbloxGnss().initMeasurementReport();
   mr.setRcvTow(msg->rcv_tow());
   mr.setGpsWeek(msg->week());
@@ -291,11 +288,10 @@ kj::Array<capnp::word> UbloxMsgParser::gen_rxm_rawx(ubx_t::rxm_rawx_t *msg) {
   auto rs = mr.initReceiverStatus();
   rs.setLeapSecValid(bit_to_bool(msg->rec_stat(), 0));
   rs.setClkReset(bit_to_bool(msg->rec_stat(), 2));
-  return capnp::messageToFlatArray(msg_builder);
+  return &msg_builder;
 }
 
-kj::Array<capnp::word> UbloxMsgParser::gen_mon_hw(ubx_t::mon_hw_t *msg) {
-  MessageBuilder msg_builder;
+ReusableMessageBuilder *UbloxMsgParser::gen_mon_hw(ubx_t::mon_hw_t *msg) {
   auto hwStatus = msg_builder.initEvent().initUbloxGnss().initHwStatus();
   hwStatus.setNoisePerMS(msg->noise_per_ms());
   hwStatus.setFlags(msg->flags());
@@ -303,11 +299,10 @@ kj::Array<capnp::word> UbloxMsgParser::gen_mon_hw(ubx_t::mon_hw_t *msg) {
   hwStatus.setAStatus((cereal::UbloxGnss::HwStatus::AntennaSupervisorState) msg->a_status());
   hwStatus.setAPower((cereal::UbloxGnss::HwStatus::AntennaPowerStatus) msg->a_power());
   hwStatus.setJamInd(msg->jam_ind());
-  return capnp::messageToFlatArray(msg_builder);
+  return &msg_builder;
 }
 
-kj::Array<capnp::word> UbloxMsgParser::gen_mon_hw2(ubx_t::mon_hw2_t *msg) {
-  MessageBuilder msg_builder;
+ReusableMessageBuilder *UbloxMsgParser::gen_mon_hw2(ubx_t::mon_hw2_t *msg) {
   auto hwStatus = msg_builder.initEvent().initUbloxGnss().initHwStatus2();
   hwStatus.setOfsI(msg->ofs_i());
   hwStatus.setMagI(msg->mag_i());
@@ -335,5 +330,5 @@ kj::Array<capnp::word> UbloxMsgParser::gen_mon_hw2(ubx_t::mon_hw2_t *msg) {
   hwStatus.setLowLevCfg(msg->low_lev_cfg());
   hwStatus.setPostStatus(msg->post_status());
 
-  return capnp::messageToFlatArray(msg_builder);
+  return &msg_builder;
 }
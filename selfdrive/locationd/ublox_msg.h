@@ -90,12 +90,14 @@ class UbloxMsgParser {
     inline int needed_bytes();
     inline std::string data() {return std::string((const char*)msg_parse_buf, bytes_in_parse_buf);}
 
-    std::pair<std::string, kj::Array<capnp::word>> gen_msg();
-    kj::Array<capnp::word> gen_nav_pvt(ubx_t::nav_pvt_t *msg);
-    kj::Array<capnp::word> gen_rxm_sfrbx(ubx_t::rxm_sfrbx_t *msg);
-    kj::Array<capnp::word> gen_rxm_rawx(ubx_t::rxm_rawx_t *msg);
-    kj::Array<capnp::word> gen_mon_hw(ubx_t::mon_hw_t *msg);
-    kj::Array<capnp::word> gen_mon_hw2(ubx_t::mon_hw2_t *msg);
+    // the message is built in the parser's builder and valid until the next call,
+    // nullptr if there is nothing to publish
+    std::pair<std::string, ReusableMessageBuilder *> gen_msg();
+    ReusableMessageBuilder *gen_nav_pvt(ubx_t::nav_pvt_t *msg);
+    ReusableMessageBuilder *gen_rxm_sfrbx(ubx_t::rxm_sfrbx_t *msg);
+    ReusableMessageBuilder *gen_rxm_rawx(ubx_t::rxm_rawx_t *msg);
+    ReusableMessageBuilder *gen_mon_hw(ubx_t::mon_hw_t *msg);
+    ReusableMessageBuilder *gen_mon_hw2(ubx_t::mon_hw2_t *msg);
 
   private:
     inline bool valid_cheksum();
@@ -104,6 +106,8 @@ class UbloxMsgParser {
 
     std::unordered_map<int, std::unordered_map<int, std::string>> gps_subframes;
 
+    ReusableMessageBuilder msg_builder;
+
     size_t bytes_in_parse_buf = 0;
     uint8_t msg_parse_buf[ublox::UBLOX_HEADER_SIZE + ublox::UBLOX_MAX_MSG_SIZE];
 
@@ -45,9 +45,8 @@ int main() {
 
         try {
           auto ublox_msg = parser.gen_msg();
-          if (ublox_msg.second.size() > 0) {
-            auto bytes = ublox_msg.second.asBytes();
-            pm.send(ublox_msg.first.c_str(), bytes.begin(), bytes.size());
+          if (ublox_msg.second) {
+            pm.send(ublox_msg.first.c_str(), *ublox_msg.second);
           }
         } catch (const std::exception& e) {
           LOGE("Error parsing ublox message %s", e.what());
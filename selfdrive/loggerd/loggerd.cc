@@ -65,15 +65,11 @@ void loggerd_thread() {
       if (do_exit) break;
 
       // drain socket
-      int count = 0;
       QlogState &qs = qlog_states[sock];
-      Message *msg = nullptr;
-      while (!do_exit && (msg = sock->receive(true))) {
+      int count = sock->receiveMany(200, [&](Message *msg) {
         const bool in_qlog = qs.freq != -1 && (qs.counter++ % qs.freq == 0);
-  
         logger_log(&s.logger, (uint8_t *)msg->getData(), msg->getSize(), in_qlog);
         bytes_count += msg->getSize();
-        delete msg;
 
         rotate_if_needed(&s);
 
@@ -81,12 +77,11 @@ void loggerd_thread() {
           double seconds = (millis_since_boot() - start_ts) / 1000.0;
           LOGD("%lu messages, %.2f msg/sec, %.2f KB/sec", msg_count, msg_count / seconds, bytes_count * 0.001 / seconds);
         }
+        return !do_exit;
+      });
 
-        count++;
-        if (count >= 200) {
-          LOGD("large volume of '%s' messages", qs.name.c_str());
-          break;
-        }
+      if (count >= 200) {
+        LOGD("large volume of '%s' messages", qs.name.c_str());
       }
     }
   }
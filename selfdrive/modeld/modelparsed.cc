@@ -137,29 +137,60 @@ int main(int argc, char **argv) {
 
 #else
     // this receive should block
-    std::unique_ptr<Message> msg(subscriber->receive());
+    // parse modelRaw in place, the predictions are copied out before the message is released
+    Message *msg = subscriber->receiveBorrowed();
     if (!msg) {
       if (errno == EINTR) {
         do_exit = true;
       }
       continue;
     }
-    capnp::FlatArrayMessageReader cmsg(aligned_buf.align(msg.get()));
-    cereal::Event::Reader event = cmsg.getRoot<cereal::Event>();
-    auto modelRaw = event.getModelRaw();
-    auto model_raw = modelRaw.getRawPredictions();
+    // A writer that reclaims the slot can overwrite the message while capnp reads it, which
+    // throws or hands back garbage. Nothing read here is used before releaseBorrowed says the
+    // data was intact.
+    uint32_t frame_id = 0, frame_id_extra = 0;
+    float frame_drop_perc = 0, model_execution_time = 0;
+    uint64_t timestamp_eof = 0;
+    bool valid = false;
+    size_t model_raw_size = 0;
+    bool parsed = false;
+    try {
+      capnp::FlatArrayMessageReader cmsg(aligned_buf.view(msg));
+      cereal::Event::Reader event = cmsg.getRoot<cereal::Event>();
+      auto modelRaw = event.getModelRaw();
+      auto model_raw = modelRaw.getRawPredictions();
+
+      model_raw_size = model_raw.size();
+      for (int i=0; i<NET_OUTPUT_SIZE && i<(int)model_raw_size; i++)
+        model_raw_preds[i] = model_raw[i];
+
+      frame_id = modelRaw.getFrameId();
+      frame_id_extra = modelRaw.getFrameIdExtra();
+      frame_drop_perc = modelRaw.getFrameDropPerc();
+      timestamp_eof = modelRaw.getTimestampEof();
+      model_execution_time = modelRaw.getModelExecutionTime();
+      valid = modelRaw.getValid();
+      parsed = true;
+    } catch (const kj::Exception &) {
+    }
 
-    assert(model_raw.size() == NET_OUTPUT_SIZE);
-    for (int i=0; i<NET_OUTPUT_SIZE; i++)
-      model_raw_preds[i] = model_raw[i];
+    // modelRaw was overwritten while we were reading it, drop the frame
+    if (!subscriber->releaseBorrowed(msg)) {
+      continue;
+    }
+    if (!parsed) {
+      cout << "Invalid modelRaw message, dropping frame" << endl;
+      continue;
+    }
+    assert(model_raw_size == NET_OUTPUT_SIZE);
 
-    uint32_t vipc_dropped_frames = modelRaw.getFrameId() - last_frame_id - 1;
+    uint32_t vipc_dropped_frames = frame_id - last_frame_id - 1;
     
-    model_publish(pm, modelRaw.getFrameId(), modelRaw.getFrameIdExtra(), modelRaw.getFrameId(), modelRaw.getFrameDropPerc()/100, 
-                  model_raw_preds, modelRaw.getTimestampEof(), modelRaw.getModelExecutionTime(), modelRaw.getValid());
-    posenet_publish(pm, modelRaw.getFrameId(), vipc_dropped_frames, model_raw_preds, modelRaw.getTimestampEof(), modelRaw.getValid());
+    model_publish(pm, frame_id, frame_id_extra, frame_id, frame_drop_perc/100,
+                  model_raw_preds, timestamp_eof, model_execution_time, valid);
+    posenet_publish(pm, frame_id, vipc_dropped_frames, model_raw_preds, timestamp_eof, valid);
 
-    last_frame_id = modelRaw.getFrameId();
+    last_frame_id = frame_id;
 #endif
 
   }
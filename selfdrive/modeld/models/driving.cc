@@ -3,73 +3,96 @@
 #include <fcntl.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <array>
 #include <cassert>
 #include <cstring>
 #include <iostream>
 
 #include <eigen3/Eigen/Dense>
 
-
+#include "selfdrive/modeld/models/vecmath.h"
 
 std::array<float, 5> prev_brake_5ms2_probs = {0,0,0,0,0};
 std::array<float, 3> prev_brake_3ms2_probs = {0,0,0};
 std::array<float, DISENGAGE_LEN * DISENGAGE_LEN> disengage_buffer = {};
 
 
+// The fill functions read the outputs stride floats apart, straight out of the model output
+// structs. The kernels write into a buffer on the stack, which is then copied into the list.
+constexpr size_t MAX_LIST_LEN = std::max<size_t>(TRAJECTORY_SIZE, DESIRE_PRED_LEN * DESIRE_LEN);
+using ListBuffer = std::array<float, MAX_LIST_LEN>;
+
+template <class T>
+constexpr size_t stride_of() {
+  return sizeof(T) / sizeof(float);
+}
+
+static void copy_list(capnp::List<float>::Builder list, const float *values) {
+  for (uint i = 0; i < list.size(); i++) {
+    list.set(i, values[i]);
+  }
+}
+
+static void set_mapped(void (*kernel)(const float *, size_t, float *, size_t),
+                       capnp::List<float>::Builder list, const float &first, size_t stride) {
+  ListBuffer out;
+  assert(list.size() <= out.size());
+  kernel(&first, stride, out.data(), list.size());
+  copy_list(list, out.data());
+}
+
+static void set_gather(capnp::List<float>::Builder list, const float &first, size_t stride) {
+  set_mapped(vec_gather, list, first, stride);
+}
+
+static void set_exp(capnp::List<float>::Builder list, const float &first, size_t stride) {
+  set_mapped(vec_exp, list, first, stride);
+}
+
+static void set_sigmoid(capnp::List<float>::Builder list, const float &first, size_t stride) {
+  set_mapped(vec_sigmoid, list, first, stride);
+}
+
 void fill_lead(cereal::ModelDataV2::LeadDataV3::Builder lead, const ModelOutputLeads &leads, int t_idx, float prob_t) {
-  std::array<float, LEAD_TRAJ_LEN> lead_t = {0.0, 2.0, 4.0, 6.0, 8.0, 10.0};
+  static constexpr std::array<float, LEAD_TRAJ_LEN> lead_t = {0.0, 2.0, 4.0, 6.0, 8.0, 10.0};
+  constexpr size_t stride = stride_of<ModelOutputLeadElement>();
   const auto &best_prediction = leads.get_best_prediction(t_idx);
+  const auto &mean = best_prediction.mean[0];
+  const auto &log_std = best_prediction.std[0];
   lead.setProb(sigmoid(leads.prob[t_idx]));
   lead.setProbTime(prob_t);
-  std::array<float, LEAD_TRAJ_LEN> lead_x, lead_y, lead_v, lead_a;
-  std::array<float, LEAD_TRAJ_LEN> lead_x_std, lead_y_std, lead_v_std, lead_a_std;
-  for (int i=0; i<LEAD_TRAJ_LEN; i++) {
-    lead_x[i] = best_prediction.mean[i].x;
-    lead_y[i] = best_prediction.mean[i].y;
-    lead_v[i] = best_prediction.mean[i].velocity;
-    lead_a[i] = best_prediction.mean[i].acceleration;
-    lead_x_std[i] = exp(best_prediction.std[i].x);
-    lead_y_std[i] = exp(best_prediction.std[i].y);
-    lead_v_std[i] = exp(best_prediction.std[i].velocity);
-    lead_a_std[i] = exp(best_prediction.std[i].acceleration);
-  }
   lead.setT(to_kj_array_ptr(lead_t));
-  lead.setX(to_kj_array_ptr(lead_x));
-  lead.setY(to_kj_array_ptr(lead_y));
-  lead.setV(to_kj_array_ptr(lead_v));
-  lead.setA(to_kj_array_ptr(lead_a));
-  lead.setXStd(to_kj_array_ptr(lead_x_std));
-  lead.setYStd(to_kj_array_ptr(lead_y_std));
-  lead.setVStd(to_kj_array_ptr(lead_v_std));
-  lead.setAStd(to_kj_array_ptr(lead_a_std));
+  set_gather(lead.initX(LEAD_TRAJ_LEN), mean.x, stride);
+  set_gather(lead.initY(LEAD_TRAJ_LEN), mean.y, stride);
+  set_gather(lead.initV(LEAD_TRAJ_LEN), mean.velocity, stride);
+  set_gather(lead.initA(LEAD_TRAJ_LEN), mean.acceleration, stride);
+  set_exp(lead.initXStd(LEAD_TRAJ_LEN), log_std.x, stride);
+  set_exp(lead.initYStd(LEAD_TRAJ_LEN), log_std.y, stride);
+  set_exp(lead.initVStd(LEAD_TRAJ_LEN), log_std.velocity, stride);
+  set_exp(lead.initAStd(LEAD_TRAJ_LEN), log_std.acceleration, stride);
 }
 
 void fill_meta(cereal::ModelDataV2::MetaData::Builder meta, const ModelOutputMeta &meta_data) {
-  std::array<float, DESIRE_LEN> desire_state_softmax;
-  softmax(meta_data.desire_state_prob.array.data(), desire_state_softmax.data(), DESIRE_LEN);
+  static constexpr std::array<float, DISENGAGE_LEN> lat_long_t = {2,4,6,8,10};
+  constexpr size_t stride = stride_of<ModelOutputDisengageProb>();
+  const auto &probs = meta_data.disengage_prob[0];
 
-  std::array<float, DESIRE_PRED_LEN * DESIRE_LEN> desire_pred_softmax;
-  for (int i=0; i<DESIRE_PRED_LEN; i++) {
-    softmax(meta_data.desire_pred_prob[i].array.data(), desire_pred_softmax.data() + (i * DESIRE_LEN), DESIRE_LEN);
-  }
-
-  std::array<float, DISENGAGE_LEN> lat_long_t = {2,4,6,8,10};
-  std::array<float, DISENGAGE_LEN> gas_disengage_sigmoid, brake_disengage_sigmoid, steer_override_sigmoid,
-                                   brake_3ms2_sigmoid, brake_4ms2_sigmoid, brake_5ms2_sigmoid;
-  for (int i=0; i<DISENGAGE_LEN; i++) {
-    gas_disengage_sigmoid[i] = sigmoid(meta_data.disengage_prob[i].gas_disengage);
-    brake_disengage_sigmoid[i] = sigmoid(meta_data.disengage_prob[i].brake_disengage);
-    steer_override_sigmoid[i] = sigmoid(meta_data.disengage_prob[i].steer_override);
-    brake_3ms2_sigmoid[i] = sigmoid(meta_data.disengage_prob[i].brake_3ms2);
-    brake_4ms2_sigmoid[i] = sigmoid(meta_data.disengage_prob[i].brake_4ms2);
-    brake_5ms2_sigmoid[i] = sigmoid(meta_data.disengage_prob[i].brake_5ms2);
-    //gas_pressed_sigmoid[i] = sigmoid(meta_data.disengage_prob[i].gas_pressed);
-  }
+  auto disengage = meta.initDisengagePredictions();
+  disengage.setT(to_kj_array_ptr(lat_long_t));
+  set_sigmoid(disengage.initGasDisengageProbs(DISENGAGE_LEN), probs.gas_disengage, stride);
+  set_sigmoid(disengage.initBrakeDisengageProbs(DISENGAGE_LEN), probs.brake_disengage, stride);
+  set_sigmoid(disengage.initSteerOverrideProbs(DISENGAGE_LEN), probs.steer_override, stride);
+  auto brake_3ms2 = disengage.initBrake3MetersPerSecondSquaredProbs(DISENGAGE_LEN);
+  set_sigmoid(brake_3ms2, probs.brake_3ms2, stride);
+  set_sigmoid(disengage.initBrake4MetersPerSecondSquaredProbs(DISENGAGE_LEN), probs.brake_4ms2, stride);
+  auto brake_5ms2 = disengage.initBrake5MetersPerSecondSquaredProbs(DISENGAGE_LEN);
+  set_sigmoid(brake_5ms2, probs.brake_5ms2, stride);
 
   std::memmove(prev_brake_5ms2_probs.data(), &prev_brake_5ms2_probs[1], 4*sizeof(float));
   std::memmove(prev_brake_3ms2_probs.data(), &prev_brake_3ms2_probs[1], 2*sizeof(float));
-  prev_brake_5ms2_probs[4] = brake_5ms2_sigmoid[0];
-  prev_brake_3ms2_probs[2] = brake_3ms2_sigmoid[0];
+  prev_brake_5ms2_probs[4] = brake_5ms2[0];
+  prev_brake_3ms2_probs[2] = brake_3ms2[0];
 
   bool above_fcw_threshold = true;
   for (int i=0; i<prev_brake_5ms2_probs.size(); i++) {
@@ -80,18 +103,14 @@ void fill_meta(cereal::ModelDataV2::MetaData::Builder meta, const ModelOutputMet
     above_fcw_threshold = above_fcw_threshold && prev_brake_3ms2_probs[i] > FCW_THRESHOLD_3MS2;
   }
 
-  auto disengage = meta.initDisengagePredictions();
-  disengage.setT(to_kj_array_ptr(lat_long_t));
-  disengage.setGasDisengageProbs(to_kj_array_ptr(gas_disengage_sigmoid));
-  disengage.setBrakeDisengageProbs(to_kj_array_ptr(brake_disengage_sigmoid));
-  disengage.setSteerOverrideProbs(to_kj_array_ptr(steer_override_sigmoid));
-  disengage.setBrake3MetersPerSecondSquaredProbs(to_kj_array_ptr(brake_3ms2_sigmoid));
-  disengage.setBrake4MetersPerSecondSquaredProbs(to_kj_array_ptr(brake_4ms2_sigmoid));
-  disengage.setBrake5MetersPerSecondSquaredProbs(to_kj_array_ptr(brake_5ms2_sigmoid));
-
   meta.setEngagedProb(sigmoid(meta_data.engaged_prob));
-  meta.setDesirePrediction(to_kj_array_ptr(desire_pred_softmax));
-  meta.setDesireState(to_kj_array_ptr(desire_state_softmax));
+  ListBuffer desire;
+  for (int i=0; i<DESIRE_PRED_LEN; i++) {
+    vec_softmax(meta_data.desire_pred_prob[i].array.data(), desire.data() + (i * DESIRE_LEN), DESIRE_LEN);
+  }
+  copy_list(meta.initDesirePrediction(DESIRE_PRED_LEN * DESIRE_LEN), desire.data());
+  vec_softmax(meta_data.desire_state_prob.array.data(), desire.data(), DESIRE_LEN);
+  copy_list(meta.initDesireState(DESIRE_LEN), desire.data());
   meta.setHardBrakePredicted(above_fcw_threshold);
 }
 
@@ -133,144 +152,79 @@ void fill_confidence(cereal::ModelDataV2::Builder &framed) {
   }
 }
 
-template<size_t size>
-void fill_xyzt(cereal::XYZTData::Builder xyzt, const std::array<float, size> &t,
-               const std::array<float, size> &x, const std::array<float, size> &y, const std::array<float, size> &z) {
+// t, then x, y and z of the trajectory
+void fill_xyzt(cereal::XYZTData::Builder xyzt, const std::array<float, TRAJECTORY_SIZE> &t,
+               const ModelOutputXYZ &mean, size_t stride) {
   xyzt.setT(to_kj_array_ptr(t));
-  xyzt.setX(to_kj_array_ptr(x));
-  xyzt.setY(to_kj_array_ptr(y));
-  xyzt.setZ(to_kj_array_ptr(z));
+  set_gather(xyzt.initX(TRAJECTORY_SIZE), mean.x, stride);
+  set_gather(xyzt.initY(TRAJECTORY_SIZE), mean.y, stride);
+  set_gather(xyzt.initZ(TRAJECTORY_SIZE), mean.z, stride);
 }
 
-template<size_t size>
-void fill_xyzt(cereal::XYZTData::Builder xyzt, const std::array<float, size> &t,
-               const std::array<float, size> &x, const std::array<float, size> &y, const std::array<float, size> &z,
-               const std::array<float, size> &x_std, const std::array<float, size> &y_std, const std::array<float, size> &z_std) {
-  fill_xyzt(xyzt, t, x, y, z);
-  xyzt.setXStd(to_kj_array_ptr(x_std));
-  xyzt.setYStd(to_kj_array_ptr(y_std));
-  xyzt.setZStd(to_kj_array_ptr(z_std));
+void fill_xyzt(cereal::XYZTData::Builder xyzt, const std::array<float, TRAJECTORY_SIZE> &t,
+               const ModelOutputXYZ &mean, const ModelOutputXYZ &log_std, size_t stride) {
+  fill_xyzt(xyzt, t, mean, stride);
+  set_exp(xyzt.initXStd(TRAJECTORY_SIZE), log_std.x, stride);
+  set_exp(xyzt.initYStd(TRAJECTORY_SIZE), log_std.y, stride);
+  set_exp(xyzt.initZStd(TRAJECTORY_SIZE), log_std.z, stride);
 }
 
-void fill_plan(cereal::ModelDataV2::Builder &framed, const ModelOutputPlanPrediction &plan) {
-  std::array<float, TRAJECTORY_SIZE> pos_x, pos_y, pos_z;
-  std::array<float, TRAJECTORY_SIZE> pos_x_std, pos_y_std, pos_z_std;
-  std::array<float, TRAJECTORY_SIZE> vel_x, vel_y, vel_z;
-  std::array<float, TRAJECTORY_SIZE> rot_x, rot_y, rot_z;
-  std::array<float, TRAJECTORY_SIZE> acc_x, acc_y, acc_z;
-  std::array<float, TRAJECTORY_SIZE> rot_rate_x, rot_rate_y, rot_rate_z;
-
-  for(int i=0; i<TRAJECTORY_SIZE; i++) {
-    pos_x[i] = plan.mean[i].position.x;
-    pos_y[i] = plan.mean[i].position.y;
-    pos_z[i] = plan.mean[i].position.z;
-    pos_x_std[i] = exp(plan.std[i].position.x);
-    pos_y_std[i] = exp(plan.std[i].position.y);
-    pos_z_std[i] = exp(plan.std[i].position.z);
-    vel_x[i] = plan.mean[i].velocity.x;
-    vel_y[i] = plan.mean[i].velocity.y;
-    vel_z[i] = plan.mean[i].velocity.z;
-    acc_x[i] = plan.mean[i].acceleration.x;
-    acc_y[i] = plan.mean[i].acceleration.y;
-    acc_z[i] = plan.mean[i].acceleration.z;
-    rot_x[i] = plan.mean[i].rotation.x;
-    rot_y[i] = plan.mean[i].rotation.y;
-    rot_z[i] = plan.mean[i].rotation.z;
-    rot_rate_x[i] = plan.mean[i].rotation_rate.x;
-    rot_rate_y[i] = plan.mean[i].rotation_rate.y;
-    rot_rate_z[i] = plan.mean[i].rotation_rate.z;
-  }
+// lane lines and road edges, x is fixed
+void fill_xyzt(cereal::XYZTData::Builder xyzt, const std::array<float, TRAJECTORY_SIZE> &t,
+               const std::array<ModelOutputYZ, TRAJECTORY_SIZE> &line) {
+  constexpr size_t stride = stride_of<ModelOutputYZ>();
+  xyzt.setT(to_kj_array_ptr(t));
+  xyzt.setX(to_kj_array_ptr(X_IDXS_FLOAT));
+  set_gather(xyzt.initY(TRAJECTORY_SIZE), line[0].y, stride);
+  set_gather(xyzt.initZ(TRAJECTORY_SIZE), line[0].z, stride);
+}
 
-  fill_xyzt(framed.initPosition(), T_IDXS_FLOAT, pos_x, pos_y, pos_z, pos_x_std, pos_y_std, pos_z_std);
-  fill_xyzt(framed.initVelocity(), T_IDXS_FLOAT, vel_x, vel_y, vel_z);
-  fill_xyzt(framed.initAcceleration(), T_IDXS_FLOAT, acc_x, acc_y, acc_z);
-  fill_xyzt(framed.initOrientation(), T_IDXS_FLOAT, rot_x, rot_y, rot_z);
-  fill_xyzt(framed.initOrientationRate(), T_IDXS_FLOAT, rot_rate_x, rot_rate_y, rot_rate_z);
+void fill_plan(cereal::ModelDataV2::Builder &framed, const ModelOutputPlanPrediction &plan) {
+  constexpr size_t stride = stride_of<ModelOutputPlanElement>();
+  const auto &mean = plan.mean[0];
+  fill_xyzt(framed.initPosition(), T_IDXS_FLOAT, mean.position, plan.std[0].position, stride);
+  fill_xyzt(framed.initVelocity(), T_IDXS_FLOAT, mean.velocity, stride);
+  fill_xyzt(framed.initAcceleration(), T_IDXS_FLOAT, mean.acceleration, stride);
+  fill_xyzt(framed.initOrientation(), T_IDXS_FLOAT, mean.rotation, stride);
+  fill_xyzt(framed.initOrientationRate(), T_IDXS_FLOAT, mean.rotation_rate, stride);
 }
 
 void fill_lateral_planner(cereal::ModelDataV2::Builder &framed, const LateralPlannerOutput &model_lateral_planner_solution) {
-  std::array<float, TRAJECTORY_SIZE> lateral_plan_solution_x, lateral_plan_solution_y, lateral_plan_solution_yaw, lateral_plan_solution_yaw_rate;
-  std::array<float, TRAJECTORY_SIZE> lateral_plan_solution_x_std, lateral_plan_solution_y_std, lateral_plan_solution_yaw_std, lateral_plan_solution_yaw_rate_std;
-
-  for (int i=0; i<TRAJECTORY_SIZE; i++) {
-    lateral_plan_solution_x[i] = model_lateral_planner_solution.mean[i].x;
-    lateral_plan_solution_y[i] = model_lateral_planner_solution.mean[i].y;
-    lateral_plan_solution_yaw[i] = model_lateral_planner_solution.mean[i].yaw;
-    lateral_plan_solution_yaw_rate[i] = model_lateral_planner_solution.mean[i].yaw_rate;
-    lateral_plan_solution_x_std[i] = exp(model_lateral_planner_solution.std[i].x);
-    lateral_plan_solution_y_std[i] = exp(model_lateral_planner_solution.std[i].y);
-    lateral_plan_solution_yaw_std[i] = exp(model_lateral_planner_solution.std[i].yaw);
-    lateral_plan_solution_yaw_rate_std[i] = exp(model_lateral_planner_solution.std[i].yaw_rate);
-  }
+  constexpr size_t stride = stride_of<LateralPlannerOutputElement>();
+  const auto &mean = model_lateral_planner_solution.mean[0];
+  const auto &log_std = model_lateral_planner_solution.std[0];
 
   auto lateral_planner_solution = framed.initLateralPlannerSolution();
-  lateral_planner_solution.setX(to_kj_array_ptr(lateral_plan_solution_x));
-  lateral_planner_solution.setY(to_kj_array_ptr(lateral_plan_solution_y));
-  lateral_planner_solution.setYaw(to_kj_array_ptr(lateral_plan_solution_yaw));
-  lateral_planner_solution.setYawRate(to_kj_array_ptr(lateral_plan_solution_yaw_rate));
-  lateral_planner_solution.setXStd(to_kj_array_ptr(lateral_plan_solution_x_std));
-  lateral_planner_solution.setYStd(to_kj_array_ptr(lateral_plan_solution_y_std));
-  lateral_planner_solution.setYawStd(to_kj_array_ptr(lateral_plan_solution_yaw_std));
-  lateral_planner_solution.setYawRateStd(to_kj_array_ptr(lateral_plan_solution_yaw_rate_std));
+  set_gather(lateral_planner_solution.initX(TRAJECTORY_SIZE), mean.x, stride);
+  set_gather(lateral_planner_solution.initY(TRAJECTORY_SIZE), mean.y, stride);
+  set_gather(lateral_planner_solution.initYaw(TRAJECTORY_SIZE), mean.yaw, stride);
+  set_gather(lateral_planner_solution.initYawRate(TRAJECTORY_SIZE), mean.yaw_rate, stride);
+  set_exp(lateral_planner_solution.initXStd(TRAJECTORY_SIZE), log_std.x, stride);
+  set_exp(lateral_planner_solution.initYStd(TRAJECTORY_SIZE), log_std.y, stride);
+  set_exp(lateral_planner_solution.initYawStd(TRAJECTORY_SIZE), log_std.yaw, stride);
+  set_exp(lateral_planner_solution.initYawRateStd(TRAJECTORY_SIZE), log_std.yaw_rate, stride);
 }
 
 void fill_lane_lines(cereal::ModelDataV2::Builder &framed, const std::array<float, TRAJECTORY_SIZE> &plan_t,
                      const ModelOutputLaneLines &lanes) {
-  std::array<float, TRAJECTORY_SIZE> left_far_y, left_far_z;
-  std::array<float, TRAJECTORY_SIZE> left_near_y, left_near_z;
-  std::array<float, TRAJECTORY_SIZE> right_near_y, right_near_z;
-  std::array<float, TRAJECTORY_SIZE> right_far_y, right_far_z;
-  for (int j=0; j<TRAJECTORY_SIZE; j++) {
-    left_far_y[j] = lanes.mean.left_far[j].y;
-    left_far_z[j] = lanes.mean.left_far[j].z;
-    left_near_y[j] = lanes.mean.left_near[j].y;
-    left_near_z[j] = lanes.mean.left_near[j].z;
-    right_near_y[j] = lanes.mean.right_near[j].y;
-    right_near_z[j] = lanes.mean.right_near[j].z;
-    right_far_y[j] = lanes.mean.right_far[j].y;
-    right_far_z[j] = lanes.mean.right_far[j].z;
-  }
-
   auto lane_lines = framed.initLaneLines(4);
-  fill_xyzt(lane_lines[0], plan_t, X_IDXS_FLOAT, left_far_y, left_far_z);
-  fill_xyzt(lane_lines[1], plan_t, X_IDXS_FLOAT, left_near_y, left_near_z);
-  fill_xyzt(lane_lines[2], plan_t, X_IDXS_FLOAT, right_near_y, right_near_z);
-  fill_xyzt(lane_lines[3], plan_t, X_IDXS_FLOAT, right_far_y, right_far_z);
-
-  framed.setLaneLineStds({
-    exp(lanes.std.left_far[0].y),
-    exp(lanes.std.left_near[0].y),
-    exp(lanes.std.right_near[0].y),
-    exp(lanes.std.right_far[0].y),
-  });
-
-  framed.setLaneLineProbs({
-    sigmoid(lanes.prob.left_far.val),
-    sigmoid(lanes.prob.left_near.val),
-    sigmoid(lanes.prob.right_near.val),
-    sigmoid(lanes.prob.right_far.val),
-  });
+  fill_xyzt(lane_lines[0], plan_t, lanes.mean.left_far);
+  fill_xyzt(lane_lines[1], plan_t, lanes.mean.left_near);
+  fill_xyzt(lane_lines[2], plan_t, lanes.mean.right_near);
+  fill_xyzt(lane_lines[3], plan_t, lanes.mean.right_far);
+
+  // the first point of each line, in the order the lines are in
+  set_exp(framed.initLaneLineStds(4), lanes.std.left_far[0].y, stride_of<decltype(lanes.std.left_far)>());
+  set_sigmoid(framed.initLaneLineProbs(4), lanes.prob.left_far.val, stride_of<ModelOutputLineProbVal>());
 }
 
 void fill_road_edges(cereal::ModelDataV2::Builder &framed, const std::array<float, TRAJECTORY_SIZE> &plan_t,
                      const ModelOutputRoadEdges &edges) {
-  std::array<float, TRAJECTORY_SIZE> left_y, left_z;
-  std::array<float, TRAJECTORY_SIZE> right_y, right_z;
-  for (int j=0; j<TRAJECTORY_SIZE; j++) {
-    left_y[j] = edges.mean.left[j].y;
-    left_z[j] = edges.mean.left[j].z;
-    right_y[j] = edges.mean.right[j].y;
-    right_z[j] = edges.mean.right[j].z;
-  }
-
   auto road_edges = framed.initRoadEdges(2);
-  fill_xyzt(road_edges[0], plan_t, X_IDXS_FLOAT, left_y, left_z);
-  fill_xyzt(road_edges[1], plan_t, X_IDXS_FLOAT, right_y, right_z);
+  fill_xyzt(road_edges[0], plan_t, edges.mean.left);
+  fill_xyzt(road_edges[1], plan_t, edges.mean.right);
 
-  framed.setRoadEdgeStds({
-    exp(edges.std.left[0].y),
-    exp(edges.std.right[0].y),
-  });
+  set_exp(framed.initRoadEdgeStds(2), edges.std.left[0].y, stride_of<decltype(edges.std.left)>());
 }
 
 void fill_model(cereal::ModelDataV2::Builder &framed, const ModelOutput &net_outputs) {
@@ -322,16 +276,36 @@ void fill_model(cereal::ModelDataV2::Builder &framed, const ModelOutput &net_out
   auto temporal_pose = framed.initTemporalPose();
   temporal_pose.setTrans({v_mean.x, v_mean.y, v_mean.z});
   temporal_pose.setRot({r_mean.x, r_mean.y, r_mean.z});
-  temporal_pose.setTransStd({exp(v_std.x), exp(v_std.y), exp(v_std.z)});
-  temporal_pose.setRotStd({exp(r_std.x), exp(r_std.y), exp(r_std.z)});
+  set_exp(temporal_pose.initTransStd(3), v_std.x, 1);
+  set_exp(temporal_pose.initRotStd(3), r_std.x, 1);
+}
+
+void fill_posenet(cereal::CameraOdometry::Builder posenetd, const ModelOutput &net_outputs) {
+  const auto &v_mean = net_outputs.pose.velocity_mean;
+  const auto &r_mean = net_outputs.pose.rotation_mean;
+  const auto &t_mean = net_outputs.wide_from_device_euler.mean;
+  const auto &v_std = net_outputs.pose.velocity_std;
+  const auto &r_std = net_outputs.pose.rotation_std;
+  const auto &t_std = net_outputs.wide_from_device_euler.std;
+  const auto &road_transform_trans_mean = net_outputs.road_transform.position_mean; // after nicki
+  const auto &road_transform_trans_std = net_outputs.road_transform.position_std; // after nicki
+
+  posenetd.setTrans({v_mean.x, v_mean.y, v_mean.z});
+  posenetd.setRot({r_mean.x, r_mean.y, r_mean.z});
+  posenetd.setWideFromDeviceEuler({t_mean.x, t_mean.y, t_mean.z});
+  posenetd.setRoadTransformTrans({road_transform_trans_mean.x, road_transform_trans_mean.y, road_transform_trans_mean.z}); // after nicki
+  set_exp(posenetd.initTransStd(3), v_std.x, 1);
+  set_exp(posenetd.initRotStd(3), r_std.x, 1);
+  set_exp(posenetd.initWideFromDeviceEulerStd(3), t_std.x, 1);
+  set_exp(posenetd.initRoadTransformTransStd(3), road_transform_trans_std.x, 1); // after nicki
 }
 
 void model_publish(PubMaster &pm, uint32_t vipc_frame_id, uint32_t vipc_frame_id_extra, uint32_t frame_id, float frame_drop,
                    const float* raw_pred, uint64_t timestamp_eof,
                    float model_execution_time, const bool valid) {
-  ModelOutput net_outputs = *(ModelOutput*) raw_pred;
+  const ModelOutput &net_outputs = *(const ModelOutput*) raw_pred;
   const uint32_t frame_age = (frame_id > vipc_frame_id) ? (frame_id - vipc_frame_id) : 0;
-  MessageBuilder msg;
+  static thread_local ReusableMessageBuilder msg;
   auto framed = msg.initEvent(valid).initModelV2();
   framed.setFrameId(vipc_frame_id);
   framed.setFrameIdExtra(vipc_frame_id_extra);
@@ -349,28 +323,10 @@ void model_publish(PubMaster &pm, uint32_t vipc_frame_id, uint32_t vipc_frame_id
 
 void posenet_publish(PubMaster &pm, uint32_t vipc_frame_id, uint32_t vipc_dropped_frames,
                      const float* raw_pred, uint64_t timestamp_eof, const bool valid) {
-  ModelOutput net_outputs = *(ModelOutput*) raw_pred;
-  MessageBuilder msg;
-  const auto &v_mean = net_outputs.pose.velocity_mean;
-  const auto &r_mean = net_outputs.pose.rotation_mean;
-  const auto &t_mean = net_outputs.wide_from_device_euler.mean;
-  const auto &v_std = net_outputs.pose.velocity_std;
-  const auto &r_std = net_outputs.pose.rotation_std;
-  const auto &t_std = net_outputs.wide_from_device_euler.std;
-  const auto &road_transform_trans_mean = net_outputs.road_transform.position_mean; // after nicki
-  const auto &road_transform_trans_std = net_outputs.road_transform.position_std; // after nicki
-
+  const ModelOutput &net_outputs = *(const ModelOutput*) raw_pred;
+  static thread_local ReusableMessageBuilder msg;
   auto posenetd = msg.initEvent(valid && (vipc_dropped_frames < 1)).initCameraOdometry();
-
-  posenetd.setTrans({v_mean.x, v_mean.y, v_mean.z});
-  posenetd.setRot({r_mean.x, r_mean.y, r_mean.z});
-  posenetd.setWideFromDeviceEuler({t_mean.x, t_mean.y, t_mean.z});
-  posenetd.setRoadTransformTrans({road_transform_trans_mean.x, road_transform_trans_mean.y, road_transform_trans_mean.z}); // after nicki
-  posenetd.setTransStd({exp(v_std.x), exp(v_std.y), exp(v_std.z)});
-  posenetd.setRotStd({exp(r_std.x), exp(r_std.y), exp(r_std.z)});
-  posenetd.setWideFromDeviceEulerStd({exp(t_std.x), exp(t_std.y), exp(t_std.z)});
-  posenetd.setRoadTransformTransStd({exp(road_transform_trans_std.x), exp(road_transform_trans_std.y), exp(road_transform_trans_std.z)}); // after nicki
-
+  fill_posenet(posenetd, net_outputs);
   posenetd.setTimestampEof(timestamp_eof);
   posenetd.setFrameId(vipc_frame_id);
 
@@ -380,9 +336,9 @@ void posenet_publish(PubMaster &pm, uint32_t vipc_frame_id, uint32_t vipc_droppe
 uint32_t parse_model(uint32_t vipc_frame_id, uint32_t vipc_frame_id_extra, uint32_t frame_id, float frame_drop,
                     float model_execution_time, uint64_t timestamp_eof, const bool valid, const float* raw_pred,
                     unsigned char* ret) {
-  ModelOutput net_outputs = *(ModelOutput*) raw_pred;
+  const ModelOutput &net_outputs = *(const ModelOutput*) raw_pred;
   const uint32_t frame_age = (frame_id > vipc_frame_id) ? (frame_id - vipc_frame_id) : 0;
-  MessageBuilder msg;
+  static thread_local ReusableMessageBuilder msg;
   auto framed = msg.initEvent(valid).initModelV2();
   framed.setFrameId(vipc_frame_id);
   framed.setFrameIdExtra(vipc_frame_id_extra);
@@ -405,27 +361,10 @@ uint32_t parse_model(uint32_t vipc_frame_id, uint32_t vipc_frame_id_extra, uint3
 
 uint32_t parse_posenet(uint32_t vipc_frame_id, uint32_t vipc_dropped_frames,
                       const bool valid, uint64_t timestamp_eof, const float* raw_pred, unsigned char* ret) { 
-  ModelOutput net_outputs = *(ModelOutput*) raw_pred;
-  MessageBuilder msg;
-  const auto &v_mean = net_outputs.pose.velocity_mean;
-  const auto &r_mean = net_outputs.pose.rotation_mean;
-  const auto &t_mean = net_outputs.wide_from_device_euler.mean;
-  const auto &v_std = net_outputs.pose.velocity_std;
-  const auto &r_std = net_outputs.pose.rotation_std;
-  const auto &t_std = net_outputs.wide_from_device_euler.std;
-  const auto &road_transform_trans_mean = net_outputs.road_transform.position_mean; // after nicki
-  const auto &road_transform_trans_std = net_outputs.road_transform.position_std; // after nicki
-
+  const ModelOutput &net_outputs = *(const ModelOutput*) raw_pred;
+  static thread_local ReusableMessageBuilder msg;
   auto posenetd = msg.initEvent(valid && (vipc_dropped_frames < 1)).initCameraOdometry();
-  posenetd.setTrans({v_mean.x, v_mean.y, v_mean.z});
-  posenetd.setRot({r_mean.x, r_mean.y, r_mean.z});
-  posenetd.setWideFromDeviceEuler({t_mean.x, t_mean.y, t_mean.z});
-  posenetd.setRoadTransformTrans({road_transform_trans_mean.x, road_transform_trans_mean.y, road_transform_trans_mean.z}); // after nicki
-  posenetd.setTransStd({exp(v_std.x), exp(v_std.y), exp(v_std.z)});
-  posenetd.setRotStd({exp(r_std.x), exp(r_std.y), exp(r_std.z)});
-  posenetd.setWideFromDeviceEulerStd({exp(t_std.x), exp(t_std.y), exp(t_std.z)});
-  posenetd.setRoadTransformTransStd({exp(road_transform_trans_std.x), exp(road_transform_trans_std.y), exp(road_transform_trans_std.z)}); // after nicki
-
+  fill_posenet(posenetd, net_outputs);
   posenetd.setTimestampEof(timestamp_eof);
   posenetd.setFrameId(vipc_frame_id);
 
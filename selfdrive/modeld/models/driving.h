@@ -303,6 +303,8 @@ struct PublishState {
   std::array<float, 3> prev_brake_3ms2_probs = {};
 };
 
+void fill_model(cereal::ModelDataV2::Builder &framed, const ModelOutput &net_outputs);
+void fill_posenet(cereal::CameraOdometry::Builder posenetd, const ModelOutput &net_outputs);
 void model_publish(PubMaster &pm, uint32_t vipc_frame_id, uint32_t vipc_frame_id_extra, uint32_t frame_id, float frame_drop,
                    const float* raw_pred, uint64_t timestamp_eof,
                    float model_execution_time, const bool valid);
@@ -0,0 +1,242 @@
+#include "selfdrive/modeld/models/vecmath.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#elif defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+enum Op { GATHER, EXP, SIGMOID };
+
+template <Op op>
+inline float apply_scalar(float x, float shift) {
+  if constexpr (op == GATHER) {
+    return x;
+  } else if constexpr (op == EXP) {
+    return std::exp(x - shift);
+  } else {
+    // from exp(-|x|), which can't overflow. Below -87 sigmoid(x) is about exp(x), a denormal
+    const float e = std::exp(-std::fabs(x));
+    return (x >= 0.0f ? 1.0f : e) / (1.0f + e);
+  }
+}
+
+template <Op op>
+void map_scalar(const float *in, size_t stride, float *out, size_t n, float shift) {
+  for (size_t i = 0; i < n; i++) {
+    out[i] = apply_scalar<op>(in[i * stride], shift);
+  }
+}
+
+#if defined(__aarch64__) || defined(__x86_64__)
+
+// Vector exp, exp(x) = 2^n * exp(r) with |r| <= ln2/2. The input is clamped to where the result
+// is inf or 0 anyway, and 2^n is applied in two steps so results in the denormal range are
+// rounded once.
+constexpr float EXP_HI = 89.0f;
+constexpr float EXP_LO = -104.0f;
+constexpr float LOG2E = 1.44269504088896341f;
+// ln2 split in two, n * LN2_HI is exact
+constexpr float LN2_HI = 0.693359375f;
+constexpr float LN2_LO = -2.12194440e-4f;
+constexpr float P0 = 1.9875691500e-4f;
+constexpr float P1 = 1.3981999507e-3f;
+constexpr float P2 = 8.3334519073e-3f;
+constexpr float P3 = 4.1665795894e-2f;
+constexpr float P4 = 1.6666665459e-1f;
+constexpr float P5 = 5.0000001201e-1f;
+
+#endif
+
+#if defined(__aarch64__)
+
+constexpr size_t WIDTH = 4;
+
+inline float32x4_t exp4(float32x4_t x) {
+  // vmaxq/vminq return NaN if either input is, so it's kept
+  x = vminq_f32(vmaxq_f32(x, vdupq_n_f32(EXP_LO)), vdupq_n_f32(EXP_HI));
+  const float32x4_t n = vrndmq_f32(vaddq_f32(vmulq_f32(x, vdupq_n_f32(LOG2E)), vdupq_n_f32(0.5f)));
+  float32x4_t r = vsubq_f32(x, vmulq_f32(n, vdupq_n_f32(LN2_HI)));
+  r = vsubq_f32(r, vmulq_f32(n, vdupq_n_f32(LN2_LO)));
+  float32x4_t y = vdupq_n_f32(P0);
+  y = vaddq_f32(vmulq_f32(y, r), vdupq_n_f32(P1));
+  y = vaddq_f32(vmulq_f32(y, r), vdupq_n_f32(P2));
+  y = vaddq_f32(vmulq_f32(y, r), vdupq_n_f32(P3));
+  y = vaddq_f32(vmulq_f32(y, r), vdupq_n_f32(P4));
+  y = vaddq_f32(vmulq_f32(y, r), vdupq_n_f32(P5));
+  y = vaddq_f32(vaddq_f32(vmulq_f32(vmulq_f32(y, r), r), r), vdupq_n_f32(1.0f));
+  const int32x4_t ni = vcvtq_s32_f32(n);
+  const int32x4_t n1 = vshrq_n_s32(ni, 1);
+  const int32x4_t n2 = vsubq_s32(ni, n1);
+  const int32x4_t bias = vdupq_n_s32(127);
+  y = vmulq_f32(y, vreinterpretq_f32_s32(vshlq_n_s32(vaddq_s32(n1, bias), 23)));
+  return vmulq_f32(y, vreinterpretq_f32_s32(vshlq_n_s32(vaddq_s32(n2, bias), 23)));
+}
+
+template <Op op>
+inline float32x4_t apply4(float32x4_t x, float shift) {
+  if constexpr (op == GATHER) {
+    return x;
+  } else if constexpr (op == EXP) {
+    return exp4(vsubq_f32(x, vdupq_n_f32(shift)));
+  } else {
+    // same as apply_scalar
+    const float32x4_t one = vdupq_n_f32(1.0f);
+    const float32x4_t e = exp4(vnegq_f32(vabsq_f32(x)));
+    return vdivq_f32(vbslq_f32(vcgeq_f32(x, vdupq_n_f32(0.0f)), one, e), vaddq_f32(one, e));
+  }
+}
+
+// no gather on NEON, and vld2q/vld4q would read past the last element
+inline float32x4_t load4(const float *in, size_t stride) {
+  if (stride == 1) return vld1q_f32(in);
+  float32x4_t v = vld1q_dup_f32(in);
+  v = vld1q_lane_f32(in + stride, v, 1);
+  v = vld1q_lane_f32(in + 2 * stride, v, 2);
+  return vld1q_lane_f32(in + 3 * stride, v, 3);
+}
+
+template <Op op>
+void map(const float *in, size_t stride, float *out, size_t n, float shift) {
+  if (n < WIDTH) {
+    map_scalar<op>(in, stride, out, n, shift);
+    return;
+  }
+  size_t i = 0;
+  for (; i + WIDTH <= n; i += WIDTH) {
+    vst1q_f32(out + i, apply4<op>(load4(in + i * stride, stride), shift));
+  }
+  if (i < n) {
+    // the last full vector again, overlapping the previous one
+    i = n - WIDTH;
+    vst1q_f32(out + i, apply4<op>(load4(in + i * stride, stride), shift));
+  }
+}
+
+const char *isa() { return "neon"; }
+
+#elif defined(__x86_64__)
+
+constexpr size_t WIDTH = 8;
+
+__attribute__((target("avx2"))) inline __m256 exp8(__m256 x) {
+  // min/max return the second operand if either is NaN, so it's kept
+  x = _mm256_max_ps(_mm256_set1_ps(EXP_LO), _mm256_min_ps(_mm256_set1_ps(EXP_HI), x));
+  const __m256 n = _mm256_floor_ps(_mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(LOG2E)), _mm256_set1_ps(0.5f)));
+  __m256 r = _mm256_sub_ps(x, _mm256_mul_ps(n, _mm256_set1_ps(LN2_HI)));
+  r = _mm256_sub_ps(r, _mm256_mul_ps(n, _mm256_set1_ps(LN2_LO)));
+  __m256 y = _mm256_set1_ps(P0);
+  y = _mm256_add_ps(_mm256_mul_ps(y, r), _mm256_set1_ps(P1));
+  y = _mm256_add_ps(_mm256_mul_ps(y, r), _mm256_set1_ps(P2));
+  y = _mm256_add_ps(_mm256_mul_ps(y, r), _mm256_set1_ps(P3));
+  y = _mm256_add_ps(_mm256_mul_ps(y, r), _mm256_set1_ps(P4));
+  y = _mm256_add_ps(_mm256_mul_ps(y, r), _mm256_set1_ps(P5));
+  y = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(y, r), r), r), _mm256_set1_ps(1.0f));
+  const __m256i ni = _mm256_cvtps_epi32(n);
+  const __m256i n1 = _mm256_srai_epi32(ni, 1);
+  const __m256i n2 = _mm256_sub_epi32(ni, n1);
+  const __m256i bias = _mm256_set1_epi32(127);
+  y = _mm256_mul_ps(y, _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(n1, bias), 23)));
+  return _mm256_mul_ps(y, _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(n2, bias), 23)));
+}
+
+template <Op op>
+__attribute__((target("avx2"))) inline __m256 apply8(__m256 x, float shift) {
+  if constexpr (op == GATHER) {
+    return x;
+  } else if constexpr (op == EXP) {
+    return exp8(_mm256_sub_ps(x, _mm256_set1_ps(shift)));
+  } else {
+    // same as apply_scalar, setting the sign bit gives -|x|
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 e = exp8(_mm256_or_ps(x, _mm256_set1_ps(-0.0f)));
+    const __m256 non_negative = _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_GE_OQ);
+    return _mm256_div_ps(_mm256_blendv_ps(e, one, non_negative), _mm256_add_ps(one, e));
+  }
+}
+
+// vgatherdps is slower than eight loads on a lot of cpus, and much slower with the GDS
+// mitigation
+__attribute__((target("avx2"))) inline __m256 load8(const float *in, size_t stride) {
+  if (stride == 1) return _mm256_loadu_ps(in);
+  return _mm256_setr_ps(in[0], in[stride], in[2 * stride], in[3 * stride],
+                        in[4 * stride], in[5 * stride], in[6 * stride], in[7 * stride]);
+}
+
+template <Op op>
+__attribute__((target("avx2"))) void map_avx2(const float *in, size_t stride, float *out, size_t n, float shift) {
+  size_t i = 0;
+  for (; i + WIDTH <= n; i += WIDTH) {
+    _mm256_storeu_ps(out + i, apply8<op>(load8(in + i * stride, stride), shift));
+  }
+  if (i < n) {
+    // the last full vector again, overlapping the previous one
+    i = n - WIDTH;
+    _mm256_storeu_ps(out + i, apply8<op>(load8(in + i * stride, stride), shift));
+  }
+}
+
+const bool has_avx2 = __builtin_cpu_supports("avx2");
+
+template <Op op>
+void map(const float *in, size_t stride, float *out, size_t n, float shift) {
+  if (has_avx2 && n >= WIDTH) {
+    map_avx2<op>(in, stride, out, n, shift);
+  } else {
+    map_scalar<op>(in, stride, out, n, shift);
+  }
+}
+
+const char *isa() { return has_avx2 ? "avx2" : "scalar"; }
+
+#else
+
+template <Op op>
+void map(const float *in, size_t stride, float *out, size_t n, float shift) {
+  map_scalar<op>(in, stride, out, n, shift);
+}
+
+const char *isa() { return "scalar"; }
+
+#endif
+
+}  // namespace
+
+void vec_gather(const float *in, size_t stride, float *out, size_t n) {
+  if (stride == 1) {
+    std::copy(in, in + n, out);
+  } else {
+    map<GATHER>(in, stride, out, n, 0.0f);
+  }
+}
+
+void vec_exp(const float *in, size_t stride, float *out, size_t n) {
+  map<EXP>(in, stride, out, n, 0.0f);
+}
+
+void vec_sigmoid(const float *in, size_t stride, float *out, size_t n) {
+  map<SIGMOID>(in, stride, out, n, 0.0f);
+}
+
+void vec_softmax(const float *in, float *out, size_t n) {
+  if (n == 0) return;
+  const float max_val = *std::max_element(in, in + n);
+  map<EXP>(in, 1, out, n, max_val);
+  float denominator = 0;
+  for (size_t i = 0; i < n; i++) {
+    denominator += out[i];
+  }
+  const float inv_denominator = 1.0f / denominator;
+  for (size_t i = 0; i < n; i++) {
+    out[i] *= inv_denominator;
+  }
+}
+
+const char *vec_isa() {
+  return isa();
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+
+// Float kernels for the model output post-processing. The model outputs are arrays of structs,
+// so the inputs are read stride floats apart: out[i] = f(in[i * stride]).
+//
+// AVX2 on x86_64 when the cpu has it, NEON on aarch64. The vector exp is a Cephes style
+// polynomial within 1 ulp of exp in double precision, with overflow to inf, gradual underflow
+// and NaN kept. Lists shorter than a vector, and cpus without either, use expf.
+// sigmoid is computed from exp(-|x|), so it keeps its precision down to the denormals for very
+// negative x instead of flushing to 0.
+
+void vec_gather(const float *in, size_t stride, float *out, size_t n);
+void vec_exp(const float *in, size_t stride, float *out, size_t n);
+void vec_sigmoid(const float *in, size_t stride, float *out, size_t n);
+
+// softmax of n contiguous values
+void vec_softmax(const float *in, float *out, size_t n);
+
+// name of the path in use, for benchmarks
+const char *vec_isa();
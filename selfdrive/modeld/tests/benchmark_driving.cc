@@ -0,0 +1,55 @@
+// Time per frame to build modelV2 and cameraOdometry, against the previous post-processing in
+// driving_reference.h.
+// usage: benchmark_driving [raw_outputs or -] [iterations]
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "selfdrive/modeld/models/vecmath.h"
+#include "driving_reference.h"
+
+typedef void (*fill_fn)(ReusableMessageBuilder &msg, const ModelOutput &net_outputs);
+
+// frames are rotated so the work for one can't be hoisted out of the loop
+static double time_us(fill_fn fn, const std::vector<std::vector<float>> &frames, int iterations) {
+  ReusableMessageBuilder msg;
+  size_t sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    fn(msg, *(const ModelOutput *)frames[i % frames.size()].data());
+    sink += msg.toBytes().size();
+  }
+  double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+  volatile size_t keep = sink;
+  (void)keep;
+  return us / iterations;
+}
+
+int main(int argc, char *argv[]) {
+  const char *filename = argc > 1 && std::string(argv[1]) != "-" ? argv[1] : nullptr;
+  const int iterations = argc > 2 ? std::stoi(argv[2]) : 20000;
+  const auto frames = load_raw_outputs(filename, 100);
+  if (frames.empty()) return 1;
+
+  struct {
+    const char *name;
+    fill_fn fn, ref;
+  } const benchmarks[] = {
+    {"modelV2",
+     [](ReusableMessageBuilder &msg, const ModelOutput &o) { auto m = msg.initEvent().initModelV2(); fill_model(m, o); },
+     [](ReusableMessageBuilder &msg, const ModelOutput &o) { auto m = msg.initEvent().initModelV2(); ref_fill_model(m, o); }},
+    {"cameraOdometry",
+     [](ReusableMessageBuilder &msg, const ModelOutput &o) { fill_posenet(msg.initEvent().initCameraOdometry(), o); },
+     [](ReusableMessageBuilder &msg, const ModelOutput &o) { ref_fill_posenet(msg.initEvent().initCameraOdometry(), o); }},
+  };
+
+  printf("%zu %s frames, %s\n", frames.size(), filename ? "recorded" : "random", vec_isa());
+  printf("%-16s %10s %10s\n", "message", "old us", "new us");
+  for (const auto &b : benchmarks) {
+    double ref_us = time_us(b.ref, frames, iterations);
+    double new_us = time_us(b.fn, frames, iterations);
+    printf("%-16s %10.2f %10.2f\n", b.name, ref_us, new_us);
+  }
+  return 0;
+}
@@ -0,0 +1,179 @@
+// Checks the vecmath.h kernels against double precision, and the modelV2 and cameraOdometry
+// messages against the previous post-processing in driving_reference.h.
+// usage: test_driving [raw_outputs]
+// Floats may differ by MAX_ULP, everything else has to match.
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <capnp/dynamic.h>
+
+#include "selfdrive/modeld/models/vecmath.h"
+#include "driving_reference.h"
+
+constexpr int64_t MAX_ULP = 4;
+
+static int64_t ulp_distance(float a, float b) {
+  if (std::isnan(a) || std::isnan(b)) return std::isnan(a) && std::isnan(b) ? 0 : INT64_MAX;
+  // consecutive floats have consecutive bit patterns, denormals and both zeros included
+  auto ordered = [](float f) {
+    int32_t i;
+    memcpy(&i, &f, sizeof(i));
+    return i < 0 ? (int64_t)INT32_MIN - i : (int64_t)i;
+  };
+  return std::llabs(ordered(a) - ordered(b));
+}
+
+struct Diff {
+  size_t floats = 0, mismatches = 0;
+  int64_t max_ulp = 0;
+
+  void mismatch(const std::string &path, const std::string &what) {
+    if (mismatches++ < 5) {
+      printf("  mismatch at %s: %s\n", path.c_str(), what.c_str());
+    }
+  }
+};
+
+static void compare(capnp::DynamicValue::Reader a, capnp::DynamicValue::Reader b, const std::string &path, Diff &diff) {
+  if (a.getType() != b.getType()) {
+    diff.mismatch(path, "type");
+    return;
+  }
+  switch (a.getType()) {
+    case capnp::DynamicValue::FLOAT: {
+      float fa = a.as<float>(), fb = b.as<float>();
+      int64_t ulp = ulp_distance(fa, fb);
+      diff.floats++;
+      diff.max_ulp = std::max(diff.max_ulp, ulp);
+      if (ulp > MAX_ULP) diff.mismatch(path, std::to_string(fa) + " != " + std::to_string(fb));
+      break;
+    }
+    case capnp::DynamicValue::LIST: {
+      auto la = a.as<capnp::DynamicList>(), lb = b.as<capnp::DynamicList>();
+      if (la.size() != lb.size()) {
+        diff.mismatch(path, "list size");
+        break;
+      }
+      for (uint i = 0; i < la.size(); i++) {
+        compare(la[i], lb[i], path + "[" + std::to_string(i) + "]", diff);
+      }
+      break;
+    }
+    case capnp::DynamicValue::STRUCT: {
+      auto sa = a.as<capnp::DynamicStruct>(), sb = b.as<capnp::DynamicStruct>();
+      for (auto field : sa.getSchema().getFields()) {
+        const std::string name = path + "." + field.getProto().getName().cStr();
+        if (sa.has(field) != sb.has(field)) {
+          diff.mismatch(name, "set in only one");
+        } else if (sa.has(field)) {
+          compare(sa.get(field), sb.get(field), name, diff);
+        }
+      }
+      break;
+    }
+    case capnp::DynamicValue::ENUM:
+      if (a.as<capnp::DynamicEnum>().getRaw() != b.as<capnp::DynamicEnum>().getRaw()) diff.mismatch(path, "enum");
+      break;
+    case capnp::DynamicValue::BOOL:
+      if (a.as<bool>() != b.as<bool>()) diff.mismatch(path, "bool");
+      break;
+    case capnp::DynamicValue::INT:
+      if (a.as<int64_t>() != b.as<int64_t>()) diff.mismatch(path, "int");
+      break;
+    case capnp::DynamicValue::UINT:
+      if (a.as<uint64_t>() != b.as<uint64_t>()) diff.mismatch(path, "uint");
+      break;
+    case capnp::DynamicValue::DATA:
+      if (a.as<capnp::Data>() != b.as<capnp::Data>()) diff.mismatch(path, "data");
+      break;
+    case capnp::DynamicValue::TEXT:
+      if (a.as<capnp::Text>() != b.as<capnp::Text>()) diff.mismatch(path, "text");
+      break;
+    default:
+      break;
+  }
+}
+
+static size_t report(const char *name, size_t frames, const Diff &diff) {
+  printf("%-14s %6zu frames %9zu floats, max %lld ulp, %zu mismatches\n",
+         name, frames, diff.floats, (long long)diff.max_ulp, diff.mismatches);
+  return diff.mismatches;
+}
+
+// exp and sigmoid over the whole float range, every stride the model outputs use
+static size_t check_kernels() {
+  std::vector<float> in;
+  for (double x = -120; x < 100; x += 0.000171) in.push_back(x);
+  for (float x : {0.0f, -0.0f, 88.72f, 89.0f, -87.33f, -103.9f, -104.0f, -150.0f, std::numeric_limits<float>::infinity(),
+                  -std::numeric_limits<float>::infinity(), std::numeric_limits<float>::quiet_NaN()}) {
+    in.push_back(x);
+  }
+
+  size_t mismatches = 0;
+  std::vector<float> out(in.size());
+  for (size_t stride : {1, 2, 3, 4, 7, 15, 66}) {
+    const size_t n = in.size() / stride;
+    Diff exp_diff, sigmoid_diff;
+    vec_exp(in.data(), stride, out.data(), n);
+    for (size_t i = 0; i < n; i++) {
+      float ref = std::exp((double)in[i * stride]);
+      int64_t ulp = ulp_distance(out[i], ref);
+      exp_diff.max_ulp = std::max(exp_diff.max_ulp, ulp);
+      if (ulp > 1) exp_diff.mismatch("exp(" + std::to_string(in[i * stride]) + ")", std::to_string(out[i]));
+    }
+    vec_sigmoid(in.data(), stride, out.data(), n);
+    for (size_t i = 0; i < n; i++) {
+      float ref = 1.0 / (1.0 + std::exp(-(double)in[i * stride]));
+      int64_t ulp = ulp_distance(out[i], ref);
+      sigmoid_diff.max_ulp = std::max(sigmoid_diff.max_ulp, ulp);
+      if (ulp > 2) sigmoid_diff.mismatch("sigmoid(" + std::to_string(in[i * stride]) + ")", std::to_string(out[i]));
+    }
+    vec_gather(in.data(), stride, out.data(), n);
+    for (size_t i = 0; i < n; i++) {
+      if (memcmp(&out[i], &in[i * stride], sizeof(float)) != 0) exp_diff.mismatch("gather", std::to_string(i));
+    }
+    printf("%-8s stride %2zu exp max %lld ulp, sigmoid max %lld ulp, %zu mismatches\n", vec_isa(), stride,
+           (long long)exp_diff.max_ulp, (long long)sigmoid_diff.max_ulp, exp_diff.mismatches + sigmoid_diff.mismatches);
+    mismatches += exp_diff.mismatches + sigmoid_diff.mismatches;
+  }
+  return mismatches;
+}
+
+int main(int argc, char *argv[]) {
+  size_t mismatches = check_kernels();
+
+  const auto frames = load_raw_outputs(argc > 1 ? argv[1] : nullptr, 1000);
+  if (frames.empty()) return 1;
+
+  Diff model_diff, posenet_diff;
+  ReusableMessageBuilder msg, ref_msg;
+  for (size_t i = 0; i < frames.size(); i++) {
+    const ModelOutput &net_outputs = *(const ModelOutput *)frames[i].data();
+
+    // the frame id decides when the confidence buffer moves
+    auto framed = msg.initEvent().initModelV2();
+    auto ref_framed = ref_msg.initEvent().initModelV2();
+    framed.setFrameId(i);
+    ref_framed.setFrameId(i);
+    fill_model(framed, net_outputs);
+    ref_fill_model(ref_framed, net_outputs);
+    compare(capnp::toDynamic(framed.asReader()), capnp::toDynamic(ref_framed.asReader()), "modelV2", model_diff);
+
+    auto posenetd = msg.initEvent().initCameraOdometry();
+    auto ref_posenetd = ref_msg.initEvent().initCameraOdometry();
+    fill_posenet(posenetd, net_outputs);
+    ref_fill_posenet(ref_posenetd, net_outputs);
+    compare(capnp::toDynamic(posenetd.asReader()), capnp::toDynamic(ref_posenetd.asReader()), "cameraOdometry", posenet_diff);
+  }
+  mismatches += report("modelV2", frames.size(), model_diff);
+  mismatches += report("cameraOdometry", frames.size(), posenet_diff);
+  return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+// On disk cache of OpenCL program binaries, so the model kernels are only compiled from source
+// the first time. An entry is keyed by the source and the build options, and lives in a
+// directory for the device name and driver version:
+//
+//   <root>/<hash of device and driver>/<hash of options and source>.bin
+//
+// Invalidation:
+//  - a new driver gets a new directory, the directories of other drivers are deleted when the
+//    cache is opened
+//  - an entry stores everything it was keyed by and is only used if all of it matches, so a
+//    hash collision or a truncated file is a miss
+//  - the caller removes an entry the driver rejects, it's rebuilt from source and stored again
+class ProgramCache {
+public:
+  ProgramCache(const std::string &root, const std::string &_device, const std::string &_driver)
+      : device(_device), driver(_driver) {
+    const std::string driver_dir = hash_name(device + '\0' + driver);
+    dir = root + "/" + driver_dir;
+    mkdir(root.c_str(), 0775);
+    remove_other_drivers(root, driver_dir);
+    ok = mkdir(dir.c_str(), 0775) == 0 || errno == EEXIST;
+  }
+
+  // the cache directory couldn't be created
+  bool failed() const { return !ok; }
+
+  bool get(const std::string &source, const std::string &options, std::string &binary) const {
+    std::string entry;
+    if (!ok || !read(path(source, options), entry)) return false;
+
+    size_t pos = 0;
+    EntryHeader h;
+    if (!take(entry, pos, &h, sizeof(h)) || memcmp(h.magic, ENTRY_MAGIC, sizeof(h.magic)) != 0 || h.version != ENTRY_VERSION) {
+      return false;
+    }
+    std::string stored[4];
+    for (int i = 0; i < 4; i++) {
+      if (h.sizes[i] > entry.size() - pos) return false;
+      stored[i] = entry.substr(pos, h.sizes[i]);
+      pos += h.sizes[i];
+    }
+    if (stored[0] != device || stored[1] != driver || stored[2] != options || stored[3] != source) {
+      return false;
+    }
+    binary = entry.substr(pos);
+    return binary.size() > 0;
+  }
+
+  // written to a temporary file and renamed, so a reader never sees part of an entry
+  bool put(const std::string &source, const std::string &options, const std::string &binary) const {
+    if (!ok) return false;
+    EntryHeader h = {};
+    memcpy(h.magic, ENTRY_MAGIC, sizeof(h.magic));
+    h.version = ENTRY_VERSION;
+    const std::string *fields[4] = {&device, &driver, &options, &source};
+    for (int i = 0; i < 4; i++) h.sizes[i] = fields[i]->size();
+
+    std::string entry((const char *)&h, sizeof(h));
+    for (const std::string *f : fields) entry += *f;
+    entry += binary;
+
+    const std::string fn = path(source, options);
+    const std::string tmp = fn + ".tmp" + std::to_string(getpid());
+    if (!write(tmp, entry) || rename(tmp.c_str(), fn.c_str()) != 0) {
+      unlink(tmp.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  void remove(const std::string &source, const std::string &options) const {
+    unlink(path(source, options).c_str());
+  }
+
+  std::string path(const std::string &source, const std::string &options) const {
+    return dir + "/" + hash_name(options + '\0' + source) + ".bin";
+  }
+
+private:
+  static constexpr const char *ENTRY_MAGIC = "CLPROGC";
+  static constexpr uint32_t ENTRY_VERSION = 1;
+
+  struct EntryHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    // device, driver, options and source, followed by the binary
+    uint64_t sizes[4];
+  };
+
+  // FNV-1a, only used for names since entries are checked against their key
+  static std::string hash_name(const std::string &s) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (unsigned char c : s) {
+      hash = (hash ^ c) * 0x100000001b3ULL;
+    }
+    char name[17];
+    snprintf(name, sizeof(name), "%016llx", (unsigned long long)hash);
+    return name;
+  }
+
+  static bool take(const std::string &s, size_t &pos, void *out, size_t size) {
+    if (size > s.size() - pos) return false;
+    memcpy(out, s.data() + pos, size);
+    pos += size;
+    return true;
+  }
+
+  static bool read(const std::string &fn, std::string &out) {
+    int fd = open(fn.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    bool ret = fstat(fd, &st) == 0;
+    if (ret) {
+      out.resize(st.st_size);
+      ret = ::read(fd, &out[0], out.size()) == (ssize_t)out.size();
+    }
+    close(fd);
+    return ret;
+  }
+
+  static bool write(const std::string &fn, const std::string &data) {
+    int fd = open(fn.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0664);
+    if (fd < 0) return false;
+    bool ret = ::write(fd, data.data(), data.size()) == (ssize_t)data.size();
+    return close(fd) == 0 && ret;
+  }
+
+  // only directories named like ours are touched
+  static void remove_other_drivers(const std::string &root, const std::string &keep) {
+    DIR *d = opendir(root.c_str());
+    if (d == nullptr) return;
+    while (struct dirent *e = readdir(d)) {
+      std::string name = e->d_name;
+      if (name == keep || name.size() != 16 || name.find_first_not_of("0123456789abcdef") != std::string::npos) {
+        continue;
+      }
+      std::string sub = root + "/" + name;
+      if (DIR *sd = opendir(sub.c_str())) {
+        while (struct dirent *f = readdir(sd)) {
+          if (f->d_name[0] != '.') unlink((sub + "/" + f->d_name).c_str());
+        }
+        closedir(sd);
+      }
+      rmdir(sub.c_str());
+    }
+    closedir(d);
+  }
+
+  const std::string device, driver;
+  std::string dir;
+  bool ok = false;
+};
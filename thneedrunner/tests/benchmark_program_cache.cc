@@ -0,0 +1,75 @@
+// Time to load a model with an empty program cache, where every kernel is compiled from
+// source, and with the cache filled by the load before. Runs on any OpenCL device, e.g. POCL.
+// Without a model one with a few dozen small programs is made up.
+// usage: benchmark_program_cache [model.thneed] [iterations]
+// With POCL, set POCL_KERNEL_CACHE=0 so its own cache of compiled kernels stays out of it.
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+
+#include "json11.hpp"
+#include "thneed.h"
+#include "timing.h"
+
+static const std::string ROOT = "/tmp/benchmark_program_cache";
+
+static void write_model(const std::string &path, int num_programs) {
+  using json11::Json;
+  const uint64_t mem = 1;
+  const std::string id((const char *)&mem, sizeof(mem));
+  Json::object programs;
+  Json::array kernels;
+  for (int i = 0; i < num_programs; i++) {
+    std::string name = "k" + std::to_string(i);
+    programs[name] = "__kernel void " + name + "(__global float *x) { int i = get_global_id(0);"
+                     " for (int j = 0; j < 8; j++) x[i] = x[i] * " + std::to_string(i + 2) + ".0f + sin(x[i]); }";
+    kernels.push_back(Json::object{{"name", name}, {"work_dim", 1}, {"global_work_size", Json::array{64}},
+                                   {"local_work_size", Json::array{1}}, {"num_args", 1},
+                                   {"args_size", Json::array{8}}, {"args", Json::array{id}}});
+  }
+  Json jdat = Json::object{
+    {"objects", Json::array{Json::object{{"id", id}, {"size", 64 * 4}, {"needs_load", false}}}},
+    {"programs", programs},
+    {"kernels", kernels},
+  };
+  std::string json = jdat.dump();
+  int jsz = json.size();
+  std::ofstream f(path, std::ios::binary);
+  f.write((const char *)&jsz, sizeof(jsz));
+  f << json;
+}
+
+// every load leaks its CL objects, Thneed never releases them
+static double load_ms(const char *path) {
+  double start = millis_since_boot();
+  Thneed *thneed = new Thneed(true);
+  thneed->debug = 0;
+  thneed->load(path);
+  return millis_since_boot() - start;
+}
+
+int main(int argc, char *argv[]) {
+  system(("rm -rf " + ROOT + " && mkdir -p " + ROOT).c_str());
+  std::string model = ROOT + "/model.thneed";
+  if (argc > 1) {
+    model = argv[1];
+  } else {
+    write_model(model, 40);
+  }
+  const int iterations = argc > 2 ? std::stoi(argv[2]) : 3;
+  setenv("THNEED_PROGRAM_CACHE", (ROOT + "/cache").c_str(), 1);
+
+  double cold = 1e9, warm = 1e9;
+  for (int i = 0; i < iterations; i++) {
+    system(("rm -rf " + ROOT + "/cache").c_str());
+    cold = std::min(cold, load_ms(model.c_str()));
+    warm = std::min(warm, load_ms(model.c_str()));
+  }
+  printf("%-8s %10s\n", "cache", "best ms");
+  printf("%-8s %10.1f\n", "empty", cold);
+  printf("%-8s %10.1f\n", "filled", warm);
+  system(("rm -rf " + ROOT).c_str());
+  return 0;
+}
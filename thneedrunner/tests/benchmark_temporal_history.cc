@@ -0,0 +1,62 @@
+// Time per frame to append a row to each temporal model input, shifting the whole buffer
+// with memmove as before against TemporalHistory.
+// usage: benchmark_temporal_history [iterations]
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "temporal_history.h"
+
+// from selfdrive/modeld/models/driving.h, which needs cereal
+#define FEATURE_LEN 512
+#define HISTORY_BUFFER_LEN 99
+#define DESIRE_LEN 8
+#define PREV_DESIRED_CURVS_LEN 100
+
+// the rows are rotated and the buffer read back so neither loop can be optimized away
+template <typename F>
+static double time_ns(F push, const float *(*view)(void *), void *ctx, const std::vector<float> &rows, size_t width, int iterations) {
+  const size_t num_rows = rows.size() / width;
+  float sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    push(&rows[(i % num_rows) * width]);
+    sink += view(ctx)[i % width];
+  }
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  volatile float keep = sink;
+  (void)keep;
+  return ns / iterations;
+}
+
+template <size_t LEN, size_t WIDTH>
+static void bench(const char *name, int iterations) {
+  std::vector<float> rows(16 * WIDTH);
+  for (size_t i = 0; i < rows.size(); i++) rows[i] = i;
+
+  std::vector<float> shift(LEN * WIDTH, 0.f);
+  auto shift_push = [&](const float *row) {
+    memmove(&shift[0], &shift[WIDTH], sizeof(float) * WIDTH * (LEN - 1));
+    memcpy(&shift[WIDTH * (LEN - 1)], row, sizeof(float) * WIDTH);
+  };
+  auto shift_view = [](void *ctx) -> const float * { return ((std::vector<float> *)ctx)->data(); };
+
+  TemporalHistory<float, LEN, WIDTH> history;
+  auto history_push = [&](const float *row) { history.push(row); };
+  auto history_view = [](void *ctx) -> const float * { return ((TemporalHistory<float, LEN, WIDTH> *)ctx)->data(); };
+
+  double shift_ns = time_ns(shift_push, shift_view, &shift, rows, WIDTH, iterations);
+  double history_ns = time_ns(history_push, history_view, &history, rows, WIDTH, iterations);
+  printf("%-20s %4zu x %-4zu %12.1f %12.1f\n", name, LEN, WIDTH, shift_ns, history_ns);
+}
+
+int main(int argc, char *argv[]) {
+  const int iterations = argc > 1 ? std::stoi(argv[1]) : 100000;
+  printf("%-20s %11s %12s %12s\n", "input", "shape", "memmove ns", "ring ns");
+  bench<HISTORY_BUFFER_LEN, FEATURE_LEN>("features_buffer", iterations);
+  bench<HISTORY_BUFFER_LEN + 1, DESIRE_LEN>("desire", iterations);
+  bench<PREV_DESIRED_CURVS_LEN, 1>("prev_desired_curvs", iterations);
+  return 0;
+}
@@ -0,0 +1,51 @@
+// Time to load a model from a .thneed with a JSON header and from the same model converted
+// to the binary format. Runs on any OpenCL device, e.g. POCL on a PC.
+// usage: benchmark_thneed_load <model.thneed> [iterations]
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#include "thneed.h"
+#include "thneed_convert.h"
+#include "timing.h"
+
+// every load leaks its CL objects, Thneed never releases them
+static double load_ms(const char *path, int iterations) {
+  double best = 1e9;
+  for (int i = 0; i < iterations; i++) {
+    double start = millis_since_boot();
+    Thneed *thneed = new Thneed(true);
+    thneed->debug = 0;
+    thneed->load(path);
+    best = std::min(best, millis_since_boot() - start);
+  }
+  return best;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <model.thneed> [iterations]\n", argv[0]);
+    return 1;
+  }
+  const int iterations = argc > 2 ? std::stoi(argv[2]) : 3;
+
+  std::ifstream ifs(argv[1], std::ios::binary);
+  std::string legacy((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+  std::string binary, error;
+  if (!thneed_convert(legacy, binary, error)) {
+    fprintf(stderr, "can't convert %s: %s\n", argv[1], error.c_str());
+    return 1;
+  }
+  const char *binary_path = "/tmp/benchmark_thneed_load.thneed";
+  std::ofstream(binary_path, std::ios::binary).write(binary.data(), binary.size());
+
+  double legacy_ms = load_ms(argv[1], iterations);
+  double binary_ms = load_ms(binary_path, iterations);
+  printf("%-8s %10s %10s\n", "format", "MB", "best ms");
+  printf("%-8s %10.1f %10.1f\n", "json", legacy.size() / 1e6, legacy_ms);
+  printf("%-8s %10.1f %10.1f\n", "binary", binary.size() / 1e6, binary_ms);
+  remove(binary_path);
+  return 0;
+}
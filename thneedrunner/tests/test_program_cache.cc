@@ -0,0 +1,192 @@
+// Checks the program binary cache, and when an OpenCL device is there (POCL works) that
+// Thneed::load builds from source once and uses the cached binary after that.
+// usage: test_program_cache
+#include <sys/stat.h>
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+#include "clutil.h"
+#include "json11.hpp"
+#include "program_cache.h"
+#include "thneed.h"
+
+#define CHECK(x)                                          \
+  do {                                                    \
+    if (!(x)) {                                           \
+      printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #x); \
+      return false;                                       \
+    }                                                     \
+  } while (0)
+
+static const std::string ROOT = "/tmp/test_program_cache";
+
+static bool exists(const std::string &path) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0;
+}
+
+static ino_t inode(const std::string &path) {
+  struct stat st = {};
+  stat(path.c_str(), &st);
+  return st.st_ino;
+}
+
+static void clear() {
+  system(("rm -rf " + ROOT).c_str());
+}
+
+static bool test_cache() {
+  clear();
+  std::string binary;
+  {
+    ProgramCache cache(ROOT, "QUALCOMM Adreno(TM)", "OpenCL 2.0 QUALCOMM build: 1");
+    CHECK(!cache.failed());
+    CHECK(!cache.get("__kernel void a() {}", "", binary));
+    CHECK(cache.put("__kernel void a() {}", "", "binary a"));
+    CHECK(cache.get("__kernel void a() {}", "", binary) && binary == "binary a");
+    CHECK(!cache.get("__kernel void a() {}", "-cl-fast-relaxed-math", binary));
+    CHECK(!cache.get("__kernel void b() {}", "", binary));
+
+    // an entry that isn't for this key is a miss, even under its name
+    std::ifstream a(cache.path("__kernel void a() {}", ""), std::ios::binary);
+    std::string entry((std::istreambuf_iterator<char>(a)), std::istreambuf_iterator<char>());
+    std::ofstream(cache.path("__kernel void b() {}", ""), std::ios::binary) << entry;
+    CHECK(!cache.get("__kernel void b() {}", "", binary));
+
+    std::ofstream(cache.path("__kernel void a() {}", ""), std::ios::binary) << entry.substr(0, entry.size() - 9);
+    CHECK(!cache.get("__kernel void a() {}", "", binary));
+    CHECK(cache.put("__kernel void a() {}", "", "binary a"));
+    cache.remove("__kernel void a() {}", "");
+    CHECK(!cache.get("__kernel void a() {}", "", binary));
+    CHECK(cache.put("__kernel void a() {}", "", "binary a"));
+  }
+  {
+    // opening for the same driver keeps the entries
+    ProgramCache cache(ROOT, "QUALCOMM Adreno(TM)", "OpenCL 2.0 QUALCOMM build: 1");
+    CHECK(cache.get("__kernel void a() {}", "", binary) && binary == "binary a");
+  }
+  mkdir((ROOT + "/other").c_str(), 0775);
+  std::string old_entry;
+  {
+    ProgramCache cache(ROOT, "QUALCOMM Adreno(TM)", "OpenCL 2.0 QUALCOMM build: 1");
+    old_entry = cache.path("__kernel void a() {}", "");
+  }
+  {
+    // a driver update drops the old binaries
+    ProgramCache cache(ROOT, "QUALCOMM Adreno(TM)", "OpenCL 2.0 QUALCOMM build: 2");
+    CHECK(!cache.get("__kernel void a() {}", "", binary));
+    CHECK(!exists(old_entry));
+    CHECK(exists(ROOT + "/other"));
+  }
+  {
+    ProgramCache cache(ROOT + "/other/a/b", "device", "driver");
+    CHECK(cache.failed());
+    CHECK(!cache.put("__kernel void a() {}", "", "binary a"));
+  }
+  printf("ok   cache\n");
+  return true;
+}
+
+static bool has_opencl() {
+  cl_uint num_platforms = 0;
+  return clGetPlatformIDs(0, NULL, &num_platforms) == CL_SUCCESS && num_platforms > 0;
+}
+
+static const char *ADD_SOURCE = "__kernel void add(__global const float *a, __global const float *b, __global float *out) {"
+                                "  int i = get_global_id(0); out[i] = a[i] + b[i]; }";
+
+// a model with one kernel that adds two buffers into a third
+static void write_model(const std::string &path) {
+  using json11::Json;
+  auto id = [](uint64_t mem) { return std::string((const char *)&mem, sizeof(mem)); };
+  const int n = 16;
+  Json jdat = Json::object{
+    {"objects", Json::array{
+      Json::object{{"id", id(1)}, {"size", n * 4}, {"needs_load", false}},
+      Json::object{{"id", id(2)}, {"size", n * 4}, {"needs_load", true}},
+      Json::object{{"id", id(3)}, {"size", n * 4}, {"needs_load", false}},
+    }},
+    {"programs", Json::object{{"add", ADD_SOURCE}}},
+    {"inputs", Json::array{Json::object{{"name", "a"}, {"buffer_id", id(1)}, {"size", n * 4}}}},
+    {"outputs", Json::array{Json::object{{"buffer_id", id(3)}, {"size", n * 4}}}},
+    {"kernels", Json::array{Json::object{{"name", "add"}, {"work_dim", 1}, {"global_work_size", Json::array{n}},
+                                         {"local_work_size", Json::array{1}}, {"num_args", 3},
+                                         {"args_size", Json::array{8, 8, 8}}, {"args", Json::array{id(1), id(2), id(3)}}}}},
+  };
+  std::string json = jdat.dump();
+  int jsz = json.size();
+  float weights[n];
+  for (int i = 0; i < n; i++) weights[i] = i;
+  std::ofstream f(path, std::ios::binary);
+  f.write((const char *)&jsz, sizeof(jsz));
+  f << json;
+  f.write((const char *)weights, sizeof(weights));
+}
+
+static bool run_model(const std::string &path) {
+  Thneed *thneed = new Thneed(true);
+  thneed->debug = 0;
+  thneed->load(path.c_str());
+  float a[16], out[16] = {};
+  for (int i = 0; i < 16; i++) a[i] = 100 * i;
+  float *inputs[] = {a};
+  thneed->execute(inputs, out);
+  for (int i = 0; i < 16; i++) {
+    CHECK(out[i] == 101 * i);
+  }
+  return true;
+}
+
+// the cache Thneed opens, the info strings keep their NUL like get_info
+static ProgramCache open_cache() {
+  cl_device_id device_id = cl_get_device_id(CL_DEVICE_TYPE_DEFAULT);
+  std::string info[2];
+  const cl_device_info params[2] = {CL_DEVICE_NAME, CL_DRIVER_VERSION};
+  for (int i = 0; i < 2; i++) {
+    size_t size = 0;
+    clGetDeviceInfo(device_id, params[i], 0, NULL, &size);
+    info[i].resize(size);
+    clGetDeviceInfo(device_id, params[i], size, &info[i][0], NULL);
+  }
+  return ProgramCache(ROOT + "/cache", info[0], info[1]);
+}
+
+static bool test_thneed() {
+  if (!has_opencl()) {
+    printf("skip thneed, no OpenCL platform\n");
+    return true;
+  }
+  clear();
+  mkdir(ROOT.c_str(), 0775);
+  const std::string model = ROOT + "/add.thneed";
+  write_model(model);
+  setenv("THNEED_PROGRAM_CACHE", (ROOT + "/cache").c_str(), 1);
+
+  CHECK(run_model(model));
+  std::string binary;
+  CHECK(open_cache().get(ADD_SOURCE, "", binary));
+  const std::string cached = open_cache().path(ADD_SOURCE, "");
+  ino_t built = inode(cached);
+
+  // a hit doesn't write the entry again
+  CHECK(run_model(model));
+  CHECK(inode(cached) == built);
+
+  // a binary the driver rejects is replaced
+  CHECK(open_cache().put(ADD_SOURCE, "", "not a program binary"));
+  CHECK(run_model(model));
+  CHECK(open_cache().get(ADD_SOURCE, "", binary) && binary != "not a program binary");
+
+  unsetenv("THNEED_PROGRAM_CACHE");
+  printf("ok   thneed\n");
+  return true;
+}
+
+int main() {
+  bool ok = test_cache();
+  ok &= test_thneed();
+  clear();
+  return ok ? 0 : 1;
+}
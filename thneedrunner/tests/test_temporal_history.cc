@@ -0,0 +1,47 @@
+// Checks TemporalHistory against the memmove shift the runners used before, for every shape
+// they use, through several wraparounds.
+// usage: test_temporal_history
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "temporal_history.h"
+
+// from selfdrive/modeld/models/driving.h, which needs cereal
+#define FEATURE_LEN 512
+#define HISTORY_BUFFER_LEN 99
+#define DESIRE_LEN 8
+#define PREV_DESIRED_CURVS_LEN 100
+
+template <size_t LEN, size_t WIDTH>
+static bool check(const char *name, std::mt19937 &rng) {
+  TemporalHistory<float, LEN, WIDTH> history;
+  std::vector<float> ref(LEN * WIDTH, 0.f);
+  std::vector<float> row(WIDTH);
+  std::uniform_real_distribution<float> dist(-1.f, 1.f);
+
+  for (size_t frame = 0; frame < LEN * 3 + 7; frame++) {
+    for (auto &v : row) v = dist(rng);
+    memmove(&ref[0], &ref[WIDTH], sizeof(float) * WIDTH * (LEN - 1));
+    memcpy(&ref[WIDTH * (LEN - 1)], row.data(), sizeof(float) * WIDTH);
+    history.push(row.data());
+
+    if (memcmp(history.data(), ref.data(), sizeof(float) * history.size()) != 0) {
+      printf("FAIL %s: differs after %zu frames\n", name, frame + 1);
+      return false;
+    }
+  }
+  printf("ok   %s\n", name);
+  return true;
+}
+
+int main() {
+  std::mt19937 rng(0);
+  bool ok = true;
+  ok &= check<HISTORY_BUFFER_LEN, FEATURE_LEN>("features_buffer", rng);
+  ok &= check<HISTORY_BUFFER_LEN + 1, DESIRE_LEN>("desire", rng);
+  ok &= check<PREV_DESIRED_CURVS_LEN, 1>("prev_desired_curvs", rng);
+  ok &= check<1, 4>("single row", rng);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,147 @@
+// Converts a small .thneed with a JSON header and checks what ThneedFile maps back.
+// usage: test_thneed_format
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "json11.hpp"
+#include "thneed_convert.h"
+#include "thneed_format.h"
+
+#define CHECK(x)                                          \
+  do {                                                    \
+    if (!(x)) {                                           \
+      printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #x); \
+      return false;                                       \
+    }                                                     \
+  } while (0)
+
+// the cl_mem of an object when it was recorded
+static std::string mem_id(uint64_t id) {
+  return std::string((const char *)&id, sizeof(id));
+}
+
+static std::string legacy_thneed(const std::string &weights, const std::string &binary) {
+  using json11::Json;
+  const int scalar = 7;
+  Json jdat = Json::object{
+    {"objects", Json::array{
+      Json::object{{"id", mem_id(0x10)}, {"size", (int)weights.size()}, {"needs_load", true}},
+      Json::object{{"id", mem_id(0x20)}, {"size", 64 * 4}, {"needs_load", false}},
+      Json::object{{"id", mem_id(0x30)}, {"size", 64 * 4}, {"needs_load", false}, {"buffer_id", mem_id(0x20)},
+                   {"arg_type", "image2d_t"}, {"width", 4}, {"height", 4}, {"row_pitch", 64}, {"float32", true}},
+      Json::object{{"id", mem_id(0x40)}, {"size", 16}, {"needs_load", true}},
+    }},
+    {"programs", Json::object{{"conv", "__kernel void conv() {}"}}},
+    {"binaries", Json::array{Json::object{{"name", "pool"}, {"length", (int)binary.size()}}}},
+    {"inputs", Json::array{Json::object{{"name", "input_imgs"}, {"buffer_id", mem_id(0x20)}, {"size", 64 * 4}}}},
+    {"outputs", Json::array{Json::object{{"buffer_id", mem_id(0x40)}, {"size", 16}}}},
+    {"kernels", Json::array{
+      Json::object{{"name", "conv"}, {"work_dim", 2}, {"global_work_size", Json::array{8, 4}}, {"local_work_size", Json::array{4, 2}},
+                   {"num_args", 4}, {"args_size", Json::array{8, 8, 4, 256}},
+                   {"args", Json::array{mem_id(0x10), mem_id(0x30), std::string((const char *)&scalar, sizeof(scalar)), ""}}},
+      Json::object{{"name", "pool"}, {"work_dim", 1}, {"global_work_size", Json::array{16}}, {"local_work_size", Json::array{16}},
+                   {"num_args", 2}, {"args_size", Json::array{8, 8}}, {"args", Json::array{mem_id(0x40), mem_id(0x99)}}},
+    }},
+  };
+
+  std::string json = jdat.dump();
+  int jsz = json.size();
+  std::string extra_weights(16, '\x5a');
+  return std::string((const char *)&jsz, sizeof(jsz)) + json + weights + extra_weights + binary;
+}
+
+static bool test_convert(const char *path) {
+  std::string weights(10000, '\0');
+  for (size_t i = 0; i < weights.size(); i++) weights[i] = i * 7;
+  const std::string binary = "\x7f" "ELF program binary";
+
+  std::string out, error;
+  CHECK(thneed_convert(legacy_thneed(weights, binary), out, error));
+  CHECK(error.empty());
+  std::ofstream(path, std::ios::binary).write(out.data(), out.size());
+
+  CHECK(ThneedFile::is_binary(path));
+  ThneedFile file;
+  CHECK(file.open(path));
+  const ThneedHeader &h = file.header();
+  CHECK(h.num_objects == 4 && h.num_inputs == 1 && h.num_outputs == 1);
+  CHECK(h.num_programs == 2 && h.num_kernels == 2 && h.num_args == 6);
+
+  const ThneedObject *objects = file.objects();
+  CHECK(objects[0].size == weights.size() && objects[0].data % THNEED_DATA_ALIGN == 0);
+  CHECK(memcmp(file.data(objects[0].data), weights.data(), weights.size()) == 0);
+  CHECK(objects[1].data == 0 && objects[1].buffer == THNEED_NONE && objects[1].type == THNEED_BUFFER);
+  CHECK(objects[2].buffer == 1 && objects[2].type == THNEED_IMAGE2D && objects[2].float32);
+  CHECK(objects[2].width == 4 && objects[2].height == 4 && objects[2].row_pitch == 64);
+  CHECK(objects[3].data % THNEED_DATA_ALIGN == 0 && *(char *)file.data(objects[3].data) == '\x5a');
+
+  CHECK(std::string(file.str(file.inputs()[0].name)) == "input_imgs");
+  CHECK(file.inputs()[0].object == 1 && file.inputs()[0].size == 64 * 4);
+  CHECK(file.outputs()[0].object == 3);
+
+  const ThneedProgram *programs = file.programs();
+  CHECK(std::string(file.str(programs[0].name)) == "conv" && programs[0].type == THNEED_PROGRAM_SOURCE);
+  CHECK(std::string((char *)file.data(programs[0].data), programs[0].size) == "__kernel void conv() {}");
+  CHECK(std::string(file.str(programs[1].name)) == "pool" && programs[1].type == THNEED_PROGRAM_BINARY);
+  CHECK(std::string((char *)file.data(programs[1].data), programs[1].size) == binary);
+
+  const ThneedKernel &conv = file.kernels()[0];
+  CHECK(std::string(file.str(conv.name)) == "conv" && conv.program == 0 && conv.work_dim == 2);
+  CHECK(conv.global_work_size[1] == 4 && conv.local_work_size[0] == 4);
+  CHECK(conv.first_arg == 0 && conv.num_args == 4);
+  const ThneedArg *args = file.args();
+  CHECK(args[0].object == 0 && args[1].object == 2);
+  CHECK(args[2].object == THNEED_NONE && args[2].size == 4 && *(int *)file.data(args[2].value) == 7);
+  CHECK(args[3].object == THNEED_NONE && args[3].size == 256 && args[3].value == 0);
+
+  const ThneedKernel &pool = file.kernels()[1];
+  CHECK(pool.program == 1 && pool.first_arg == 4 && pool.num_args == 2);
+  // a cl_mem that wasn't saved is NULL
+  CHECK(args[4].object == 3 && args[5].object == THNEED_NONE && *(uint64_t *)file.data(args[5].value) == 0);
+
+  // the mapping is private
+  memset(file.data(objects[0].data), 0, 16);
+  file.close();
+  CHECK(file.open(path));
+  CHECK(memcmp(file.data(file.objects()[0].data), weights.data(), 16) == 0);
+  printf("ok   convert\n");
+  return true;
+}
+
+static bool test_invalid(const char *path) {
+  std::string out, error;
+  CHECK(!thneed_convert(std::string("\x10\0\0\0{}", 6), out, error));
+  CHECK(!thneed_convert(legacy_thneed(std::string(100, 'w'), "b").substr(0, 200), out, error));
+
+  CHECK(thneed_convert(legacy_thneed(std::string(100, 'w'), "b"), out, error));
+  auto rejected = [&](size_t offset, const void *value, size_t size) {
+    std::string bad = out;
+    memcpy(&bad[offset], value, size);
+    std::ofstream(path, std::ios::binary).write(bad.data(), bad.size());
+    ThneedFile file;
+    return !file.open(path);
+  };
+  const uint32_t version = THNEED_FORMAT_VERSION + 1, big = 1000;
+  const ThneedHeader &h = *(const ThneedHeader *)out.data();
+  CHECK(rejected(offsetof(ThneedHeader, version), &version, sizeof(version)));
+  CHECK(rejected(offsetof(ThneedHeader, num_args), &big, sizeof(big)));
+  CHECK(rejected(h.kernels + offsetof(ThneedKernel, program), &big, sizeof(big)));
+  CHECK(rejected(h.objects + 2 * sizeof(ThneedObject) + offsetof(ThneedObject, buffer), &big, sizeof(big)));
+  CHECK(!rejected(0, THNEED_MAGIC, 8));
+
+  std::ofstream(path, std::ios::binary).write(out.data(), out.size() - 1);
+  ThneedFile file;
+  CHECK(!file.open(path));
+  printf("ok   invalid\n");
+  return true;
+}
+
+int main() {
+  const char *path = "/tmp/test_thneed_format.thneed";
+  bool ok = test_convert(path);
+  ok &= test_invalid(path);
+  remove(path);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,92 @@
+// Runs a small model through ThneedPipeline in the order thneedapp does, with an input that
+// depends on the outputs of the frame before, and checks it against running it serially.
+// Needs an OpenCL device, POCL works.
+// usage: test_thneed_pipeline
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+
+#include "json11.hpp"
+#include "thneed_pipeline.h"
+
+#define N 16
+
+// out = a + b, b is fed back from out
+static void write_model(const std::string &path) {
+  using json11::Json;
+  auto id = [](uint64_t mem) { return std::string((const char *)&mem, sizeof(mem)); };
+  Json jdat = Json::object{
+    {"objects", Json::array{
+      Json::object{{"id", id(1)}, {"size", N * 4}, {"needs_load", false}},
+      Json::object{{"id", id(2)}, {"size", N * 4}, {"needs_load", false}},
+      Json::object{{"id", id(3)}, {"size", N * 4}, {"needs_load", false}},
+    }},
+    {"programs", Json::object{{"add", "__kernel void add(__global const float *a, __global const float *b, __global float *out) {"
+                                      "  int i = get_global_id(0); out[i] = a[i] + b[i]; }"}}},
+    // in the reverse order of ThneedModel
+    {"inputs", Json::array{Json::object{{"name", "b"}, {"buffer_id", id(2)}, {"size", N * 4}},
+                           Json::object{{"name", "a"}, {"buffer_id", id(1)}, {"size", N * 4}}}},
+    {"outputs", Json::array{Json::object{{"buffer_id", id(3)}, {"size", N * 4}}}},
+    {"kernels", Json::array{Json::object{{"name", "add"}, {"work_dim", 1}, {"global_work_size", Json::array{N}},
+                                         {"local_work_size", Json::array{1}}, {"num_args", 3},
+                                         {"args_size", Json::array{8, 8, 8}}, {"args", Json::array{id(1), id(2), id(3)}}}}},
+  };
+  std::string json = jdat.dump();
+  int jsz = json.size();
+  std::ofstream f(path, std::ios::binary);
+  f.write((const char *)&jsz, sizeof(jsz));
+  f << json;
+}
+
+int main() {
+  cl_uint num_platforms = 0;
+  if (clGetPlatformIDs(0, NULL, &num_platforms) != CL_SUCCESS || num_platforms == 0) {
+    printf("skip, no OpenCL platform\n");
+    return 0;
+  }
+  const std::string model_path = "/tmp/test_thneed_pipeline.thneed";
+  write_model(model_path);
+  setenv("THNEED_PROGRAM_CACHE", "", 1);
+
+  float output[N];
+  float b[N] = {};
+  ThneedModel model(model_path, output, N, 0, false, NULL);
+  model.addInput("a", NULL, N);
+  model.addInput("b", b, N);
+  ThneedPipeline pipeline(&model, {"a"});
+
+  const int frames = 10;
+  float expected[N] = {};
+  bool ok = true;
+  for (int frame = 0; frame <= frames; frame++) {
+    if (frame < frames) {
+      float *a = pipeline.input("a");
+      for (int i = 0; i < N; i++) a[i] = frame * 100 + i;
+      pipeline.upload();
+    }
+
+    if (pipeline.in_flight() > 0) {
+      ThneedTimings t;
+      const float *out = pipeline.wait(&t);
+      // serially frame - 1 adds its a to the output of the frame before
+      for (int i = 0; i < N; i++) {
+        expected[i] += (frame - 1) * 100 + i;
+        if (out[i] != expected[i]) {
+          printf("FAIL frame %d [%d]: %f != %f\n", frame - 1, i, out[i], expected[i]);
+          ok = false;
+        }
+      }
+      if (t.latency <= 0 || t.kernels < 0 || t.upload < 0 || t.download < 0) {
+        printf("FAIL bad timings\n");
+        ok = false;
+      }
+      std::copy(out, out + N, b);
+    }
+
+    if (frame < frames) pipeline.submit();
+  }
+  remove(model_path.c_str());
+  if (ok) printf("ok   pipeline\n");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,227 @@
+#include "thneed_convert.h"
+
+#include <map>
+#include <vector>
+
+#include "json11.hpp"
+#include "thneed_format.h"
+
+static size_t align_up(size_t n, size_t align) {
+  return (n + align - 1) / align * align;
+}
+
+template <typename T>
+static void append(std::string &out, const std::vector<T> &records) {
+  out.append((const char *)records.data(), records.size() * sizeof(T));
+}
+
+bool thneed_convert(const std::string &legacy, std::string &out, std::string &error) {
+  int jsz = 0;
+  if (legacy.size() < sizeof(jsz)) {
+    error = "file is too short";
+    return false;
+  }
+  memcpy(&jsz, legacy.data(), sizeof(jsz));
+  if (jsz <= 0 || (size_t)jsz > legacy.size() - sizeof(jsz)) {
+    error = "bad JSON size";
+    return false;
+  }
+  std::string json_error;
+  json11::Json jdat = json11::Json::parse(legacy.substr(sizeof(jsz), jsz), json_error);
+  if (!json_error.empty()) {
+    error = "bad JSON: " + json_error;
+    return false;
+  }
+  // weights and then program binaries follow the JSON, in the order they are listed
+  size_t ptr = sizeof(jsz) + jsz;
+  auto take = [&](size_t size, const char *&blob) {
+    if (size > legacy.size() - ptr) return false;
+    blob = &legacy[ptr];
+    ptr += size;
+    return true;
+  };
+
+  std::string strings(1, '\0');
+  std::map<std::string, uint32_t> string_ids;
+  auto add_string = [&](const std::string &s) {
+    auto [it, added] = string_ids.try_emplace(s, strings.size());
+    if (added) strings.append(s.c_str(), s.size() + 1);
+    return it->second;
+  };
+
+  // data offsets are from the start of the data section until the layout is known
+  std::string data;
+  auto add_data = [&](const char *blob, size_t size, size_t align) {
+    data.resize(align_up(data.size(), align), '\0');
+    uint64_t offset = data.size();
+    data.append(blob, size);
+    return offset;
+  };
+
+  // objects are referred to by their cl_mem when the model was recorded
+  std::vector<ThneedObject> objects;
+  std::vector<uint32_t> loaded_objects;
+  std::map<std::string, uint32_t> object_ids;
+  for (auto &obj : jdat["objects"].array_items()) {
+    ThneedObject o = {};
+    o.size = obj["size"].int_value();
+    o.buffer = THNEED_NONE;
+    if (obj["buffer_id"].string_value().size() > 0) {
+      auto it = object_ids.find(obj["buffer_id"].string_value());
+      if (it == object_ids.end() || obj["needs_load"].bool_value()) {
+        error = "image without an earlier buffer";
+        return false;
+      }
+      o.buffer = it->second;
+    } else if (obj["needs_load"].bool_value()) {
+      const char *blob = nullptr;
+      if (!take(o.size, blob)) {
+        error = "weights past the end of the file";
+        return false;
+      }
+      loaded_objects.push_back(objects.size());
+      o.data = add_data(blob, o.size, THNEED_DATA_ALIGN);
+    }
+
+    if (obj["arg_type"] == "image2d_t" || obj["arg_type"] == "image1d_t") {
+      o.type = (obj["arg_type"] == "image2d_t") ? THNEED_IMAGE2D : THNEED_IMAGE1D_BUFFER;
+      o.width = obj["width"].int_value();
+      o.height = obj["height"].int_value();
+      o.row_pitch = obj["row_pitch"].int_value();
+      o.float32 = obj["float32"].bool_value();
+    }
+    object_ids[obj["id"].string_value()] = objects.size();
+    objects.push_back(o);
+  }
+
+  std::vector<ThneedProgram> programs;
+  std::map<std::string, uint32_t> program_ids;
+  for (const auto &[name, source] : jdat["programs"].object_items()) {
+    ThneedProgram p = {add_string(name), THNEED_PROGRAM_SOURCE, 0, source.string_value().size()};
+    p.data = add_data(source.string_value().data(), p.size, 8);
+    program_ids[name] = programs.size();
+    programs.push_back(p);
+  }
+  for (auto &obj : jdat["binaries"].array_items()) {
+    ThneedProgram p = {add_string(obj["name"].string_value()), THNEED_PROGRAM_BINARY, 0, (uint64_t)obj["length"].int_value()};
+    const char *blob = nullptr;
+    if (!take(p.size, blob)) {
+      error = "program binary past the end of the file";
+      return false;
+    }
+    p.data = add_data(blob, p.size, 8);
+    program_ids[obj["name"].string_value()] = programs.size();
+    programs.push_back(p);
+  }
+
+  auto convert_io = [&](const json11::Json &list, std::vector<ThneedIO> &ios) {
+    for (auto &obj : list.array_items()) {
+      auto it = object_ids.find(obj["buffer_id"].string_value());
+      if (it == object_ids.end()) return false;
+      ios.push_back({add_string(obj["name"].string_value()), it->second, (uint64_t)obj["size"].int_value()});
+    }
+    return true;
+  };
+  std::vector<ThneedIO> inputs, outputs;
+  if (!convert_io(jdat["inputs"], inputs) || !convert_io(jdat["outputs"], outputs)) {
+    error = "input or output without a buffer";
+    return false;
+  }
+
+  std::vector<ThneedKernel> kernels;
+  std::vector<ThneedArg> args;
+  std::vector<uint32_t> value_args;
+  for (auto &obj : jdat["kernels"].array_items()) {
+    ThneedKernel k = {};
+    auto it = program_ids.find(obj["name"].string_value());
+    if (it == program_ids.end()) {
+      error = "no program for kernel " + obj["name"].string_value();
+      return false;
+    }
+    k.name = add_string(obj["name"].string_value());
+    k.program = it->second;
+    k.work_dim = obj["work_dim"].int_value();
+    if (k.work_dim > 3) {
+      error = "bad work_dim for kernel " + obj["name"].string_value();
+      return false;
+    }
+    for (uint32_t i = 0; i < k.work_dim; i++) {
+      k.global_work_size[i] = obj["global_work_size"][i].int_value();
+      k.local_work_size[i] = obj["local_work_size"][i].int_value();
+    }
+    k.num_args = obj["num_args"].int_value();
+    k.first_arg = args.size();
+    for (uint32_t i = 0; i < k.num_args; i++) {
+      const std::string &value = obj["args"][i].string_value();
+      ThneedArg arg = {THNEED_NONE, (uint32_t)obj["args_size"][i].int_value(), 0};
+      if (arg.size == 8) {
+        // 8 byte args are cl_mem, the ones that weren't saved are NULL like in Thneed::load
+        auto obj_it = object_ids.find(value);
+        if (obj_it != object_ids.end()) {
+          arg.object = obj_it->second;
+        } else {
+          const char null_mem[8] = {};
+          value_args.push_back(args.size());
+          arg.value = add_data(null_mem, sizeof(null_mem), 8);
+        }
+      } else if (value.size() > 0) {
+        if (value.size() != arg.size) {
+          error = "arg size mismatch in kernel " + obj["name"].string_value();
+          return false;
+        }
+        value_args.push_back(args.size());
+        arg.value = add_data(value.data(), value.size(), 8);
+      }
+      args.push_back(arg);
+    }
+    kernels.push_back(k);
+  }
+
+  ThneedHeader h = {};
+  memcpy(h.magic, THNEED_MAGIC, sizeof(h.magic));
+  h.version = THNEED_FORMAT_VERSION;
+  h.num_objects = objects.size();
+  h.num_inputs = inputs.size();
+  h.num_outputs = outputs.size();
+  h.num_programs = programs.size();
+  h.num_kernels = kernels.size();
+  h.num_args = args.size();
+  h.strings_size = strings.size();
+
+  // every record is a multiple of 8 bytes, so the tables stay aligned
+  size_t offset = sizeof(h);
+  h.objects = offset;
+  offset += objects.size() * sizeof(ThneedObject);
+  h.inputs = offset;
+  offset += inputs.size() * sizeof(ThneedIO);
+  h.outputs = offset;
+  offset += outputs.size() * sizeof(ThneedIO);
+  h.programs = offset;
+  offset += programs.size() * sizeof(ThneedProgram);
+  h.kernels = offset;
+  offset += kernels.size() * sizeof(ThneedKernel);
+  h.args = offset;
+  offset += args.size() * sizeof(ThneedArg);
+  h.strings = offset;
+  offset += strings.size();
+  const size_t data_start = align_up(offset, THNEED_DATA_ALIGN);
+  h.file_size = data_start + data.size();
+
+  for (uint32_t i : loaded_objects) objects[i].data += data_start;
+  for (auto &p : programs) p.data += data_start;
+  for (uint32_t i : value_args) args[i].value += data_start;
+
+  out.clear();
+  out.reserve(h.file_size);
+  out.append((const char *)&h, sizeof(h));
+  append(out, objects);
+  append(out, inputs);
+  append(out, outputs);
+  append(out, programs);
+  append(out, kernels);
+  append(out, args);
+  out += strings;
+  out.resize(data_start, '\0');
+  out += data;
+  return true;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <string>
+
+// Converts a .thneed with a JSON header into the binary format of thneed_format.h.
+// Returns false with the reason in error if legacy isn't a valid .thneed.
+bool thneed_convert(const std::string &legacy, std::string &out, std::string &error);
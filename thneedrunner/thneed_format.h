@@ -0,0 +1,216 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+
+// Binary thneed model file. Everything is little endian with fixed size records, so it's used
+// straight from an mmap. thneedconvert makes one from a .thneed with a JSON header.
+//
+//   ThneedHeader
+//   tables: objects, inputs, outputs, programs, kernels, args
+//   strings, NUL terminated
+//   data: weights on THNEED_DATA_ALIGN boundaries, program sources and binaries, arg values
+//
+// Offsets are from the start of the file, references between tables are indices.
+
+#define THNEED_MAGIC "THNEEDB"
+#define THNEED_FORMAT_VERSION 1
+#define THNEED_DATA_ALIGN 4096
+#define THNEED_NONE 0xffffffffU
+
+enum ThneedObjectType : uint32_t {
+  THNEED_BUFFER = 0,
+  THNEED_IMAGE2D = 1,
+  THNEED_IMAGE1D_BUFFER = 2,
+};
+
+enum ThneedProgramType : uint32_t {
+  THNEED_PROGRAM_SOURCE = 0,
+  THNEED_PROGRAM_BINARY = 1,
+};
+
+struct ThneedHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t num_objects;
+  uint32_t num_inputs;
+  uint32_t num_outputs;
+  uint32_t num_programs;
+  uint32_t num_kernels;
+  uint32_t num_args;
+  uint32_t strings_size;
+  uint64_t objects;
+  uint64_t inputs;
+  uint64_t outputs;
+  uint64_t programs;
+  uint64_t kernels;
+  uint64_t args;
+  uint64_t strings;
+  uint64_t file_size;
+};
+
+struct ThneedObject {
+  uint64_t size;
+  // initial contents, 0 for zeros
+  uint64_t data;
+  // image on the buffer of an earlier object, or THNEED_NONE
+  uint32_t buffer;
+  uint32_t type;
+  uint32_t width;
+  uint32_t height;
+  uint32_t row_pitch;
+  uint32_t float32;
+};
+
+struct ThneedIO {
+  uint32_t name;
+  uint32_t object;
+  uint64_t size;
+};
+
+struct ThneedProgram {
+  uint32_t name;
+  uint32_t type;
+  uint64_t data;
+  uint64_t size;
+};
+
+struct ThneedKernel {
+  uint32_t name;
+  uint32_t program;
+  uint32_t work_dim;
+  uint32_t num_args;
+  uint32_t first_arg;
+  uint32_t reserved;
+  uint64_t global_work_size[3];
+  uint64_t local_work_size[3];
+};
+
+struct ThneedArg {
+  // a cl_mem arg, or THNEED_NONE
+  uint32_t object;
+  uint32_t size;
+  // value of any other arg, 0 for NULL
+  uint64_t value;
+};
+
+static_assert(sizeof(ThneedHeader) == 104 && sizeof(ThneedObject) == 40 && sizeof(ThneedIO) == 16 &&
+              sizeof(ThneedProgram) == 24 && sizeof(ThneedKernel) == 72 && sizeof(ThneedArg) == 16,
+              "thneed file records are fixed size");
+
+// A mapped and checked binary thneed file. The mapping is private and writable, so it can back
+// CL_MEM_USE_HOST_PTR buffers without the file changing.
+class ThneedFile {
+public:
+  ThneedFile() = default;
+  ThneedFile(const ThneedFile &) = delete;
+  ThneedFile &operator=(const ThneedFile &) = delete;
+  ~ThneedFile() { close(); }
+
+  static bool is_binary(const char *filename) {
+    char magic[sizeof(ThneedHeader::magic)] = {};
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0) return false;
+    bool ret = ::read(fd, magic, sizeof(magic)) == sizeof(magic) && memcmp(magic, THNEED_MAGIC, sizeof(magic)) == 0;
+    ::close(fd);
+    return ret;
+  }
+
+  // false if the file can't be mapped or isn't a valid thneed file
+  bool open(const char *filename) {
+    close();
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(ThneedHeader)) {
+      void *addr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+      if (addr != MAP_FAILED) {
+        base = (uint8_t *)addr;
+        length = st.st_size;
+      }
+    }
+    ::close(fd);
+    if (base == nullptr || !valid()) {
+      close();
+      return false;
+    }
+    return true;
+  }
+
+  void close() {
+    if (base != nullptr) munmap(base, length);
+    base = nullptr;
+    length = 0;
+  }
+
+  const ThneedHeader &header() const { return *(const ThneedHeader *)base; }
+  const ThneedObject *objects() const { return (const ThneedObject *)(base + header().objects); }
+  const ThneedIO *inputs() const { return (const ThneedIO *)(base + header().inputs); }
+  const ThneedIO *outputs() const { return (const ThneedIO *)(base + header().outputs); }
+  const ThneedProgram *programs() const { return (const ThneedProgram *)(base + header().programs); }
+  const ThneedKernel *kernels() const { return (const ThneedKernel *)(base + header().kernels); }
+  const ThneedArg *args() const { return (const ThneedArg *)(base + header().args); }
+  const char *str(uint32_t offset) const { return (const char *)base + header().strings + offset; }
+  void *data(uint64_t offset) const { return base + offset; }
+
+private:
+  bool in_file(uint64_t offset, uint64_t size) const {
+    return offset <= length && size <= length - offset;
+  }
+
+  bool table(uint64_t offset, uint32_t count, size_t record_size) const {
+    return offset % 8 == 0 && in_file(offset, (uint64_t)count * record_size);
+  }
+
+  bool valid() const {
+    const ThneedHeader &h = header();
+    if (memcmp(h.magic, THNEED_MAGIC, sizeof(h.magic)) != 0 || h.version != THNEED_FORMAT_VERSION || h.file_size != length) {
+      return false;
+    }
+    if (!table(h.objects, h.num_objects, sizeof(ThneedObject)) || !table(h.inputs, h.num_inputs, sizeof(ThneedIO)) ||
+        !table(h.outputs, h.num_outputs, sizeof(ThneedIO)) || !table(h.programs, h.num_programs, sizeof(ThneedProgram)) ||
+        !table(h.kernels, h.num_kernels, sizeof(ThneedKernel)) || !table(h.args, h.num_args, sizeof(ThneedArg))) {
+      return false;
+    }
+    if (h.strings_size == 0 || !in_file(h.strings, h.strings_size) || base[h.strings + h.strings_size - 1] != '\0') {
+      return false;
+    }
+
+    for (uint32_t i = 0; i < h.num_objects; i++) {
+      const ThneedObject &obj = objects()[i];
+      if (obj.buffer != THNEED_NONE && (obj.buffer >= i || obj.data != 0)) return false;
+      if (obj.data != 0 && (obj.data % THNEED_DATA_ALIGN != 0 || !in_file(obj.data, obj.size))) return false;
+      if (obj.type > THNEED_IMAGE1D_BUFFER) return false;
+    }
+    auto io_valid = [&](const ThneedIO *io, uint32_t num) {
+      for (uint32_t i = 0; i < num; i++) {
+        if (io[i].name >= h.strings_size || io[i].object >= h.num_objects) return false;
+      }
+      return true;
+    };
+    if (!io_valid(inputs(), h.num_inputs) || !io_valid(outputs(), h.num_outputs)) return false;
+    for (uint32_t i = 0; i < h.num_programs; i++) {
+      const ThneedProgram &prg = programs()[i];
+      if (prg.name >= h.strings_size || prg.type > THNEED_PROGRAM_BINARY || !in_file(prg.data, prg.size)) return false;
+    }
+    for (uint32_t i = 0; i < h.num_kernels; i++) {
+      const ThneedKernel &k = kernels()[i];
+      if (k.name >= h.strings_size || k.program >= h.num_programs || k.work_dim > 3) return false;
+      if (k.first_arg > h.num_args || k.num_args > h.num_args - k.first_arg) return false;
+    }
+    for (uint32_t i = 0; i < h.num_args; i++) {
+      const ThneedArg &arg = args()[i];
+      if (arg.object != THNEED_NONE && arg.object >= h.num_objects) return false;
+      if (arg.value != 0 && !in_file(arg.value, arg.size)) return false;
+    }
+    return true;
+  }
+
+  uint8_t *base = nullptr;
+  size_t length = 0;
+};
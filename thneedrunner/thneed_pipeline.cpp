@@ -0,0 +1,152 @@
+#include "thneed_pipeline.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include "clutil.h"
+#include "timing.h"
+
+static double event_ms(cl_event start, cl_profiling_info start_info, cl_event end, cl_profiling_info end_info) {
+  cl_ulong start_ns = 0, end_ns = 0;
+  if (start == NULL || end == NULL) return 0;
+  clGetEventProfilingInfo(start, start_info, sizeof(start_ns), &start_ns, NULL);
+  clGetEventProfilingInfo(end, end_info, sizeof(end_ns), &end_ns, NULL);
+  return (end_ns - start_ns) * 1e-6;
+}
+
+static void release(cl_event &event) {
+  if (event != NULL) clReleaseEvent(event);
+  event = NULL;
+}
+
+ThneedPipeline::ThneedPipeline(ThneedModel *model, const std::vector<std::string> &streamed) : thneed(model->thneed) {
+  cl_command_queue_properties props[3] = {CL_QUEUE_PROPERTIES, CL_QUEUE_PROFILING_ENABLE, 0};
+  compute_queue = CL_CHECK_ERR(clCreateCommandQueueWithProperties(thneed->context, thneed->device_id, props, &err));
+  upload_queue = CL_CHECK_ERR(clCreateCommandQueueWithProperties(thneed->context, thneed->device_id, props, &err));
+
+  // the kernels go on the profiled queue
+  thneed_queue = thneed->command_queue;
+  thneed->command_queue = compute_queue;
+
+  // ThneedModel keeps its inputs in the reverse order of Thneed
+  const size_t n = model->inputs.size();
+  assert(n <= thneed->input_clmem.size());
+  for (size_t i = 0; i < n; i++) {
+    Input in;
+    in.model_input = model->inputs[i].get();
+    in.clmem = thneed->input_clmem[n - i - 1];
+    in.size = thneed->input_sizes[n - i - 1];
+    in.streamed = std::find(streamed.begin(), streamed.end(), in.model_input->name) != streamed.end();
+    if (in.streamed) {
+      for (int s = 0; s < 2; s++) {
+        in.host[s].resize((in.size + sizeof(float) - 1) / sizeof(float));
+        in.staging[s] = CL_CHECK_ERR(clCreateBuffer(thneed->context, CL_MEM_READ_ONLY, in.size, NULL, &err));
+      }
+    }
+    inputs.push_back(std::move(in));
+  }
+
+  if (thneed->output != NULL) {
+    clGetMemObjectInfo(thneed->output, CL_MEM_SIZE, sizeof(output_size), &output_size, NULL);
+  }
+  for (auto &slot : slots) {
+    slot.output.resize(output_size / sizeof(float));
+  }
+}
+
+ThneedPipeline::~ThneedPipeline() {
+  clFinish(upload_queue);
+  clFinish(compute_queue);
+  for (auto &slot : slots) {
+    for (cl_event *e : {&slot.upload_start, &slot.upload_done, &slot.inputs_done, &slot.kernels_done, &slot.read_done}) {
+      release(*e);
+    }
+  }
+  for (auto &in : inputs) {
+    for (cl_mem staging : in.staging) {
+      if (staging != NULL) clReleaseMemObject(staging);
+    }
+  }
+  thneed->command_queue = thneed_queue;
+  clReleaseCommandQueue(upload_queue);
+  clReleaseCommandQueue(compute_queue);
+}
+
+float *ThneedPipeline::input(const std::string &name) {
+  // the slot is free once the frame that used it was waited for
+  assert(uploaded - waited < 2);
+  for (auto &in : inputs) {
+    if (in.streamed && in.model_input->name == name) {
+      return in.host[uploaded % 2].data();
+    }
+  }
+  assert(false);
+  return nullptr;
+}
+
+void ThneedPipeline::upload() {
+  assert(uploaded - waited < 2);
+  Slot &slot = slots[uploaded % 2];
+  for (auto &in : inputs) {
+    if (!in.streamed) continue;
+    CL_CHECK(clEnqueueWriteBuffer(upload_queue, in.staging[uploaded % 2], CL_FALSE, 0, in.size, in.host[uploaded % 2].data(),
+                                  0, NULL, (slot.upload_start == NULL) ? &slot.upload_start : NULL));
+  }
+  CL_CHECK(clEnqueueMarkerWithWaitList(upload_queue, 0, NULL, &slot.upload_done));
+  clFlush(upload_queue);
+  uploaded++;
+}
+
+void ThneedPipeline::submit() {
+  assert(submitted < uploaded);
+  Slot &slot = slots[submitted % 2];
+  slot.submit_time = millis_since_boot();
+
+  for (auto &in : inputs) {
+    if (in.streamed) {
+      CL_CHECK(clEnqueueCopyBuffer(compute_queue, in.staging[submitted % 2], in.clmem, 0, 0, in.size, 1, &slot.upload_done, NULL));
+    } else if (in.model_input->buffer != NULL) {
+      CL_CHECK(clEnqueueWriteBuffer(compute_queue, in.clmem, CL_FALSE, 0, in.size, in.model_input->buffer, 0, NULL, NULL));
+    }
+  }
+  CL_CHECK(clEnqueueMarkerWithWaitList(compute_queue, 0, NULL, &slot.inputs_done));
+
+  for (auto &k : thneed->kq) {
+    cl_int ret = k->exec();
+    assert(ret == CL_SUCCESS);
+  }
+  CL_CHECK(clEnqueueMarkerWithWaitList(compute_queue, 0, NULL, &slot.kernels_done));
+
+  if (output_size > 0) {
+    CL_CHECK(clEnqueueReadBuffer(compute_queue, thneed->output, CL_FALSE, 0, output_size, slot.output.data(), 0, NULL, &slot.read_done));
+  }
+  clFlush(compute_queue);
+  submitted++;
+}
+
+const float *ThneedPipeline::submitted_output(cl_event *done) {
+  assert(waited < submitted);
+  Slot &slot = slots[(submitted - 1) % 2];
+  *done = (slot.read_done != NULL) ? slot.read_done : slot.kernels_done;
+  CL_CHECK(clRetainEvent(*done));
+  return slot.output.data();
+}
+
+const float *ThneedPipeline::wait(ThneedTimings *timings) {
+  assert(waited < submitted);
+  Slot &slot = slots[waited % 2];
+  cl_event done = (slot.read_done != NULL) ? slot.read_done : slot.kernels_done;
+  CL_CHECK(clWaitForEvents(1, &done));
+
+  if (timings != nullptr) {
+    timings->upload = event_ms(slot.upload_start, CL_PROFILING_COMMAND_START, slot.upload_done, CL_PROFILING_COMMAND_END);
+    timings->kernels = event_ms(slot.inputs_done, CL_PROFILING_COMMAND_END, slot.kernels_done, CL_PROFILING_COMMAND_END);
+    timings->download = event_ms(slot.read_done, CL_PROFILING_COMMAND_START, slot.read_done, CL_PROFILING_COMMAND_END);
+    timings->latency = millis_since_boot() - slot.submit_time;
+  }
+  for (cl_event *e : {&slot.upload_start, &slot.upload_done, &slot.inputs_done, &slot.kernels_done, &slot.read_done}) {
+    release(*e);
+  }
+  waited++;
+  return slot.output.data();
+}
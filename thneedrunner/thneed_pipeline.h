@@ -0,0 +1,77 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "thneedmodel.h"
+
+// How long the stages of a frame took in ms, the GPU ones from CL event profiling
+struct ThneedTimings {
+  // streamed inputs into their staging buffers, on the upload queue
+  double upload;
+  // from the inputs being in place until the last kernel finished
+  double kernels;
+  // outputs back to the host
+  double download;
+  // from submit until the outputs were back, on the host
+  double latency;
+};
+
+// Runs a ThneedModel with two frames of buffers in flight. The streamed inputs (the camera
+// images) of a frame are written to a staging buffer on their own queue while the kernels of
+// the frame before run, and copied into the model inputs on the GPU right before its kernels.
+// The other inputs are written from their ModelInput buffers at submit, so they can depend on
+// the outputs of the frame before, and have to stay unchanged until that frame is waited for.
+//
+//   fill input() -> upload() -> [wait() for the frame before] -> submit() -> ... -> wait()
+class ThneedPipeline {
+public:
+  ThneedPipeline(ThneedModel *model, const std::vector<std::string> &streamed);
+  ~ThneedPipeline();
+
+  // host memory for a streamed input of the next frame to upload
+  float *input(const std::string &name);
+  // starts writing the streamed inputs of the next frame to the GPU
+  void upload();
+  // queues the rest of the inputs, the kernels and the output read of the oldest uploaded frame
+  void submit();
+  // waits for the oldest submitted frame, its outputs are valid until the frame after next is submitted
+  const float *wait(ThneedTimings *timings = nullptr);
+  // the outputs of the frame submitted last, and in done an event that completes once they're
+  // on the host, so another thread can pick them up right away. Call it before that frame is
+  // waited for, the caller releases done
+  const float *submitted_output(cl_event *done);
+  // frames submitted but not waited for
+  int in_flight() const { return submitted - waited; }
+
+private:
+  struct Input {
+    ModelInput *model_input;
+    cl_mem clmem;
+    size_t size;
+    bool streamed;
+    std::vector<float> host[2];
+    cl_mem staging[2] = {};
+  };
+
+  struct Slot {
+    cl_event upload_start = NULL;
+    cl_event upload_done = NULL;
+    cl_event inputs_done = NULL;
+    cl_event kernels_done = NULL;
+    cl_event read_done = NULL;
+    double submit_time = 0;
+    std::vector<float> output;
+  };
+
+  Thneed *thneed;
+  cl_command_queue thneed_queue;
+  cl_command_queue compute_queue;
+  cl_command_queue upload_queue;
+  std::vector<Input> inputs;
+  size_t output_size = 0;
+  Slot slots[2];
+  uint64_t uploaded = 0;
+  uint64_t submitted = 0;
+  uint64_t waited = 0;
+};
@@ -1,5 +1,10 @@
 #include <iostream>
+#include <atomic>
+#include <condition_variable>
 #include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -11,6 +16,9 @@
 
 #include "selfdrive/modeld/models/driving.h"
 #include "thneedmodel.h"
+#include "thneed_pipeline.h"
+#include "temporal_history.h"
+#include "timing.h"
 
 using namespace std;
 
@@ -144,74 +152,140 @@ int getClientSocket(int port) {
 	return client_sock;
 }
 
-int main () {
+// sends the model outputs to the other C++ application on its own thread, as soon as the GPU
+// has read them back. The main thread is blocked reading the next frame by then
+class OutputSender {
+public:
+	OutputSender(int _port, int size) : port(_port), sending(size) {
+		thread = std::thread(&OutputSender::run, this);
+	}
+
+	// connects to the other application if we aren't, returns whether we are. The sender thread
+	// drops the connection when a send fails
+	bool connect() {
+		if (client_sock == -1)
+			client_sock = getClientSocket(port);
+		return client_sock != -1;
+	}
+
+	// sends outputs once done completes, taking over the reference to done. Waits until the
+	// outputs queued before were copied, so they stay valid until the frame after next is submitted
+	void send_when_done(cl_event done, const float *outputs) {
+		std::unique_lock lk(lock);
+		cv.wait(lk, [&] { return !has_pending; });
+		pending_done = done;
+		pending = outputs;
+		has_pending = true;
+		cv.notify_all();
+	}
+
+	// how long sending the last outputs took
+	double last_send_ms() const { return send_ms; }
+
+private:
+	void run() {
+		while (true) {
+			{
+				std::unique_lock lk(lock);
+				cv.wait(lk, [&] { return has_pending; });
+			}
 
+			clWaitForEvents(1, &pending_done);
+			clReleaseEvent(pending_done);
+			std::copy(pending, pending + sending.size(), sending.begin());
+			{
+				std::lock_guard lk(lock);
+				has_pending = false;
+				cv.notify_all();
+			}
 
-    bool success; // flag to indicate success or failure
-	
-	int server_conn_sock = -1;
-	int client_sock = -1;
+			// the connection broke after these outputs were computed, they are dropped
+			const int sock = client_sock;
+			if (sock == -1)
+				continue;
 
-	bool do_exit;
+			double start = millis_since_boot();
+			// write the data to the output stream without writing the length first
+			if (!writeFully(sock, (char*)sending.data(), sending.size() * 4)) {
+				close(sock);
+				client_sock = -1;
+				continue;
+			}
+			send_ms = millis_since_boot() - start;
+		}
+	}
+
+	const int port;
+	std::atomic<int> client_sock = -1;
+	cl_event pending_done = NULL;
+	const float *pending = nullptr;
+	std::vector<float> sending;
+	bool has_pending = false;
+	std::atomic<double> send_ms = 0;
+	std::mutex lock;
+	std::condition_variable cv;
+	std::thread thread;
+};
 
-	// outputs
-	float *model_raw_preds = new float[NET_OUTPUT_SIZE];
+int main () {
+	bool success; // flag to indicate success or failure
+
+	int server_conn_sock = -1;
 
 	// these are the inputs we need to read
 	int input_imgs_len = 1572864 / 4;
-	int features_len = 512 * 3072 / 4; // 1572864 with feature len 512
-	int desire_len = 3200 / 4;
-	int total_input_len = input_imgs_len * 2 + 1;
-	float *model_input = new float[1024/4 + total_input_len + desire_len + features_len];
 
-	int StartInput = 1024/4;
-	int StartDesireInt = StartInput + total_input_len - 1;
-	int StartDesire = StartInput + total_input_len;
-	int StartFeatures = StartDesire + desire_len;
-
-	// first part of model_input will be zeros
-	memset(model_input, 0, 1024);
+	// traffic_convention and the nav inputs stay zero
+	float *model_zeros = new float[1024/4]();
 
 	// we will manage desire and features in here
-	float *prev_desire = new float[DESIRE_LEN];
+	float prev_desire[DESIRE_LEN] = {0};
+	TemporalHistory<float, HISTORY_BUFFER_LEN + 1, DESIRE_LEN> desire_history;
+	TemporalHistory<float, HISTORY_BUFFER_LEN, FEATURE_LEN> feature_history;
 
 	// magic model
+	float *model_raw_preds = new float[NET_OUTPUT_SIZE];
 	ThneedModel *thneed;
 	thneed = new ThneedModel("/sdcard/flowpilot/selfdrive/assets/models/f3/supercombo.thneed", model_raw_preds, NET_OUTPUT_SIZE, 0, false, NULL);
 
-	thneed->addInput("input_imgs", model_input + StartInput, input_imgs_len);
-	thneed->addInput("big_input_imgs", model_input + StartInput + input_imgs_len, input_imgs_len);
-	thneed->addInput("desire", model_input + StartDesire, desire_len);
-	thneed->addInput("traffic_convention", model_input, 8/4);
-	thneed->addInput("nav_features", model_input, 1024/4);
-	thneed->addInput("nav_instructions", model_input, 600/4);
-	thneed->addInput("features_buffer", model_input + StartFeatures, features_len);
+	// the images are streamed through the pipeline
+	thneed->addInput("input_imgs", NULL, input_imgs_len);
+	thneed->addInput("big_input_imgs", NULL, input_imgs_len);
+	thneed->addInput("desire", desire_history.data(), desire_history.size());
+	thneed->addInput("traffic_convention", model_zeros, 8/4);
+	thneed->addInput("nav_features", model_zeros, 1024/4);
+	thneed->addInput("nav_instructions", model_zeros, 600/4);
+	thneed->addInput("features_buffer", feature_history.data(), feature_history.size());
 
-	uint32_t last_frame_id = 0;
-	bool inputsSet = false;
+	// frame N is read and uploaded while the kernels of frame N-1 run, the outputs of
+	// frame N-1 are sent as soon as they're back, while frame N is still being read
+	ThneedPipeline pipeline(thneed, {"input_imgs", "big_input_imgs"});
+	OutputSender sender(9229, NET_OUTPUT_SIZE);
 
     // loop until the connection is closed
     while (true) {
-		
+
 		// make sure we have a valid server connection
 		if (server_conn_sock == -1)
 			server_conn_sock = getServerSocket(8228); // get data from Java app
-		
-		// if we don't have a client connection, get that
-		if (client_sock == -1)
-			client_sock = getClientSocket(9229);
-		
-		if (client_sock == -1 || server_conn_sock == -1) {
+
+		// frames are only read while the outputs have somewhere to go, so the desire and
+		// feature history only moves with frames the other application sees
+		if (server_conn_sock == -1 || !sender.connect()) {
 			// broken connection to apps, loop again and try
 			sched_yield();
 			continue;
 		}
-		
-        // read the data from the input stream without reading the length first
-        success = readFully(server_conn_sock, (char*)&model_input[StartInput], total_input_len * 4);
+
+        // read the data from the input stream without reading the length first, the images go
+        // straight into the host buffers of the pipeline
+        int desire = 0;
+        success = readFully(server_conn_sock, (char*)pipeline.input("input_imgs"), input_imgs_len * 4) &&
+                  readFully(server_conn_sock, (char*)pipeline.input("big_input_imgs"), input_imgs_len * 4) &&
+                  readFully(server_conn_sock, (char*)&desire, sizeof(desire));
 
         if (!success) { // if an error occurred or end of stream reached
-			if (server_conn_sock != -1) {	
+			if (server_conn_sock != -1) {
 				close(server_conn_sock);
 				server_conn_sock = -1;
 			}
@@ -219,63 +293,49 @@ int main () {
 			continue;
         }
 
-        cout << "Server received data from Java application" << endl;
+		pipeline.upload();
+
+		// the features of this frame come from the outputs of the one before
+		if (pipeline.in_flight() > 0) {
+			ThneedTimings t;
+			const float *outputs = pipeline.wait(&t);
+			feature_history.push(&outputs[OUTPUT_SIZE]);
+			printf("model timings ms: upload %.2f kernels %.2f download %.2f latency %.2f send %.2f\n",
+			       t.upload, t.kernels, t.download, t.latency, sender.last_send_ms());
+		}
 
 		// handle desire
-		int desire = *((int*)&model_input[StartDesireInt]);
 		float vec_desire[DESIRE_LEN] = {0};
 		if (desire >= 0 && desire < DESIRE_LEN) {
 		  vec_desire[desire] = 1.0;
 		}
 
-		memmove(&model_input[StartDesire], &model_input[StartDesire + DESIRE_LEN], sizeof(float) * DESIRE_LEN*HISTORY_BUFFER_LEN);
+		float desire_pulse[DESIRE_LEN] = {0};
 		for (int i = 1; i < DESIRE_LEN; i++) {
 		  // Model decides when action is completed
 		  // so desire input is just a pulse triggered on rising edge
 		  if (vec_desire[i] - prev_desire[i] > .99) {
-				model_input[StartDesire + DESIRE_LEN*HISTORY_BUFFER_LEN+i] = vec_desire[i];
-		  } else {
-				model_input[StartDesire + DESIRE_LEN*HISTORY_BUFFER_LEN+i] = 0.0;
+				desire_pulse[i] = vec_desire[i];
 		  }
 		  prev_desire[i] = vec_desire[i];
 		}
+		desire_history.push(desire_pulse);
 
-		cout << "Executing model!" << endl;
-
-		thneed->execute();
-
-		cout << "Handling features..." << endl;
-
-		// handle features
-		std::memmove(&model_input[StartFeatures], &model_input[StartFeatures + FEATURE_LEN], sizeof(float) * FEATURE_LEN*(HISTORY_BUFFER_LEN-1));
-		std::memcpy(&model_input[StartFeatures + FEATURE_LEN*(HISTORY_BUFFER_LEN-1)], &model_raw_preds[OUTPUT_SIZE], sizeof(float) * FEATURE_LEN);
-
-        cout << "Server generated output float array" << endl;
-
-        // write the data to the output stream without writing the length first
-        success = writeFully(client_sock, (char*)model_raw_preds, NET_OUTPUT_SIZE * 4);
-
-        if (!success) { // if an error occurred or end of stream reached
-            if (client_sock != -1) {
-				close(client_sock);
-				client_sock = -1;
-			}
-			sched_yield();
-			continue;
-        }
-
-        cout << "Client sent data to another C++ application" << endl;
+		thneed->setInputBuffer("desire", desire_history.data(), desire_history.size());
+		thneed->setInputBuffer("features_buffer", feature_history.data(), feature_history.size());
 
-        // no need to free the memory allocated for the buffer and the float array inside the loop
+		pipeline.submit();
+		cl_event done;
+		const float *outputs = pipeline.submitted_output(&done);
+		sender.send_when_done(done, outputs);
     }
 
-    // free the memory allocated for the buffer and the float array only once after exiting the loop
+    // free the memory allocated for the buffers only once after exiting the loop
     delete [] model_raw_preds;
-    delete [] model_input;
+    delete [] model_zeros;
 
-    // close both sockets
+    // close the socket
     close (server_conn_sock);
-    close (client_sock);
 
     cout << "Connection closed" << endl;
 
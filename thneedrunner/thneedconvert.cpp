@@ -0,0 +1,36 @@
+// Converts a .thneed with a JSON header to the binary format that Thneed::load maps directly.
+// usage: thneedconvert <in.thneed> <out.thneed>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#include "thneed_convert.h"
+
+int main(int argc, char *argv[]) {
+  if (argc != 3) {
+    fprintf(stderr, "usage: %s <in.thneed> <out.thneed>\n", argv[0]);
+    return 1;
+  }
+
+  std::ifstream ifs(argv[1], std::ios::binary);
+  if (!ifs) {
+    fprintf(stderr, "can't open %s\n", argv[1]);
+    return 1;
+  }
+  std::string legacy((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+
+  std::string out, error;
+  if (!thneed_convert(legacy, out, error)) {
+    fprintf(stderr, "can't convert %s: %s\n", argv[1], error.c_str());
+    return 1;
+  }
+
+  std::ofstream ofs(argv[2], std::ios::binary);
+  if (!ofs.write(out.data(), out.size())) {
+    fprintf(stderr, "can't write %s\n", argv[2]);
+    return 1;
+  }
+  printf("%s: %zu bytes -> %s: %zu bytes\n", argv[1], legacy.size(), argv[2], out.size());
+  return 0;
+}
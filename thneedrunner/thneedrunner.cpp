@@ -136,6 +136,12 @@ std::string readFileIntoString(const char *filepath) {
 }
 
 void Thneed::load(const char *filename) {
+    open_program_cache(filename);
+    if (ThneedFile::is_binary(filename)) {
+        load_binary(filename);
+        return;
+    }
+
     printf("Thneed::load: loading from %s\n", filename);
 
     string buf = readFileIntoString(filename);
@@ -200,7 +206,7 @@ void Thneed::load(const char *filename) {
     map<string, cl_program> g_programs;
     for (const auto &[name, source] : jdat["programs"].object_items()) {
         if (debug >= 1) printf("building %s with size %zu\n", name.c_str(), source.string_value().size());
-        g_programs[name] = cl_program_from_source(context, device_id, source.string_value());
+        g_programs[name] = program_from_source(source.string_value());
     }
 
     for (auto &obj : jdat["inputs"].array_items()) {
@@ -267,6 +273,162 @@ void Thneed::load(const char *filename) {
     clFinish(command_queue);
 }
 
+void Thneed::load_binary(const char *filename) {
+    printf("Thneed::load: mapping binary model %s\n", filename);
+
+    bool opened = file.open(filename);
+    assert(opened);
+    const ThneedHeader &hdr = file.header();
+
+    // with memory shared between host and GPU the weights are used from the mapping
+    cl_bool unified_memory = CL_FALSE;
+    clGetDeviceInfo(device_id, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(unified_memory), &unified_memory, NULL);
+    cl_mem_flags load_flags = CL_MEM_READ_WRITE | (unified_memory ? CL_MEM_USE_HOST_PTR : CL_MEM_COPY_HOST_PTR);
+
+    vector<cl_mem> mem(hdr.num_objects, NULL);
+    for (uint32_t i = 0; i < hdr.num_objects; i++) {
+        const ThneedObject &obj = file.objects()[i];
+        cl_mem clbuf = NULL;
+
+        if (obj.buffer != THNEED_NONE) {
+            clbuf = mem[obj.buffer];
+        } else if (obj.data != 0) {
+            clbuf = clCreateBuffer(context, load_flags, obj.size, file.data(obj.data), NULL);
+            if (debug >= 1) printf("loading %p %lu @ 0x%lX\n", clbuf, obj.size, obj.data);
+        } else {
+            clbuf = clCreateBuffer(context, CL_MEM_READ_WRITE, obj.size, NULL, NULL);
+            cl_uchar zero = 0;
+            CL_CHECK(clEnqueueFillBuffer(command_queue, clbuf, &zero, sizeof(zero), 0, obj.size, 0, NULL, NULL));
+        }
+        assert(clbuf != NULL);
+
+        if (obj.type != THNEED_BUFFER) {
+            cl_image_desc desc = {0};
+            desc.image_type = (obj.type == THNEED_IMAGE2D) ? CL_MEM_OBJECT_IMAGE2D : CL_MEM_OBJECT_IMAGE1D_BUFFER;
+            desc.image_width = obj.width;
+            desc.image_height = obj.height;
+            desc.image_row_pitch = obj.row_pitch;
+            assert(obj.size == desc.image_height*desc.image_row_pitch);
+            desc.buffer = clbuf;
+            cl_image_format format = {0};
+            format.image_channel_order = CL_RGBA;
+            format.image_channel_data_type = obj.float32 ? CL_FLOAT : CL_HALF_FLOAT;
+
+            cl_int errcode;
+            clbuf = clCreateImage(context, CL_MEM_READ_WRITE, &format, &desc, NULL, &errcode);
+            if (clbuf == NULL) {
+                printf("clError: %d create image %zux%zu rp %zu with buffer %p\n", errcode,
+                       desc.image_width, desc.image_height, desc.image_row_pitch, desc.buffer);
+            }
+            assert(clbuf != NULL);
+        }
+        mem[i] = clbuf;
+    }
+
+    vector<cl_program> programs;
+    for (uint32_t i = 0; i < hdr.num_programs; i++) {
+        const ThneedProgram &prg = file.programs()[i];
+        if (debug >= 1) printf("building %s with size %lu\n", file.str(prg.name), prg.size);
+        if (prg.type == THNEED_PROGRAM_BINARY) {
+            programs.push_back(cl_program_from_binary(context, device_id, (const uint8_t*)file.data(prg.data), prg.size));
+        } else {
+            programs.push_back(program_from_source(string((const char*)file.data(prg.data), prg.size)));
+        }
+    }
+
+    for (uint32_t i = 0; i < hdr.num_inputs; i++) {
+        const ThneedIO &in = file.inputs()[i];
+        cl_mem aa = mem[in.object];
+        input_clmem.push_back(aa);
+        input_sizes.push_back(in.size);
+        printf("Thneed::load: adding input %s with size %lu\n", file.str(in.name), in.size);
+
+        cl_int cl_err;
+        void *ret = clEnqueueMapBuffer(command_queue, aa, CL_TRUE, CL_MAP_WRITE, 0, in.size, 0, NULL, NULL, &cl_err);
+        assert(cl_err == CL_SUCCESS);
+        inputs.push_back(ret);
+    }
+
+    // TODO: support multiple outputs
+    for (uint32_t i = 0; i < hdr.num_outputs; i++) {
+        output = mem[file.outputs()[i].object];
+    }
+
+    for (uint32_t i = 0; i < hdr.num_kernels; i++) {
+        const ThneedKernel &k = file.kernels()[i];
+        auto kk = shared_ptr<CLQueuedKernel>(new CLQueuedKernel(this));
+
+        kk->name = file.str(k.name);
+        kk->program = programs[k.program];
+        kk->work_dim = k.work_dim;
+        for (int j = 0; j < kk->work_dim; j++) {
+            kk->global_work_size[j] = k.global_work_size[j];
+            kk->local_work_size[j] = k.local_work_size[j];
+        }
+        kk->num_args = k.num_args;
+        for (uint32_t j = 0; j < k.num_args; j++) {
+            const ThneedArg &arg = file.args()[k.first_arg + j];
+            kk->args_size.push_back(arg.size);
+            if (arg.object != THNEED_NONE) {
+                cl_mem val = mem[arg.object];
+                kk->args.push_back(string((char*)&val, sizeof(val)));
+            } else if (arg.value != 0) {
+                kk->args.push_back(string((const char*)file.data(arg.value), arg.size));
+            } else {
+                kk->args.push_back(string());
+            }
+        }
+        kq.push_back(kk);
+    }
+
+    clFinish(command_queue);
+    if (!unified_memory) file.close();
+}
+
+void Thneed::open_program_cache(const char *filename) {
+    // next to the model unless THNEED_PROGRAM_CACHE says where, set it empty to turn the cache off
+    const char *env = getenv("THNEED_PROGRAM_CACHE");
+    string path = filename;
+    string root = (env != NULL) ? env : path.substr(0, path.find_last_of('/') + 1) + "program_cache";
+    if (root.empty()) return;
+
+    program_cache = make_unique<ProgramCache>(root, get_info(&clGetDeviceInfo, device_id, CL_DEVICE_NAME),
+                                              get_info(&clGetDeviceInfo, device_id, CL_DRIVER_VERSION));
+    if (program_cache->failed()) {
+        printf("Thneed: can't use program cache in %s\n", root.c_str());
+        program_cache.reset();
+    }
+}
+
+cl_program Thneed::program_from_source(const string &source) {
+    if (!program_cache) return cl_program_from_source(context, device_id, source);
+
+    string binary;
+    if (program_cache->get(source, "", binary)) {
+        const uint8_t *bin = (const uint8_t *)binary.data();
+        size_t length = binary.size();
+        cl_int status = CL_INVALID_BINARY, err = CL_INVALID_VALUE;
+        cl_program prg = clCreateProgramWithBinary(context, 1, &device_id, &length, &bin, &status, &err);
+        if (prg != NULL && err == CL_SUCCESS && status == CL_SUCCESS && clBuildProgram(prg, 1, &device_id, NULL, NULL, NULL) == CL_SUCCESS) {
+            return prg;
+        }
+        if (prg != NULL) clReleaseProgram(prg);
+        printf("Thneed: cached program binary rejected, building from source\n");
+        program_cache->remove(source, "");
+    }
+
+    cl_program prg = cl_program_from_source(context, device_id, source);
+    size_t size = 0;
+    if (clGetProgramInfo(prg, CL_PROGRAM_BINARY_SIZES, sizeof(size), &size, NULL) == CL_SUCCESS && size > 0) {
+        binary.resize(size);
+        unsigned char *ptr = (unsigned char *)&binary[0];
+        if (clGetProgramInfo(prg, CL_PROGRAM_BINARIES, sizeof(ptr), &ptr, NULL) == CL_SUCCESS) {
+            program_cache->put(source, "", binary);
+        }
+    }
+    return prg;
+}
+
 // *********** Thneed ***********
 
 #ifndef QCOM2